@@ -0,0 +1,61 @@
+/*
+ * log.h
+ *
+ * Interface for the server's asynchronous logger. A thread that logs formats the
+ * line into its own lock-free SPSC ring and returns at once; a background flusher
+ * thread drains every ring and writes the lines to standard output in large
+ * batches, so a slow terminal, file or pipe never stalls packet processing. If a
+ * ring fills up faster than it is drained, further lines are dropped and counted
+ * rather than waited for.
+ */
+
+#ifndef _LOG_H_
+#define _LOG_H_
+
+/* Log levels, from the most to the least severe */
+#define LOG_ERROR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+
+/*
+ * starts the logger; lines of a level more verbose than `level' are discarded
+ * without being formatted; if `timestamps' is non-zero, every line is prefixed
+ * with the local date and time at which it was logged
+ *
+ * returns 1 if successful, 0 if not (eventfd() or pthread_create() errors)
+ */
+int log_init(int level, int timestamps);
+
+/*
+ * stops the flusher thread after writing out every line logged so far; lines
+ * logged afterwards are discarded; the per-thread rings are not freed, as other
+ * threads may still be logging, and are reclaimed when the process exits
+ */
+void log_shutdown(void);
+
+/*
+ * logs a line at level `level', formatted as printf(3) would; the newline is
+ * appended by the logger, and lines longer than LOG_LINE_SIZE are truncated;
+ * never blocks, and does nothing if the logger has not been started
+ */
+void log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/*
+ * returns 1 if lines of level `level' are being logged, 0 if they are discarded;
+ * lets a caller skip work that only serves to build a log line
+ */
+int log_enabled(int level);
+
+/*
+ * returns the level named `name' (error, warn, info or debug), or -1 if there
+ * is no level by that name
+ */
+int log_parseLevel(const char *name);
+
+/*
+ * returns the number of lines dropped so far because a ring was full
+ */
+long log_drops(void);
+
+#endif /* _LOG_H_ */
@@ -34,6 +34,20 @@
 /* Should be kept at 2-5 minutes */
 #define REFRESH_RATE 2
 
+/* Maximum number of log lines the server may have waiting to be written */
+/* Lines are handed to a background thread that writes them in batches; beyond this they are dropped */
+#define LOG_RING_SIZE 4096
+
+/* Maximum length (in bytes) of a single log line; longer lines are truncated */
+#define LOG_LINE_SIZE 256
+
+/* Size (in bytes) of the buffer the server's log lines are batched in before being written */
+#define LOG_BATCH_SIZE 65536
+
+/* The rate (in milliseconds) for the server to write out the log lines waiting to be written */
+/* Lines are written sooner whenever the log ring is half full */
+#define LOG_FLUSH_RATE 100
+
 /* The name of the application's default channel */
 /* Upon login, every client will send a join request for this channel */
 /* The server will also never remove this channel, even when its empty */
@@ -35,6 +35,7 @@
 #include "duckchat.h"
 #include "hashmap.h"
 #include "linkedlist.h"
+#include "log.h"
 #include "properties.h"
 
 
@@ -141,22 +142,13 @@ static void free_user(User *user) {
 }
 
 /*
- * Prints out the specified message for the server log. Prints out the full current
- * date and time followed by the message.
+ * Prints out the specified message for the server log. The logger prefixes the
+ * full date and time the message was logged at, and writes it out in the
+ * background.
  */
 static void print_log_message(const char *msg) {
 
-    struct tm *timestamp;
-    time_t timer;
-
-    /* Access the current local time */
-    time(&timer);
-    timestamp = localtime(&timer);
-    /* Prints out the logging date, time, & the message */
-    fprintf(stdout, "[%02d/%02d/%d %02d:%02d:%02d] %s\n", (timestamp->tm_mon + 1),
-            timestamp->tm_mday, (1900 + timestamp->tm_year),
-            timestamp->tm_hour, timestamp->tm_min,
-            timestamp->tm_sec, msg);
+    log_write(LOG_INFO, "%s", msg);
 }
 
 /*
@@ -799,6 +791,8 @@ static void free_ll(LinkedList *ll) {
  */
 static void cleanup(void) {
     
+    /* Write out whatever is left in the log */
+    log_shutdown();
     /* Close the socket if open */
     if (socket_fd != -1)
         close(socket_fd);
@@ -902,6 +896,10 @@ int main(int argc, char *argv[]) {
     if (!hm_put(channels, DEFAULT_CHANNEL, default_ll, NULL))
         print_error("Failed to allocate a sufficient amount of memory.");
 
+    /* Start the logger; log lines are written out by a thread of its own */
+    if (!log_init(LOG_INFO, 1))
+        print_error("Failed to start the logger.");
+
     /* Display successful launch title, timestamp & address */
     sprintf(buffer, "Duckchat server launched addressed at %s:%d",
             inet_ntoa(server.sin_addr), ntohs(server.sin_port));
@@ -0,0 +1,55 @@
+/*
+ * spscring.h
+ *
+ * Interface for a bounded, lock-free, single-producer/single-consumer ring of
+ * fixed-size elements. Exactly one thread may push and exactly one (possibly
+ * different) thread may pop; neither ever blocks or takes a lock.
+ */
+
+#ifndef _SPSCRING_H_
+#define _SPSCRING_H_
+
+#include <stddef.h>
+
+typedef struct spscring SpscRing;   /* opaque type definition */
+
+/*
+ * create a ring holding up to `capacity' elements of `elemsize' bytes each;
+ * the capacity is rounded up to the next power of two
+ *
+ * returns a pointer to the ring, or NULL if there are malloc() errors
+ */
+SpscRing *sr_create(long capacity, size_t elemsize);
+
+/*
+ * destroys the ring; any elements still in it are discarded
+ */
+void sr_destroy(SpscRing *sr);
+
+/*
+ * producer only: copies `elem' into the ring
+ *
+ * returns 0 if the ring is full (the element is dropped and counted), 1 if
+ * successful, or 2 if successful and the consumer had already taken every
+ * earlier element, i.e. it may have gone idle and needs to be woken up
+ */
+int sr_push(SpscRing *sr, const void *elem);
+
+/*
+ * consumer only: copies the oldest element into `*elem' and removes it
+ *
+ * returns 1 if successful, 0 if the ring is empty
+ */
+int sr_pop(SpscRing *sr, void *elem);
+
+/*
+ * returns the number of elements currently in the ring
+ */
+long sr_size(SpscRing *sr);
+
+/*
+ * returns the number of elements dropped because the ring was full
+ */
+long sr_drops(SpscRing *sr);
+
+#endif /* _SPSCRING_H_ */
@@ -0,0 +1,437 @@
+/*
+ * addrmap.c
+ *
+ * Implementation of the address map; see addrmap.h. A slot is free when its
+ * element is NULL. Removal shifts the following entries of the probe run back
+ * instead of leaving tombstones, so lookups never scan past deleted entries.
+ *
+ * A resize does not rehash every entry at once. A new table is allocated, and
+ * each am_put() and am_remove() moves the next MIGRATE_STEP slots of the old
+ * table over to it, while lookups consult both; once the old table is empty, it
+ * is freed. The table doubles when it fills up, and halves when removals leave
+ * it less than a quarter full, as the HashMap does (see hashmap.c). A table's
+ * keys and elements share one block; a large block is mapped from the kernel,
+ * and once migrated out of, is unmapped a few pages per update, so that no
+ * single update pays for returning a whole table's memory.
+ */
+
+#include "addrmap.h"
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define DEFAULT_CAPACITY 16L
+#define MAX_CAPACITY 134217728L
+#define MIGRATE_STEP 64L        /* slots moved per update while resizing */
+#define MAP_BYTES 65536L        /* blocks this large are mapped */
+#define UNMAP_STEP 65536L       /* bytes of a spent table unmapped per update */
+#define SLOT_BYTES ((long)(sizeof(uint64_t) + sizeof(void *)))
+
+/* marks a slot of the old table whose entry was moved or removed; the slot */
+/* keeps its key, so the probe runs through it stay unbroken */
+static char moved_mark;
+#define MOVED ((void *)&moved_mark)
+
+/* an array of slots; a map has two while it is being resized */
+typedef struct {
+    long mask;              /* number of slots - 1, a power of two */
+    long used;              /* entries held */
+    long limit;             /* resize once `used' reaches this */
+    long unmapped;          /* bytes at the start of the block already unmapped */
+    uint64_t *keys;         /* the block; the elements follow the keys */
+    void **elements;
+} Table;
+
+struct addrmap {
+    long size;
+    long minimum;           /* never shrink below this many slots */
+    long moved;             /* slots of `old' migrated so far */
+    Table cur;              /* where new entries are added */
+    Table old;              /* being migrated from, elements == NULL if none */
+    Table spent;            /* migrated from, being unmapped, ditto */
+};
+
+/*
+ * generate the home slot of a key; multiplicative hashing mixes the port and
+ * the low bits of the address into the top bits, which are then folded down
+ */
+static long slot(Table *t, uint64_t key) {
+    uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+
+    return (long)((h ^ (h >> 32)) & (uint64_t)t->mask);
+}
+
+uint64_t am_key(const struct sockaddr_in *addr) {
+    return (((uint64_t)addr->sin_addr.s_addr << 16) | (uint64_t)addr->sin_port);
+}
+
+/*
+ * local function to allocate the slot arrays of table `t' for `N' slots, all
+ * free; a large block is mapped, and so zeroed until its pages are first used
+ */
+static int allocate(Table *t, long N) {
+    void *p;
+
+    if (N * SLOT_BYTES < MAP_BYTES) {
+        p = calloc(N, SLOT_BYTES);
+    } else {
+        p = mmap(NULL, N * SLOT_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            p = NULL;
+    }
+    if ((t->keys = (uint64_t *)p) == NULL)
+        return 0;
+    t->elements = (void **)(t->keys + N);
+    t->mask = N - 1;
+    t->used = 0L;
+    t->limit = (N / 4) * 3;
+    t->unmapped = 0L;
+    return 1;
+}
+
+/*
+ * local function to return what is left of the slot arrays of table `t'
+ */
+static void release(Table *t) {
+    long bytes = (t->mask + 1) * SLOT_BYTES;
+
+    if (t->elements == NULL)
+        return;
+    if (bytes < MAP_BYTES)
+        free(t->keys);
+    else
+        munmap((char *)t->keys + t->unmapped, bytes - t->unmapped);
+    t->keys = NULL;
+    t->elements = NULL;
+}
+
+/*
+ * local function to unmap the next UNMAP_STEP bytes of the spent table, or the
+ * rest of it; one from the heap is freed at once
+ */
+static void drain(AddrMap *am) {
+    Table *t = &am->spent;
+    long bytes = (t->mask + 1) * SLOT_BYTES;
+
+    if (t->elements == NULL)
+        return;
+    if (bytes < MAP_BYTES || bytes - t->unmapped <= UNMAP_STEP) {
+        release(t);
+        return;
+    }
+    munmap((char *)t->keys + t->unmapped, UNMAP_STEP);
+    t->unmapped += UNMAP_STEP;
+}
+
+AddrMap *am_create(long capacity) {
+    AddrMap *am;
+    long N = DEFAULT_CAPACITY;
+
+    if (capacity > MAX_CAPACITY)
+        capacity = MAX_CAPACITY;
+    /* enough slots to hold `capacity' entries without growing */
+    while ((N / 4) * 3 < capacity)
+        N <<= 1;
+    if ((am = (AddrMap *)malloc(sizeof(AddrMap))) == NULL)
+        return NULL;
+    if (!allocate(&am->cur, N)) {
+        free(am);
+        return NULL;
+    }
+    am->size = 0L;
+    am->minimum = N;
+    am->moved = 0L;
+    am->old.mask = 0L;
+    am->old.keys = NULL;
+    am->old.elements = NULL;
+    am->spent = am->old;
+    return am;
+}
+
+/*
+ * local function to call userFunction on each element of table `t'
+ */
+static void purge(Table *t, void (*userFunction)(void *element)) {
+    long i;
+
+    if (t->elements == NULL)
+        return;
+    for (i = 0L; i <= t->mask; i++)
+        if (t->elements[i] != NULL && t->elements[i] != MOVED)
+            (*userFunction)(t->elements[i]);
+}
+
+void am_destroy(AddrMap *am, void (*userFunction)(void *element)) {
+
+    if (userFunction != NULL) {
+        purge(&am->cur, userFunction);
+        purge(&am->old, userFunction);
+    }
+    release(&am->cur);
+    release(&am->old);
+    release(&am->spent);
+    free(am);
+}
+
+/*
+ * local function to locate the slot of table `t' holding `key', or the free
+ * slot that ends its probe run
+ */
+static long find(Table *t, uint64_t key) {
+    long i = slot(t, key);
+
+    while (t->elements[i] != NULL && t->keys[i] != key)
+        i = (i + 1) & t->mask;
+    return i;
+}
+
+/*
+ * local function to locate the entry for `key'; entries not yet migrated are
+ * still in the old table
+ *
+ * returns the index of its slot, and the table in `*table', or -1 if none
+ */
+static long locate(AddrMap *am, uint64_t key, Table **table) {
+    long i = find(&am->cur, key);
+
+    if (am->cur.elements[i] != NULL) {
+        *table = &am->cur;
+        return i;
+    }
+    if (am->old.elements != NULL) {
+        i = find(&am->old, key);
+        if (am->old.elements[i] != NULL && am->old.elements[i] != MOVED) {
+            *table = &am->old;
+            return i;
+        }
+    }
+    return -1L;
+}
+
+/*
+ * local function to move up to `count' slots of the old table into the current
+ * one; once all of its slots have been moved, the old table is spent, and from
+ * then on each call unmaps a little more of it
+ */
+static void migrate(AddrMap *am, long count) {
+    Table *old = &am->old;
+    long end = am->moved + count, i;
+
+    drain(am);
+    if (old->elements == NULL)
+        return;
+    if (end > old->mask + 1)
+        end = old->mask + 1;
+    for (; am->moved < end; am->moved++) {
+        if (old->elements[am->moved] == NULL || old->elements[am->moved] == MOVED)
+            continue;
+        i = find(&am->cur, old->keys[am->moved]);
+        am->cur.keys[i] = old->keys[am->moved];
+        am->cur.elements[i] = old->elements[am->moved];
+        am->cur.used++;
+        old->elements[am->moved] = MOVED;
+    }
+    if (am->moved > old->mask) {
+        release(&am->spent);
+        am->spent = *old;
+        old->keys = NULL;
+        old->elements = NULL;
+    }
+}
+
+/*
+ * routine that starts resizing the map to `N' slots; the entries are moved
+ * over by later calls to migrate(), while lookups consult both tables; if the
+ * allocation fails, the map is left as it was
+ */
+static void resize(AddrMap *am, long N) {
+    Table t;
+
+    migrate(am, am->old.mask + 1);      /* a previous resize must be complete */
+    release(&am->spent);
+    if (!allocate(&t, N))
+        return;
+    am->old = am->cur;
+    am->cur = t;
+    am->moved = 0L;
+}
+
+int am_containsKey(AddrMap *am, uint64_t key) {
+    Table *t;
+
+    return (locate(am, key, &t) >= 0L);
+}
+
+int am_get(AddrMap *am, uint64_t key, void **element) {
+    Table *t;
+    long i;
+
+    if ((i = locate(am, key, &t)) < 0L)
+        return 0;
+    *element = t->elements[i];
+    return 1;
+}
+
+int am_put(AddrMap *am, uint64_t key, void *element, void **previous) {
+    long N = am->cur.mask + 1, i;
+    Table *t;
+
+    if ((i = locate(am, key, &t)) >= 0L) {
+        if (previous != NULL)
+            *previous = t->elements[i];
+        t->elements[i] = element;
+        return 1;
+    }
+    if (previous != NULL)
+        *previous = NULL;
+    migrate(am, MIGRATE_STEP);
+    if (am->cur.used >= am->cur.limit) {
+        /* never fill the table past its load limit, so every probe run ends */
+        if (N < MAX_CAPACITY)
+            resize(am, 2 * N);
+        if (am->cur.used >= am->cur.limit)
+            return 0;
+        migrate(am, MIGRATE_STEP);
+    }
+    i = find(&am->cur, key);
+    am->cur.keys[i] = key;
+    am->cur.elements[i] = element;
+    am->cur.used++;
+    am->size++;
+    return 1;
+}
+
+/*
+ * local function to empty slot `i' of the current table; every later entry of
+ * its run whose home slot is not past the gap is moved back, so the run stays
+ * unbroken
+ */
+static void vacate(Table *t, long i) {
+    long j, home;
+
+    t->elements[i] = NULL;
+    t->used--;
+    for (j = (i + 1) & t->mask; t->elements[j] != NULL; j = (j + 1) & t->mask) {
+        home = slot(t, t->keys[j]);
+        if (((j - home) & t->mask) >= ((j - i) & t->mask)) {
+            t->keys[i] = t->keys[j];
+            t->elements[i] = t->elements[j];
+            t->elements[j] = NULL;
+            i = j;
+        }
+    }
+}
+
+/*
+ * local function to remove the entry in slot `i' of table `t'; entries of the
+ * old table are only marked, as it no longer changes other than by migrate()
+ */
+static void take(AddrMap *am, Table *t, long i) {
+
+    if (t == &am->cur)
+        vacate(t, i);
+    else
+        t->elements[i] = MOVED;
+    am->size--;
+}
+
+int am_remove(AddrMap *am, uint64_t key, void **element) {
+    long N = am->cur.mask + 1, i;
+    Table *t;
+
+    if ((i = locate(am, key, &t)) < 0L)
+        return 0;
+    *element = t->elements[i];
+    take(am, t, i);
+
+    migrate(am, MIGRATE_STEP);
+    /* halve the table once it is less than a quarter as full as it may be */
+    if (am->old.elements == NULL && N > am->minimum && am->size < am->cur.limit / 4)
+        resize(am, N / 2);
+    return 1;
+}
+
+void **am_valueArray(AddrMap *am, long *len) {
+    Table *tables[2] = { &am->cur, &am->old }, *t;
+    void **tmp;
+    long i, n = 0L;
+    int j;
+
+    *len = 0L;
+    if (am->size == 0L)
+        return NULL;
+    if ((tmp = (void **)malloc(am->size * sizeof(void *))) == NULL)
+        return NULL;
+    for (j = 0; j < 2; j++) {
+        if ((t = tables[j])->elements == NULL)
+            continue;
+        for (i = 0L; i <= t->mask; i++)
+            if (t->elements[i] != NULL && t->elements[i] != MOVED)
+                tmp[n++] = t->elements[i];
+    }
+    *len = n;
+    return tmp;
+}
+
+int am_isEmpty(AddrMap *am) {
+    return (am->size == 0L);
+}
+
+long am_size(AddrMap *am) {
+    return am->size;
+}
+
+/*
+ * The traversal of the current table starts just after a free slot and goes
+ * once around it. No run of entries wraps past that slot, and vacate() only
+ * moves entries back within their run, towards the gap; so after a removal, the
+ * entries that moved all land on slots not yet examined, starting with the one
+ * just vacated. The old table, where removal only marks the slot, is then
+ * traversed from its first slot.
+ */
+void am_iterInit(AddrMap *am, AMIter *it) {
+    long i;
+
+    /* the table is never full, so there is a free slot */
+    for (i = 0L; am->cur.elements[i] != NULL; i++)
+        ;
+    it->am = am;
+    it->table = 0;
+    it->start = i;
+    it->offset = 1L;
+    it->current = -1L;
+}
+
+int am_iterNext(AMIter *it, void **element) {
+    AddrMap *am = it->am;
+    Table *t;
+    long i;
+
+    for (; it->table < 2; it->table++, it->start = 0L, it->offset = 0L) {
+        t = (it->table == 0) ? &am->cur : &am->old;
+        if (t->elements == NULL)
+            continue;
+        while (it->offset <= t->mask) {
+            i = (it->start + it->offset++) & t->mask;
+            if (t->elements[i] != NULL && t->elements[i] != MOVED) {
+                it->current = i;
+                *element = t->elements[i];
+                return 1;
+            }
+        }
+    }
+    it->current = -1L;
+    return 0;
+}
+
+int am_iterRemove(AMIter *it) {
+    AddrMap *am = it->am;
+
+    if (it->current < 0L)
+        return 0;
+    take(am, (it->table == 0) ? &am->cur : &am->old, it->current);
+    /* examine the vacated slot again, an entry may have moved into it */
+    if (it->table == 0)
+        it->offset--;
+    it->current = -1L;
+    return 1;
+}
@@ -0,0 +1,128 @@
+/*
+ * addrmap.h
+ *
+ * Interface for a hashmap keyed by IPv4 socket addresses. The address and port
+ * of a sockaddr_in are packed into a single 64-bit integer key, so a lookup for
+ * the sender of a packet needs no string formatting, and hashing and comparing
+ * a key are a multiply and an integer compare. The table is open addressed with
+ * linear probing, and keeps its keys and elements in flat arrays.
+ */
+
+#ifndef _ADDRMAP_H_
+#define _ADDRMAP_H_
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+typedef struct addrmap AddrMap;     /* opaque type definition */
+
+/*
+ * returns the key for the specified address; two addresses have the same key
+ * if and only if their IP addresses and port numbers are equal
+ */
+uint64_t am_key(const struct sockaddr_in *addr);
+
+/*
+ * create an address map with room for `capacity' entries before it first has
+ * to grow; if capacity == 0, a default capacity (16 entries) is used; the table
+ * doubles in size whenever it becomes more than 3/4 full, and halves, though
+ * never below its initial size, when it becomes less than 3/16 full; the
+ * entries are moved to the new table a few at a time by later updates
+ *
+ * returns a pointer to the map, or NULL if there are malloc() errors
+ */
+AddrMap *am_create(long capacity);
+
+/*
+ * destroys the map; if userFunction != NULL, it is invoked on each element
+ * in the map; the storage associated with the map is then returned to the heap
+ */
+void am_destroy(AddrMap *am, void (*userFunction)(void *element));
+
+/*
+ * returns 1 if the map has an entry for `key', 0 otherwise
+ */
+int am_containsKey(AddrMap *am, uint64_t key);
+
+/*
+ * returns the element to which the specified key is mapped in `*element'
+ *
+ * returns 1 if successful, 0 if no mapping for `key'
+ */
+int am_get(AddrMap *am, uint64_t key, void **element);
+
+/*
+ * associates `element' with `key'; `element' must not be NULL; if this
+ * replaces an existing mapping, the old element is returned in `*previous'
+ * (if previous != NULL), otherwise *previous == NULL
+ *
+ * returns 1 if successful, 0 if not (malloc failure)
+ */
+int am_put(AddrMap *am, uint64_t key, void *element, void **previous);
+
+/*
+ * removes the entry associated with `key' if one exists; returns the element
+ * associated with the key in `*element'
+ *
+ * returns 1 if successful, 0 if no element associated with `key'
+ */
+int am_remove(AddrMap *am, uint64_t key, void **element);
+
+/*
+ * returns an array containing all of the elements of the map in an arbitrary
+ * order; returns the length of the array in `*len'
+ *
+ * returns pointer to void * array of elements, or NULL if malloc failure or
+ * the map is empty
+ *
+ * NB - the caller is responsible for freeing the void * array when finished
+ */
+void **am_valueArray(AddrMap *am, long *len);
+
+/*
+ * returns 1 if the map is empty, 0 if it is not
+ */
+int am_isEmpty(AddrMap *am);
+
+/*
+ * returns the number of mappings in the map
+ */
+long am_size(AddrMap *am);
+
+/*
+ * a cursor over the elements of an address map, in an arbitrary order; it is
+ * declared by the caller, usually on the stack, so that an iteration needs no
+ * storage from the heap; its members are private to the implementation
+ */
+typedef struct amiter {
+    AddrMap *am;
+    int table;                  /* 0 while traversing the current table, 1 the old one */
+    long start;                 /* a free slot, where the traversal begins and ends */
+    long offset;                /* distance from `start' of the slot to examine next */
+    long current;               /* slot last returned, -1 if none */
+} AMIter;
+
+/*
+ * positions the cursor `it' before the first element of the map
+ */
+void am_iterInit(AddrMap *am, AMIter *it);
+
+/*
+ * advances the cursor, returning the next element in `*element'
+ *
+ * returns 1 if successful, 0 if there are no more elements
+ */
+int am_iterNext(AMIter *it, void **element);
+
+/*
+ * removes the entry of the element last returned by am_iterNext() from the
+ * map; the iteration continues with the remaining elements
+ *
+ * NB - while iterating, the map must not be modified other than through
+ *      am_iterRemove()
+ *
+ * returns 1 if successful, 0 if not (no element returned, or already removed)
+ */
+int am_iterRemove(AMIter *it);
+
+#endif /* _ADDRMAP_H_ */
@@ -0,0 +1,81 @@
+/*
+ * bitset.c
+ *
+ * Implementation of the fixed-size sets of small integers; see bitset.h.
+ */
+
+#include "bitset.h"
+
+#define WORD(i) ((i) >> 6)
+#define BIT(i) (1ULL << ((i) & 63))
+
+void bs_clear(BitSet *s) {
+    int w;
+
+    for (w = 0; w < BS_WORDS; w++)
+        s->words[w] = 0ULL;
+}
+
+void bs_add(BitSet *s, int i) {
+    s->words[WORD(i)] |= BIT(i);
+}
+
+void bs_remove(BitSet *s, int i) {
+    s->words[WORD(i)] &= ~BIT(i);
+}
+
+int bs_contains(const BitSet *s, int i) {
+    return ((s->words[WORD(i)] & BIT(i)) != 0ULL);
+}
+
+int bs_size(const BitSet *s) {
+    int w, n = 0;
+
+    for (w = 0; w < BS_WORDS; w++)
+        n += __builtin_popcountll(s->words[w]);
+    return n;
+}
+
+int bs_isEmpty(const BitSet *s) {
+    uint64_t any = 0ULL;
+    int w;
+
+    for (w = 0; w < BS_WORDS; w++)
+        any |= s->words[w];
+    return (any == 0ULL);
+}
+
+int bs_intersects(const BitSet *s, const BitSet *t) {
+    uint64_t any = 0ULL;
+    int w;
+
+    for (w = 0; w < BS_WORDS; w++)
+        any |= (s->words[w] & t->words[w]);
+    return (any != 0ULL);
+}
+
+void bs_andNot(BitSet *s, const BitSet *mask) {
+    int w;
+
+    for (w = 0; w < BS_WORDS; w++)
+        s->words[w] &= ~mask->words[w];
+}
+
+int bs_next(const BitSet *s, int from) {
+    uint64_t bits;
+    int w;
+
+    if (from < 0)
+        from = 0;
+    if (from >= BS_WORDS * 64)
+        return -1;
+    /* the first word is masked below `from', the rest are taken whole */
+    w = WORD(from);
+    bits = s->words[w] & (~0ULL << (from & 63));
+    while (bits == 0ULL) {
+        if (++w == BS_WORDS)
+            return -1;
+        bits = s->words[w];
+    }
+    return (w << 6) + __builtin_ctzll(bits);
+}
@@ -0,0 +1,76 @@
+/*
+ * bitset.h
+ *
+ * Interface for fixed-size sets of small integers, used as the sets of
+ * neighboring servers subscribed to each channel; a neighbor is known by its
+ * index, in the range [0, MAX_NEIGHBORS) (see properties.h). A set is a plain
+ * array of 64-bit words, so adding, removing and testing a member are single
+ * bit operations, and the whole-set operations below are straight loops over
+ * the words, which the compiler turns into vector instructions.
+ */
+
+#ifndef _BITSET_H_
+#define _BITSET_H_
+
+#include <stdint.h>
+#include "properties.h"
+
+#define BS_WORDS ((MAX_NEIGHBORS + 63) / 64)
+
+/*
+ * a set; declared by the user, and copied by assignment; its members are
+ * private to the implementation
+ */
+typedef struct bitset {
+    uint64_t words[BS_WORDS];
+} BitSet;
+
+/*
+ * empties the set
+ */
+void bs_clear(BitSet *s);
+
+/*
+ * adds `i' to the set
+ */
+void bs_add(BitSet *s, int i);
+
+/*
+ * removes `i' from the set
+ */
+void bs_remove(BitSet *s, int i);
+
+/*
+ * returns 1 if `i' is in the set, 0 if not
+ */
+int bs_contains(const BitSet *s, int i);
+
+/*
+ * returns the number of members of the set
+ */
+int bs_size(const BitSet *s);
+
+/*
+ * returns 1 if the set is empty, 0 otherwise
+ */
+int bs_isEmpty(const BitSet *s);
+
+/*
+ * returns 1 if the sets `s' and `t' have a member in common, 0 otherwise
+ */
+int bs_intersects(const BitSet *s, const BitSet *t);
+
+/*
+ * removes every member of `mask' from the set `s'
+ */
+void bs_andNot(BitSet *s, const BitSet *mask);
+
+/*
+ * returns the smallest member of the set not less than `from', or -1 if there
+ * is none; the members are visited in turn with
+ *
+ *      for (i = bs_next(s, 0); i >= 0; i = bs_next(s, i + 1))
+ */
+int bs_next(const BitSet *s, int from);
+
+#endif /* _BITSET_H_ */
@@ -0,0 +1,166 @@
+/*
+ * dedupe.c
+ *
+ * Implementation of the duplicate detector; see dedupe.h. The origins are kept
+ * in an address map keyed by origin ID, and each has a circular bitmap indexed
+ * by sequence number modulo the window size. When a newer sequence number
+ * arrives, the bits of the numbers skipped over are cleared, a word at a time.
+ */
+
+#include "dedupe.h"
+#include "addrmap.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_WINDOW 0x40000000L      /* well short of half the sequence space */
+
+/* the sliding window of one origin */
+typedef struct {
+    uint32_t origin;
+    uint32_t top;               /* the newest sequence number seen */
+    unsigned long used;         /* clock of the last ID seen, for eviction */
+    uint64_t *bits;             /* one bit per sequence number in the window */
+} Window;
+
+struct dedupe {
+    AddrMap *index;             /* origin ID -> Window */
+    Window *windows;
+    long nwindows;              /* windows in use */
+    long max;                   /* windows allocated */
+    uint32_t mask;              /* window size - 1, a power of two */
+    unsigned long clock;        /* advanced on every ID */
+};
+
+uint64_t dd_id(uint32_t origin, uint32_t seq) {
+    return (((uint64_t)origin << 32) | (uint64_t)seq);
+}
+
+Dedupe *dd_create(long origins, long window) {
+    Dedupe *dd;
+    long N = 64L;
+
+    if (origins < 1L)
+        origins = 1L;
+    if (window > MAX_WINDOW)
+        window = MAX_WINDOW;
+    while (N < window)
+        N <<= 1;
+    if ((dd = (Dedupe *)malloc(sizeof(Dedupe))) == NULL)
+        return NULL;
+    if ((dd->index = am_create(origins)) == NULL) {
+        free(dd);
+        return NULL;
+    }
+    if ((dd->windows = (Window *)calloc(origins, sizeof(Window))) == NULL) {
+        am_destroy(dd->index, NULL);
+        free(dd);
+        return NULL;
+    }
+    dd->nwindows = 0L;
+    dd->max = origins;
+    dd->mask = (uint32_t)(N - 1);
+    dd->clock = 0UL;
+    return dd;
+}
+
+void dd_destroy(Dedupe *dd) {
+    long i;
+
+    for (i = 0L; i < dd->nwindows; i++)
+        free(dd->windows[i].bits);
+    free(dd->windows);
+    am_destroy(dd->index, NULL);
+    free(dd);
+}
+
+/*
+ * local function to obtain a cleared window for a new origin; a fresh one is
+ * allocated while there are fewer than `max', after which the least recently
+ * used one is taken over
+ */
+static Window *claim(Dedupe *dd, uint32_t origin) {
+    Window *w, *victim;
+    size_t nbytes = ((size_t)dd->mask + 1) / 8;
+    void *dummy;
+    long i;
+
+    if (dd->nwindows < dd->max) {
+        w = &dd->windows[dd->nwindows];
+        if ((w->bits = (uint64_t *)calloc(1, nbytes)) == NULL)
+            return NULL;
+        dd->nwindows++;
+    } else {
+        victim = &dd->windows[0];
+        for (i = 1L; i < dd->nwindows; i++)
+            if (dd->windows[i].used < victim->used)
+                victim = &dd->windows[i];
+        (void)am_remove(dd->index, (uint64_t)victim->origin, &dummy);
+        w = victim;
+        memset(w->bits, 0, nbytes);
+    }
+    w->origin = origin;
+    if (!am_put(dd->index, (uint64_t)origin, w, NULL)) {
+        /* left out of the index, the window is the first to be taken over */
+        w->used = 0UL;
+        return NULL;
+    }
+    return w;
+}
+
+/*
+ * local function to clear `count' bits of the window, starting with the bit of
+ * sequence number `from'
+ */
+static void clear_bits(Window *w, uint32_t mask, uint32_t from, uint32_t count) {
+
+    while (count > 0 && (from & 63) != 0) {
+        w->bits[(from & mask) >> 6] &= ~(1ULL << (from & 63));
+        from++; count--;
+    }
+    /* the window is a whole number of words, so an aligned word never wraps */
+    while (count >= 64) {
+        w->bits[(from & mask) >> 6] = 0ULL;
+        from += 64; count -= 64;
+    }
+    while (count > 0) {
+        w->bits[(from & mask) >> 6] &= ~(1ULL << (from & 63));
+        from++; count--;
+    }
+}
+
+int dd_insert(Dedupe *dd, uint64_t id) {
+    uint32_t origin = (uint32_t)(id >> 32), seq = (uint32_t)id, ahead, behind;
+    uint64_t bit;
+    Window *w;
+
+    if (!am_get(dd->index, (uint64_t)origin, (void **)&w)) {
+        if ((w = claim(dd, origin)) == NULL)
+            return 1;
+        w->top = seq;
+        w->bits[(seq & dd->mask) >> 6] |= (1ULL << (seq & 63));
+        w->used = ++dd->clock;
+        return 1;
+    }
+    w->used = ++dd->clock;
+
+    ahead = seq - w->top;
+    if (ahead != 0 && ahead < 0x80000000U) {
+        /* newer than any seen so far, slide the window forward to it */
+        if (ahead > dd->mask)
+            memset(w->bits, 0, ((size_t)dd->mask + 1) / 8);
+        else
+            clear_bits(w, dd->mask, w->top + 1, ahead);
+        w->top = seq;
+        w->bits[(seq & dd->mask) >> 6] |= (1ULL << (seq & 63));
+        return 1;
+    }
+
+    behind = w->top - seq;
+    if (behind > dd->mask)
+        return 0;       /* fell out of the window */
+    bit = 1ULL << (seq & 63);
+    if (w->bits[(seq & dd->mask) >> 6] & bit)
+        return 0;
+    w->bits[(seq & dd->mask) >> 6] |= bit;
+    return 1;
+}
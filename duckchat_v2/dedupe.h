@@ -0,0 +1,51 @@
+/*
+ * dedupe.h
+ *
+ * Interface for a duplicate detector of message IDs. An ID is made of the ID of
+ * the server that originated the message in its high 32 bits, and a sequence
+ * number that the origin increments for every message in its low 32 bits. For
+ * every origin, a bitmap remembers which of the most recent `window' sequence
+ * numbers have been seen, and slides forward as newer ones arrive; checking an
+ * ID is a lookup of its origin and a bit test, whatever the message rate.
+ */
+
+#ifndef _DEDUPE_H_
+#define _DEDUPE_H_
+
+#include <stdint.h>
+
+typedef struct dedupe Dedupe;       /* opaque type definition */
+
+/*
+ * returns the message ID made of origin `origin' and sequence number `seq'
+ */
+uint64_t dd_id(uint32_t origin, uint32_t seq);
+
+/*
+ * create a duplicate detector that tracks up to `origins' origins at once, and
+ * the last `window' sequence numbers of each; `window' is rounded up to a power
+ * of two, at least 64; the bitmap of an origin is allocated when the first ID
+ * from it arrives, and once `origins' are tracked, the origin that has been idle
+ * the longest is forgotten to make room for a new one
+ *
+ * returns a pointer to the detector, or NULL if there are malloc() errors
+ */
+Dedupe *dd_create(long origins, long window);
+
+/*
+ * destroys the detector, returning all of its storage to the heap
+ */
+void dd_destroy(Dedupe *dd);
+
+/*
+ * checks `id' against the IDs seen so far, and records it as seen; an ID that
+ * is older than the window of its origin can no longer be told apart from a
+ * duplicate, and is reported as one; sequence numbers are compared modulo 2^32,
+ * so they may wrap around; if a new origin cannot be tracked (malloc failure),
+ * its IDs are reported as new
+ *
+ * returns 1 if `id' has not been seen before, 0 if it is a duplicate
+ */
+int dd_insert(Dedupe *dd, uint64_t id);
+
+#endif /* _DEDUPE_H_ */
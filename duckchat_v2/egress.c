@@ -0,0 +1,201 @@
+/*
+ * egress.c
+ *
+ * Implementation of the transmit stage; see egress.h. The producer stages each
+ * batch in a buffer of its own and pushes it into the ring; payloads up to
+ * INLINE_SIZE bytes travel inside the batch, larger ones as a heap copy that the
+ * thread frees once sent. The thread sleeps on an eventfd while the ring is
+ * empty, and is kicked when a push finds it may have gone idle.
+ */
+
+#define _GNU_SOURCE
+#include "egress.h"
+#include "spscring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+
+#define INLINE_SIZE 256     /* fits every fixed-size packet the server sends */
+
+typedef struct {
+    int n;                          /* destinations */
+    size_t len;                     /* length of the payload */
+    char *heap;                     /* copy of a payload too large to fit inline */
+    char payload[INLINE_SIZE];
+    struct sockaddr_in to[];        /* the destinations, room for `batch' */
+} Batch;
+
+struct egress {
+    int fd;
+    int batch;
+    int wake_fd;
+    int stopping;                   /* the thread should exit once drained */
+    long stalls;
+    SpscRing *ring;
+    Batch *staged;                  /* producer only */
+    Batch *sending;                 /* thread only, as are the headers */
+    struct mmsghdr *msgs;
+    struct iovec iov;
+    pthread_t thread;
+};
+
+/*
+ * local function to send the batch popped into `sending'; a destination the
+ * kernel refuses is skipped, as in the fan-out engine
+ */
+static void send_out(Egress *eg) {
+    Batch *b = eg->sending;
+    int i = 0, res;
+
+    eg->iov.iov_base = (b->heap != NULL) ? b->heap : b->payload;
+    eg->iov.iov_len = b->len;
+    for (i = 0; i < b->n; i++)
+        eg->msgs[i].msg_hdr.msg_name = &b->to[i];
+    i = 0;
+    while (i < b->n) {
+        res = sendmmsg(eg->fd, &eg->msgs[i], b->n - i, 0);
+        if (res <= 0)
+            i++;
+        else
+            i += res;
+    }
+    free(b->heap);
+}
+
+/*
+ * local function run by the thread; sends batches until the ring is empty, then
+ * sleeps until kicked
+ */
+static void *egress_main(void *arg) {
+    Egress *eg = (Egress *)arg;
+    struct pollfd pfd;
+    uint64_t count;
+
+    pfd.fd = eg->wake_fd;
+    pfd.events = POLLIN;
+    for (;;) {
+        while (sr_pop(eg->ring, eg->sending))
+            send_out(eg);
+        if (__atomic_load_n(&eg->stopping, __ATOMIC_ACQUIRE)) {
+            while (sr_pop(eg->ring, eg->sending))
+                send_out(eg);
+            break;
+        }
+        if (poll(&pfd, 1, -1) > 0)
+            (void)!read(eg->wake_fd, &count, sizeof(count));
+    }
+    return NULL;
+}
+
+/*
+ * local function to kick the thread awake
+ */
+static void kick(Egress *eg) {
+    uint64_t one = 1;
+
+    (void)!write(eg->wake_fd, &one, sizeof(one));
+}
+
+Egress *eg_create(int fd, int batch, long capacity) {
+    Egress *eg;
+    size_t size = sizeof(Batch) + batch * sizeof(struct sockaddr_in);
+    sigset_t all, old;
+    int i, res;
+
+    if (batch <= 0)
+        return NULL;
+    if ((eg = (Egress *)calloc(1, sizeof(Egress))) == NULL)
+        return NULL;
+    eg->fd = fd;
+    eg->batch = batch;
+    eg->wake_fd = -1;
+    if ((eg->ring = sr_create(capacity, size)) == NULL)
+        goto error;
+    if ((eg->staged = (Batch *)malloc(size)) == NULL ||
+        (eg->sending = (Batch *)malloc(size)) == NULL)
+        goto error;
+    if ((eg->msgs = (struct mmsghdr *)calloc(batch, sizeof(struct mmsghdr))) == NULL)
+        goto error;
+    for (i = 0; i < batch; i++) {
+        eg->msgs[i].msg_hdr.msg_iov = &eg->iov;
+        eg->msgs[i].msg_hdr.msg_iovlen = 1;
+        eg->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+    if ((eg->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        goto error;
+
+    /* the thread never handles signals; they are left to the server's threads */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    res = pthread_create(&eg->thread, NULL, egress_main, eg);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (res != 0)
+        goto error;
+    return eg;
+
+error:
+    if (eg->wake_fd >= 0)
+        close(eg->wake_fd);
+    free(eg->msgs);
+    free(eg->sending);
+    free(eg->staged);
+    if (eg->ring != NULL)
+        sr_destroy(eg->ring);
+    free(eg);
+    return NULL;
+}
+
+void eg_destroy(Egress *eg) {
+    __atomic_store_n(&eg->stopping, 1, __ATOMIC_RELEASE);
+    kick(eg);
+    pthread_join(eg->thread, NULL);
+    close(eg->wake_fd);
+    free(eg->msgs);
+    free(eg->sending);
+    free(eg->staged);
+    sr_destroy(eg->ring);
+    free(eg);
+}
+
+int eg_send(Egress *eg, const void *payload, size_t len, const struct mmsghdr *msgs, int n) {
+    Batch *b = eg->staged;
+    int i;
+
+    b->heap = NULL;
+    if (len <= INLINE_SIZE)
+        memcpy(b->payload, payload, len);
+    else if ((b->heap = (char *)malloc(len)) != NULL)
+        memcpy(b->heap, payload, len);
+    else
+        return 0;
+    b->len = len;
+    b->n = n;
+    for (i = 0; i < n; i++)
+        b->to[i] = *(const struct sockaddr_in *)msgs[i].msg_hdr.msg_name;
+
+    /* backpressure; wait for the thread to make room rather than drop the batch */
+    while (sr_isFull(eg->ring)) {
+        __atomic_fetch_add(&eg->stalls, 1L, __ATOMIC_RELAXED);
+        sched_yield();
+    }
+    if (sr_push(eg->ring, b) == 2)
+        kick(eg);
+    return 1;
+}
+
+long eg_depth(Egress *eg) {
+    return sr_size(eg->ring);
+}
+
+long eg_stalls(Egress *eg) {
+    return __atomic_load_n(&eg->stalls, __ATOMIC_RELAXED);
+}
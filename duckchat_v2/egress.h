@@ -0,0 +1,56 @@
+/*
+ * egress.h
+ *
+ * Interface for the server's transmit stage. An egress owns a thread that sends
+ * the batches a single producer thread prepares, so the cost of the system calls
+ * overlaps with the producer's work. A batch is one payload and the destinations
+ * it goes to; it is copied into a bounded lock-free SPSC ring (see spscring.h),
+ * and sent by the thread with a single sendmmsg(2) call.
+ *
+ * The ring applies backpressure: a producer that finds it full waits for the
+ * thread to catch up rather than dropping the batch, and counts the stall.
+ */
+
+#ifndef _EGRESS_H_
+#define _EGRESS_H_
+
+#include <stddef.h>
+
+struct mmsghdr;                     /* see sendmmsg(2); needs _GNU_SOURCE */
+typedef struct egress Egress;       /* opaque type definition */
+
+/*
+ * create an egress that sends on socket `fd' batches of up to `batch'
+ * destinations, with up to `capacity' batches waiting; its thread is started
+ *
+ * returns a pointer to the egress, or NULL if there are malloc(), eventfd() or
+ * pthread_create() errors
+ */
+Egress *eg_create(int fd, int batch, long capacity);
+
+/*
+ * stops the thread once every waiting batch has been sent, and returns the
+ * storage of the egress to the heap; the socket is not closed
+ */
+void eg_destroy(Egress *eg);
+
+/*
+ * producer only: queues the `len' bytes of `payload' for the destinations named
+ * by the first `n' headers of `msgs', n <= batch; both are copied
+ *
+ * returns 1 if successful, 0 if not (malloc() failure on a payload too large
+ * to be copied inline); the caller must then send the batch itself
+ */
+int eg_send(Egress *eg, const void *payload, size_t len, const struct mmsghdr *msgs, int n);
+
+/*
+ * returns the number of batches currently waiting to be sent
+ */
+long eg_depth(Egress *eg);
+
+/*
+ * returns the number of times the producer found the ring full and waited
+ */
+long eg_stalls(Egress *eg);
+
+#endif /* _EGRESS_H_ */
@@ -0,0 +1,146 @@
+/*
+ * epoch.c
+ *
+ * Implementation of the epoch domain; see epoch.h. A global counter names the
+ * current epoch. A reader entering a read section announces the epoch it saw in
+ * its own slot, and clears the slot on leaving. A retired object is stamped with
+ * the epoch the retire advanced the counter to; a reader announcing an older one
+ * may have loaded the object before it was unpublished, whereas one that entered
+ * later can only have loaded its replacement. The object is freed once no slot
+ * announces an older epoch.
+ */
+
+#include "epoch.h"
+#include <stdlib.h>
+#include <sched.h>
+
+#define CACHE_LINE 64
+
+typedef struct retired {
+    struct retired *next;
+    void *object;
+    void (*freeFxn)(void *object);
+    long epoch;                     /* readers before this one may hold it */
+} Retired;
+
+typedef struct {
+    long active;                    /* epoch announced by the reader, or 0 */
+    Retired *retired;               /* objects retired by the thread, oldest last */
+    long pending;
+} __attribute__((aligned(CACHE_LINE))) Slot;
+
+struct epoch {
+    int nthreads;
+    Slot *slots;
+    long global __attribute__((aligned(CACHE_LINE)));
+};
+
+Epoch *ep_create(int nthreads) {
+    Epoch *ep;
+    int i;
+
+    if (nthreads <= 0)
+        return NULL;
+    if ((ep = (Epoch *)aligned_alloc(CACHE_LINE, sizeof(Epoch))) == NULL)
+        return NULL;
+    if ((ep->slots = (Slot *)aligned_alloc(CACHE_LINE, nthreads * sizeof(Slot))) == NULL) {
+        free(ep);
+        return NULL;
+    }
+    for (i = 0; i < nthreads; i++) {
+        ep->slots[i].active = 0L;
+        ep->slots[i].retired = NULL;
+        ep->slots[i].pending = 0L;
+    }
+    ep->nthreads = nthreads;
+    ep->global = 1L;
+    return ep;
+}
+
+void ep_destroy(Epoch *ep) {
+    Retired *r, *next;
+    int i;
+
+    for (i = 0; i < ep->nthreads; i++) {
+        for (r = ep->slots[i].retired; r != NULL; r = next) {
+            next = r->next;
+            (*r->freeFxn)(r->object);
+            free(r);
+        }
+    }
+    free(ep->slots);
+    free(ep);
+}
+
+void ep_enter(Epoch *ep, int thread) {
+    /*
+     * sequentially consistent, so that the announcement is visible before any
+     * published pointer is loaded; pairs with the exchange made by the writer
+     */
+    __atomic_store_n(&ep->slots[thread].active, __atomic_load_n(&ep->global,
+            __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+}
+
+void ep_exit(Epoch *ep, int thread) {
+    __atomic_store_n(&ep->slots[thread].active, 0L, __ATOMIC_RELEASE);
+}
+
+/*
+ * local function to determine the oldest epoch announced by any reader
+ *
+ * returns that epoch, or LONG_MAX if no reader is in a read section
+ */
+static long oldest_reader(Epoch *ep) {
+    long oldest = __LONG_MAX__, e;
+    int i;
+
+    for (i = 0; i < ep->nthreads; i++) {
+        e = __atomic_load_n(&ep->slots[i].active, __ATOMIC_SEQ_CST);
+        if (e != 0L && e < oldest)
+            oldest = e;
+    }
+    return oldest;
+}
+
+long ep_reclaim(Epoch *ep, int thread) {
+    Slot *slot = &ep->slots[thread];
+    Retired **link, *r;
+    long oldest;
+
+    if (slot->retired == NULL)
+        return 0L;
+    oldest = oldest_reader(ep);
+    /* the list is newest first; everything after the first free one is older still */
+    for (link = &slot->retired; *link != NULL; link = &(*link)->next)
+        if ((*link)->epoch <= oldest)
+            break;
+    while ((r = *link) != NULL) {
+        *link = r->next;
+        (*r->freeFxn)(r->object);
+        free(r);
+        slot->pending--;
+    }
+    return slot->pending;
+}
+
+void ep_retire(Epoch *ep, int thread, void *object, void (*freeFxn)(void *object)) {
+    Slot *slot = &ep->slots[thread];
+    Retired *r;
+    long epoch;
+
+    /* advance the epoch; readers entering from now on cannot hold the object */
+    epoch = __atomic_add_fetch(&ep->global, 1L, __ATOMIC_SEQ_CST);
+    if ((r = (Retired *)malloc(sizeof(Retired))) == NULL) {
+        while (oldest_reader(ep) < epoch)
+            sched_yield();
+        (*freeFxn)(object);
+    } else {
+        r->object = object;
+        r->freeFxn = freeFxn;
+        r->epoch = epoch;
+        r->next = slot->retired;
+        slot->retired = r;
+        slot->pending++;
+    }
+    (void)ep_reclaim(ep, thread);
+}
@@ -0,0 +1,63 @@
+/*
+ * epoch.h
+ *
+ * Interface for epoch-based reclamation of shared, read-only objects (RCU-style).
+ * A writer publishes a new version of an object by swapping a pointer, then
+ * retires the old version; readers bracket their use of any published object
+ * with ep_enter() and ep_exit(), and never block or take a lock. A retired
+ * object is freed only once every reader that could still hold it has left its
+ * read section.
+ *
+ * Every participating thread is given a number 0..nthreads-1; each thread may
+ * both read and retire, but a read section must not contain a retire by the
+ * same thread.
+ */
+
+#ifndef _EPOCH_H_
+#define _EPOCH_H_
+
+typedef struct epoch Epoch;         /* opaque type definition */
+
+/*
+ * create an epoch domain for `nthreads' threads
+ *
+ * returns a pointer to the domain, or NULL if there are malloc() errors
+ */
+Epoch *ep_create(int nthreads);
+
+/*
+ * frees every retired object still pending, then returns the storage of the
+ * domain to the heap; no thread may be in a read section
+ */
+void ep_destroy(Epoch *ep);
+
+/*
+ * thread `thread' only: starts a read section; objects loaded from a published
+ * pointer from now on stay valid until ep_exit()
+ */
+void ep_enter(Epoch *ep, int thread);
+
+/*
+ * thread `thread' only: ends the read section started by ep_enter()
+ */
+void ep_exit(Epoch *ep, int thread);
+
+/*
+ * thread `thread' only: retires `object', which the caller has just unpublished;
+ * `freeFxn' is invoked on it once no reader can hold it any longer; retired
+ * objects of the thread whose time has come are freed as well
+ *
+ * if the bookkeeping cannot be allocated, waits for the readers to move on and
+ * frees the object right away
+ */
+void ep_retire(Epoch *ep, int thread, void *object, void (*freeFxn)(void *object));
+
+/*
+ * thread `thread' only: frees the retired objects of the thread that no reader
+ * can hold any longer
+ *
+ * returns the number of objects still pending
+ */
+long ep_reclaim(Epoch *ep, int thread);
+
+#endif /* _EPOCH_H_ */
@@ -0,0 +1,225 @@
+/*
+ * eventloop.c
+ *
+ * Implementation of the epoll/timerfd based event loop; see eventloop.h.
+ */
+
+#include "eventloop.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#define MAX_EVENTS 64   /* number of events collected per wakeup */
+
+typedef struct elhandler {
+    struct elhandler *next;
+    int fd;
+    int timer;                              /* 1 if fd is owned timerfd */
+    int removed;                            /* 1 once unregistered */
+    void (*fdCallback)(int fd, void *arg);
+    void (*timerCallback)(void *arg);
+    void *arg;
+} ELHandler;
+
+struct eventloop {
+    int epfd;
+    int running;
+    int dispatching;
+    ELHandler *handlers;
+    ELHandler *zombies;     /* handlers removed while dispatching */
+    int (*backlogCallback)(void *arg);
+    void *backlogArg;
+};
+
+EventLoop *el_create(void) {
+    EventLoop *el;
+
+    el = (EventLoop *)malloc(sizeof(EventLoop));
+    if (el != NULL) {
+        if ((el->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+            free(el);
+            return NULL;
+        }
+        el->running = 0;
+        el->dispatching = 0;
+        el->handlers = NULL;
+        el->zombies = NULL;
+        el->backlogCallback = NULL;
+        el->backlogArg = NULL;
+    }
+    return el;
+}
+
+static void freeHandler(ELHandler *h) {
+    if (h->timer)
+        close(h->fd);
+    free(h);
+}
+
+void el_destroy(EventLoop *el) {
+    ELHandler *p, *q;
+
+    for (p = el->handlers; p != NULL; p = q) {
+        q = p->next;
+        freeHandler(p);
+    }
+    for (p = el->zombies; p != NULL; p = q) {
+        q = p->next;
+        freeHandler(p);
+    }
+    close(el->epfd);
+    free(el);
+}
+
+/*
+ * local function to link a new handler into the loop and the epoll set
+ *
+ * returns 1 if successful, 0 if not
+ */
+static int addHandler(EventLoop *el, ELHandler *h) {
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = h;
+    if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, h->fd, &ev) < 0)
+        return 0;
+    h->next = el->handlers;
+    el->handlers = h;
+    return 1;
+}
+
+int el_addFd(EventLoop *el, int fd, void (*callback)(int fd, void *arg), void *arg) {
+    ELHandler *h;
+
+    h = (ELHandler *)malloc(sizeof(ELHandler));
+    if (h == NULL)
+        return 0;
+    h->fd = fd;
+    h->timer = 0;
+    h->removed = 0;
+    h->fdCallback = callback;
+    h->timerCallback = NULL;
+    h->arg = arg;
+    if (!addHandler(el, h)) {
+        free(h);
+        return 0;
+    }
+    return 1;
+}
+
+int el_removeFd(EventLoop *el, int fd) {
+    ELHandler *p, *prev;
+
+    for (prev = NULL, p = el->handlers; p != NULL; prev = p, p = p->next)
+        if (p->fd == fd)
+            break;
+    if (p == NULL)
+        return 0;
+    if (prev == NULL)
+        el->handlers = p->next;
+    else
+        prev->next = p->next;
+    (void)epoll_ctl(el->epfd, EPOLL_CTL_DEL, fd, NULL);
+    p->removed = 1;
+    if (el->dispatching) {
+        /* events for this handler may still be pending in this wakeup */
+        p->next = el->zombies;
+        el->zombies = p;
+    } else {
+        freeHandler(p);
+    }
+    return 1;
+}
+
+int el_addTimer(EventLoop *el, long interval, void (*callback)(void *arg), void *arg) {
+    ELHandler *h;
+    struct itimerspec spec;
+    int fd;
+
+    if (interval <= 0L)
+        return -1;
+    if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+        return -1;
+    spec.it_interval.tv_sec = interval / 1000L;
+    spec.it_interval.tv_nsec = (interval % 1000L) * 1000000L;
+    spec.it_value = spec.it_interval;
+    if (timerfd_settime(fd, 0, &spec, NULL) < 0)
+        goto error;
+    if ((h = (ELHandler *)malloc(sizeof(ELHandler))) == NULL)
+        goto error;
+    h->fd = fd;
+    h->timer = 1;
+    h->removed = 0;
+    h->fdCallback = NULL;
+    h->timerCallback = callback;
+    h->arg = arg;
+    if (!addHandler(el, h)) {
+        free(h);
+        goto error;
+    }
+    return fd;
+
+error:
+    close(fd);
+    return -1;
+}
+
+/*
+ * local function to invoke the callback of a handler that became ready
+ */
+static void dispatch(ELHandler *h) {
+    uint64_t expirations;
+
+    if (h->removed)
+        return;
+    if (h->timer) {
+        /* consume the expiration count, otherwise the timer stays readable */
+        if (read(h->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            return;
+        (*h->timerCallback)(h->arg);
+    } else {
+        (*h->fdCallback)(h->fd, h->arg);
+    }
+}
+
+void el_setBacklog(EventLoop *el, int (*callback)(void *arg), void *arg) {
+    el->backlogCallback = callback;
+    el->backlogArg = arg;
+}
+
+int el_run(EventLoop *el) {
+    struct epoll_event events[MAX_EVENTS];
+    ELHandler *p, *q;
+    int i, n, behind = 0;
+
+    el->running = 1;
+    while (el->running) {
+        /* with a backlog left, only poll, so that it is resumed right after the events */
+        if ((n = epoll_wait(el->epfd, events, MAX_EVENTS, behind ? 0 : -1)) < 0) {
+            if (errno == EINTR)
+                continue;
+            el->running = 0;
+            return 0;
+        }
+        el->dispatching = 1;
+        for (i = 0; i < n; i++)
+            dispatch((ELHandler *)events[i].data.ptr);
+        el->dispatching = 0;
+        /* now safe to release handlers removed during the wakeup */
+        for (p = el->zombies; p != NULL; p = q) {
+            q = p->next;
+            freeHandler(p);
+        }
+        el->zombies = NULL;
+        if (el->backlogCallback != NULL)
+            behind = (*el->backlogCallback)(el->backlogArg);
+    }
+    return 1;
+}
+
+void el_stop(EventLoop *el) {
+    el->running = 0;
+}
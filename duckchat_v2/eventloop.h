@@ -0,0 +1,83 @@
+/*
+ * eventloop.h
+ *
+ * Interface for the server's event loop. The loop is built on epoll(7), so the
+ * cost of a wakeup does not depend on how many descriptors are registered, and
+ * periodic jobs are driven by timerfd(2) descriptors registered in the same
+ * epoll set, so housekeeping fires on schedule no matter how much packet
+ * traffic the loop is handling.
+ *
+ * Work too large to finish in one turn of the loop may be left to a backlog
+ * callback, which the loop invokes after every turn until it has caught up;
+ * meanwhile the loop only polls its descriptors, so the work is interleaved
+ * with newly arrived events rather than holding them up.
+ */
+
+#ifndef _EVENTLOOP_H_
+#define _EVENTLOOP_H_
+
+typedef struct eventloop EventLoop;     /* opaque type definition */
+
+/*
+ * create an event loop with no registered descriptors or timers
+ *
+ * returns a pointer to the event loop, or NULL if there are malloc() or
+ * epoll_create() errors
+ */
+EventLoop *el_create(void);
+
+/*
+ * destroys the event loop; closes every timer created with el_addTimer() and
+ * returns all storage associated with the loop to the heap; descriptors
+ * registered with el_addFd() are not closed
+ */
+void el_destroy(EventLoop *el);
+
+/*
+ * registers `fd' with the event loop; `callback' is invoked with `fd' and
+ * `arg' every time the descriptor becomes readable (level triggered)
+ *
+ * returns 1 if successful, 0 if not (malloc() or epoll_ctl() errors)
+ */
+int el_addFd(EventLoop *el, int fd, void (*callback)(int fd, void *arg), void *arg);
+
+/*
+ * unregisters `fd' from the event loop; safe to call from within a callback,
+ * including the callback registered for `fd' itself
+ *
+ * returns 1 if successful, 0 if `fd' was not registered
+ */
+int el_removeFd(EventLoop *el, int fd);
+
+/*
+ * creates a periodic timer that invokes `callback' with `arg' every
+ * `interval' milliseconds, starting `interval' milliseconds from now; if the
+ * loop falls behind and several expirations are pending, the callback is
+ * invoked only once for all of them
+ *
+ * returns the timer's descriptor if successful, -1 if not
+ */
+int el_addTimer(EventLoop *el, long interval, void (*callback)(void *arg), void *arg);
+
+/*
+ * sets `callback' as the loop's backlog callback; it is invoked with `arg' after
+ * the callbacks of every wakeup have been dispatched, and returns 1 if work is
+ * still left, in which case the loop does not block waiting for the next event,
+ * or 0 if not; NULL removes it
+ */
+void el_setBacklog(EventLoop *el, int (*callback)(void *arg), void *arg);
+
+/*
+ * runs the event loop, dispatching callbacks until el_stop() is invoked
+ *
+ * returns 1 if the loop was stopped, 0 if epoll_wait() failed
+ */
+int el_run(EventLoop *el);
+
+/*
+ * requests that el_run() returns once the callbacks of the current wakeup
+ * have been dispatched
+ */
+void el_stop(EventLoop *el);
+
+#endif /* _EVENTLOOP_H_ */
@@ -0,0 +1,357 @@
+/*
+ * fanout.c
+ *
+ * Implementation of the fan-out engine, on sendmmsg() or, when built with
+ * USE_IO_URING, on batches of io_uring sendmsg requests; see fanout.h. Messages
+ * left for later turns are kept in a list, oldest first, each with a copy of its
+ * payload and of the destinations not yet sent to.
+ */
+
+#define _GNU_SOURCE
+#include "fanout.h"
+#include "egress.h"
+#include "fanpool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#ifdef USE_IO_URING
+#include "uring.h"
+#endif
+
+typedef struct deferred {
+    struct deferred *next;
+    size_t len;             /* of the payload */
+    long n;                 /* destinations */
+    long capacity;          /* room in addrs[] */
+    long done;              /* destinations already sent to */
+    struct sockaddr_in *addrs;
+    char payload[];         /* copy of the message */
+} Deferred;
+
+struct fanout {
+    int fd;
+    int batch;
+    int queued;             /* destinations waiting in msgs[] */
+    long sent;              /* destinations sent to since fo_begin() */
+    struct iovec iov;       /* the payload, shared by every header */
+    struct mmsghdr *msgs;
+    Egress *eg;             /* hands batches to a transmit thread, if set */
+    FanPool *fp;            /* sends large arrays in parallel, if set */
+    long threshold;         /* smallest array sent through the pool */
+    long budget;            /* destinations sent per turn, 0 for no limit */
+    long spent;             /* destinations sent this turn */
+    int backlog;            /* messages in the list */
+    int maxBacklog;
+    Deferred *head, *tail;  /* messages left for later turns, oldest first */
+    Deferred *current;      /* the current message, once it has been deferred */
+#ifdef USE_IO_URING
+    Uring *ur;              /* one sendmsg request per destination */
+#endif
+};
+
+Fanout *fo_create(int fd, int batch) {
+    Fanout *fo;
+    int i;
+
+    if (batch <= 0)
+        return NULL;
+    if ((fo = (Fanout *)malloc(sizeof(Fanout))) == NULL)
+        return NULL;
+    if ((fo->msgs = (struct mmsghdr *)malloc(batch * sizeof(struct mmsghdr))) == NULL) {
+        free(fo);
+        return NULL;
+    }
+#ifdef USE_IO_URING
+    if ((fo->ur = ur_create(batch, 2 * batch)) == NULL) {
+        free(fo->msgs);
+        free(fo);
+        return NULL;
+    }
+#endif
+    fo->fd = fd;
+    fo->batch = batch;
+    fo->queued = 0;
+    fo->sent = 0L;
+    fo->eg = NULL;
+    fo->fp = NULL;
+    fo->threshold = 0L;
+    fo->budget = fo->spent = 0L;
+    fo->backlog = fo->maxBacklog = 0;
+    fo->head = fo->tail = fo->current = NULL;
+    fo->iov.iov_base = NULL;
+    fo->iov.iov_len = 0;
+    memset(fo->msgs, 0, batch * sizeof(struct mmsghdr));
+    for (i = 0; i < batch; i++) {
+        fo->msgs[i].msg_hdr.msg_iov = &fo->iov;
+        fo->msgs[i].msg_hdr.msg_iovlen = 1;
+        fo->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+    return fo;
+}
+
+void fo_destroy(Fanout *fo) {
+    Deferred *d;
+
+    while ((d = fo->head) != NULL) {
+        fo->head = d->next;
+        free(d->addrs);
+        free(d);
+    }
+#ifdef USE_IO_URING
+    ur_destroy(fo->ur);
+#endif
+    free(fo->msgs);
+    free(fo);
+}
+
+#ifdef USE_IO_URING
+
+/*
+ * local function to push the queued batch to the socket; one sendmsg request per
+ * destination, all submitted with a single system call; the payload belongs to
+ * the caller, so the batch is waited for before returning
+ */
+static void send_batch(Fanout *fo) {
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    int i, n, done = 0;
+
+    for (i = 0; i < fo->queued; i++) {
+        if ((sqe = ur_getSqe(fo->ur)) == NULL)
+            break;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fo->fd;
+        sqe->addr = (unsigned long)&fo->msgs[i].msg_hdr;
+        sqe->len = 1;
+    }
+    if ((n = ur_submit(fo->ur, i)) > 0) {
+        /* a destination the kernel refuses is skipped, as with sendmmsg() */
+        while (done < n) {
+            while ((cqe = ur_peekCqe(fo->ur)) != NULL) {
+                if (cqe->res >= 0)
+                    fo->sent++;
+                ur_seenCqe(fo->ur);
+                done++;
+            }
+            if (done < n && ur_submit(fo->ur, n - done) < 0)
+                break;
+        }
+    }
+    fo->queued = 0;
+}
+
+#else   /* classic sendmmsg() path */
+
+/*
+ * local function to push the queued batch to the socket; a destination the
+ * kernel refuses is skipped, just as a failed sendto() would be
+ */
+static void send_batch(Fanout *fo) {
+    int i = 0, res;
+
+    while (i < fo->queued) {
+        res = sendmmsg(fo->fd, &fo->msgs[i], fo->queued - i, 0);
+        if (res <= 0) {
+            i++;
+        } else {
+            fo->sent += res;
+            i += res;
+        }
+    }
+    fo->queued = 0;
+}
+
+#endif /* USE_IO_URING */
+
+/*
+ * local function to send the queued batch, through the egress if there is one;
+ * a batch the egress cannot take is sent right here instead
+ */
+static void dispatch(Fanout *fo) {
+    if (fo->eg != NULL &&
+        eg_send(fo->eg, fo->iov.iov_base, fo->iov.iov_len, fo->msgs, fo->queued)) {
+        fo->sent += fo->queued;
+        fo->queued = 0;
+    } else {
+        send_batch(fo);
+    }
+}
+
+void fo_setEgress(Fanout *fo, Egress *eg) {
+    fo->eg = eg;
+}
+
+void fo_setPool(Fanout *fo, FanPool *fp, long threshold) {
+    fo->fp = fp;
+    fo->threshold = threshold;
+}
+
+/*
+ * local function to send the current payload to the `n' addresses of the array
+ * `addrs'; through the pool if there is one and the array is large enough for it
+ */
+static void send_array(Fanout *fo, const struct sockaddr_in *addrs, long n) {
+    long i;
+
+    if (fo->fp != NULL && n >= fo->threshold) {
+        if (fo->queued > 0)
+            dispatch(fo);
+        fo->sent += fp_send(fo->fp, fo->iov.iov_base, fo->iov.iov_len, addrs, n);
+        return;
+    }
+    for (i = 0L; i < n; i++) {
+        fo->msgs[fo->queued++].msg_hdr.msg_name = (void *)&addrs[i];
+        if (fo->queued == fo->batch)
+            dispatch(fo);
+    }
+}
+
+/*
+ * local function to determine how many destinations of the current message may
+ * still be sent to in this turn; none while older messages wait, so that every
+ * destination receives the messages in the order they were sent
+ */
+static long room(Fanout *fo) {
+    if (fo->budget == 0L)
+        return LONG_MAX;
+    if (fo->head != NULL || fo->spent >= fo->budget)
+        return 0L;
+    return fo->budget - fo->spent;
+}
+
+/*
+ * local function to leave the `n' addresses of the array `addrs' to later turns,
+ * copying them to the current message's entry in the list, which is created with
+ * a copy of the payload if it is not there yet
+ *
+ * returns 1 if successful, 0 if there are malloc() errors
+ */
+static int defer(Fanout *fo, const struct sockaddr_in *addrs, long n) {
+    Deferred *d = fo->current;
+    struct sockaddr_in *grown;
+    long capacity;
+
+    if (d == NULL) {
+        if ((d = (Deferred *)malloc(sizeof(Deferred) + fo->iov.iov_len)) == NULL)
+            return 0;
+        memcpy(d->payload, fo->iov.iov_base, fo->iov.iov_len);
+        d->len = fo->iov.iov_len;
+        d->n = d->capacity = d->done = 0L;
+        d->addrs = NULL;
+        d->next = NULL;
+        if (fo->tail == NULL)
+            fo->head = d;
+        else
+            fo->tail->next = d;
+        fo->tail = fo->current = d;
+        fo->backlog++;
+    }
+    if (d->n + n > d->capacity) {
+        capacity = (d->capacity == 0L) ? fo->batch : d->capacity;
+        while (capacity < d->n + n)
+            capacity *= 2;
+        if ((grown = (struct sockaddr_in *)realloc(d->addrs,
+                capacity * sizeof(struct sockaddr_in))) == NULL)
+            return 0;
+        d->addrs = grown;
+        d->capacity = capacity;
+    }
+    memcpy(&d->addrs[d->n], addrs, n * sizeof(struct sockaddr_in));
+    d->n += n;
+    fo->sent += n;
+    return 1;
+}
+
+/*
+ * local function to send the messages in the list, oldest first, to up to
+ * `limit' destinations in all; a message sent to all of its destinations is
+ * removed from the list
+ *
+ * returns the number of destinations sent to
+ */
+static long work_off(Fanout *fo, long limit) {
+    Deferred *d;
+    long n, total = 0L;
+
+    if (fo->queued > 0)
+        dispatch(fo);
+    fo->current = NULL;
+    while ((d = fo->head) != NULL && limit > 0L) {
+        n = (d->n - d->done < limit) ? d->n - d->done : limit;
+        fo->iov.iov_base = d->payload;
+        fo->iov.iov_len = d->len;
+        send_array(fo, &d->addrs[d->done], n);
+        if (fo->queued > 0)
+            dispatch(fo);
+        d->done += n;
+        total += n;
+        limit -= n;
+        if (d->done == d->n) {
+            if ((fo->head = d->next) == NULL)
+                fo->tail = NULL;
+            fo->backlog--;
+            free(d->addrs);
+            free(d);
+        }
+    }
+    return total;
+}
+
+void fo_setBudget(Fanout *fo, long budget, int backlog) {
+    fo->budget = budget;
+    fo->maxBacklog = backlog;
+}
+
+int fo_resume(Fanout *fo) {
+    fo->spent = 0L;
+    if (fo->head == NULL)
+        return 0;
+    fo->spent = work_off(fo, fo->budget);
+    return (fo->head != NULL);
+}
+
+void fo_begin(Fanout *fo, const void *payload, size_t len) {
+    if (fo->queued > 0)
+        dispatch(fo);
+    fo->current = NULL;
+    /* with the list full, the older messages are finished before taking on another */
+    if (fo->backlog >= fo->maxBacklog && fo->head != NULL)
+        (void)work_off(fo, LONG_MAX);
+    fo->iov.iov_base = (void *)payload;
+    fo->iov.iov_len = len;
+    fo->sent = 0L;
+}
+
+void fo_add(Fanout *fo, struct sockaddr_in *addr) {
+    if (fo->budget > 0L) {
+        if (room(fo) == 0L && defer(fo, addr, 1L))
+            return;
+        fo->spent++;
+    }
+    fo->msgs[fo->queued++].msg_hdr.msg_name = addr;
+    if (fo->queued == fo->batch)
+        dispatch(fo);
+}
+
+void fo_addArray(Fanout *fo, const struct sockaddr_in *addrs, long n) {
+    long now = n;
+
+    if (fo->budget > 0L) {
+        if ((now = room(fo)) > n)
+            now = n;
+        /* the rest is sent right away if it cannot be left for later */
+        if (now < n && !defer(fo, &addrs[now], n - now))
+            now = n;
+        fo->spent += now;
+    }
+    send_array(fo, addrs, now);
+}
+
+long fo_flush(Fanout *fo) {
+    if (fo->queued > 0)
+        dispatch(fo);
+    return fo->sent;
+}
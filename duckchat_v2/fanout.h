@@ -0,0 +1,114 @@
+/*
+ * fanout.h
+ *
+ * Interface for the server's fan-out engine. A fan-out sends one payload to many
+ * destinations with sendmmsg(2); every message header of a batch shares the same
+ * iovec, so the payload is built once per message no matter how many recipients
+ * it has, and the headers are allocated once and reused for every message.
+ *
+ * When built with the io_uring backend (make IO_BACKEND=uring), each batch is
+ * instead queued as one sendmsg request per destination and submitted to the
+ * kernel with a single io_uring_enter(2) call.
+ *
+ * A fan-out may instead hand each batch to an egress (see egress.h), whose
+ * thread makes the system call while the caller goes on with its work, and may
+ * share the arrays of large channels with a fan-out pool (see fanpool.h), whose
+ * helpers send parts of the array in parallel with the caller.
+ *
+ * A fan-out given a budget sends to at most that many destinations per turn of
+ * the caller's event loop; the destinations beyond it are copied, along with the
+ * payload, and sent in later turns by fo_resume(), so a message to a huge channel
+ * does not hold up the packets arriving meanwhile. While messages wait, newer
+ * ones wait behind them, so every destination still receives them in order.
+ */
+
+#ifndef _FANOUT_H_
+#define _FANOUT_H_
+
+#include <stddef.h>
+#include <netinet/in.h>
+#include "egress.h"
+#include "fanpool.h"
+
+typedef struct fanout Fanout;       /* opaque type definition */
+
+/*
+ * create a fan-out that sends on socket `fd' in batches of up to `batch'
+ * destinations per system call
+ *
+ * returns a pointer to the fan-out, or NULL if there are malloc() errors (or,
+ * with the io_uring backend, if the kernel does not support it)
+ */
+Fanout *fo_create(int fd, int batch);
+
+/*
+ * destroys the fan-out, returning all of its storage to the heap; the socket
+ * is not closed
+ */
+void fo_destroy(Fanout *fo);
+
+/*
+ * hands every batch from now on to `eg', which must send on the same socket, in
+ * batches at least as large; NULL reverts to sending them directly
+ *
+ * destinations handed to an egress count as sent, since their delivery is no
+ * longer observed
+ */
+void fo_setEgress(Fanout *fo, Egress *eg);
+
+/*
+ * sends every array of at least `threshold' destinations through `fp', which must
+ * send on the same socket; NULL reverts to sending them in batches
+ */
+void fo_setPool(Fanout *fo, FanPool *fp, long threshold);
+
+/*
+ * limits the fan-out to `budget' destinations per turn, 0 for no limit; at most
+ * `backlog' messages are left for later turns, beyond which fo_begin() finishes
+ * them before starting another
+ *
+ * destinations left for later turns count as sent
+ */
+void fo_setBudget(Fanout *fo, long budget, int backlog);
+
+/*
+ * ends the caller's turn, starting a new one; sends the messages left for later
+ * turns, oldest first, to as many destinations as the budget allows; to be
+ * called once per turn of the event loop, and never between fo_begin() and
+ * fo_flush()
+ *
+ * returns 1 if messages are still waiting, 0 if not
+ */
+int fo_resume(Fanout *fo);
+
+/*
+ * starts a new message; `payload' is sent to every destination added until
+ * the next fo_flush() and must remain valid until then; any destinations still
+ * queued for the previous message are flushed first
+ */
+void fo_begin(Fanout *fo, const void *payload, size_t len);
+
+/*
+ * queues `addr' as a destination of the current message; the batch is sent
+ * as soon as it is full; `addr' must remain valid until the next fo_flush(),
+ * unless it is left for later turns, when it is copied
+ */
+void fo_add(Fanout *fo, struct sockaddr_in *addr);
+
+/*
+ * queues the `n' addresses of the array `addrs' as destinations of the current
+ * message; the headers point straight into the array, which must remain valid
+ * and unchanged until the next fo_flush(); an array large enough for the pool is
+ * sent before returning, and the part left for later turns is copied
+ */
+void fo_addArray(Fanout *fo, const struct sockaddr_in *addrs, long n);
+
+/*
+ * sends the current message to all destinations still queued
+ *
+ * returns the number of destinations the message was sent to since
+ * fo_begin(), including earlier full batches
+ */
+long fo_flush(Fanout *fo);
+
+#endif /* _FANOUT_H_ */
@@ -0,0 +1,268 @@
+/*
+ * fanpool.c
+ *
+ * Implementation of the fan-out pool; see fanpool.h. Participant 0 is the calling
+ * thread, participants 1..nthreads the helpers. A range is a pair of counters; a
+ * participant claims the next chunk of any range, its own or a victim's, with one
+ * atomic increment, so no chunk is ever sent twice and none needs a lock. The
+ * helpers sleep on a condition variable between messages, and the caller waits on
+ * another one for the last helper to finish.
+ */
+
+#define _GNU_SOURCE
+#include "fanpool.h"
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define CACHE_LINE 64
+
+typedef struct {
+    long next;                      /* next chunk to claim */
+    long end;                       /* end of the range */
+} __attribute__((aligned(CACHE_LINE))) Range;
+
+typedef struct {
+    int fd;                         /* the participant's own descriptor */
+    struct iovec iov;
+    struct mmsghdr *msgs;           /* headers for one chunk */
+    pthread_t thread;
+    struct fanpool *fp;
+} Participant;
+
+struct fanpool {
+    int nthreads;
+    int batch;
+    pthread_mutex_t lock;
+    pthread_cond_t start;           /* a message is ready, or the pool stops */
+    pthread_cond_t done;            /* the last helper finished the message */
+    long generation;                /* counts the messages, so a helper sees each once */
+    int busy;                       /* helpers still working on the message */
+    int stopping;
+    const void *payload;            /* the message; set while `busy' */
+    size_t len;
+    const struct sockaddr_in *addrs;
+    long n;
+    long sent;
+    long messages;
+    long steals;
+    Participant *parts;
+    Range *ranges;
+};
+
+/*
+ * local function to send chunk `c' of the current message
+ *
+ * returns the number of destinations sent to
+ */
+static long send_chunk(FanPool *fp, Participant *p, long c) {
+    long first = c * fp->batch, sent = 0L;
+    int i, count, res;
+
+    count = (int)((fp->n - first < fp->batch) ? fp->n - first : fp->batch);
+    for (i = 0; i < count; i++)
+        p->msgs[i].msg_hdr.msg_name = (void *)&fp->addrs[first + i];
+    i = 0;
+    while (i < count) {
+        res = sendmmsg(p->fd, &p->msgs[i], count - i, 0);
+        if (res <= 0) {
+            i++;
+        } else {
+            sent += res;
+            i += res;
+        }
+    }
+    return sent;
+}
+
+/*
+ * local function to take part in sending the current message as participant `me';
+ * works through its own range, then steals from the others until none has a chunk
+ */
+static void take_part(FanPool *fp, int me) {
+    Participant *p = &fp->parts[me];
+    int nparts = fp->nthreads + 1, v, i;
+    long c, sent = 0L, stolen = 0L;
+
+    p->iov.iov_base = (void *)fp->payload;
+    p->iov.iov_len = fp->len;
+    for (i = 0; i < nparts; i++) {
+        v = (me + i) % nparts;
+        while ((c = __atomic_fetch_add(&fp->ranges[v].next, 1L, __ATOMIC_RELAXED)) <
+                fp->ranges[v].end) {
+            sent += send_chunk(fp, p, c);
+            if (v != me)
+                stolen++;
+        }
+    }
+    __atomic_fetch_add(&fp->sent, sent, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&fp->steals, stolen, __ATOMIC_RELAXED);
+}
+
+/*
+ * local function run by the helpers
+ */
+static void *helper_main(void *arg) {
+    Participant *p = (Participant *)arg;
+    FanPool *fp = p->fp;
+    long seen = 0L;
+
+    pthread_mutex_lock(&fp->lock);
+    for (;;) {
+        while (!fp->stopping && fp->generation == seen)
+            pthread_cond_wait(&fp->start, &fp->lock);
+        if (fp->stopping)
+            break;
+        seen = fp->generation;
+        pthread_mutex_unlock(&fp->lock);
+        take_part(fp, (int)(p - fp->parts));
+        pthread_mutex_lock(&fp->lock);
+        if (--fp->busy == 0)
+            pthread_cond_signal(&fp->done);
+    }
+    pthread_mutex_unlock(&fp->lock);
+    return NULL;
+}
+
+/*
+ * local function to stop the first `n' helpers and wait for them to exit
+ */
+static void stop_helpers(FanPool *fp, int n) {
+    int i;
+
+    pthread_mutex_lock(&fp->lock);
+    fp->stopping = 1;
+    pthread_cond_broadcast(&fp->start);
+    pthread_mutex_unlock(&fp->lock);
+    for (i = 1; i <= n; i++)
+        pthread_join(fp->parts[i].thread, NULL);
+    pthread_cond_destroy(&fp->done);
+    pthread_cond_destroy(&fp->start);
+    pthread_mutex_destroy(&fp->lock);
+}
+
+/*
+ * local function to return the storage of the participants' headers and
+ * descriptors to the heap; the first `nfds' descriptors were duplicated
+ */
+static void free_parts(FanPool *fp, int nfds) {
+    int i;
+
+    for (i = 0; i <= fp->nthreads; i++) {
+        if (i > 0 && i <= nfds)
+            close(fp->parts[i].fd);
+        free(fp->parts[i].msgs);
+    }
+    free(fp->parts);
+    free(fp->ranges);
+}
+
+FanPool *fp_create(int fd, int nthreads, int batch) {
+    FanPool *fp;
+    Participant *p;
+    sigset_t all, old;
+    int i, j, nfds = 0, started = 0;
+
+    if (nthreads <= 0 || batch <= 0)
+        return NULL;
+    if ((fp = (FanPool *)calloc(1, sizeof(FanPool))) == NULL)
+        return NULL;
+    fp->nthreads = nthreads;
+    fp->batch = batch;
+    fp->parts = (Participant *)calloc(nthreads + 1, sizeof(Participant));
+    fp->ranges = (Range *)aligned_alloc(CACHE_LINE, (nthreads + 1) * sizeof(Range));
+    if (fp->parts == NULL || fp->ranges == NULL)
+        goto error;
+    for (i = 0; i <= nthreads; i++) {
+        p = &fp->parts[i];
+        p->fp = fp;
+        if ((p->msgs = (struct mmsghdr *)calloc(batch, sizeof(struct mmsghdr))) == NULL)
+            goto error;
+        for (j = 0; j < batch; j++) {
+            p->msgs[j].msg_hdr.msg_iov = &p->iov;
+            p->msgs[j].msg_hdr.msg_iovlen = 1;
+            p->msgs[j].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        }
+        if (i == 0) {
+            p->fd = fd;
+        } else {
+            if ((p->fd = dup(fd)) < 0)
+                goto error;
+            nfds++;
+        }
+    }
+    pthread_mutex_init(&fp->lock, NULL);
+    pthread_cond_init(&fp->start, NULL);
+    pthread_cond_init(&fp->done, NULL);
+
+    /* the helpers never handle signals; they are left to the server's threads */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    for (started = 0; started < nthreads; started++)
+        if (pthread_create(&fp->parts[started + 1].thread, NULL, helper_main,
+                &fp->parts[started + 1]) != 0)
+            break;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (started < nthreads) {
+        stop_helpers(fp, started);
+        goto error;
+    }
+    return fp;
+
+error:
+    if (fp->parts != NULL)
+        free_parts(fp, nfds);
+    else
+        free(fp->ranges);
+    free(fp);
+    return NULL;
+}
+
+void fp_destroy(FanPool *fp) {
+    stop_helpers(fp, fp->nthreads);
+    free_parts(fp, fp->nthreads);
+    free(fp);
+}
+
+long fp_send(FanPool *fp, const void *payload, size_t len,
+        const struct sockaddr_in *addrs, long n) {
+    int nparts = fp->nthreads + 1, i;
+    long chunks = (n + fp->batch - 1) / fp->batch;
+
+    /* split the chunks evenly; the helpers read the message once woken */
+    pthread_mutex_lock(&fp->lock);
+    fp->payload = payload;
+    fp->len = len;
+    fp->addrs = addrs;
+    fp->n = n;
+    fp->sent = 0L;
+    for (i = 0; i < nparts; i++) {
+        fp->ranges[i].next = chunks * i / nparts;
+        fp->ranges[i].end = chunks * (i + 1) / nparts;
+    }
+    fp->busy = fp->nthreads;
+    fp->generation++;
+    fp->messages++;
+    pthread_cond_broadcast(&fp->start);
+    pthread_mutex_unlock(&fp->lock);
+
+    take_part(fp, 0);
+
+    /* the array and payload belong to the caller again once every helper is done */
+    pthread_mutex_lock(&fp->lock);
+    while (fp->busy > 0)
+        pthread_cond_wait(&fp->done, &fp->lock);
+    pthread_mutex_unlock(&fp->lock);
+    return __atomic_load_n(&fp->sent, __ATOMIC_RELAXED);
+}
+
+long fp_messages(FanPool *fp) {
+    return __atomic_load_n(&fp->messages, __ATOMIC_RELAXED);
+}
+
+long fp_steals(FanPool *fp) {
+    return __atomic_load_n(&fp->steals, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,58 @@
+/*
+ * fanpool.h
+ *
+ * Interface for a fan-out pool: helper threads that share the sending of one payload
+ * to a large array of destinations with the calling thread, so a single message can
+ * keep several cores busy. The array is cut into chunks of one sendmmsg(2) call
+ * each; every participant starts on a range of chunks of its own, and when done
+ * steals chunks from the ranges of the others, so a participant that is held up
+ * does not hold up the whole message.
+ *
+ * Each helper sends on its own descriptor for the caller's socket, so the
+ * datagrams still come from the caller's address.
+ */
+
+#ifndef _FANPOOL_H_
+#define _FANPOOL_H_
+
+#include <stddef.h>
+#include <netinet/in.h>
+
+typedef struct fanpool FanPool;     /* opaque type definition */
+
+/*
+ * create a pool of `nthreads' helpers that send on socket `fd' in chunks of up to
+ * `batch' destinations; its threads are started
+ *
+ * returns a pointer to the pool, or NULL if there are malloc(), dup() or
+ * pthread_create() errors
+ */
+FanPool *fp_create(int fd, int nthreads, int batch);
+
+/*
+ * stops the helpers and returns the storage of the pool to the heap; the socket
+ * is not closed
+ */
+void fp_destroy(FanPool *fp);
+
+/*
+ * sends the `len' bytes of `payload' to the `n' addresses of the array `addrs',
+ * together with the helpers; returns once every destination has been sent to, so
+ * that neither needs to outlive the call; only one thread may call it
+ *
+ * returns the number of destinations the payload was sent to
+ */
+long fp_send(FanPool *fp, const void *payload, size_t len,
+        const struct sockaddr_in *addrs, long n);
+
+/*
+ * returns the number of messages sent through the pool so far
+ */
+long fp_messages(FanPool *fp);
+
+/*
+ * returns the number of chunks a participant took from another's range so far
+ */
+long fp_steals(FanPool *fp);
+
+#endif /* _FANPOOL_H_ */
@@ -1,163 +1,481 @@
 /*
- * Copyright (c) 2013, Court of the University of Glasgow
- * All rights reserved.
-
- * Redistribution and use in source and binary forms, with or without
- * modification, are permitted provided that the following conditions are met:
-
- * - Redistributions of source code must retain the above copyright notice,
- *   this list of conditions and the following disclaimer.
+ * hashmap.c
+ *
+ * Open addressing implementation of the hashmap interface; see hashmap.h. The
+ * slots are divided into groups of 16, and every slot has a control byte that
+ * is either EMPTY, DELETED, or the low 7 bits of the hash of the key it holds
+ * with the top bit set.
+ * A lookup compares the control bytes of a whole group with the hash bits at
+ * once (with SSE2, where available), and only compares the keys of the slots
+ * that match; it stops at the first group that has an EMPTY slot. Keys that fit
+ * in INLINE_KEY bytes, which includes every username and channel name, are
+ * stored in the slot itself; longer ones are copied to the heap.
  *
- * - Redistributions in binary form must reproduce the above copyright notice,
- *   this list of conditions and the following disclaimer in the documentation
- *   and/or other materials provided with the distribution.
+ * A resize does not rehash every entry at once. A new table is allocated, and
+ * each hm_put() and hm_remove() moves the next MIGRATE_STEP slots of the old
+ * table over to it, while lookups consult both; once the old table is empty, it
+ * is freed. The table doubles when it fills up, and halves when removals leave
+ * it less than a quarter full, so memory follows the number of entries. Large
+ * arrays are mapped from the kernel rather than taken from the heap; as EMPTY
+ * is zero, a new table needs no initialising, and the slots of the old one are
+ * unmapped a few pages at a time as they are moved out of, so no single update
+ * pays for setting up or returning a whole table's memory.
  *
- * - Neither the name of the University of Glasgow nor the names of its
- *   contributors may be used to endorse or promote products derived from this
- *   software without specific prior written permission.
+ * The keys are hashed with a seed that differs for every map and every run of
+ * the program, so names crafted to collide cannot pile up in one probe chain.
  *
- * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
- * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
- * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
- * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
- * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
- * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
- * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
- * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
- * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
- * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
- * POSSIBILITY OF SUCH DAMAGE.
+ * The previous separately chained implementation is kept in hashmap_chained.c;
+ * 'make bench' compares the two.
  */
 
 #include "hashmap.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define DEFAULT_CAPACITY 16
 #define MAX_CAPACITY 134217728L
 #define DEFAULT_LOAD_FACTOR 0.75
-#define TRIGGER 100	/* number of changes that will trigger a load check */
+#define MAX_LOAD_FACTOR 0.875
+#define GROUP 16                    /* slots probed at once */
+#define MIGRATE_STEP 64             /* slots moved per update while resizing */
+#define MAP_BYTES 65536L            /* arrays this large are mapped */
+#define UNMAP_STEP 65536L           /* bytes of moved slots unmapped at once */
+#define INLINE_KEY 32               /* USERNAME_MAX and CHANNEL_MAX */
+#define EMPTY ((signed char)0)
+#define DELETED ((signed char)1)
+#define TAG(h) ((signed char)(((h) & 0x7F) | 0x80))
+#define FULL(c) ((c) < 0)
+
+struct hmentry {
+    void *element;
+    char *heap;                     /* the key if it does not fit inline, else NULL */
+    char key[INLINE_KEY];
+};
+
+/* an array of slots; a map has two while it is being resized */
+typedef struct {
+    long mask;                      /* number of slots - 1 */
+    long used;                      /* slots that are not EMPTY */
+    long limit;                     /* resize once `used' reaches this */
+    signed char *ctrl;              /* control byte of every slot */
+    HMEntry *slots;
+    long unmapped;                  /* bytes at the start of `slots' already unmapped */
+} Table;
 
 struct hashmap {
     long size;
-    long capacity;
-    long changes;
-    double load;
+    long minimum;                   /* never shrink below this many slots */
+    long moved;                     /* slots of `old' migrated so far */
     double loadFactor;
-    double increment;
-    HMEntry **buckets;
+    uint64_t seed;
+    Table cur;                      /* where new entries are added */
+    Table old;                      /* being migrated from, ctrl == NULL if none */
 };
 
-struct hmentry {
-    struct hmentry *next;
-    char *key;
-    void *element;
-};
+/*
+ * hashing; a multiply-mix hash in the style of wyhash, reading the key 8 or 16
+ * bytes at a time
+ */
+#define P0 0xa0761d6478bd642fULL
+#define P1 0xe7037ed1a0b428dbULL
+#define P2 0x8ebc6af09c88c6e3ULL
+
+static uint64_t secret = 0;         /* random per run, set on first use */
+
+static uint64_t mum(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+
+    return ((uint64_t)r ^ (uint64_t)(r >> 64));
+}
+
+static uint64_t read8(const unsigned char *p) {
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t read4(const unsigned char *p) {
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/*
+ * generate hash value from key of length `len'
+ */
+static uint64_t hash(HashMap *hm, const char *key, size_t len) {
+    const unsigned char *p = (const unsigned char *)key;
+    uint64_t a, b, seed = hm->seed;
+    size_t n = len;
+
+    for (; n > 16; n -= 16, p += 16)
+        seed = mum(read8(p) ^ P1, read8(p + 8) ^ seed);
+    if (n > 8) {
+        a = read8(p);
+        b = read8(p + n - 8);
+    } else if (n >= 4) {
+        a = read4(p);
+        b = read4(p + n - 4);
+    } else if (n > 0) {
+        a = ((uint64_t)p[0] << 16) | ((uint64_t)p[n >> 1] << 8) | (uint64_t)p[n - 1];
+        b = 0;
+    } else {
+        a = b = 0;
+    }
+    return mum(P2 ^ (uint64_t)len, mum(a ^ P1, b ^ seed));
+}
 
 /*
- * generate hash value from key; value returned in range of 0..N-1
+ * local function to obtain the per-run secret, drawing it on first use; every
+ * map's seed is derived from it
  */
-#define SHIFT 7L			/* should be prime */
-static long hash(char *key, long N) {
-    long ans = 0L;
-    char *sp;
+static uint64_t get_secret(void) {
+    uint64_t s = __atomic_load_n(&secret, __ATOMIC_RELAXED), none = 0;
+
+    if (s != 0)
+        return s;
+    if (getrandom(&s, sizeof(s), GRND_NONBLOCK) != (ssize_t)sizeof(s))
+        s = mum((uint64_t)time(NULL) ^ P0, ((uint64_t)getpid() << 32) ^ (uintptr_t)&s);
+    s |= 1;
+    /* threads racing here all end up with the value that was stored first */
+    if (!__atomic_compare_exchange_n(&secret, &none, s, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        s = none;
+    return s;
+}
 
-    for (sp = key; *sp != '\0'; sp++)
-        ans = ((SHIFT * ans) + *sp) % N;
-    return ans;
+/*
+ * group matching; returns a bit mask with bit i set if control byte i of the
+ * group starting at `ctrl' has the wanted property
+ */
+#ifdef __SSE2__
+static unsigned match_byte(const signed char *ctrl, signed char b) {
+    __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(b)));
+}
+
+/* EMPTY and DELETED are the only control bytes with the top bit clear */
+static unsigned match_free(const signed char *ctrl) {
+    return (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl)) ^ 0xFFFFU;
+}
+#else
+static unsigned match_byte(const signed char *ctrl, signed char b) {
+    unsigned m = 0;
+    int i;
+
+    for (i = 0; i < GROUP; i++)
+        if (ctrl[i] == b)
+            m |= (1U << i);
+    return m;
+}
+
+static unsigned match_free(const signed char *ctrl) {
+    unsigned m = 0;
+    int i;
+
+    for (i = 0; i < GROUP; i++)
+        if (!FULL(ctrl[i]))
+            m |= (1U << i);
+    return m;
+}
+#endif /* __SSE2__ */
+
+/*
+ * local function to obtain a block of `bytes' zeroed bytes; a large one is
+ * mapped, so that its pages cost nothing until they are first used
+ */
+static void *get_block(long bytes) {
+    void *p;
+
+    if (bytes < MAP_BYTES)
+        return calloc(1, bytes);
+    p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return ((p == MAP_FAILED) ? NULL : p);
+}
+
+/*
+ * local function to return a block of `bytes' bytes obtained from get_block(),
+ * of which the first `gone' have already been unmapped
+ */
+static void put_block(void *p, long bytes, long gone) {
+
+    if (bytes < MAP_BYTES)
+        free(p);
+    else if (gone < bytes)
+        munmap((char *)p + gone, bytes - gone);
+}
+
+/*
+ * local function to allocate the arrays of table `t' for `N' slots, all EMPTY
+ */
+static int allocate(HashMap *hm, Table *t, long N) {
+
+    if ((t->ctrl = (signed char *)get_block(N)) == NULL)
+        return 0;
+    if ((t->slots = (HMEntry *)get_block(N * (long)sizeof(HMEntry))) == NULL) {
+        put_block(t->ctrl, N, 0L);
+        t->ctrl = NULL;
+        return 0;
+    }
+    t->mask = N - 1;
+    t->used = 0L;
+    t->unmapped = 0L;
+    t->limit = (long)(N * hm->loadFactor);
+    if (t->limit >= N)
+        t->limit = N - 1;
+    return 1;
+}
+
+/*
+ * local function to return the arrays of table `t' to the heap, or the kernel
+ */
+static void release(Table *t) {
+    long N = t->mask + 1;
+
+    if (t->ctrl == NULL)
+        return;
+    put_block(t->ctrl, N, 0L);
+    put_block(t->slots, N * (long)sizeof(HMEntry), t->unmapped);
+    t->ctrl = NULL;
+    t->slots = NULL;
 }
 
 HashMap *hm_create(long capacity, double loadFactor) {
     HashMap *hm;
-    long N;
+    long N = DEFAULT_CAPACITY;
     double lf;
-    HMEntry **array;
-    long i;
 
-    hm = (HashMap *)malloc(sizeof(HashMap));
-    if (hm != NULL) {
-        N = ((capacity > 0) ? capacity : DEFAULT_CAPACITY);
-        if (N > MAX_CAPACITY)
-            N = MAX_CAPACITY;
-        lf = ((loadFactor > 0.000001) ? loadFactor : DEFAULT_LOAD_FACTOR);
-        array = (HMEntry **)malloc(N * sizeof(HMEntry *));
-        if (array != NULL) {
-            hm->capacity = N;
-            hm->loadFactor = lf;
-            hm->size = 0L;
-            hm->load = 0.0;
-            hm->changes = 0L;
-            hm->increment = 1.0 / (double)N;
-            hm->buckets = array;
-            for (i = 0; i < N; i++)
-                array[i] = NULL;
-        } else {
-            free(hm);
-            hm = NULL;
-        }
+    if (capacity > MAX_CAPACITY)
+        capacity = MAX_CAPACITY;
+    lf = ((loadFactor > 0.000001) ? loadFactor : DEFAULT_LOAD_FACTOR);
+    if (lf > MAX_LOAD_FACTOR)
+        lf = MAX_LOAD_FACTOR;
+    /* enough slots to hold `capacity' entries without resizing */
+    while (N < MAX_CAPACITY && N * lf < capacity)
+        N <<= 1;
+    if ((hm = (HashMap *)malloc(sizeof(HashMap))) == NULL)
+        return NULL;
+    hm->size = 0L;
+    hm->minimum = N;
+    hm->moved = 0L;
+    hm->loadFactor = lf;
+    hm->seed = mum(get_secret() ^ (uintptr_t)hm, P0);
+    hm->old.mask = 0L;
+    hm->old.ctrl = NULL;
+    hm->old.slots = NULL;
+    if (!allocate(hm, &hm->cur, N)) {
+        free(hm);
+        return NULL;
     }
     return hm;
 }
 
 /*
- * traverses the hashmap, calling userFunction on each element
- * then frees storage associated with the key and the HMEntry structure
+ * traverses table `t', calling userFunction on each element
+ * then frees storage associated with the key
  */
-static void purge(HashMap *hm, void (*userFunction)(void *element)) {
-
+static void purge(Table *t, void (*userFunction)(void *element)) {
     long i;
 
-    for (i = 0L; i < hm->capacity; i++) {
-        HMEntry *p, *q;
-        p = hm->buckets[i];
-        while (p != NULL) {
-            if (userFunction != NULL)
-                (*userFunction)(p->element);
-            q = p->next;
-            free(p->key);
-            free(p);
-            p = q;
-        }
-        hm->buckets[i] = NULL;
+    if (t->ctrl == NULL)
+        return;
+    for (i = 0L; i <= t->mask; i++) {
+        if (!FULL(t->ctrl[i]))
+            continue;
+        if (userFunction != NULL)
+            (*userFunction)(t->slots[i].element);
+        free(t->slots[i].heap);
     }
 }
 
 void hm_destroy(HashMap *hm, void (*userFunction)(void *element)) {
-    purge(hm, userFunction);
-    free(hm->buckets);
+    purge(&hm->cur, userFunction);
+    purge(&hm->old, userFunction);
+    release(&hm->cur);
+    release(&hm->old);
     free(hm);
 }
 
 void hm_clear(HashMap *hm, void (*userFunction)(void *element)) {
-    purge(hm, userFunction);
-    hm->size = 0;
-    hm->load = 0.0;
-    hm->changes = 0;
+    purge(&hm->cur, userFunction);
+    purge(&hm->old, userFunction);
+    release(&hm->old);
+    memset(hm->cur.ctrl, EMPTY, hm->cur.mask + 1);
+    hm->cur.used = 0L;
+    hm->size = 0L;
+}
+
+/*
+ * local function to compare the key in a slot with `key' of length `len'
+ */
+static int same_key(HMEntry *p, const char *key, size_t len) {
+    if (len < INLINE_KEY)
+        return (p->heap == NULL && memcmp(p->key, key, len + 1) == 0);
+    return (p->heap != NULL && strcmp(p->heap, key) == 0);
+}
+
+/*
+ * local function to locate key in table `t', given its length and hash
+ *
+ * returns the index of its slot, or -1 if not found
+ */
+static long findSlot(Table *t, const char *key, size_t len, uint64_t h) {
+    long ngroups = (t->mask + 1) / GROUP;
+    long g = (long)(h >> 7) & (ngroups - 1), i, k;
+    signed char tag = TAG(h);
+    const signed char *ctrl;
+    unsigned m;
+
+    /* triangular steps over a power of two groups visit every group once */
+    for (k = 1L; k <= ngroups; k++) {
+        ctrl = t->ctrl + g * GROUP;
+        for (m = match_byte(ctrl, tag); m != 0; m &= m - 1) {
+            i = g * GROUP + __builtin_ctz(m);
+            if (same_key(&t->slots[i], key, len))
+                return i;
+        }
+        if (match_byte(ctrl, EMPTY) != 0)
+            return -1L;
+        g = (g + k) & (ngroups - 1);
+    }
+    return -1L;
 }
 
 /*
- * local function to locate key in a hashmap
+ * local function to locate key in a hashmap; entries not yet migrated are
+ * still in the old table
  *
  * returns pointer to entry, if found, as function value; NULL if not found
- * returns bucket index in `bucket'
+ * returns the table holding it in `*table' and its index in `*index'
  */
-static HMEntry *findKey(HashMap *hm, char *key, long *bucket) {
-    long i = hash(key, hm->capacity);
+static HMEntry *findKey(HashMap *hm, const char *key, Table **table, long *index) {
+    size_t len = strlen(key);
+    uint64_t h = hash(hm, key, len);
+    long i;
+
+    if ((i = findSlot(&hm->cur, key, len, h)) >= 0L) {
+        *table = &hm->cur;
+    } else if (hm->old.ctrl != NULL && (i = findSlot(&hm->old, key, len, h)) >= 0L) {
+        *table = &hm->old;
+    } else {
+        return NULL;
+    }
+    *index = i;
+    return &(*table)->slots[i];
+}
+
+/*
+ * local function to find the first EMPTY or DELETED slot on the probe sequence
+ * of hash `h' in table `t'; there always is one, as `used' stays below the
+ * number of slots
+ */
+static long freeSlot(Table *t, uint64_t h) {
+    long ngroups = (t->mask + 1) / GROUP;
+    long g = (long)(h >> 7) & (ngroups - 1), k;
+    unsigned m;
+
+    for (k = 1L; ; k++) {
+        if ((m = match_free(t->ctrl + g * GROUP)) != 0)
+            return g * GROUP + __builtin_ctz(m);
+        g = (g + k) & (ngroups - 1);
+    }
+}
+
+/*
+ * local function to store entry `p', whose key has hash `h', in table `t'
+ */
+static void place(Table *t, HMEntry *p, uint64_t h) {
+    long i = freeSlot(t, h);
+
+    if (t->ctrl[i] == EMPTY)
+        t->used++;
+    t->ctrl[i] = TAG(h);
+    t->slots[i] = *p;
+}
+
+/*
+ * local function to vacate slot `i' of table `t'; a group that still has an
+ * EMPTY slot has never been probed past, so the slot can be made EMPTY again,
+ * otherwise lookups must continue past it
+ */
+static void vacate(Table *t, long i) {
+    if (match_byte(t->ctrl + (i & ~(long)(GROUP - 1)), EMPTY) != 0) {
+        t->ctrl[i] = EMPTY;
+        t->used--;
+    } else {
+        t->ctrl[i] = DELETED;
+    }
+}
+
+/*
+ * local function to move up to `count' slots of the old table into the current
+ * one; the old table is freed once all of its slots have been moved, and if its
+ * slots are mapped, the pages of those moved are unmapped along the way; their
+ * control bytes are DELETED, so no lookup reads them again
+ */
+static void migrate(HashMap *hm, long count) {
+    Table *old = &hm->old;
+    long end = hm->moved + count, done;
     HMEntry *p;
+    char *key;
 
-    *bucket = i;
-    for (p = hm->buckets[i]; p != NULL; p = p->next) {
-        if (strcmp(p->key, key) == 0) {
-            break;
+    if (old->ctrl == NULL)
+        return;
+    if (end > old->mask + 1)
+        end = old->mask + 1;
+    for (; hm->moved < end; hm->moved++) {
+        if (!FULL(old->ctrl[hm->moved]))
+            continue;
+        p = &old->slots[hm->moved];
+        key = hmentry_key(p);
+        place(&hm->cur, p, hash(hm, key, strlen(key)));
+        /* DELETED rather than EMPTY, so lookups still probe past it */
+        old->ctrl[hm->moved] = DELETED;
+    }
+    if (hm->moved > old->mask) {
+        release(old);
+    } else if ((old->mask + 1) * (long)sizeof(HMEntry) >= MAP_BYTES) {
+        done = (hm->moved * (long)sizeof(HMEntry)) & ~(UNMAP_STEP - 1);
+        if (done > old->unmapped) {
+            munmap((char *)old->slots + old->unmapped, done - old->unmapped);
+            old->unmapped = done;
         }
     }
-    return p;
+}
+
+/*
+ * routine that starts resizing the hashmap to `N' slots; the entries are moved
+ * over by later calls to migrate(), while lookups consult both tables
+ *
+ * returns 1 if successful, 0 if not (malloc failure)
+ */
+static int resize(HashMap *hm, long N) {
+    Table t;
+
+    migrate(hm, hm->old.mask + 1);      /* a previous resize must be complete */
+    if (!allocate(hm, &t, N))
+        return 0;
+    hm->old = hm->cur;
+    hm->cur = t;
+    hm->moved = 0L;
+    return 1;
 }
 
 int hm_containsKey(HashMap *hm, char *key) {
-    long bucket;
+    Table *t;
+    long i;
 
-    return (findKey(hm, key, &bucket) != NULL);
+    return (findKey(hm, key, &t, &i) != NULL);
 }
 
 /*
@@ -167,19 +485,18 @@ int hm_containsKey(HashMap *hm, char *key) {
  */
 static HMEntry **entries(HashMap *hm) {
     HMEntry **tmp = NULL;
+    Table *tables[2] = { &hm->cur, &hm->old }, *t;
+    long i, n = 0L;
+    int j;
+
     if (hm->size > 0L) {
-        size_t nbytes = hm->size * sizeof(HMEntry *);
-        tmp = (HMEntry **)malloc(nbytes);
-        if (tmp != NULL) {
-            long i, n = 0L;
-            for (i = 0L; i < hm->capacity; i++) {
-                HMEntry *p;
-                p = hm->buckets[i];
-                while (p != NULL) {
-                    tmp[n++] = p;
-                    p = p->next;
-                }
-            }
+        tmp = (HMEntry **)malloc(hm->size * sizeof(HMEntry *));
+        for (j = 0; tmp != NULL && j < 2; j++) {
+            if ((t = tables[j])->ctrl == NULL)
+                continue;
+            for (i = 0L; i <= t->mask; i++)
+                if (FULL(t->ctrl[i]))
+                    tmp[n++] = &t->slots[i];
         }
     }
     return tmp;
@@ -194,16 +511,14 @@ HMEntry **hm_entryArray(HashMap *hm, long *len) {
 }
 
 int hm_get(HashMap *hm, char *key, void **element) {
-    long i;
     HMEntry *p;
-    int ans = 0;
+    Table *t;
+    long i;
 
-    p = findKey(hm, key, &i);
-    if (p != NULL) {
-        ans = 1;
-        *element = p->element;
-    }
-    return ans;
+    if ((p = findKey(hm, key, &t, &i)) == NULL)
+        return 0;
+    *element = p->element;
+    return 1;
 }
 
 int hm_isEmpty(HashMap *hm) {
@@ -211,27 +526,30 @@ int hm_isEmpty(HashMap *hm) {
 }
 
 /*
- * local function for generating an array of keys from a hashmap
+ * local function for generating an array of keys from a hashmap; the keys are
+ * copied into the same block as the array, after the pointers
  *
  * returns pointer to the array or NULL if malloc failure
  */
 static char **keys(HashMap *hm) {
-    char **tmp = NULL;
-    if (hm->size > 0L) {
-        size_t nbytes = hm->size * sizeof(char *);
-        tmp = (char **)malloc(nbytes);
-        if (tmp != NULL) {
-            long i, n = 0L;
-            for (i = 0L; i < hm->capacity; i++) {
-                HMEntry *p;
-                p = hm->buckets[i];
-                while (p != NULL) {
-                    tmp[n++] = p->key;
-                    p = p->next;
-                }
-            }
+    HMEntry **array;
+    char **tmp = NULL, *sp;
+    size_t nbytes;
+    long i;
+
+    if ((array = entries(hm)) == NULL)
+        return NULL;
+    nbytes = hm->size * sizeof(char *);
+    for (i = 0L; i < hm->size; i++)
+        nbytes += strlen(hmentry_key(array[i])) + 1;
+    if ((tmp = (char **)malloc(nbytes)) != NULL) {
+        sp = (char *)(tmp + hm->size);
+        for (i = 0L; i < hm->size; i++) {
+            tmp[i] = strcpy(sp, hmentry_key(array[i]));
+            sp += strlen(sp) + 1;
         }
     }
+    free(array);
     return tmp;
 }
 
@@ -243,107 +561,59 @@ char **hm_keyArray(HashMap *hm, long *len) {
     return tmp;
 }
 
-/*
- * routine that resizes the hashmap
- */
-static void resize(HashMap *hm) {
-    int N;
-    HMEntry *p, *q, **array;
-    long i, j;
-
-    N = 2 * hm->capacity;
-    if (N > MAX_CAPACITY)
-        N = MAX_CAPACITY;
-    if (N == hm->capacity)
-        return;
-    array = (HMEntry **)malloc(N * sizeof(HMEntry *));
-    if (array == NULL)
-        return;
-    for (j = 0; j < N; j++)
-        array[j] = NULL;
-    /*
-     * now redistribute the entries into the new set of buckets
-     */
-    for (i = 0; i < hm->capacity; i++) {
-        for (p = hm->buckets[i]; p != NULL; p = q) {
-            q = p->next;
-            j = hash(p->key, N);
-            p->next = array[j];
-            array[j] = p;
-        }
-    }
-    free(hm->buckets);
-    hm->buckets = array;
-    hm->capacity = N;
-    hm->load /= 2.0;
-    hm->changes = 0;
-    hm->increment = 1.0 / (double)N;
-}
-
 int hm_put(HashMap *hm, char *key, void *element, void **previous) {
-    /*printf("entering put: %p %s %p %p\n",hm,key,element,previous);*/
-    long i;
-    HMEntry *p;
-    int ans = 0;
-
-    if (hm->changes > TRIGGER) {
-        hm->changes = 0;
-        if (hm->load > hm->loadFactor)
-            resize(hm);
-    }
-    p = findKey(hm, key, &i);
-    if (p != NULL && previous != NULL) {
-        *previous = p->element;
+    size_t len = strlen(key);
+    long N = hm->cur.mask + 1, i;
+    HMEntry entry, *p;
+    Table *t;
+
+    if ((p = findKey(hm, key, &t, &i)) != NULL) {
+        if (previous != NULL)
+            *previous = p->element;
         p->element = element;
-        ans = 1;
-    } else {
-        p = (HMEntry *)malloc(sizeof(HMEntry));
-        if (p != NULL) {
-            char *q = strdup(key);
-            if (q != NULL) {
-                p->key = q;
-                p->element = element;
-                p->next = hm->buckets[i];
-                hm->buckets[i] = p;
-                if(previous != NULL) {
-                    *previous = NULL;
-                }
-                hm->size++;
-                hm->load += hm->increment;
-                hm->changes++;
-                ans = 1;
-            } else {
-                free(p);
-            }
-        }
+        return 1;
     }
-    return ans;
+    migrate(hm, MIGRATE_STEP);
+    if (hm->cur.used >= hm->cur.limit) {
+        /* double if the entries are filling the table, else only drop the tombstones */
+        if (hm->size >= hm->cur.limit / 2 && N < MAX_CAPACITY)
+            N *= 2;
+        /* keep an EMPTY slot even if that fails, so every probe ends */
+        if (!resize(hm, N) && hm->cur.used >= hm->cur.mask)
+            return 0;
+        migrate(hm, MIGRATE_STEP);
+    }
+
+    entry.element = element;
+    entry.heap = NULL;
+    if (len < INLINE_KEY)
+        memcpy(entry.key, key, len + 1);
+    else if ((entry.heap = strdup(key)) == NULL)
+        return 0;
+    place(&hm->cur, &entry, hash(hm, key, len));
+    hm->size++;
+    if (previous != NULL)
+        *previous = NULL;
+    return 1;
 }
 
 int hm_remove(HashMap *hm, char *key, void **element) {
-    long i;
-    HMEntry *entry;
-    int ans = 0;
-
-    entry = findKey(hm, key, &i);
-    if (entry != NULL) {
-        HMEntry *p, *c;
-        *element = entry->element;
-        /* determine where the entry lives in the singly linked list */
-        for (p = NULL, c = hm->buckets[i]; c != entry; p = c, c = c->next)
-            ;
-        if (p == NULL)
-            hm->buckets[i] = entry->next;
-        else
-            p->next = entry->next;
-        hm->size--;
-        hm->load -= hm->increment;
-        hm->changes++;
-        free(entry->key);
-        free(entry);
-        ans = 1;
-    }
-    return ans;
+    long N = hm->cur.mask + 1, i;
+    HMEntry *p;
+    Table *t;
+
+    if ((p = findKey(hm, key, &t, &i)) == NULL)
+        return 0;
+    *element = p->element;
+    free(p->heap);
+    vacate(t, i);
+    hm->size--;
+
+    migrate(hm, MIGRATE_STEP);
+    /* halve the table once it is less than a quarter as full as it may be */
+    if (hm->old.ctrl == NULL && N > hm->minimum && hm->size < hm->cur.limit / 4)
+        (void)resize(hm, N / 2);
+    return 1;
 }
 
 long hm_size(HashMap *hm) {
@@ -351,9 +621,52 @@ long hm_size(HashMap *hm) {
 }
 
 char *hmentry_key(HMEntry *hme) {
-    return hme->key;
+    return ((hme->heap != NULL) ? hme->heap : hme->key);
 }
 
 void *hmentry_value(HMEntry *hme) {
     return hme->element;
 }
+
+void hm_iterInit(HashMap *hm, HMIter *it) {
+    it->hm = hm;
+    it->table = 0;
+    it->index = 0L;
+    it->current = -1L;
+}
+
+int hm_iterNext(HMIter *it, char **key, void **element) {
+    Table *t;
+
+    /* the current table first, then the old one while a resize is in progress */
+    for (; it->table < 2; it->table++, it->index = 0L) {
+        t = (it->table == 0) ? &it->hm->cur : &it->hm->old;
+        if (t->ctrl == NULL)
+            continue;
+        for (; it->index <= t->mask; it->index++) {
+            if (!FULL(t->ctrl[it->index]))
+                continue;
+            it->current = it->index++;
+            if (key != NULL)
+                *key = hmentry_key(&t->slots[it->current]);
+            if (element != NULL)
+                *element = t->slots[it->current].element;
+            return 1;
+        }
+    }
+    it->current = -1L;
+    return 0;
+}
+
+int hm_iterRemove(HMIter *it) {
+    Table *t = (it->table == 0) ? &it->hm->cur : &it->hm->old;
+
+    if (it->current < 0L)
+        return 0;
+    /* vacating a slot moves no other entry, so the cursor stays valid */
+    free(t->slots[it->current].heap);
+    vacate(t, it->current);
+    it->hm->size--;
+    it->current = -1L;
+    return 1;
+}
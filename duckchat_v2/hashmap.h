@@ -44,10 +44,14 @@ typedef struct hmentry HMEntry;
 /*
  * create a hashmap with the specified capacity and load factor;
  * if capacity == 0, a default initial capacity (16 elements) is used
- * if loadFactor == 0.0, a default load factor (0.75) is used
+ * if loadFactor == 0.0, a default load factor (0.75) is used; load factors
+ * above 0.875 are lowered to 0.875
  * if number of elements/number of buckets exceeds the load factor, the
  * table is resized, doubling the number of buckets, up to a max number
- * of buckets (134,217,728)
+ * of buckets (134,217,728); if it falls below a quarter of the load factor,
+ * the number of buckets is halved, but never below the initial number; the
+ * entries are moved to the resized table a few at a time, by later calls to
+ * hm_put() and hm_remove()
  *
  * returns a pointer to the hashmap, or NULL if there are malloc() errors
  */
@@ -82,6 +86,7 @@ int hm_containsKey(HashMap *hm, char *key);
  * returns pointer to HMEntry * array of elements, or NULL if malloc failure
  *
  * NB - the caller is responsible for freeing the HMEntry * array when finished
+ * NB - the entries are only valid until the next hm_put() or hm_remove()
  */
 HMEntry **hm_entryArray(HashMap *hm, long *len);
 
@@ -104,6 +109,8 @@ int hm_isEmpty(HashMap *hm);
  * returns pointer to char * array of keys, or NULL if malloc failure
  *
  * NB - the caller is responsible for freeing the char * array when finished
+ * NB - the keys are copies, stored in the same block as the array; they remain
+ *      valid until the array is freed, whatever is done to the hashmap
  */
 char **hm_keyArray(HashMap *hm, long *len);
 
@@ -137,4 +144,42 @@ long hm_size(HashMap *hm);
 char *hmentry_key(HMEntry *hme);
 void *hmentry_value(HMEntry *hme);
 
+/*
+ * a cursor over the entries of a hashmap, in an arbitrary order; it is
+ * declared by the caller, usually on the stack, so that an iteration needs
+ * no storage from the heap; its members are private to the implementation
+ */
+typedef struct hmiter {
+    HashMap *hm;
+    int table;                  /* table being traversed */
+    long index;                 /* slot to examine next */
+    long current;               /* slot last returned, -1 if none */
+} HMIter;
+
+/*
+ * positions the cursor `it' before the first entry of the hashmap
+ */
+void hm_iterInit(HashMap *hm, HMIter *it);
+
+/*
+ * advances the cursor, returning the key of the next entry in `*key' (if
+ * key != NULL) and its element in `*element' (if element != NULL); the key
+ * belongs to the hashmap
+ *
+ * returns 1 if successful, 0 if there are no more entries
+ */
+int hm_iterNext(HMIter *it, char **key, void **element);
+
+/*
+ * removes the entry last returned by hm_iterNext() from the hashmap; the
+ * iteration continues with the remaining entries; the hashmap is not resized
+ * by this removal
+ *
+ * NB - while iterating, the hashmap must not be modified other than through
+ *      hm_iterRemove()
+ *
+ * returns 1 if successful, 0 if not (no entry returned, or already removed)
+ */
+int hm_iterRemove(HMIter *it);
+
 #endif /* _HASHMAP_H_ */
@@ -0,0 +1,230 @@
+/*
+ * hm_bench.c
+ *
+ * Micro-benchmark of the HashMap ADT with the key patterns of the server: usernames,
+ * channel names and "ip:port" strings. It is linked once against hashmap.c and once
+ * against hashmap_chained.c; 'make bench' builds and runs both.
+ *
+ * Usage: ./hm_bench [entries]
+ *     entries: Optional; the number of keys in the large map (default 100000).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hashmap.h"
+
+#define KEY_SIZE 32
+#define SMALL_KEYS 16           /* channels of a typical server */
+#define ROUNDS 4
+
+static char (*names)[KEY_SIZE] = NULL;
+static char (*misses)[KEY_SIZE] = NULL;
+static long *order = NULL;
+static long sink = 0L;          /* keeps the lookups from being optimized away */
+
+/*
+ * Returns the current time in nanoseconds.
+ */
+static double now(void) {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double)ts.tv_sec * 1e9 + (double)ts.tv_nsec);
+}
+
+/*
+ * Prints the time per operation of a phase that started at `start'.
+ */
+static void report(const char *phase, double start, long ops) {
+
+    printf("  %-28s %8.1f ns/op\n", phase, (now() - start) / (double)ops);
+}
+
+/*
+ * Fills the key arrays; half of the keys look like usernames, half like client addresses.
+ */
+static void make_keys(long n) {
+
+    long i, j, t;
+
+    for (i = 0L; i < n; i++) {
+        if (i % 2 == 0)
+            sprintf(names[i], "user_%ld", i);
+        else
+            sprintf(names[i], "10.%ld.%ld.%ld:%ld", (i >> 16) & 255, (i >> 8) & 255, i & 255,
+                    4000 + (i % 1000));
+        sprintf(misses[i], "nobody_%ld", i);
+        order[i] = i;
+    }
+    /* Shuffle the lookup order so that the keys are not probed in insertion order */
+    srand(42);
+    for (i = n - 1; i > 0; i--) {
+        j = rand() % (i + 1);
+        t = order[i]; order[i] = order[j]; order[j] = t;
+    }
+}
+
+/*
+ * Times inserting, looking up, and churning `n' keys in a map created with the default size.
+ */
+static int bench_large(long n) {
+
+    HashMap *hm;
+    void *element;
+    double start;
+    long i, r;
+
+    if ((hm = hm_create(0L, 0.0)) == NULL)
+        return 0;
+    start = now();
+    for (i = 0L; i < n; i++)
+        if (!hm_put(hm, names[i], names[i], &element))
+            goto error;
+    report("put (growing)", start, n);
+
+    start = now();
+    for (r = 0L; r < ROUNDS; r++)
+        for (i = 0L; i < n; i++)
+            if (hm_get(hm, names[order[i]], &element))
+                sink += ((char *)element)[0];
+    report("get (hit)", start, ROUNDS * n);
+
+    start = now();
+    for (r = 0L; r < ROUNDS; r++)
+        for (i = 0L; i < n; i++)
+            sink += hm_containsKey(hm, misses[order[i]]);
+    report("get (miss)", start, ROUNDS * n);
+
+    /* Users logging out and back in */
+    start = now();
+    for (r = 0L; r < ROUNDS; r++)
+        for (i = 0L; i < n; i++) {
+            (void)hm_remove(hm, names[order[i]], &element);
+            if (!hm_put(hm, names[order[i]], element, &element))
+                goto error;
+        }
+    report("remove + put", start, ROUNDS * n);
+
+    hm_destroy(hm, NULL);
+    return 1;
+
+error:
+    hm_destroy(hm, NULL);
+    return 0;
+}
+
+/*
+ * Measures the slowest single hm_put() and hm_remove() while `n' keys are added to and then
+ * removed from a map created with the default size; a resize that rehashes every entry at
+ * once shows up here.
+ */
+static int bench_latency(long n) {
+
+    HashMap *hm;
+    void *element;
+    double start, t, worst = 0.0;
+    long i;
+
+    if ((hm = hm_create(0L, 0.0)) == NULL)
+        return 0;
+    for (i = 0L; i < n; i++) {
+        start = now();
+        if (!hm_put(hm, names[i], names[i], &element)) {
+            hm_destroy(hm, NULL);
+            return 0;
+        }
+        if ((t = now() - start) > worst)
+            worst = t;
+    }
+    printf("  %-28s %8.1f us\n", "put (slowest)", worst / 1000.0);
+
+    worst = 0.0;
+    for (i = 0L; i < n; i++) {
+        start = now();
+        (void)hm_remove(hm, names[order[i]], &element);
+        if ((t = now() - start) > worst)
+            worst = t;
+    }
+    printf("  %-28s %8.1f us\n", "remove (slowest)", worst / 1000.0);
+
+    hm_destroy(hm, NULL);
+    return 1;
+}
+
+/*
+ * Times lookups in a map as small as a server's channel map, as done for every packet.
+ */
+static int bench_small(long n) {
+
+    HashMap *hm;
+    void *element;
+    char channels[SMALL_KEYS][KEY_SIZE];
+    double start;
+    long i;
+
+    if ((hm = hm_create(100L, 0.0)) == NULL)
+        return 0;
+    for (i = 0L; i < SMALL_KEYS; i++) {
+        sprintf(channels[i], "channel-%ld", i);
+        if (!hm_put(hm, channels[i], channels[i], &element)) {
+            hm_destroy(hm, NULL);
+            return 0;
+        }
+    }
+    start = now();
+    for (i = 0L; i < ROUNDS * n; i++)
+        if (hm_get(hm, channels[i % SMALL_KEYS], &element))
+            sink += ((char *)element)[0];
+    report("get (16 channels)", start, ROUNDS * n);
+
+    /* A temporary set, as built to answer a LIST or WHO request */
+    start = now();
+    for (i = 0L; i < n / 100; i++) {
+        HashMap *set = hm_create(0L, 0.0);
+        long j;
+        if (set == NULL)
+            break;
+        for (j = 0L; j < SMALL_KEYS; j++)
+            (void)hm_put(set, channels[j], NULL, NULL);
+        sink += hm_size(set);
+        hm_destroy(set, NULL);
+    }
+    report("create + 16 puts + destroy", start, n / 100);
+
+    hm_destroy(hm, NULL);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+
+    long n = 100000L;
+
+    if (argc > 1 && (n = atol(argv[1])) < 100L) {
+        fprintf(stderr, "Usage: %s [entries >= 100]\n", argv[0]);
+        return 1;
+    }
+    names = malloc(n * sizeof(*names));
+    misses = malloc(n * sizeof(*misses));
+    order = malloc(n * sizeof(*order));
+    if (names == NULL || misses == NULL || order == NULL) {
+        fprintf(stderr, "Failed to allocate a sufficient amount of memory.\n");
+        return 1;
+    }
+    make_keys(n);
+
+    printf("%s, %ld keys:\n", argv[0], n);
+    if (!bench_large(n) || !bench_latency(n) || !bench_small(n)) {
+        fprintf(stderr, "Failed to allocate a sufficient amount of memory.\n");
+        return 1;
+    }
+    if (sink == 42L)
+        printf("\n");
+
+    free(names);
+    free(misses);
+    free(order);
+    return 0;
+}
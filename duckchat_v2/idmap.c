@@ -0,0 +1,100 @@
+/*
+ * idmap.c
+ *
+ * Implementation of the idmap; see idmap.h.
+ */
+
+#include "idmap.h"
+#include <stdlib.h>
+
+#define DEFAULT_CAPACITY 16L
+
+struct idmap {
+    long capacity;                  /* slots in the array */
+    long size;                      /* slots holding an element */
+    void **slots;
+};
+
+IdMap *im_create(long capacity) {
+    IdMap *im;
+    long i;
+
+    if (capacity <= 0L)
+        capacity = DEFAULT_CAPACITY;
+    if ((im = (IdMap *)malloc(sizeof(IdMap))) == NULL)
+        return NULL;
+    if ((im->slots = (void **)malloc(capacity * sizeof(void *))) == NULL) {
+        free(im);
+        return NULL;
+    }
+    for (i = 0L; i < capacity; i++)
+        im->slots[i] = NULL;
+    im->capacity = capacity;
+    im->size = 0L;
+    return im;
+}
+
+void im_destroy(IdMap *im, void (*freeFxn)(void *element)) {
+    long i;
+
+    if (freeFxn != NULL)
+        for (i = 0L; i < im->capacity; i++)
+            if (im->slots[i] != NULL)
+                (*freeFxn)(im->slots[i]);
+    free(im->slots);
+    free(im);
+}
+
+void *im_get(IdMap *im, int id) {
+    if (id < 0 || id >= im->capacity)
+        return NULL;
+    return im->slots[id];
+}
+
+int im_put(IdMap *im, int id, void *element) {
+    long i, N = im->capacity;
+    void **tmp;
+
+    if (id < 0)
+        return 0;
+    if (id >= N) {
+        while (id >= N)
+            N *= 2;
+        if ((tmp = (void **)realloc(im->slots, N * sizeof(void *))) == NULL)
+            return 0;
+        for (i = im->capacity; i < N; i++)
+            tmp[i] = NULL;
+        im->slots = tmp;
+        im->capacity = N;
+    }
+    if (im->slots[id] == NULL)
+        im->size++;
+    im->slots[id] = element;
+    return 1;
+}
+
+void *im_remove(IdMap *im, int id) {
+    void *element;
+
+    if ((element = im_get(im, id)) != NULL) {
+        im->slots[id] = NULL;
+        im->size--;
+    }
+    return element;
+}
+
+long im_size(IdMap *im) {
+    return im->size;
+}
+
+int im_next(IdMap *im, int from, void **element) {
+    long i;
+
+    for (i = (from < 0) ? 0L : from; i < im->capacity; i++) {
+        if (im->slots[i] != NULL) {
+            *element = im->slots[i];
+            return (int)i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,64 @@
+/*
+ * idmap.h
+ *
+ * Interface for a map from small integer IDs, such as the channel IDs handed
+ * out by the registry (see registry.h), to elements. The map is a plain array
+ * indexed by the ID, grown as larger IDs are put into it, so a lookup is a
+ * single bounds check and load. The IDs are meant to be dense; the map's
+ * storage follows the largest ID it has held.
+ */
+
+#ifndef _IDMAP_H_
+#define _IDMAP_H_
+
+typedef struct idmap IdMap;         /* opaque type definition */
+
+/*
+ * create an idmap with room for the IDs below `capacity' before it first grows
+ *
+ * returns a pointer to the idmap, or NULL if there are malloc() errors
+ */
+IdMap *im_create(long capacity);
+
+/*
+ * destroys the idmap; if freeFxn != NULL, it is invoked on each element still
+ * in the map; the storage associated with the idmap is returned to the heap
+ */
+void im_destroy(IdMap *im, void (*freeFxn)(void *element));
+
+/*
+ * returns the element mapped to `id', or NULL if there is none
+ */
+void *im_get(IdMap *im, int id);
+
+/*
+ * maps `element', which must not be NULL, to `id', replacing any element the
+ * ID was mapped to
+ *
+ * returns 1 if successful, 0 if not (malloc failure)
+ */
+int im_put(IdMap *im, int id, void *element);
+
+/*
+ * removes the mapping of `id'
+ *
+ * returns the element `id' was mapped to, or NULL if there was none
+ */
+void *im_remove(IdMap *im, int id);
+
+/*
+ * returns the number of IDs mapped to elements
+ */
+long im_size(IdMap *im);
+
+/*
+ * finds the smallest ID not less than `from' that is mapped to an element,
+ * returning the element in `*element'; the IDs in the map are visited in turn with
+ *
+ *      for (id = im_next(im, 0, &e); id >= 0; id = im_next(im, id + 1, &e))
+ *
+ * returns the ID, or -1 if there is none
+ */
+int im_next(IdMap *im, int from, void **element);
+
+#endif /* _IDMAP_H_ */
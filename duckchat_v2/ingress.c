@@ -0,0 +1,193 @@
+/*
+ * ingress.c
+ *
+ * Implementation of the decode stage; see ingress.h. A datagram that fits a
+ * receive slot is copied inline into the ring, a larger one as a heap copy that
+ * the consumer frees once done with it; either way, the bytes following it read
+ * as zeros, as they do in the packet ring. The thread waits on the packet ring's
+ * descriptor with a timeout, so that it notices when it is asked to stop.
+ */
+
+#define _GNU_SOURCE
+#include "ingress.h"
+#include "spscring.h"
+#include "properties.h"
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+#define GUARD 64            /* zeroed bytes kept after every packet */
+#define POLL_TIMEOUT 100    /* msec between checks for being stopped */
+
+typedef struct {
+    long len;
+    struct sockaddr_in from;
+    char *heap;                         /* copy of a packet too large to fit inline */
+    char data[RECV_SLOT_SIZE + GUARD];
+} Element;
+
+struct ingress {
+    PktRing *pr;
+    int (*accept)(const Packet *pkt);
+    int wake_fd;
+    int stopping;
+    long stalls;
+    long rejects;
+    SpscRing *ring;
+    Element staged;                     /* thread only */
+    Element current;                    /* consumer only, as is `pkt' */
+    Packet pkt;
+    pthread_t thread;
+};
+
+/*
+ * local function to copy `pkt' into `staged'
+ *
+ * returns 1 if successful, 0 if there are malloc() errors
+ */
+static int stage(Ingress *ig, Packet *pkt) {
+    Element *e = &ig->staged;
+
+    e->len = pkt->len;
+    e->from = pkt->from;
+    e->heap = NULL;
+    if (pkt->len <= RECV_SLOT_SIZE) {
+        memcpy(e->data, pkt->data, pkt->len);
+        memset(e->data + pkt->len, 0, sizeof(e->data) - pkt->len);
+    } else {
+        if ((e->heap = (char *)calloc(1, pkt->len + GUARD)) == NULL)
+            return 0;
+        memcpy(e->heap, pkt->data, pkt->len);
+    }
+    return 1;
+}
+
+/*
+ * local function to hand every packet received so far to the consumer
+ */
+static void pass_on(Ingress *ig) {
+    Packet *pkt;
+    uint64_t one = 1;
+
+    while (pr_next(ig->pr, &pkt)) {
+        if (!(*ig->accept)(pkt) || !stage(ig, pkt)) {
+            __atomic_fetch_add(&ig->rejects, 1L, __ATOMIC_RELAXED);
+            pr_release(ig->pr);
+            continue;
+        }
+        pr_release(ig->pr);
+        while (sr_isFull(ig->ring)) {
+            if (__atomic_load_n(&ig->stopping, __ATOMIC_ACQUIRE)) {
+                free(ig->staged.heap);
+                return;
+            }
+            __atomic_fetch_add(&ig->stalls, 1L, __ATOMIC_RELAXED);
+            sched_yield();
+        }
+        if (sr_push(ig->ring, &ig->staged) == 2)
+            (void)!write(ig->wake_fd, &one, sizeof(one));
+    }
+}
+
+/*
+ * local function run by the thread
+ */
+static void *ingress_main(void *arg) {
+    Ingress *ig = (Ingress *)arg;
+    struct pollfd pfd;
+
+    pfd.fd = pr_fd(ig->pr);
+    pfd.events = POLLIN;
+    while (!__atomic_load_n(&ig->stopping, __ATOMIC_ACQUIRE)) {
+        if (poll(&pfd, 1, POLL_TIMEOUT) <= 0)
+            continue;
+        while (pr_receive(ig->pr) > 0)
+            pass_on(ig);
+    }
+    return NULL;
+}
+
+Ingress *ig_create(PktRing *pr, long capacity, int (*accept)(const Packet *pkt)) {
+    Ingress *ig;
+    sigset_t all, old;
+    int res;
+
+    if ((ig = (Ingress *)calloc(1, sizeof(Ingress))) == NULL)
+        return NULL;
+    ig->pr = pr;
+    ig->accept = accept;
+    if ((ig->ring = sr_create(capacity, sizeof(Element))) == NULL)
+        goto error;
+    if ((ig->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        goto error;
+
+    /* the thread never handles signals; they are left to the server's threads */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    res = pthread_create(&ig->thread, NULL, ingress_main, ig);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (res != 0) {
+        close(ig->wake_fd);
+        goto error;
+    }
+    return ig;
+
+error:
+    if (ig->ring != NULL)
+        sr_destroy(ig->ring);
+    free(ig);
+    return NULL;
+}
+
+void ig_destroy(Ingress *ig) {
+    __atomic_store_n(&ig->stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(ig->thread, NULL);
+    free(ig->current.heap);
+    while (sr_pop(ig->ring, &ig->current))
+        free(ig->current.heap);
+    close(ig->wake_fd);
+    sr_destroy(ig->ring);
+    free(ig);
+}
+
+int ig_fd(Ingress *ig) {
+    return ig->wake_fd;
+}
+
+void ig_ack(Ingress *ig) {
+    uint64_t count;
+
+    (void)!read(ig->wake_fd, &count, sizeof(count));
+}
+
+int ig_next(Ingress *ig, Packet **pkt) {
+    Element *e = &ig->current;
+
+    free(e->heap);
+    e->heap = NULL;
+    if (!sr_pop(ig->ring, e))
+        return 0;
+    ig->pkt.data = (e->heap != NULL) ? e->heap : e->data;
+    ig->pkt.len = e->len;
+    ig->pkt.from = e->from;
+    *pkt = &ig->pkt;
+    return 1;
+}
+
+long ig_depth(Ingress *ig) {
+    return sr_size(ig->ring);
+}
+
+long ig_stalls(Ingress *ig) {
+    return __atomic_load_n(&ig->stalls, __ATOMIC_RELAXED);
+}
+
+long ig_rejects(Ingress *ig) {
+    return __atomic_load_n(&ig->rejects, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,77 @@
+/*
+ * ingress.h
+ *
+ * Interface for the server's decode stage. An ingress owns a thread that
+ * receives from a packet ring (see pktring.h), drops every datagram that fails
+ * a validation function, and copies the rest into a bounded lock-free SPSC ring
+ * (see spscring.h) for a single consumer thread, which is woken through a
+ * descriptor it can wait on in its event loop.
+ *
+ * The ring applies backpressure: a thread that finds it full waits for the
+ * consumer to catch up, leaving later datagrams queued in the socket, and
+ * counts the stall.
+ */
+
+#ifndef _INGRESS_H_
+#define _INGRESS_H_
+
+#include "pktring.h"
+
+typedef struct ingress Ingress;     /* opaque type definition */
+
+/*
+ * create an ingress that receives from `pr', with up to `capacity' packets
+ * waiting for the consumer; a packet for which `accept' returns 0 is dropped
+ * and counted; its thread is started
+ *
+ * the packet ring belongs to the thread from then on, and must not be used
+ * by any other thread until the ingress is destroyed
+ *
+ * returns a pointer to the ingress, or NULL if there are malloc(), eventfd()
+ * or pthread_create() errors
+ */
+Ingress *ig_create(PktRing *pr, long capacity, int (*accept)(const Packet *pkt));
+
+/*
+ * stops the thread and returns the storage of the ingress to the heap; packets
+ * still waiting are discarded, and neither the packet ring nor its socket is
+ * destroyed
+ */
+void ig_destroy(Ingress *ig);
+
+/*
+ * returns the descriptor that becomes readable when packets are waiting
+ */
+int ig_fd(Ingress *ig);
+
+/*
+ * consumer only: clears the readable state of the descriptor; to be called
+ * before the packets are taken, so that none arriving meanwhile goes unnoticed
+ */
+void ig_ack(Ingress *ig);
+
+/*
+ * consumer only: retrieves and removes the oldest waiting packet in `*pkt';
+ * the packet is valid until the next call
+ *
+ * returns 1 if successful, 0 if no packets are waiting
+ */
+int ig_next(Ingress *ig, Packet **pkt);
+
+/*
+ * returns the number of packets currently waiting for the consumer
+ */
+long ig_depth(Ingress *ig);
+
+/*
+ * returns the number of times the thread found the ring full and waited
+ */
+long ig_stalls(Ingress *ig);
+
+/*
+ * returns the number of packets dropped by the validation function, or because
+ * a packet too large to be copied inline could not be allocated
+ */
+long ig_rejects(Ingress *ig);
+
+#endif /* _INGRESS_H_ */
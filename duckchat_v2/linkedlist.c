@@ -34,10 +34,10 @@
  */
 
 #include "linkedlist.h"
+#include "slab.h"
 #include <stdlib.h>
 
 #define SENTINEL(p) (&(p)->sentinel)
-#define FL_INCREMENT 128	/* number of entries to add to free list */
 
 typedef struct llnode {
     struct llnode *next;
@@ -47,36 +47,22 @@ typedef struct llnode {
 
 struct linkedlist {
     long size;
-    LLNode *freel;
     LLNode sentinel;
 };
 
 /*
- * local routines for maintaining free list of LLNode's
+ * local routines for allocating LLNode's; the nodes of all lists come from
+ * the process-wide slabs, see slab.h
  */
 
-static void putEntry(LinkedList *ll, LLNode *p) {
-    p->element = NULL;
-    p->next = ll->freel;
-    ll->freel = p;
-}
+static SlabType node_type = SLAB_TYPE("llnode", LLNode);
 
-static LLNode *getEntry(LinkedList *ll) {
-    LLNode *p;
+static void putEntry(LLNode *p) {
+    sl_free(&node_type, p);
+}
 
-    if ((p = ll->freel) == NULL) {
-        long i;
-        for (i = 0; i < FL_INCREMENT; i++) {
-            p = (LLNode *)malloc(sizeof(LLNode));
-            if (p == NULL)
-                break;
-            putEntry(ll, p);
-        }
-        p = ll->freel;
-    }
-    if (p != NULL)
-        ll->freel = p->next;
-    return p;
+static LLNode *getEntry(void) {
+    return (LLNode *)sl_alloc(&node_type);
 }
 
 LinkedList *ll_create(void) {
@@ -85,7 +71,6 @@ LinkedList *ll_create(void) {
     ll = (LinkedList *)malloc(sizeof(LinkedList));
     if (ll != NULL) {
         ll->size = 0l;
-        ll->freel = NULL;
         ll->sentinel.next = SENTINEL(ll);
         ll->sentinel.prev = SENTINEL(ll);
     }
@@ -104,21 +89,13 @@ static void purge(LinkedList *ll, void (*userFunction)(void *element)) {
         if (userFunction != NULL)
             (*userFunction)(cur->element);
         next = cur->next;
-        putEntry(ll, cur);
+        putEntry(cur);
         cur = next;
     }
 }
 
 void ll_destroy(LinkedList *ll, void (*userFunction)(void *element)) {
-    LLNode *p;
     purge(ll, userFunction);
-    p = ll->freel;
-    while (p != NULL) {		/* return nodes on free list */
-        LLNode *q;
-        q = p->next;
-        free(p);
-        p = q;
-    }
     free(ll);
 }
 
@@ -142,7 +119,7 @@ int ll_insert(LinkedList *ll, long index, void *element) {
     int status = 0;
     LLNode *p;
 
-    if (index <= ll->size && (p = getEntry(ll)) != NULL) {
+    if (index <= ll->size && (p = getEntry()) != NULL) {
         long n;
         LLNode *b;
 
@@ -158,7 +135,7 @@ int ll_insert(LinkedList *ll, long index, void *element) {
 
 int ll_addFirst(LinkedList *ll, void *element) {
     int status = 0;
-    LLNode *p = getEntry(ll);
+    LLNode *p = getEntry();
 
     if (p != NULL) {
         p->element = element;
@@ -171,7 +148,7 @@ int ll_addFirst(LinkedList *ll, void *element) {
 
 int ll_addLast(LinkedList *ll, void *element) {
     int status = 0;
-    LLNode *p = getEntry(ll);
+    LLNode *p = getEntry();
 
     if (p != NULL) {
         p->element = element;
@@ -246,7 +223,7 @@ int ll_remove(LinkedList *ll, long index, void **element) {
             ;
         *element = p->element;
         unlink(p);
-        putEntry(ll, p);
+        putEntry(p);
         ll->size--;
     }
     return status;
@@ -260,7 +237,7 @@ int ll_removeFirst(LinkedList *ll, void **element) {
         status = 1;
         *element = p->element;
         unlink(p);
-        putEntry(ll, p);
+        putEntry(p);
         ll->size--;
     }
     return status;
@@ -274,7 +251,7 @@ int ll_removeLast(LinkedList *ll, void **element) {
         status = 1;
         *element = p->element;
         unlink(p);
-        putEntry(ll, p);
+        putEntry(p);
         ll->size--;
     }
     return status;
@@ -332,3 +309,32 @@ void **ll_toArray(LinkedList *ll, long *len) {
     return tmp;
 }
 
+void ll_iterInit(LinkedList *ll, LLIter *it) {
+    it->ll = ll;
+    it->current = NULL;
+    it->next = SENTINEL(ll)->next;
+}
+
+int ll_iterNext(LLIter *it, void **element) {
+    LLNode *p = it->next;
+
+    if (p == SENTINEL(it->ll))
+        return 0;
+    /* remember the successor now, so that `p' may be removed */
+    it->current = p;
+    it->next = p->next;
+    *element = p->element;
+    return 1;
+}
+
+int ll_iterRemove(LLIter *it) {
+    LLNode *p = it->current;
+
+    if (p == NULL)
+        return 0;
+    unlink(p);
+    putEntry(p);
+    it->ll->size--;
+    it->current = NULL;
+    return 1;
+}
@@ -162,4 +162,38 @@ int ll_isEmpty(LinkedList *ll);
  */
 void **ll_toArray(LinkedList *ll, long *len);
 
+/*
+ * a cursor over the elements of a linked list, from first to last; it is
+ * declared by the caller, usually on the stack, so that an iteration needs
+ * no storage from the heap; its members are private to the implementation
+ */
+typedef struct lliter {
+    LinkedList *ll;
+    struct llnode *current;     /* node last returned, NULL if none */
+    struct llnode *next;        /* node to return next */
+} LLIter;
+
+/*
+ * positions the cursor `it' before the first element of the list
+ */
+void ll_iterInit(LinkedList *ll, LLIter *it);
+
+/*
+ * advances the cursor, returning the next element in `*element'
+ *
+ * returns 1 if successful, 0 if there are no more elements
+ */
+int ll_iterNext(LLIter *it, void **element);
+
+/*
+ * removes the element last returned by ll_iterNext() from the list; the
+ * iteration continues with the element that followed it
+ *
+ * NB - while iterating, the list must not be modified other than through
+ *      ll_iterRemove()
+ *
+ * returns 1 if successful, 0 if not (no element returned, or already removed)
+ */
+int ll_iterRemove(LLIter *it);
+
 #endif /* _LINKEDLIST_H_ */
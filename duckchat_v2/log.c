@@ -0,0 +1,246 @@
+/*
+ * log.c
+ *
+ * Implementation of the asynchronous logger; see log.h. Every logging thread
+ * registers a ring on its first line; the flusher is the single consumer of all
+ * of them. It sleeps until the flush interval expires, or until a producer finds
+ * its ring half full and kicks the eventfd, whichever comes first.
+ */
+
+#include "log.h"
+#include "properties.h"
+#include "spscring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+#define MAX_THREADS 128     /* threads that may log, each gets one ring */
+
+/* a logged line, as it travels through a ring */
+typedef struct {
+    time_t when;                /* when the line was logged */
+    int len;                    /* length of the text, without a terminator */
+    char text[LOG_LINE_SIZE];
+} Line;
+
+static SpscRing *rings[MAX_THREADS];
+static int nrings = 0;                  /* published with a release store */
+static pthread_mutex_t reg_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread SpscRing *my_ring = NULL;
+
+static int threshold = LOG_INFO;
+static int stamped = 0;
+static int running = 0;                 /* lines are accepted */
+static int stopping = 0;                /* the flusher should exit */
+static int wake_fd = -1;
+static pthread_t flusher;
+static long lost = 0L;                  /* lines that found no ring at all */
+static long reported = 0L;              /* drops already written out */
+
+/* state of the flusher thread only */
+static char out[LOG_BATCH_SIZE];
+static size_t out_len = 0;
+static time_t stamp_time = (time_t)-1;
+static char stamp[32];
+static int stamp_len = 0;
+
+/*
+ * local function to obtain the calling thread's ring, registering one on its
+ * first line
+ */
+static SpscRing *thread_ring(void) {
+    SpscRing *sr;
+
+    if (my_ring != NULL)
+        return my_ring;
+    pthread_mutex_lock(&reg_lock);
+    if (nrings < MAX_THREADS && (sr = sr_create(LOG_RING_SIZE, sizeof(Line))) != NULL) {
+        rings[nrings] = sr;
+        __atomic_store_n(&nrings, nrings + 1, __ATOMIC_RELEASE);
+        my_ring = sr;
+    }
+    pthread_mutex_unlock(&reg_lock);
+    return my_ring;
+}
+
+/*
+ * local function to write the batched output to standard output; on errors,
+ * the batch is discarded
+ */
+static void write_out(void) {
+    size_t done = 0;
+    ssize_t res;
+
+    while (done < out_len) {
+        if ((res = write(STDOUT_FILENO, out + done, out_len - done)) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        done += (size_t)res;
+    }
+    out_len = 0;
+}
+
+/*
+ * local function to append one line to the batched output, prefixed with its
+ * timestamp if enabled; localtime() only runs when the second changes
+ */
+static void append(time_t when, const char *text, int len) {
+    struct tm tm;
+
+    if (stamped && when != stamp_time) {
+        localtime_r(&when, &tm);
+        stamp_len = snprintf(stamp, sizeof(stamp), "[%02d/%02d/%d %02d:%02d:%02d] ",
+                             (tm.tm_mon + 1), tm.tm_mday, (1900 + tm.tm_year),
+                             tm.tm_hour, tm.tm_min, tm.tm_sec);
+        stamp_time = when;
+    }
+    if (out_len + stamp_len + len + 1 > sizeof(out))
+        write_out();
+    if (stamped) {
+        memcpy(out + out_len, stamp, stamp_len);
+        out_len += stamp_len;
+    }
+    memcpy(out + out_len, text, len);
+    out_len += len;
+    out[out_len++] = '\n';
+}
+
+/*
+ * local function to drain every ring into the batched output and write it
+ */
+static void drain(void) {
+    static Line line;       /* too large for a tidy stack frame */
+    char buffer[64];
+    long drops;
+    int i, n = __atomic_load_n(&nrings, __ATOMIC_ACQUIRE);
+
+    for (i = 0; i < n; i++)
+        while (sr_pop(rings[i], &line))
+            append(line.when, line.text, line.len);
+    if ((drops = log_drops()) != reported) {
+        sprintf(buffer, "*** %ld log line(s) dropped, the log could not keep up",
+                drops - reported);
+        append(time(NULL), buffer, strlen(buffer));
+        reported = drops;
+    }
+    if (out_len > 0)
+        write_out();
+}
+
+/*
+ * the flusher thread; drains the rings every LOG_FLUSH_RATE milliseconds, or
+ * sooner when woken up, until the logger is shut down
+ */
+static void *flusher_main(UNUSED void *arg) {
+    struct pollfd pfd;
+    uint64_t count;
+
+    pfd.fd = wake_fd;
+    pfd.events = POLLIN;
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        if (poll(&pfd, 1, LOG_FLUSH_RATE) > 0 && read(wake_fd, &count, sizeof(count)) < 0) {
+            /* interrupted; the eventfd is cleared on the next wakeup instead */
+        }
+        drain();
+    }
+    drain();
+    return NULL;
+}
+
+int log_init(int level, int timestamps) {
+
+    if (running)
+        return 1;
+    if ((wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        return 0;
+    threshold = level;
+    stamped = timestamps;
+    stopping = 0;
+    if (pthread_create(&flusher, NULL, flusher_main, NULL) != 0) {
+        close(wake_fd);
+        wake_fd = -1;
+        return 0;
+    }
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+void log_shutdown(void) {
+    uint64_t one = 1;
+
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+        return;
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    if (write(wake_fd, &one, sizeof(one)) < 0) {
+        /* the flusher still notices on its next interval */
+    }
+    pthread_join(flusher, NULL);
+    /* the eventfd stays open; a thread still logging may be about to kick it */
+}
+
+void log_write(int level, const char *fmt, ...) {
+    static __thread Line line;      /* too large for a tidy stack frame */
+    SpscRing *sr;
+    uint64_t one = 1;
+    va_list args;
+    int len;
+
+    if (level > threshold || !__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+        return;
+    if ((sr = thread_ring()) == NULL) {
+        __atomic_fetch_add(&lost, 1L, __ATOMIC_RELAXED);
+        return;
+    }
+
+    va_start(args, fmt);
+    len = vsnprintf(line.text, sizeof(line.text), fmt, args);
+    va_end(args);
+    if (len < 0)
+        return;
+    line.len = (len < (int)sizeof(line.text)) ? len : (int)sizeof(line.text) - 1;
+    line.when = time(NULL);
+
+    /* kick the flusher once per half ring, instead of once per line */
+    if (sr_push(sr, &line) && sr_size(sr) == LOG_RING_SIZE / 2) {
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+            /* the counter is saturated, the flusher is awake already */
+        }
+    }
+}
+
+int log_enabled(int level) {
+    return (level <= threshold && __atomic_load_n(&running, __ATOMIC_ACQUIRE));
+}
+
+int log_parseLevel(const char *name) {
+
+    if (strcmp(name, "error") == 0)
+        return LOG_ERROR;
+    if (strcmp(name, "warn") == 0)
+        return LOG_WARN;
+    if (strcmp(name, "info") == 0)
+        return LOG_INFO;
+    if (strcmp(name, "debug") == 0)
+        return LOG_DEBUG;
+    return -1;
+}
+
+long log_drops(void) {
+    long drops = __atomic_load_n(&lost, __ATOMIC_RELAXED);
+    int i, n = __atomic_load_n(&nrings, __ATOMIC_ACQUIRE);
+
+    for (i = 0; i < n; i++)
+        drops += sr_drops(rings[i]);
+    return drops;
+}
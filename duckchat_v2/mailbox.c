@@ -0,0 +1,214 @@
+/*
+ * mailbox.c
+ *
+ * Implementation of the worker inbox; see mailbox.h. A sender's queue only ever
+ * holds mail younger than all of its ring's: the sender sends to the queue while
+ * it is not empty, and the owner takes from it only once the ring is empty. The
+ * length of the queue is read without the lock by the sender, which alone makes
+ * it grow, so the lock is only taken while there is a queue.
+ */
+
+#include "mailbox.h"
+#include "spscring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+typedef struct letter {
+    struct letter *next;
+    char msg[];
+} Letter;
+
+/* the mail a sender queued behind its full ring */
+typedef struct {
+    pthread_mutex_t lock;
+    long length;            /* written under the lock, read by the sender without */
+    long queued;            /* messages queued so far */
+    Letter *first;
+    Letter *last;
+} Queue;
+
+struct mailbox {
+    int fd;
+    int nsenders;
+    int next;               /* sender to serve first on the next fetch */
+    size_t msgsize;
+    SpscRing **rings;
+    Queue *queues;
+};
+
+Mailbox *mb_create(int nsenders, long capacity, size_t msgsize) {
+    Mailbox *mb;
+    int i;
+
+    if (nsenders <= 0)
+        return NULL;
+    if ((mb = (Mailbox *)malloc(sizeof(Mailbox))) == NULL)
+        return NULL;
+    mb->rings = (SpscRing **)calloc(nsenders, sizeof(SpscRing *));
+    mb->queues = (Queue *)calloc(nsenders, sizeof(Queue));
+    if (mb->rings == NULL || mb->queues == NULL) {
+        free(mb->rings);
+        free(mb->queues);
+        free(mb);
+        return NULL;
+    }
+    mb->nsenders = nsenders;
+    mb->next = 0;
+    mb->msgsize = msgsize;
+    if ((mb->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        free(mb->rings);
+        free(mb->queues);
+        free(mb);
+        return NULL;
+    }
+    for (i = 0; i < nsenders; i++)
+        pthread_mutex_init(&mb->queues[i].lock, NULL);
+    for (i = 0; i < nsenders; i++) {
+        if ((mb->rings[i] = sr_create(capacity, msgsize)) == NULL) {
+            mb_destroy(mb);
+            return NULL;
+        }
+    }
+    return mb;
+}
+
+void mb_destroy(Mailbox *mb) {
+    Letter *l;
+    int i;
+
+    for (i = 0; i < mb->nsenders; i++) {
+        if (mb->rings[i] != NULL)
+            sr_destroy(mb->rings[i]);
+        while ((l = mb->queues[i].first) != NULL) {
+            mb->queues[i].first = l->next;
+            free(l);
+        }
+        pthread_mutex_destroy(&mb->queues[i].lock);
+    }
+    close(mb->fd);
+    free(mb->rings);
+    free(mb->queues);
+    free(mb);
+}
+
+int mb_fd(Mailbox *mb) {
+    return mb->fd;
+}
+
+/*
+ * local function to wake up the owner
+ */
+static void wake(Mailbox *mb) {
+    uint64_t one = 1;
+
+    if (write(mb->fd, &one, sizeof(one)) < 0) {
+        /* counter saturated; the owner is awake anyway */
+    }
+}
+
+int mb_post(Mailbox *mb, int sender, const void *msg) {
+    int res;
+
+    /* overtaking the queued mail would reorder the sender's messages */
+    if (__atomic_load_n(&mb->queues[sender].length, __ATOMIC_ACQUIRE) > 0)
+        return 0;
+    if ((res = sr_push(mb->rings[sender], msg)) == 2)
+        wake(mb);
+    return (res != 0);
+}
+
+int mb_send(Mailbox *mb, int sender, const void *msg) {
+    Queue *q = &mb->queues[sender];
+    Letter *l;
+    int res;
+
+    if (__atomic_load_n(&q->length, __ATOMIC_ACQUIRE) == 0 && !sr_isFull(mb->rings[sender])) {
+        if ((res = sr_push(mb->rings[sender], msg)) == 2)
+            wake(mb);
+        return 1;
+    }
+    if ((l = (Letter *)malloc(sizeof(Letter) + mb->msgsize)) == NULL)
+        return 0;
+    memcpy(l->msg, msg, mb->msgsize);
+    l->next = NULL;
+    pthread_mutex_lock(&q->lock);
+    if (q->last != NULL)
+        q->last->next = l;
+    else
+        q->first = l;
+    q->last = l;
+    q->queued++;
+    __atomic_store_n(&q->length, q->length + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&q->lock);
+    wake(mb);
+    return 1;
+}
+
+void mb_ack(Mailbox *mb) {
+    uint64_t count;
+
+    if (read(mb->fd, &count, sizeof(count)) < 0) {
+        /* nothing pending; spurious wakeup */
+    }
+}
+
+/*
+ * local function to take the oldest message off the queue of sender `s'
+ *
+ * returns 1 if successful, 0 if the queue is empty
+ */
+static int dequeue(Mailbox *mb, int s, void *msg) {
+    Queue *q = &mb->queues[s];
+    Letter *l;
+
+    if (__atomic_load_n(&q->length, __ATOMIC_ACQUIRE) == 0)
+        return 0;
+    pthread_mutex_lock(&q->lock);
+    l = q->first;
+    if ((q->first = l->next) == NULL)
+        q->last = NULL;
+    __atomic_store_n(&q->length, q->length - 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&q->lock);
+    memcpy(msg, l->msg, mb->msgsize);
+    free(l);
+    return 1;
+}
+
+int mb_fetch(Mailbox *mb, void *msg) {
+    int i, s;
+
+    for (i = 0; i < mb->nsenders; i++) {
+        s = (mb->next + i) % mb->nsenders;
+        /* the queued mail is younger than any in the ring */
+        if (sr_pop(mb->rings[s], msg) || dequeue(mb, s, msg)) {
+            mb->next = (s + 1) % mb->nsenders;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+long mb_drops(Mailbox *mb) {
+    long drops = 0L;
+    int i;
+
+    for (i = 0; i < mb->nsenders; i++)
+        drops += sr_drops(mb->rings[i]);
+    return drops;
+}
+
+long mb_queued(Mailbox *mb) {
+    long queued = 0L;
+    int i;
+
+    for (i = 0; i < mb->nsenders; i++) {
+        pthread_mutex_lock(&mb->queues[i].lock);
+        queued += mb->queues[i].queued;
+        pthread_mutex_unlock(&mb->queues[i].lock);
+    }
+    return queued;
+}
@@ -0,0 +1,86 @@
+/*
+ * mailbox.h
+ *
+ * Interface for a worker thread's inbox. A mailbox holds one lock-free SPSC ring
+ * per sending thread, so any number of threads can post to it without locks, and
+ * an eventfd(2) that becomes readable when mail arrives so the owner can wait for
+ * it in its event loop alongside its sockets.
+ *
+ * Mail that must not be lost is sent rather than posted: when the sender's ring
+ * is full, it is queued on a list of the sender's own, which the owner empties
+ * after the ring; the list takes a lock, but only while it is in use. A sender
+ * never waits for the owner, so two workers sending each other mail cannot
+ * deadlock.
+ */
+
+#ifndef _MAILBOX_H_
+#define _MAILBOX_H_
+
+#include <stddef.h>
+
+typedef struct mailbox Mailbox;     /* opaque type definition */
+
+/*
+ * create a mailbox for messages of `msgsize' bytes that `nsenders' threads,
+ * numbered 0..nsenders-1, may post to; each sender may have up to `capacity'
+ * messages waiting
+ *
+ * returns a pointer to the mailbox, or NULL if there are malloc() or
+ * eventfd() errors
+ */
+Mailbox *mb_create(int nsenders, long capacity, size_t msgsize);
+
+/*
+ * destroys the mailbox; any messages still in it are discarded
+ */
+void mb_destroy(Mailbox *mb);
+
+/*
+ * returns the descriptor that becomes readable when mail is waiting; it
+ * should be registered with the owner's event loop
+ */
+int mb_fd(Mailbox *mb);
+
+/*
+ * sender `sender' only: copies `msg' into the mailbox, waking up the owner if
+ * it may be idle
+ *
+ * returns 1 if successful, 0 if the sender's ring is full, or mail it sent is
+ * still queued (message dropped)
+ */
+int mb_post(Mailbox *mb, int sender, const void *msg);
+
+/*
+ * sender `sender' only: copies `msg' into the mailbox like mb_post(), but queues
+ * it behind the ring if the ring is full; the owner fetches the sender's mail in
+ * the order it was posted and sent
+ *
+ * returns 1 if successful, 0 if not (malloc failure)
+ */
+int mb_send(Mailbox *mb, int sender, const void *msg);
+
+/*
+ * owner only: acknowledges a wakeup; must be called before the mail is
+ * fetched, so that mail posted while fetching triggers another wakeup
+ */
+void mb_ack(Mailbox *mb);
+
+/*
+ * owner only: copies the next waiting message into `*msg'; senders are
+ * served round-robin
+ *
+ * returns 1 if successful, 0 if the mailbox is empty
+ */
+int mb_fetch(Mailbox *mb, void *msg);
+
+/*
+ * returns the number of messages dropped because a sender's ring was full
+ */
+long mb_drops(Mailbox *mb);
+
+/*
+ * returns the number of messages sent that had to be queued behind a full ring
+ */
+long mb_queued(Mailbox *mb);
+
+#endif /* _MAILBOX_H_ */
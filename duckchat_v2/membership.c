@@ -0,0 +1,218 @@
+/*
+ * membership.c
+ *
+ * Implementation of channel membership; see membership.h. The members of a
+ * channel are a doubly linked list in joining order, and the channels of a
+ * member a list whose nodes point back at the link that points at them, so
+ * that a subscription unlinks itself from both lists without searching either.
+ * The destinations are a pair of parallel arrays, the addresses and the
+ * subscription owning each slot, and every subscription knows its slot, so that
+ * the last slot can be moved into the one a member leaves.
+ */
+
+#include "membership.h"
+#include "addrmap.h"
+#include "slab.h"
+#include <stdlib.h>
+
+#define INDEX_CAPACITY 8L
+#define DESTS_CAPACITY 8L
+
+struct subscription {
+    Channel *ch;
+    void *member;
+    uint64_t key;
+    long slot;                      /* index into the channel's destinations */
+    struct subscription *c_prev;    /* neighbors in the channel's list */
+    struct subscription *c_next;
+    struct subscription *m_next;    /* next in the member's list */
+    struct subscription **m_pprev;  /* the link pointing at this node */
+};
+
+static SlabType sub_type = SLAB_TYPE("subscription", Subscription);
+
+struct channel {
+    const char *name;
+    int id;
+    long size;
+    AddrMap *index;                 /* member key -> subscription */
+    Subscription *first;
+    Subscription *last;
+    long capacity;                  /* slots allocated in the two arrays below */
+    struct sockaddr_in *dests;      /* members' addresses, size entries in use */
+    Subscription **owners;          /* subscription owning each slot of dests */
+};
+
+Channel *ms_create(const char *name, int id) {
+    Channel *ch;
+
+    if ((ch = (Channel *)malloc(sizeof(Channel))) == NULL)
+        return NULL;
+    if ((ch->index = am_create(INDEX_CAPACITY)) == NULL) {
+        free(ch);
+        return NULL;
+    }
+    ch->name = name;
+    ch->id = id;
+    ch->size = 0L;
+    ch->first = NULL;
+    ch->last = NULL;
+    ch->capacity = 0L;
+    ch->dests = NULL;
+    ch->owners = NULL;
+    return ch;
+}
+
+/*
+ * local function to unlink subscription `s' from both of its lists and free it
+ */
+static void unsubscribe(Subscription *s) {
+    Channel *ch = s->ch;
+    long last = ch->size - 1;
+    void *dummy;
+
+    if (s->c_prev != NULL)
+        s->c_prev->c_next = s->c_next;
+    else
+        ch->first = s->c_next;
+    if (s->c_next != NULL)
+        s->c_next->c_prev = s->c_prev;
+    else
+        ch->last = s->c_prev;
+    *s->m_pprev = s->m_next;
+    if (s->m_next != NULL)
+        s->m_next->m_pprev = s->m_pprev;
+    (void)am_remove(ch->index, s->key, &dummy);
+    /* fill the slot left with the last destination */
+    if (s->slot != last) {
+        ch->dests[s->slot] = ch->dests[last];
+        ch->owners[s->slot] = ch->owners[last];
+        ch->owners[s->slot]->slot = s->slot;
+    }
+    ch->size--;
+    sl_free(&sub_type, s);
+}
+
+void ms_destroy(Channel *ch) {
+    while (ch->first != NULL)
+        unsubscribe(ch->first);
+    am_destroy(ch->index, NULL);
+    free(ch->dests);
+    free(ch->owners);
+    free(ch);
+}
+
+const char *ms_name(Channel *ch) {
+    return ch->name;
+}
+
+int ms_id(Channel *ch) {
+    return ch->id;
+}
+
+long ms_size(Channel *ch) {
+    return ch->size;
+}
+
+int ms_isEmpty(Channel *ch) {
+    return (ch->size == 0L);
+}
+
+int ms_contains(Channel *ch, uint64_t key) {
+    return am_containsKey(ch->index, key);
+}
+
+/*
+ * local function to double the capacity of the channel's destinations
+ *
+ * returns 1 if successful, 0 if not (malloc failure)
+ */
+static int grow(Channel *ch) {
+    long n = (ch->capacity == 0L) ? DESTS_CAPACITY : 2 * ch->capacity;
+    struct sockaddr_in *dests;
+    Subscription **owners;
+
+    if ((dests = (struct sockaddr_in *)realloc(ch->dests, n * sizeof(struct sockaddr_in))) == NULL)
+        return 0;
+    ch->dests = dests;
+    if ((owners = (Subscription **)realloc(ch->owners, n * sizeof(Subscription *))) == NULL)
+        return 0;
+    ch->owners = owners;
+    ch->capacity = n;
+    return 1;
+}
+
+int ms_join(Channel *ch, Subscription **subs, uint64_t key, void *member,
+            const struct sockaddr_in *addr) {
+    Subscription *s;
+
+    if (am_containsKey(ch->index, key))
+        return 0;
+    if (ch->size == ch->capacity && !grow(ch))
+        return -1;
+    if ((s = (Subscription *)sl_alloc(&sub_type)) == NULL)
+        return -1;
+    if (!am_put(ch->index, key, s, NULL)) {
+        sl_free(&sub_type, s);
+        return -1;
+    }
+    s->ch = ch;
+    s->member = member;
+    s->key = key;
+    s->slot = ch->size;
+    ch->dests[s->slot] = *addr;
+    ch->owners[s->slot] = s;
+    /* append to the channel's list, so members are visited in joining order */
+    s->c_next = NULL;
+    s->c_prev = ch->last;
+    if (ch->last != NULL)
+        ch->last->c_next = s;
+    else
+        ch->first = s;
+    ch->last = s;
+    /* push onto the member's list */
+    s->m_next = *subs;
+    s->m_pprev = subs;
+    if (*subs != NULL)
+        (*subs)->m_pprev = &s->m_next;
+    *subs = s;
+    ch->size++;
+    return 1;
+}
+
+int ms_leave(Channel *ch, uint64_t key) {
+    Subscription *s;
+
+    if (!am_get(ch->index, key, (void **)&s))
+        return 0;
+    unsubscribe(s);
+    return 1;
+}
+
+Channel *ms_leaveFirst(Subscription **subs) {
+    Channel *ch;
+
+    if (*subs == NULL)
+        return NULL;
+    ch = (*subs)->ch;
+    unsubscribe(*subs);
+    return ch;
+}
+
+const struct sockaddr_in *ms_destinations(Channel *ch) {
+    return ch->dests;
+}
+
+void ms_iterInit(Channel *ch, MSIter *it) {
+    it->next = ch->first;
+}
+
+int ms_iterNext(MSIter *it, void **member) {
+    Subscription *s = it->next;
+
+    if (s == NULL)
+        return 0;
+    it->next = s->c_next;
+    *member = s->member;
+    return 1;
+}
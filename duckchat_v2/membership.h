@@ -0,0 +1,124 @@
+/*
+ * membership.h
+ *
+ * Interface for the subscriptions of members (the server's users) to channels.
+ * Each subscription is a single node linked into two lists at once: the list of
+ * the channel's members, and the list of the member's channels. Joining and
+ * leaving a channel, and leaving every channel at logout, take constant time per
+ * subscription whatever the size of the channel. A channel also indexes its
+ * subscriptions by the member's key (see am_key()), so a duplicate join, or the
+ * subscription to remove on a leave, is found with a hash lookup.
+ *
+ * Besides its list of members, a channel keeps the members' addresses packed in
+ * one array, the destinations a message on the channel is sent to; a fan-out
+ * streams through it without touching the members themselves. A leaving member's
+ * slot is filled with the last one, so the array stays dense in constant time,
+ * though not in joining order.
+ */
+
+#ifndef _MEMBERSHIP_H_
+#define _MEMBERSHIP_H_
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+typedef struct channel Channel;             /* opaque type definition */
+typedef struct subscription Subscription;   /* opaque type definition */
+
+/*
+ * a cursor over the members of a channel, from the earliest to join to the
+ * latest; it is declared by the caller, usually on the stack; its members are
+ * private to the implementation
+ */
+typedef struct msiter {
+    Subscription *next;         /* subscription to return next */
+} MSIter;
+
+/*
+ * create an empty channel with the specified name and ID (see registry.h); the
+ * name is not copied, and must outlive the channel
+ *
+ * returns a pointer to the channel, or NULL if there are malloc() errors
+ */
+Channel *ms_create(const char *name, int id);
+
+/*
+ * destroys the channel; any members still subscribed are unsubscribed first,
+ * and the storage associated with the channel is returned to the heap
+ */
+void ms_destroy(Channel *ch);
+
+/*
+ * returns the name of the channel
+ */
+const char *ms_name(Channel *ch);
+
+/*
+ * returns the ID of the channel
+ */
+int ms_id(Channel *ch);
+
+/*
+ * returns the number of members subscribed to the channel
+ */
+long ms_size(Channel *ch);
+
+/*
+ * returns 1 if no members are subscribed to the channel, 0 otherwise
+ */
+int ms_isEmpty(Channel *ch);
+
+/*
+ * returns 1 if the member with key `key' is subscribed to the channel, 0 if not
+ */
+int ms_contains(Channel *ch, uint64_t key);
+
+/*
+ * subscribes `member', whose key is `key' and address `addr', to the channel;
+ * `subs' points at the head of the member's list of subscriptions, which must
+ * be NULL before its first subscription; the address is copied into the
+ * channel's destinations; a member already subscribed is left as it is
+ *
+ * returns 1 if subscribed, 0 if already subscribed, -1 if not (malloc failure)
+ */
+int ms_join(Channel *ch, Subscription **subs, uint64_t key, void *member,
+            const struct sockaddr_in *addr);
+
+/*
+ * unsubscribes the member with key `key' from the channel, unlinking the
+ * subscription from the member's list as well
+ *
+ * returns 1 if successful, 0 if the member was not subscribed
+ */
+int ms_leave(Channel *ch, uint64_t key);
+
+/*
+ * unsubscribes the member whose list of subscriptions begins at `*subs' from
+ * the first channel on the list; used to leave every channel in turn
+ *
+ * returns the channel left, or NULL if the member has no subscriptions
+ */
+Channel *ms_leaveFirst(Subscription **subs);
+
+/*
+ * returns the addresses of the channel's members, an array of ms_size()
+ * entries in no particular order; it belongs to the channel, and is only valid
+ * until a member next joins or leaves
+ */
+const struct sockaddr_in *ms_destinations(Channel *ch);
+
+/*
+ * positions the cursor `it' before the first member of the channel
+ */
+void ms_iterInit(Channel *ch, MSIter *it);
+
+/*
+ * advances the cursor, returning the next member in `*member'
+ *
+ * NB - while iterating, the channel must not be modified
+ *
+ * returns 1 if successful, 0 if there are no more members
+ */
+int ms_iterNext(MSIter *it, void **member);
+
+#endif /* _MEMBERSHIP_H_ */
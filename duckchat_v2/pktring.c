@@ -0,0 +1,326 @@
+/*
+ * pktring.c
+ *
+ * Implementation of the packet ring, on recvmmsg() or, when built with
+ * USE_IO_URING, on a multishot io_uring receive; see pktring.h.
+ */
+
+#define _GNU_SOURCE
+#include "pktring.h"
+#include "properties.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#ifdef USE_IO_URING
+#include <sys/mman.h>
+#include "uring.h"
+#endif
+
+#define GUARD 64    /* zeroed bytes kept after every datagram */
+
+#ifdef USE_IO_URING
+
+/*
+ * every provided buffer holds the kernel's recvmsg header, the sender's address,
+ * then the datagram itself, followed by the guard
+ */
+#define BUF_HEAD (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in))
+#define BUF_SIZE (BUF_HEAD + BUFF_SIZE)
+#define BUF_STRIDE (BUF_SIZE + GUARD)
+#define BUF_GROUP 0     /* every ring has its own instance, one group suffices */
+
+struct pktring {
+    int fd;
+    int nslots;             /* a power of two, as the kernel requires */
+    int head;               /* index of the oldest received packet */
+    int count;              /* number of received, unreleased packets */
+    int armed;              /* the multishot receive is still active */
+    unsigned short br_tail; /* next free entry of the provided buffer ring */
+    char *bufs;             /* nslots buffers, committed lazily */
+    Packet *packets;
+    unsigned short *bids;   /* buffer each received packet lives in */
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    struct msghdr msg;      /* template of the multishot receive */
+    Uring *ur;
+};
+
+/*
+ * local function to hand buffer `bid' back to the kernel
+ */
+static void provide(PktRing *pr, unsigned short bid) {
+    struct io_uring_buf *buf = &pr->br->bufs[pr->br_tail & (pr->nslots - 1)];
+
+    buf->addr = (unsigned long)(pr->bufs + ((size_t)bid * BUF_STRIDE));
+    buf->len = BUF_SIZE;
+    buf->bid = bid;
+    __atomic_store_n(&pr->br->tail, ++pr->br_tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * local function to (re)start the multishot receive; the kernel ends it when it
+ * runs out of buffers, so it is restarted once a buffer has been released
+ */
+static void arm(PktRing *pr) {
+    struct io_uring_sqe *sqe;
+
+    if (pr->armed || pr->count == pr->nslots)
+        return;
+    if ((sqe = ur_getSqe(pr->ur)) == NULL)
+        return;
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = pr->fd;
+    sqe->addr = (unsigned long)&pr->msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    if (ur_submit(pr->ur, 0) == 1)
+        pr->armed = 1;
+}
+
+PktRing *pr_create(int fd, int nslots) {
+    struct io_uring_buf_reg reg;
+    PktRing *pr;
+    int i, N = 1;
+
+    if (nslots <= 0 || nslots > 32768)
+        return NULL;
+    while (N < nslots)
+        N <<= 1;
+    if ((pr = (PktRing *)calloc(1, sizeof(PktRing))) == NULL)
+        return NULL;
+    pr->fd = fd;
+    pr->nslots = N;
+    pr->br = MAP_FAILED;
+    pr->br_size = N * sizeof(struct io_uring_buf);
+    /* large allocation; pages are only committed once a datagram lands there */
+    pr->bufs = (char *)malloc((size_t)N * BUF_STRIDE);
+    pr->packets = (Packet *)malloc(N * sizeof(Packet));
+    pr->bids = (unsigned short *)malloc(N * sizeof(unsigned short));
+    if (pr->bufs == NULL || pr->packets == NULL || pr->bids == NULL)
+        goto error;
+    if ((pr->ur = ur_create(4, 2 * N)) == NULL)
+        goto error;
+
+    /* the buffer ring must be page aligned; register it, then fill it */
+    if ((pr->br = mmap(NULL, pr->br_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+        goto error;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)pr->br;
+    reg.ring_entries = N;
+    reg.bgid = BUF_GROUP;
+    if (!ur_register(pr->ur, IORING_REGISTER_PBUF_RING, &reg, 1))
+        goto error;
+    for (i = 0; i < N; i++)
+        provide(pr, (unsigned short)i);
+
+    memset(&pr->msg, 0, sizeof(pr->msg));
+    pr->msg.msg_namelen = sizeof(struct sockaddr_in);
+    arm(pr);
+    if (!pr->armed)
+        goto error;
+    return pr;
+
+error:
+    pr_destroy(pr);
+    return NULL;
+}
+
+void pr_destroy(PktRing *pr) {
+    /* tear down the instance first, so the kernel lets go of the buffers */
+    if (pr->ur != NULL)
+        ur_destroy(pr->ur);
+    if (pr->br != MAP_FAILED)
+        munmap(pr->br, pr->br_size);
+    free(pr->bufs);
+    free(pr->packets);
+    free(pr->bids);
+    free(pr);
+}
+
+int pr_fd(PktRing *pr) {
+    return ur_fd(pr->ur);
+}
+
+/*
+ * local function to queue the datagram the kernel received into buffer `bid';
+ * zeroes the bytes that follow it, like the classic path does
+ */
+static void settle(PktRing *pr, unsigned short bid) {
+    int i = (pr->head + pr->count) & (pr->nslots - 1);
+    char *buf = pr->bufs + ((size_t)bid * BUF_STRIDE);
+    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buf;
+    Packet *pkt = &pr->packets[i];
+    long len = (out->payloadlen > BUFF_SIZE) ? BUFF_SIZE : (long)out->payloadlen;
+
+    pkt->len = len;
+    pkt->data = buf + BUF_HEAD;
+    memcpy(&pkt->from, buf + sizeof(*out), sizeof(pkt->from));
+    memset(pkt->data + len, 0, ((len < RECV_SLOT_SIZE) ? (RECV_SLOT_SIZE - len) : 0) + GUARD);
+    pr->bids[i] = bid;
+    pr->count++;
+}
+
+int pr_receive(PktRing *pr) {
+    struct io_uring_cqe *cqe;
+    int n = 0;
+
+    while ((cqe = ur_peekCqe(pr->ur)) != NULL) {
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            pr->armed = 0;
+        if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+            settle(pr, (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+            n++;
+        }
+        ur_seenCqe(pr->ur);
+    }
+    arm(pr);
+    return n;
+}
+
+int pr_next(PktRing *pr, Packet **pkt) {
+    if (pr->count == 0)
+        return 0;
+    *pkt = &pr->packets[pr->head];
+    return 1;
+}
+
+void pr_release(PktRing *pr) {
+    if (pr->count == 0)
+        return;
+    provide(pr, pr->bids[pr->head]);
+    pr->head = (pr->head + 1) & (pr->nslots - 1);
+    pr->count--;
+    arm(pr);
+}
+
+#else   /* classic recvmmsg() path */
+
+#define SLOT_STRIDE (RECV_SLOT_SIZE + GUARD)
+#define SPILL_STRIDE (BUFF_SIZE + GUARD)
+
+struct pktring {
+    int fd;
+    int nslots;
+    int head;               /* index of the oldest received packet */
+    int count;              /* number of received, unreleased packets */
+    char *slots;            /* nslots small buffers, contiguous */
+    char *spill;            /* nslots overflow areas, committed lazily */
+    Packet *packets;
+    struct iovec *iovs;     /* two per slot: small buffer, then spill */
+    struct mmsghdr *msgs;
+};
+
+PktRing *pr_create(int fd, int nslots) {
+    PktRing *pr;
+    int i;
+
+    if (nslots <= 0)
+        return NULL;
+    if ((pr = (PktRing *)malloc(sizeof(PktRing))) == NULL)
+        return NULL;
+    pr->fd = fd;
+    pr->nslots = nslots;
+    pr->head = 0;
+    pr->count = 0;
+    pr->slots = (char *)malloc((size_t)nslots * SLOT_STRIDE);
+    /* large allocation; pages are only committed once a datagram spills */
+    pr->spill = (char *)malloc((size_t)nslots * SPILL_STRIDE);
+    pr->packets = (Packet *)malloc(nslots * sizeof(Packet));
+    pr->iovs = (struct iovec *)malloc(2 * nslots * sizeof(struct iovec));
+    pr->msgs = (struct mmsghdr *)malloc(nslots * sizeof(struct mmsghdr));
+    if (pr->slots == NULL || pr->spill == NULL || pr->packets == NULL ||
+        pr->iovs == NULL || pr->msgs == NULL) {
+        pr_destroy(pr);
+        return NULL;
+    }
+
+    /* the scatter/gather layout of every slot never changes, set it up once */
+    memset(pr->msgs, 0, nslots * sizeof(struct mmsghdr));
+    for (i = 0; i < nslots; i++) {
+        pr->iovs[2 * i].iov_base = pr->slots + ((size_t)i * SLOT_STRIDE);
+        pr->iovs[2 * i].iov_len = RECV_SLOT_SIZE;
+        pr->iovs[2 * i + 1].iov_base = pr->spill + ((size_t)i * SPILL_STRIDE) + RECV_SLOT_SIZE;
+        pr->iovs[2 * i + 1].iov_len = BUFF_SIZE - RECV_SLOT_SIZE;
+        pr->msgs[i].msg_hdr.msg_iov = &pr->iovs[2 * i];
+        pr->msgs[i].msg_hdr.msg_iovlen = 2;
+        pr->msgs[i].msg_hdr.msg_name = &pr->packets[i].from;
+    }
+    return pr;
+}
+
+void pr_destroy(PktRing *pr) {
+    free(pr->slots);
+    free(pr->spill);
+    free(pr->packets);
+    free(pr->iovs);
+    free(pr->msgs);
+    free(pr);
+}
+
+int pr_fd(PktRing *pr) {
+    return pr->fd;
+}
+
+/*
+ * local function to finish a slot after recvmmsg() filled it; joins spilled
+ * datagrams into one contiguous buffer and zeroes the bytes that follow
+ */
+static void settle(PktRing *pr, int i) {
+    Packet *pkt = &pr->packets[i];
+    char *slot = pr->slots + ((size_t)i * SLOT_STRIDE);
+    char *spill = pr->spill + ((size_t)i * SPILL_STRIDE);
+    long len = (long)pr->msgs[i].msg_len;
+
+    pkt->len = len;
+    if (len <= RECV_SLOT_SIZE) {
+        pkt->data = slot;
+        memset(slot + len, 0, SLOT_STRIDE - len);
+    } else {
+        memcpy(spill, slot, RECV_SLOT_SIZE);
+        pkt->data = spill;
+        memset(spill + len, 0, GUARD);
+    }
+}
+
+int pr_receive(PktRing *pr) {
+    int i, tail, n, res;
+
+    if (pr->count == pr->nslots)
+        return 0;
+    /* only the free slots up to the end of the array are contiguous */
+    tail = (pr->head + pr->count) % pr->nslots;
+    n = pr->nslots - pr->count;
+    if (tail + n > pr->nslots)
+        n = pr->nslots - tail;
+    for (i = tail; i < tail + n; i++)
+        pr->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+
+    if ((res = recvmmsg(pr->fd, &pr->msgs[tail], n, MSG_DONTWAIT, NULL)) < 0)
+        return ((errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1);
+    for (i = tail; i < tail + res; i++)
+        settle(pr, i);
+    pr->count += res;
+    return res;
+}
+
+int pr_next(PktRing *pr, Packet **pkt) {
+    if (pr->count == 0)
+        return 0;
+    *pkt = &pr->packets[pr->head];
+    return 1;
+}
+
+void pr_release(PktRing *pr) {
+    if (pr->count == 0)
+        return;
+    pr->head = (pr->head + 1) % pr->nslots;
+    pr->count--;
+}
+
+#endif /* USE_IO_URING */
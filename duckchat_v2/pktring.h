@@ -0,0 +1,83 @@
+/*
+ * pktring.h
+ *
+ * Interface for the server's receive stage. A packet ring owns a preallocated set
+ * of packet buffers and fills as many of them as are free with a single
+ * recvmmsg(2) call, so a burst of datagrams costs one system call instead of one
+ * per packet, and no buffer is ever allocated or cleared in full on the hot path.
+ *
+ * Each slot is a small buffer of RECV_SLOT_SIZE bytes, large enough for every
+ * fixed-size packet of the protocol; a datagram that does not fit continues into
+ * a per-slot spill area which is only committed to memory when first used, and
+ * is handed out as a single contiguous buffer.
+ *
+ * When built with the io_uring backend (make IO_BACKEND=uring), the slots are
+ * instead registered with the kernel as a ring of provided buffers, and a single
+ * multishot recvmsg request keeps receiving into them; pr_receive() then only
+ * collects the completions, and pr_release() hands the slot back to the kernel.
+ */
+
+#ifndef _PKTRING_H_
+#define _PKTRING_H_
+
+#include <netinet/in.h>
+
+typedef struct pktring PktRing;     /* opaque type definition */
+
+/*
+ * a packet received into one of the ring's slots; `data' is valid until the
+ * slot is returned with pr_release(); the bytes following the datagram read as
+ * zeros up to the end of the slot, or, for a datagram larger than RECV_SLOT_SIZE,
+ * for the next 64 bytes only, beyond which bytes of earlier datagrams may follow;
+ * either way a string field the sender did not terminate stays bounded
+ */
+typedef struct packet {
+    char *data;                 /* contents of the datagram */
+    long len;                   /* number of bytes received */
+    struct sockaddr_in from;    /* address of the sender */
+} Packet;
+
+/*
+ * create a packet ring with `nslots' slots that receives from socket `fd'
+ *
+ * returns a pointer to the ring, or NULL if there are malloc() errors (or, with
+ * the io_uring backend, if the kernel does not support it)
+ */
+PktRing *pr_create(int fd, int nslots);
+
+/*
+ * destroys the packet ring, returning all of its buffers to the heap; the
+ * socket is not closed
+ */
+void pr_destroy(PktRing *pr);
+
+/*
+ * returns the descriptor to wait on for packets; the socket itself, or the
+ * io_uring instance with the io_uring backend
+ */
+int pr_fd(PktRing *pr);
+
+/*
+ * receives as many pending datagrams as there are free slots without
+ * blocking, using a single recvmmsg() call (or by collecting the completions
+ * of the multishot receive with the io_uring backend)
+ *
+ * returns the number of datagrams received, 0 if none were pending or the
+ * ring is full, or -1 on socket errors
+ */
+int pr_receive(PktRing *pr);
+
+/*
+ * retrieves, but does not release, the oldest received packet in `*pkt'
+ *
+ * returns 1 if successful, 0 if the ring is empty
+ */
+int pr_next(PktRing *pr, Packet **pkt);
+
+/*
+ * releases the oldest received packet, making its slot available to
+ * pr_receive() again
+ */
+void pr_release(PktRing *pr);
+
+#endif /* _PKTRING_H_ */
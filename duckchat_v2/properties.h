@@ -15,6 +15,72 @@
 /* Maximum number of bytes for host to receive from another at a time */
 #define BUFF_SIZE 150000
 
+/* Maximum number of datagrams the server receives with a single system call */
+/* The server preallocates this many packet buffers and fills all free ones at once */
+#define RECV_BATCH 64
+
+/* Size (in bytes) of each of the server's preallocated packet buffers */
+/* Must hold every fixed-size packet; larger datagrams spill into a lazily committed area */
+#define RECV_SLOT_SIZE 512
+
+/* Maximum number of datagrams the server sends with a single system call */
+/* Broadcasts and S2S floods are sent to their recipients in batches of this size */
+#define SEND_BATCH 64
+
+/* Maximum number of worker threads the server may be run with */
+/* Each worker has its own socket on the server's port and owns a shard of the users */
+#define MAX_WORKERS 64
+
+/* Maximum number of reader threads the server may be run with */
+/* Readers answer the clients' LIST, WHO and VERIFY requests from the workers' snapshots */
+#define MAX_READERS 16
+
+/* Maximum number of fan-out helper threads each worker may be run with */
+/* Helpers share the sending of a message to a large channel with their worker */
+#define MAX_FANOUT_HELPERS 16
+
+/* Smallest number of a worker's subscribers to a channel sent to by its fan-out helpers */
+/* Messages to fewer are sent by the worker alone, in batches of SEND_BATCH */
+#define FANOUT_THRESHOLD 4096
+
+/* Default number of destinations a worker's fan-out sends to per turn of its event loop */
+/* The rest of a message is sent in later turns, between the packets arriving meanwhile */
+#define FANOUT_BUDGET 2048
+
+/* Maximum number of messages a worker's fan-out may leave for later turns */
+/* Beyond this the worker finishes sending them before it sends another */
+#define FANOUT_BACKLOG 64
+
+/* Maximum number of neighboring servers the server may be given */
+/* The routing table keeps a set of MAX_NEIGHBORS / 8 bytes per channel */
+#define MAX_NEIGHBORS 256
+
+/* Maximum number of messages each worker may have waiting in another worker's inbox */
+/* Channel messages beyond this are dropped; other mail waits in a queue behind the inbox */
+#define MAILBOX_SIZE 1024
+
+/* Maximum number of received packets waiting for a worker when the server is pipelined */
+/* The worker's ingress thread stops receiving, and counts a stall, while this many wait */
+#define INGRESS_RING_SIZE 1024
+
+/* Maximum number of send batches waiting for a worker's egress thread when pipelined */
+/* Each batch holds up to SEND_BATCH destinations; the worker stalls while this many wait */
+#define EGRESS_RING_SIZE 256
+
+/* Maximum number of log lines each server thread may have waiting to be written */
+/* Lines are handed to a background thread that writes them in batches; beyond this they are dropped */
+#define LOG_RING_SIZE 4096
+
+/* Maximum length (in bytes) of a single log line; longer lines are truncated */
+#define LOG_LINE_SIZE 256
+
+/* Size (in bytes) of the buffer the server's log lines are batched in before being written */
+#define LOG_BATCH_SIZE 65536
+
+/* The rate (in milliseconds) for the server to write out the log lines waiting to be written */
+/* Lines are written sooner whenever a thread's log ring is half full */
+#define LOG_FLUSH_RATE 100
+
 /* Maximum number of channels a client may be subscribed to at once */
 #define MAX_CHANNELS 10
 
@@ -29,15 +95,33 @@
 /* Should be kept between 45-60 seconds */
 #define KEEP_ALIVE_RATE 60
 
-/* Refresh rate (in minutes) of the server to refresh its internal data structures */
-/* The server will scan and remove users who have not sent a packet past the refresh rate */
-/* Inactive neighboring servers will also be removed from the routing table */
+/* Inactivity timeout (in minutes) of the server's soft state */
+/* A user who has not sent a packet for this long is logged out, to the second */
+/* A neighboring server silent for this long is removed from the routing table */
+/* The memory statistics are also logged at this rate */
 /* Should be kept between 2-5 minutes */
 #define REFRESH_RATE 2
 
-/* Size of the server's cache for storing the IDs of received S2S packets */
-/* The server will cache this many IDs before replacing older ones */
-#define MSGQ_SIZE 48
+/* The rate (in seconds) for the server to flood its neighbors with S2S KEEP ALIVE and JOIN requests */
+/* This soft-state refresh keeps the server from being removed by its neighbors as crashed */
+/* Should be kept well below the refresh rate above */
+#define S2S_REFRESH_RATE 60
+
+/* Maximum number of host names the server keeps the resolved addresses of */
+/* Addresses given by name are resolved once; names beyond this are resolved every time */
+#define ADDR_CACHE_SIZE 256
+
+/* Maximum number of channel names a worker keeps the IDs of, so messages skip the registry */
+/* Each keeps its name interned; once this many are kept, the worker forgets them all */
+#define RESOLVED_CACHE_SIZE 1024
+
+/* Number of most recent S2S packet IDs the server remembers per originating server */
+/* Each originating server being tracked costs DEDUPE_WINDOW / 8 bytes */
+#define DEDUPE_WINDOW 1048576
+
+/* Maximum number of originating servers whose recent S2S packet IDs are remembered */
+/* Beyond this, the server that has been heard from least recently is forgotten */
+#define DEDUPE_ORIGINS 64
 
 /* The name of the application's default channel */
 /* Upon login, every client will send a join request for this channel */
@@ -0,0 +1,185 @@
+/*
+ * registry.c
+ *
+ * Implementation of the registry of channel names; see registry.h. The entries
+ * live in pages of PAGE_SIZE that are allocated as the IDs grow and are never
+ * moved, so the name and reference count of an ID in use are reached without
+ * the lock. A hashmap indexes the entries by name; it, the list of freed IDs
+ * and the creation of pages are guarded by a read-write lock. Dropping the last
+ * reference takes the lock for writing and checks the count again, since the
+ * name may have been looked up meanwhile.
+ */
+
+#define _GNU_SOURCE
+#include "registry.h"
+#include "hashmap.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define PAGE_BITS 10
+#define PAGE_SIZE (1 << PAGE_BITS)
+#define MAX_PAGES (RG_MAX_NAMES / PAGE_SIZE)
+
+typedef struct {
+    int id;
+    int refs;
+    int live;                       /* 1 while a name has the ID */
+    int next_free;                  /* next freed ID, while this one is free */
+    char name[CHANNEL_MAX];
+} Entry;
+
+#define ENTRY(id) (&pages[(id) >> PAGE_BITS][(id) & (PAGE_SIZE - 1)])
+
+static Entry *pages[MAX_PAGES];
+static HashMap *by_name = NULL;     /* name -> entry */
+static int next_id = 0;             /* IDs below this have been handed out */
+static int free_ids = -1;           /* head of the list of freed IDs */
+static long count = 0L;
+static pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+
+int rg_init(void) {
+    if ((by_name = hm_create(100L, 0.0f)) == NULL)
+        return 0;
+    return 1;
+}
+
+void rg_shutdown(void) {
+    int i;
+
+    if (by_name != NULL)
+        hm_destroy(by_name, NULL);
+    by_name = NULL;
+    for (i = 0; i < MAX_PAGES && pages[i] != NULL; i++) {
+        free(pages[i]);
+        pages[i] = NULL;
+    }
+    next_id = 0;
+    free_ids = -1;
+    count = 0L;
+}
+
+/*
+ * local function to return `name' cut down to CHANNEL_MAX - 1 characters, copied
+ * into `buf' if it is longer
+ */
+static char *truncated(const char *name, char *buf) {
+    if (strnlen(name, CHANNEL_MAX) < CHANNEL_MAX)
+        return (char *)name;
+    memcpy(buf, name, CHANNEL_MAX - 1);
+    buf[CHANNEL_MAX - 1] = '\0';
+    return buf;
+}
+
+/*
+ * local function to find the entry of `name'; the lock must be held
+ */
+static Entry *find(const char *name) {
+    char buf[CHANNEL_MAX];
+    Entry *e;
+
+    if (!hm_get(by_name, truncated(name, buf), (void **)&e))
+        return NULL;
+    return e;
+}
+
+int rg_intern(const char *name) {
+    char buf[CHANNEL_MAX];
+    Entry *e;
+    int id;
+
+    if ((id = rg_acquire(name)) >= 0)
+        return id;
+
+    pthread_rwlock_wrlock(&lock);
+    /* another thread may have interned the name since */
+    if ((e = find(name)) != NULL) {
+        __atomic_add_fetch(&e->refs, 1, __ATOMIC_ACQ_REL);
+        pthread_rwlock_unlock(&lock);
+        return e->id;
+    }
+    if (free_ids >= 0) {
+        id = free_ids;
+        e = ENTRY(id);
+        free_ids = e->next_free;
+    } else {
+        if (next_id == RG_MAX_NAMES)
+            goto error;
+        if (pages[next_id >> PAGE_BITS] == NULL &&
+            (pages[next_id >> PAGE_BITS] = (Entry *)malloc(PAGE_SIZE * sizeof(Entry))) == NULL)
+            goto error;
+        id = next_id++;
+        e = ENTRY(id);
+        e->id = id;
+    }
+    strcpy(e->name, truncated(name, buf));
+    e->refs = 1;
+    e->live = 1;
+    if (!hm_put(by_name, e->name, e, NULL)) {
+        e->live = 0;
+        e->next_free = free_ids;
+        free_ids = id;
+        goto error;
+    }
+    count++;
+    pthread_rwlock_unlock(&lock);
+    return id;
+
+error:
+    pthread_rwlock_unlock(&lock);
+    return -1;
+}
+
+int rg_acquire(const char *name) {
+    Entry *e;
+
+    pthread_rwlock_rdlock(&lock);
+    if ((e = find(name)) != NULL)
+        __atomic_add_fetch(&e->refs, 1, __ATOMIC_ACQ_REL);
+    pthread_rwlock_unlock(&lock);
+    return (e != NULL) ? e->id : -1;
+}
+
+int rg_lookup(const char *name) {
+    Entry *e;
+
+    pthread_rwlock_rdlock(&lock);
+    e = find(name);
+    pthread_rwlock_unlock(&lock);
+    return (e != NULL) ? e->id : -1;
+}
+
+void rg_hold(int id) {
+    __atomic_add_fetch(&ENTRY(id)->refs, 1, __ATOMIC_ACQ_REL);
+}
+
+void rg_release(int id) {
+    Entry *e = ENTRY(id);
+    void *dummy;
+
+    if (__atomic_sub_fetch(&e->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+    /* nobody can take a reference while the lock is held; check nobody did before */
+    pthread_rwlock_wrlock(&lock);
+    if (e->live && __atomic_load_n(&e->refs, __ATOMIC_ACQUIRE) == 0) {
+        (void)hm_remove(by_name, e->name, &dummy);
+        e->live = 0;
+        e->next_free = free_ids;
+        free_ids = id;
+        count--;
+    }
+    pthread_rwlock_unlock(&lock);
+}
+
+const char *rg_name(int id) {
+    return ENTRY(id)->name;
+}
+
+long rg_size(void) {
+    long n;
+
+    pthread_rwlock_rdlock(&lock);
+    n = count;
+    pthread_rwlock_unlock(&lock);
+    return n;
+}
@@ -0,0 +1,90 @@
+/*
+ * registry.h
+ *
+ * Interface for the process-wide registry of channel names. Every channel name
+ * known to the server, whether it has subscribers on some worker or is routed
+ * to neighboring servers, is interned here once and given a small integer ID;
+ * the server's tables of channels are indexed by the ID rather than by the name
+ * (see idmap.h), so a name is hashed once, where a request enters the server.
+ *
+ * The IDs are dense: an ID is handed out again once its name is forgotten, and
+ * a name is forgotten as soon as nothing holds a reference to it. Each table
+ * entry indexed by an ID holds a reference, as does each piece of mail carrying
+ * one between workers, so that the ID keeps naming the same channel for as
+ * long as it is in use. The registry may be used by every thread at once, but
+ * takes a lock to do so; the server's workers keep the IDs of the names they
+ * look up often, and messages between them carry their channel's name to check
+ * the ID against instead of a reference.
+ */
+
+#ifndef _REGISTRY_H_
+#define _REGISTRY_H_
+
+#include "duckchat.h"
+
+/*
+ * maximum number of names the registry holds at once; interning fails past these
+ */
+#define RG_MAX_NAMES (1 << 22)
+
+/*
+ * sets up the registry; must be called before any other function
+ *
+ * returns 1 if successful, 0 if not (malloc failure)
+ */
+int rg_init(void);
+
+/*
+ * forgets every name, and returns the storage of the registry to the heap
+ */
+void rg_shutdown(void);
+
+/*
+ * interns the channel name `name', truncated to CHANNEL_MAX - 1 characters,
+ * giving it an ID if it has none; a reference to the ID is taken for the caller
+ *
+ * returns the ID, or -1 if not (malloc failure, or RG_MAX_NAMES reached)
+ */
+int rg_intern(const char *name);
+
+/*
+ * looks up the ID of the channel name `name'; a reference to the ID is taken for
+ * the caller if it is found
+ *
+ * returns the ID, or -1 if the name is not interned
+ */
+int rg_acquire(const char *name);
+
+/*
+ * looks up the ID of the channel name `name', without taking a reference; the ID
+ * may only be used to look up entries of tables that hold references themselves,
+ * by the thread that modifies the table; an entry found under it then belongs to
+ * the same name
+ *
+ * returns the ID, or -1 if the name is not interned
+ */
+int rg_lookup(const char *name);
+
+/*
+ * takes another reference to `id'; the caller must already hold one
+ */
+void rg_hold(int id);
+
+/*
+ * drops a reference to `id'; the name is forgotten, and the ID freed for reuse,
+ * when the last reference is dropped
+ */
+void rg_release(int id);
+
+/*
+ * returns the name of `id'; the caller must hold a reference, or a table entry
+ * must, for as long as the name is used
+ */
+const char *rg_name(int id);
+
+/*
+ * returns the number of names currently interned
+ */
+long rg_size(void);
+
+#endif /* _REGISTRY_H_ */
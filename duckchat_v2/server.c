@@ -9,7 +9,26 @@
  * This new version now supports server-to-server communication. Multiple servers can now
  * be run in parallel, reducing individual server load and improving response time(s).
  *
- * Usage: ./server domain_name port_number [domain_name port_number] ...
+ * Usage: ./server [-w workers] [-c] [-p] [-r readers] [-f helpers] [-b budget] [-l level] domain_name port_number [domain_name port_number] ...
+ *     -w workers: Optional; the number of worker threads to run (default 1). Each worker
+ *                 has its own socket bound to the same port with SO_REUSEPORT and owns
+ *                 the users whose packets the kernel steers to that socket.
+ *     -c: Optional; gives every channel to one worker, which holds all of its subscribers
+ *         and sends all of its messages; the other workers pass their clients' joins and
+ *         leaves on to it.
+ *     -p: Optional; pipelines every worker, giving it an ingress thread that receives and
+ *         validates its packets and an egress thread that sends its fan-out batches.
+ *     -r readers: Optional; the number of reader threads to run (default 0). While the
+ *                 server has no neighbors, they answer the clients' LIST, WHO and VERIFY
+ *                 requests from snapshots the workers publish of their shards.
+ *     -f helpers: Optional; the number of fan-out helper threads per worker (default 0).
+ *                 They send a message to a channel with at least FANOUT_THRESHOLD of
+ *                 the worker's subscribers together with the worker, each part of it.
+ *     -b budget: Optional; the number of recipients a worker sends to per turn of its event
+ *                loop (default FANOUT_BUDGET, 0 for no limit), per thread sending. A message
+ *                to more is finished in later turns, between the packets arriving meanwhile.
+ *     -l level: Optional; the log level, one of error, warn, info or debug (default info).
+ *               Packet traffic is logged at info, removed users and servers at warn.
  *     domain_name: The host address this server will bind to.
  *     port_number: The port number this server will listen on.
  *     The following pair(s) of arguments are optional; they are the hostname and port numbers
@@ -19,9 +38,6 @@
  * Lots of help about basic socket programming received from Beej's Guide to Socket Programming:
  * https://beej.us/guide/bgnet/html/multi/index.html
  *
- * Help on random number generation with /dev/urandom consulted from:
- * http://www.cs.yale.edu/homes/aspnes/pinewiki/C(2f)Randomization.html
- * 
  * Implementations for the LinkedList and HashMap ADTs that this server uses were borrowed from
  * professor Joe Sventek's ADT library on github (https://github.com/jsventek/ADTs).
  * These implementations are not my own.
@@ -35,193 +51,334 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
-#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <pthread.h>
+#include "addrmap.h"
+#include "bitset.h"
+#include "dedupe.h"
 #include "duckchat.h"
+#include "eventloop.h"
+#include "fanout.h"
+#include "fanpool.h"
 #include "hashmap.h"
+#include "egress.h"
+#include "epoch.h"
+#include "idmap.h"
+#include "ingress.h"
 #include "linkedlist.h"
+#include "log.h"
+#include "mailbox.h"
+#include "membership.h"
+#include "pktring.h"
 #include "properties.h"
+#include "registry.h"
+#include "slab.h"
+#include "snapshot.h"
+#include "timerwheel.h"
+
+/*
+ * A structure to represent one of the server's worker threads. Every worker owns a
+ * shard of the users and channels, which only it ever modifies; other workers may
+ * read the shard while holding its lock. Queries about other shards read the snapshot
+ * the worker publishes after every batch that changed its shard. Work that needs to
+ * reach users on other shards, or that touches the S2S state owned by worker 0, is
+ * passed along as mail.
+ */
+typedef struct {
+    int id;                     /* Index of the worker, 0 is the main thread */
+    int socket_fd;              /* The worker's own socket, bound to the server's port */
+    EventLoop *loop;            /* Event loop driving the worker */
+    PktRing *ring;              /* Ring of packet buffers the worker receives into */
+    Fanout *fanout;             /* The worker's fan-out engine */
+    Ingress *ingress;           /* Receives and validates the worker's packets, see pipelined */
+    Egress *egress;             /* Sends the fan-out engine's batches, ditto */
+    FanPool *pool;              /* Helps send to large channels, see fanout_helpers */
+    Snapshot *snapshot;         /* Read-only copy of the shard, published for other threads */
+    HashMap *changed_channels;  /* Names of the channels changed since the snapshot was taken */
+    HashMap *changed_users;     /* Usernames logged in or out since then */
+    int rebuild;                /* Set if a change could not be noted; see publish_snapshot */
+    Mailbox *inbox;             /* Mail sent to the worker by the other workers */
+    AddrMap *users;             /* The worker's shard of users, keyed by address */
+    HashMap *names;             /* The same users, keyed by username */
+    IdMap *channels;            /* The worker's shard of channels, see channel_affinity */
+    HashMap *resolved;          /* IDs of the channel names the worker looked up lately */
+    AddrMap *guests;            /* Clients of other workers subscribed to its channels, ditto */
+    TimerWheel *wheel;          /* Expires the worker's inactive users, and on worker 0 servers */
+    pthread_rwlock_t lock;      /* Held for writing by the owner while it modifies its shard */
+    pthread_t thread;           /* The worker's thread */
+} Worker;
+
+/*
+ * A structure to represent one of the server's reader threads. A reader owns no state;
+ * it answers the queries the workers post to it from their published snapshots.
+ */
+typedef struct {
+    int id;                     /* Index of the reader */
+    EventLoop *loop;            /* Event loop driving the reader */
+    Mailbox *inbox;             /* Queries posted by the workers */
+    pthread_t thread;           /* The reader's thread */
+} Reader;
+
+/*
+ * A structure to represent a piece of mail passed between workers.
+ */
+typedef struct {
+    int type;                   /* Type of the mail, one of the MAIL_ codes below */
+    int forward;                /* MAIL_SAY: also forward the message to neighboring servers */
+    int channel_id;             /* MAIL_SAY, _JOIN, _LEAVE, _ENROL, _RESIGN: the channel; or -1 */
+    long len;                   /* MAIL_PACKET: length of the packet */
+    char *data;                 /* MAIL_PACKET: heap copy of a packet too large to fit inline */
+    struct sockaddr_in from;    /* Address of the client or server the request came from */
+    union {
+        struct {
+            char channel[CHANNEL_MAX];
+            char username[USERNAME_MAX];
+            char text[SAY_MAX];
+        } say;                  /* MAIL_SAY: the message and its channel's name; */
+                                /* MAIL_ENROL, _VERIFY: the username; MAIL_WHO: the channel's name */
+        char packet[sizeof(struct request_s2s_say)];  /* MAIL_PACKET: inline copy */
+    } u;
+} Mail;
+
+#define MAIL_PACKET 0           /* A packet for worker 0 to handle as if it received it */
+#define MAIL_SAY 1              /* A message to broadcast to the worker's local subscribers */
+#define MAIL_JOIN 2             /* A channel was joined; subscribe the server to it */
+#define MAIL_LEAVE 3            /* A channel was left; leave its sub-tree if this server is a leaf */
+#define MAIL_LIST 4             /* A client's list request; reply with every channel */
+#define MAIL_WHO 5              /* A client's who request; reply with every user on the channel */
+#define MAIL_ENROL 6            /* A client of the sender joined a channel the worker owns */
+#define MAIL_RESIGN 7           /* A client of the sender left a channel the worker owns */
+#define MAIL_DEPART 8           /* A client of the sender logged out; drop all its subscriptions */
+#define MAIL_VERIFY 9           /* A client's verify request; reply whether the username is taken */
 
 /* String for displaying this server's full address */
 static char server_addr[IP_MAX];
-/* List of IDs from most recently received packets */
-static long id_cache[MSGQ_SIZE];
-static int curr_index = 0;
+/* IDs of the most recently received and sent S2S packets, for detecting loops */
+/* An ID is this server's origin ID and the sequence number of the packet, see dedupe.h */
+/* Only accessed by worker 0 */
+static Dedupe *id_cache = NULL;
+static uint32_t origin_id = 0;
+static uint32_t next_seq = 0;
+/* Array of all the server's workers, and the number of them */
+static Worker *workers = NULL;
+static int nworkers = 1;
+/* Set if every channel is owned by one worker, see channel_owner(), which holds all of */
+/* its subscribers; the clients of the other workers are kept there as guests */
+/* Otherwise every worker holds its own clients' subscriptions to any channel */
+static int channel_affinity = 0;
+/* Set if every worker runs as a pipeline of three stages: its ingress thread receives */
+/* and validates packets, the worker's own thread handles them, and its egress thread */
+/* sends the fan-out batches; the stages pass packets through lock-free SPSC rings */
+static int pipelined = 0;
+/* Number of fan-out helper threads every worker has; a message to a channel with at */
+/* least FANOUT_THRESHOLD of the worker's subscribers is split into chunks, which the */
+/* worker and its helpers send in parallel, each taking chunks left to the others */
+static int fanout_helpers = 0;
+/* Number of recipients every worker's fan-out engine, and each of its helpers, sends to */
+/* per turn of the event loop; a broadcast or S2S flood to more is left for later turns, */
+/* so the packets arriving meanwhile are handled in between; 0 for no limit */
+static long fanout_budget = FANOUT_BUDGET;
+/* Array of the server's reader threads, and the number of them; while the server has */
+/* no neighbors, whose S2S state only worker 0 may use, they answer the clients' LIST, */
+/* WHO and VERIFY requests, reading only the snapshots the workers publish of their */
+/* shards, never the shards themselves */
+static Reader *readers = NULL;
+static int nreaders = 0;
+/* Set once the server has no neighboring servers; they are only ever removed */
+static int standalone = 0;
+/* Frees the snapshots the workers replace once no thread can still be reading them */
+/* Workers use the slots 0..nworkers-1 of the epoch domain, readers the ones after */
+static Epoch *epochs = NULL;
+/* The worker the calling thread runs */
+static __thread Worker *self = NULL;
+/* The reader the calling thread runs, if it runs one instead */
+static __thread Reader *reader = NULL;
+/* The calling thread's slot in the epoch domain */
+static __thread int epoch_slot = -1;
+/* The reader the calling worker posts its next query to */
+static __thread int next_reader = 0;
 /* File descriptor for the socket to use */
-static int socket_fd = -1;
-/* HashMap of all users currently logged on */
-/* Maps the user's IP address in a string to the user struct */
-static HashMap *users = NULL;
-/* HashMap of all the channels currently available */
-/* Maps the channel name to a linked list of pointers of all users on the channel */
-static HashMap *channels = NULL;
-/* Hashmap of all the neighboring servers */
-/* Maps the server's IP address in a string to the server struct */
-static HashMap *neighbors = NULL;
-/* HashMap of all channels neighboring servers are subscribed to */
-/* Acts as a routing table; maps a list of listening servers to each existing channel */
-static HashMap *r_table = NULL;
+static __thread int socket_fd = -1;
+/* Event loop driving packet handling and the periodic maintenance jobs */
+static __thread EventLoop *loop = NULL;
+/* Ring of preallocated buffers that received packets are batched into */
+static __thread PktRing *ring = NULL;
+/* Engine for sending one packet to many clients or servers at once */
+static __thread Fanout *fanout = NULL;
+/* Map of all users currently logged on to this worker */
+/* Maps the user's address (see am_key()) to the user struct */
+static __thread AddrMap *users = NULL;
+/* Index of the users logged on to this worker by username */
+/* Maps the username to a user; others with the same name are chained through it */
+static __thread HashMap *names = NULL;
+/* Map of all the channels available on this worker */
+/* Maps the channel's ID (see registry.h) to the channel, holding the users subscribed to it */
+/* Every channel holds a reference to its ID */
+static __thread IdMap *channels = NULL;
+/* Channel names this worker looked up lately, mapped to their IDs, see resolve_channel() */
+/* Each holds a reference to its ID, so that the name keeps it */
+static __thread HashMap *resolved = NULL;
+/* Map of the clients of other workers subscribed to channels this worker owns */
+/* Maps the client's address to a user record holding only those subscriptions */
+/* Only used with channel_affinity */
+static __thread AddrMap *guests = NULL;
+/* The worker's timer wheel, ticking once a second on the monotonic clock */
+static __thread TimerWheel *wheel = NULL;
+/* Map of all the neighboring servers */
+/* Maps the server's address (see am_key()) to the server struct */
+/* Only accessed by worker 0 once the workers are running */
+static AddrMap *neighbors = NULL;
+/* HashMap of the addresses of hosts given by name, resolved once */
+/* Maps the 'host:port' string to its socket address */
+/* Only accessed by worker 0 once the workers are running */
+static HashMap *addr_cache = NULL;
+/* Map of all channels neighboring servers are subscribed to */
+/* Acts as a routing table; maps the set of listening servers to each existing channel's ID */
+/* A server is a member of the sets by its index, see bitset.h; each set holds a reference to the ID */
+/* Only accessed by worker 0 */
+static IdMap *r_table = NULL;
+/* The neighboring servers by index, and the set of the indices in use */
+/* Only accessed by worker 0 once the workers are running */
+static struct server *neighbor_index[MAX_NEIGHBORS];
+static BitSet live_neighbors;
+
+static void handle_mail(Mail *mail);
+static void handle_query(Mail *mail);
 
 /*
  * A structure to represent a user logged into the server.
  */
-typedef struct {
-    struct sockaddr_in *addr;   /* The client's address to send packets to */
-    LinkedList *channels;       /* List of channel names user is listening to */
-    char *ip_addr;              /* Full IP address of client in string format */
-    char *username;             /* The user's username */
-    short last_min;             /* Clock minute of last received packet from this client */
+typedef struct user {
+    struct sockaddr_in addr;    /* The client's address to send packets to */
+    Subscription *subs;         /* The user's subscriptions to channels, see membership.h */
+    struct user *same_name;     /* Next user on this worker with the same username */
+    uint64_t shards;            /* Other workers holding the user as a guest, by worker ID */
+    Timer timer;                /* Logs the client out REFRESH_RATE minutes after its last packet */
+    char ip_addr[IP_MAX];       /* Full IP address of client in string format */
+    char username[USERNAME_MAX];    /* The user's username */
 } User;
 
 /*
  * A structure to represent a neighboring server.
  */
-typedef struct {
-    struct sockaddr_in *addr;   /* The address of the neighboring server */
-    char *ip_addr;              /* Full IP address of server in string format */
-    short last_min;             /* Clock minute of last received S2S request */
+typedef struct server {
+    struct sockaddr_in addr;    /* The address of the neighboring server */
+    int index;                  /* Index of the server in the routing table's sets */
+    Timer timer;                /* Removes the server REFRESH_RATE minutes after its last S2S request */
+    char ip_addr[IP_MAX];       /* Full IP address of server in string format */
 } Server;
 
+/* Users and servers are allocated from the slabs, each in a single object; see slab.h */
+static SlabType user_type = SLAB_TYPE("user", User);
+static SlabType server_type = SLAB_TYPE("server", Server);
+/* The routing table's sets of listening servers are allocated from the slabs too */
+static SlabType route_type = SLAB_TYPE("route", BitSet);
+
+static void logout_user(User *user);
+static void user_expired(void *arg);
+static void server_expired(void *arg);
+
+/*
+ * Formats the specified address into 'buf' as a string in the format '127.0.0.1:8080';
+ * 'buf' must hold at least IP_MAX bytes. Returns 'buf'.
+ */
+static char *format_addr(const struct sockaddr_in *addr, char *buf) {
+
+    char ip[INET_ADDRSTRLEN];
+
+    inet_ntop(AF_INET, &addr->sin_addr, ip, sizeof(ip));
+    sprintf(buf, "%s:%d", ip, ntohs(addr->sin_port));
+    return buf;
+}
+
 /*
  * Creates a new instance of a user logged in the server by allocating memory and returns
- * a pointer to the new user instance. The user is created given an IP address in a string,
- * the username, and the addressing information to send packets to. Returns pointer to new
- * user instance if creation successful, or NULL if not (malloc() error).
+ * a pointer to the new user instance. The user is created given the username and the
+ * addressing information to send packets to; the address is formatted into a string
+ * once here, for logging. The whole record is a single object from the user slab.
+ * Returns pointer to new user instance if creation successful, or NULL if not (malloc()
+ * error).
  */
-static User *malloc_user(const char *ip, const char *name, struct sockaddr_in *addr) {
+static User *malloc_user(const char *name, struct sockaddr_in *addr) {
 
-    struct tm *timestamp;
-    time_t timer;
     User *new_user;
    
-    /* Allocate memory for the struct itself */
-    if ((new_user = (User *)malloc(sizeof(User))) != NULL) {
-
-        /* Allocate memory for the user members */
-        new_user->addr = (struct sockaddr_in *)malloc(sizeof(struct sockaddr_in));
-        new_user->channels = ll_create();
-        new_user->ip_addr = (char *)malloc(strlen(ip) + 1);
-        new_user->username = (char *)malloc(strlen(name) + 1);
-
-        /* Do error checking for malloc(), free all members and return NULL if failed */
-        if (new_user->addr == NULL || new_user->channels == NULL || 
-            new_user->ip_addr == NULL || new_user->username == NULL) {
-            if (new_user->addr != NULL)
-                free(new_user->addr);
-            if (new_user->channels != NULL)
-                ll_destroy(new_user->channels, free);
-            if (new_user->ip_addr != NULL)
-                free(new_user->ip_addr);
-            if (new_user->username != NULL)
-                free(new_user->username);
-            free(new_user);
-            return NULL;
-        }
+    /* Allocate the record, with its address and strings inline */
+    if ((new_user = (User *)sl_alloc(&user_type)) != NULL) {
 
         /* Initialize all the members, return the pointer */
-        *new_user->addr = *addr;
-        strcpy(new_user->ip_addr, ip);
-        strcpy(new_user->username, name);
-        time(&timer);
-        timestamp = localtime(&timer);
-        new_user->last_min = timestamp->tm_min;
+        new_user->addr = *addr;
+        new_user->subs = NULL;
+        new_user->same_name = NULL;
+        new_user->shards = 0ULL;
+        tw_init(&new_user->timer, user_expired, new_user);
+        format_addr(addr, new_user->ip_addr);
+        snprintf(new_user->username, sizeof(new_user->username), "%s", name);
     }
 
     return new_user;    
 }
 
 /*
- * Updates the time of the specified user's last sent packet to now. Should be
- * invoked every time a packet is received from a connected client.
+ * Pushes the expiry of the specified user back to REFRESH_RATE minutes from now. Should
+ * be invoked every time a packet is received from a connected client; the time is the
+ * wheel's, so the clock is not read.
  */
 static void update_user_time(User *user) {
     
-    struct tm *timestamp;
-    time_t timer;
-
-    if (user != NULL) {
-        /* Retrieve current time, update user record */
-        time(&timer);
-        timestamp = localtime(&timer);
-        user->last_min = timestamp->tm_min;
-    }
+    if (user != NULL)
+        tw_schedule(wheel, &user->timer, (REFRESH_RATE * 60UL));
 }
 
 /*
  * Destroys the user instance by freeing & returning all memory it reserved back
- * to the heap.
+ * to the heap. The user must no longer be subscribed to any channels.
  */
 static void free_user(User *user) {
     
     if (user != NULL) {
-        /* Free all reserved memory within instance */
-        free(user->addr);
-        ll_destroy(user->channels, free);
-        free(user->ip_addr);
-        free(user->username);
-        free(user);
+        /* Stop the user's timer, return the record to the slab */
+        tw_cancel(&user->timer);
+        sl_free(&user_type, user);
     }
 }
 
 /*
  * Creates a new instance of a connected server by allocating memory and returns a pointer to
- * the new server instance. The server is created given an IP address in a string and the
- * addressing information to send packets to. Returns a pointer to new server instance if creation
- * was successful, or NULL if not (malloc() error).
+ * the new server instance. The server is created given the addressing information to send
+ * packets to; the address is formatted into a string once here, for logging and for the
+ * S2S packets that carry it. The whole record is a single object from the server slab.
+ * Returns a pointer to new server instance if creation was successful, or NULL if not
+ * (malloc() error).
  */
-static Server *malloc_server(const char *ip, struct sockaddr_in *addr) {
+static Server *malloc_server(struct sockaddr_in *addr) {
 
-    struct tm *timestamp;
-    time_t timer;
     Server *new_server;
 
-    /* Allocate memory for the struct itself */
-    if ((new_server = (Server *)malloc(sizeof(Server))) != NULL) {
-
-        /* Allocate memory for the server members */
-        new_server->addr = (struct sockaddr_in *)malloc(sizeof(struct sockaddr_in));
-        new_server->ip_addr = (char *)malloc(strlen(ip) + 1);
-
-        /* Do error checking for malloc(), free memory if failed */
-        if (new_server->addr == NULL || new_server->ip_addr == NULL) {
-            if (new_server->addr != NULL)
-                free(new_server->addr);
-            if (new_server->ip_addr != NULL)
-                free(new_server->ip_addr);
-            free(new_server);
-            return NULL;
-        }
+    /* Allocate the record, with its address and string inline */
+    if ((new_server = (Server *)sl_alloc(&server_type)) != NULL) {
 
         /* Initialize all the members, return the pointer */
-        *new_server->addr = *addr;
-        strcpy(new_server->ip_addr, ip);
-        time(&timer);
-        timestamp = localtime(&timer);
-        new_server->last_min = timestamp->tm_min;
+        new_server->addr = *addr;
+        tw_init(&new_server->timer, server_expired, new_server);
+        format_addr(addr, new_server->ip_addr);
     }
 
     return new_server;
 }
 
 /*
- * Updates the time of the specified server's last received S2S request to now. Needed
- * for soft-state server tracking to prevent network failures.
+ * Pushes the expiry of the specified server back to REFRESH_RATE minutes from now.
+ * Needed for soft-state server tracking to prevent network failures.
  */
 static void update_server_time(Server *server) {
     
-    struct tm *timestamp;
-    time_t timer;
-
-    if (server != NULL) {
-        /* Retrieve current time, update server record */
-        time(&timer);
-        timestamp = localtime(&timer);
-        server->last_min = timestamp->tm_min;
-    }
+    if (server != NULL)
+        tw_schedule(wheel, &server->timer, (REFRESH_RATE * 60UL));
 }
 
 /*
@@ -231,13 +388,33 @@ static void update_server_time(Server *server) {
 static void free_server(Server *server) {
     
     if (server != NULL) {
-        /* Free all memory within the instance */
-        free(server->addr);
-        free(server->ip_addr);
-        free(server);
+        /* Stop the server's timer, return the record to the slab */
+        tw_cancel(&server->timer);
+        sl_free(&server_type, server);
     }
 }
 
+/*
+ * Adds the resolved address of the specified 'host:port' string into the address
+ * cache, unless the cache is full. Returns 1 if successful, 0 if not (malloc() error).
+ */
+static int cache_addr(const char *ip_addr, struct sockaddr_in *addr) {
+
+    struct sockaddr_in *copy;
+
+    if (hm_size(addr_cache) >= ADDR_CACHE_SIZE || hm_containsKey(addr_cache, (char *)ip_addr))
+        return 1;
+    if ((copy = (struct sockaddr_in *)malloc(sizeof(struct sockaddr_in))) == NULL)
+        return 0;
+    *copy = *addr;
+    if (!hm_put(addr_cache, (char *)ip_addr, copy, NULL)) {
+        free(copy);
+        return 0;
+    }
+
+    return 1;
+}
+
 /*
  * Locates all of the specified neighboring server(s), and checks to see if they exist.
  * Then creates a server struct for each neighbor and adds it into the neighboring
@@ -247,9 +424,9 @@ static int add_neighbors(char *args[], int n) {
     
     struct hostent *host_end;
     struct sockaddr_in addr;
-    Server *server;
-    char buffer[128];
-    int i, port_num;
+    Server *server, *previous;
+    char buffer[256];
+    int i, port_num, next_index = 0;
     
     /* If no args given, do nothing */
     if (n == 0)
@@ -273,11 +450,23 @@ static int add_neighbors(char *args[], int n) {
         addr.sin_family = AF_INET;
         memcpy((char *)&addr.sin_addr, (char *)host_end->h_addr_list[0], host_end->h_length);
         addr.sin_port = htons(port_num);
-        sprintf(buffer, "%s:%d", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
-        /* Create the server struct, add it into the hashmap */
-        if ((server = malloc_server(buffer, &addr)) == NULL)
+        /* Create the server struct, add it into the map */
+        if ((server = malloc_server(&addr)) == NULL)
             return 0;
-        if (!hm_put(neighbors, buffer, server, NULL))
+        if (!am_put(neighbors, am_key(&addr), server, (void **)&previous))
+            return 0;
+        /* A neighbor given twice keeps the index it was first given */
+        if (previous != NULL) {
+            server->index = previous->index;
+            free_server(previous);
+        } else {
+            server->index = next_index++;
+        }
+        neighbor_index[server->index] = server;
+        bs_add(&live_neighbors, server->index);
+        /* Remember the address the neighbor was given by */
+        snprintf(buffer, sizeof(buffer), "%s:%s", args[i], args[i + 1]);
+        if (!cache_addr(buffer, &addr))
             return 0;
     }
     
@@ -285,1513 +474,2184 @@ static int add_neighbors(char *args[], int n) {
 }
 
 /*
- * Adds the specified ID into the message ID cache.
+ * Starts the inactivity timers of the neighboring servers on worker 0's timer wheel;
+ * the neighbors are added before the workers exist, so their timers start here.
  */
-static void queue_id(long id) {
-    
-    id_cache[curr_index++] = id;
-    if (curr_index >= MSGQ_SIZE)
-        curr_index = 0;
+static void start_neighbor_timers(void) {
+
+    Server *server;
+    AMIter it;
+
+    am_iterInit(neighbors, &it);
+    while (am_iterNext(&it, (void **)&server))
+        update_server_time(server);
 }
 
 /*
- * Generates and returns a random long integer; used for the ID member inside
- * several of the S2S packets. Generated by reading bytes from /dev/urandom.
+ * Generates and returns a new ID for the ID member inside several of the S2S
+ * packets; made of this server's origin ID and the next sequence number. The ID
+ * is recorded as seen, so the packet is recognized if it loops back.
  */
 static long generate_id(void) {
     
-    FILE *fd;
-    int res;
-    long num;
-    
-    /* Opens and reads bytes from /dev/urandom */
-    if ((fd = fopen("/dev/urandom", "r")) == NULL)
-        return 10000L;
-    if ((res = fread(&num, sizeof(num), 1, fd)) < 0)
-        return 20000L;
-    /* Close descriptor, queue the id, return number */
-    fclose(fd);
-    queue_id(num);
+    uint64_t id = dd_id(origin_id, ++next_seq);
 
-    return num;
+    (void)dd_insert(id_cache, id);
+    return (long)id;
 }
 
 /*
- * Verifies whether the specified ID is unique; compares the ID with all the IDs
- * inside the server's ID cache. Returns 1 if unique, 0 if not (is a duplicate,
- * indicating a loop).
+ * Verifies whether the specified ID is unique, and records it in the ID cache.
+ * Returns 1 if unique, 0 if not (is a duplicate, indicating a loop).
  */
 static int id_unique(long id) {
     
-    int i;
-
-    for (i = 0; i < MSGQ_SIZE; i++)
-        if (id_cache[i] == id)
-            return 0;   /* Duplicate found, return 0 */
-
-    return 1;
+    return dd_insert(id_cache, (uint64_t)id);
 }
 
 /*
- * Allocates and returns a socket address struct of the given ip address to
- * send packets to. The IP address string is expected to be in the format
- * '127.0.0.1:8080'. The caller is responsible for freeing the pointer.
+ * Sets 'addr' to the socket address of the given ip address to send packets to.
+ * The IP address string is expected to be in the format '127.0.0.1:8080'. Numeric
+ * addresses, which is what servers put in their packets, are parsed in place; host
+ * names are looked up in the address cache, and only resolved on a miss. Returns 1
+ * if successful, 0 if the address is malformed or the host could not be located.
  */
-static struct sockaddr_in *get_addr(char *ip_addr) {
+static int get_addr(const char *ip_addr, struct sockaddr_in *addr) {
 
-    struct sockaddr_in *addr;
+    struct sockaddr_in *cached;
     struct hostent *host_end;
-    char hostname[128], port[32];
-    char *res;
+    char hostname[128];
+    const char *res;
     int i;
 
     /* Extract the hostname and port number */
     if ((res = strrchr(ip_addr, ':')) == NULL)
-        return NULL;
-    strcpy(port, res + 1);
-    i = res - ip_addr;
-    strncpy(hostname, ip_addr, i);
+        return 0;
+    if ((i = res - ip_addr) >= (int)sizeof(hostname))
+        return 0;
+    memcpy(hostname, ip_addr, i);
     hostname[i] = '\0';
-
-    /* Locate the hostname, return NULL if not found */
-    if ((host_end = gethostbyname(hostname)) == NULL)
-        return NULL;
-
-    /* Initialize and set the address struct members, return the struct */
-    if ((addr = (struct sockaddr_in *)malloc(sizeof(struct sockaddr_in))) == NULL)
-        return NULL;
     memset(addr, 0, sizeof(*addr));
     addr->sin_family = AF_INET;
+    addr->sin_port = htons(atoi(res + 1));
+
+    /* Numeric address, no need for the resolver */
+    if (inet_pton(AF_INET, hostname, &addr->sin_addr) == 1)
+        return 1;
+    /* Host name resolved before */
+    if (hm_get(addr_cache, (char *)ip_addr, (void **)&cached)) {
+        *addr = *cached;
+        return 1;
+    }
+
+    /* Locate the hostname, return 0 if not found */
+    if ((host_end = gethostbyname(hostname)) == NULL)
+        return 0;
     memcpy((char *)&(addr->sin_addr), (char *)host_end->h_addr_list[0], host_end->h_length);
-    addr->sin_port = htons(atoi(port));
+    (void)cache_addr(ip_addr, addr);
 
-    return addr;
+    return 1;
 }
 
 /*
- * Checks to see if this server is a leaf in the channel sub-tree, given the
- * specified channel name. The server is a leaf if only one neighbor is
- * subscribed, and no clients are currently listening. Returns 1 if is a leaf,
- * or 0 if not.
+ * Picks a neighboring server to send a request to first, and copies the IP addresses
+ * of all the other neighbors into the visitation list 'to_visit' of the request, whose
+ * entries are 'width' bytes apart. Returns the server picked, or NULL if there are no
+ * neighbors; the number of addresses copied is returned in '*count'.
  */
-static int remove_server_leaf(char *channel) {
-    
-    LinkedList *servers, *users;
-    Server *server;
-    int res = 0;
-    struct request_s2s_leave leave_packet;
+static Server *visit_neighbors(char *to_visit, size_t width, int *count) {
 
-    /* No neighbors, do nothing */
-    if (hm_isEmpty(neighbors))
-        return 0;
+    Server *first, *server;
+    AMIter it;
 
-    /* Retrieve the list of subscribed servers */
-    (void)hm_get(r_table, channel, (void **)&servers);
-    if (hm_get(channels, channel, (void **)&users)) {
-        /* Server has no other servers or clients listening */
-        if (ll_size(servers) < 2L && ll_isEmpty(users))
-            res = 1;
-    } else {
-        /* Server has no other servers listening */
-        if (ll_size(servers) < 2L)
-            res = 1;
+    *count = 0;
+    am_iterInit(neighbors, &it);
+    if (!am_iterNext(&it, (void **)&first))
+        return NULL;
+    while (am_iterNext(&it, (void **)&server)) {
+        snprintf(to_visit + (*count) * width, width, "%s", server->ip_addr);
+        (*count)++;
     }
 
-    if (!res)
-        return res;     /* Server not a leaf, return */
+    return first;
+}
 
-    /* Initialize & set S2S leave request packet members */
-    memset(&leave_packet, 0, sizeof(leave_packet));
-    leave_packet.req_type = REQ_S2S_LEAVE;
-    strncpy(leave_packet.req_channel, channel, (CHANNEL_MAX - 1));
+/*
+ * Adds the IP address of every neighboring server, except the one at 'skip', into
+ * the set of servers an S2S request has yet to visit.
+ */
+static void add_neighbor_ips(HashMap *ip_set, const char *skip) {
 
-    /* Remove channel from server subscription list */
-    (void)hm_remove(r_table, channel, (void **)&users);
-    if (ll_isEmpty(users)) {  /* Destroy the stored LL */
-        ll_destroy(users, NULL);
-        return 1;
-    }
-    /* Extract the only neighboring subscribed server */
-    ll_removeFirst(users, (void **)&server);
-    ll_destroy(users, NULL);
+    Server *server;
+    AMIter it;
 
-    /* Send S2S leave request to neighboring server */
-    sendto(socket_fd, &leave_packet, sizeof(leave_packet), 0,
-            (struct sockaddr *)server->addr, sizeof(*server->addr));
-    /* Log the sent packet */
-    fprintf(stdout, "%s %s send S2S LEAVE %s\n",
-            server_addr, server->ip_addr, leave_packet.req_channel);
-    
-    return res;
-}    
+    am_iterInit(neighbors, &it);
+    while (am_iterNext(&it, (void **)&server))
+        if (strcmp(server->ip_addr, skip))
+            if (!hm_containsKey(ip_set, server->ip_addr))
+                (void)hm_put(ip_set, server->ip_addr, NULL, NULL);
+}
 
 /*
- * Floods all the neighboring servers with an S2S JOIN request given the specified
- * channel name and the sender's IP address. The sender is skipped over; no packet
- * needs to be sent back to the sender.
+ * Like visit_neighbors(), but over a non-empty set of IP addresses left to visit;
+ * the first address is returned (it belongs to the set), the others are copied into
+ * the fixed-width entries at 'to_visit' and counted in '*count'.
  */
-static void neighbor_flood_channel(char *channel, char *sender_ip) {
-    
-    Server *server;
-    HMEntry **addrs;
-    struct request_s2s_join join_packet;
-    long i, len = 0L;
+static char *visit_set(HashMap *ip_set, char *to_visit, size_t width, int *count) {
 
-    if (hm_isEmpty(neighbors))
-        return;
+    HMIter it;
+    char *first, *ip;
 
-    /* Get the array of neighboring servers, return if malloc() fails */
-    if ((addrs = hm_entryArray(neighbors, &len)) == NULL) {
-        fprintf(stdout, "%s Failed to flood server(s), memory allocation failed\n",
-                server_addr);
-        return;
+    *count = 0;
+    hm_iterInit(ip_set, &it);
+    if (!hm_iterNext(&it, &first, NULL))
+        return NULL;
+    while (hm_iterNext(&it, &ip, NULL)) {
+        strncpy(to_visit + (*count) * width, ip, (width - 1));
+        (*count)++;
     }
 
-    /* Initializes & sets the packet's contents */
-    memset(&join_packet, 0, sizeof(join_packet));
-    join_packet.req_type = REQ_S2S_JOIN;
-    strncpy(join_packet.req_channel, channel, (CHANNEL_MAX - 1));
+    return first;
+}
 
-    /* Send the packet to each of the connecting servers */
-    /* Do not send it to the server that it received from */
-    for (i = 0L; i < len; i++) {
-        server = (Server *)hmentry_value(addrs[i]);
-        if (strcmp(server->ip_addr, sender_ip)) {
-            sendto(socket_fd, &join_packet, sizeof(join_packet), 0,
-                    (struct sockaddr *)server->addr, sizeof(*server->addr));
-            /* Log the sent packet */
-            fprintf(stdout, "%s %s send S2S JOIN %s\n",
-                    server_addr, server->ip_addr, channel);
-        }
-    }
+/*
+ * Returns the IP address, in string format, of the server an S2S packet was received
+ * from; a neighboring server is returned in '*sender' and its stored address string
+ * is used, otherwise '*sender' is set to NULL and the address is formatted into 'buf'.
+ */
+static char *sender_ip(struct sockaddr_in *from, Server **sender, char *buf) {
 
-    free(addrs);
+    if (am_get(neighbors, am_key(from), (void **)sender))
+        return (*sender)->ip_addr;
+    *sender = NULL;
+    return format_addr(from, buf);
 }
 
 /*
- * Sends a S2S KEEP ALIVE packet to each of the neighboring servers; this
- * will prevent the neighboring servers from being removed fom inactivity.
+ * Locks the specified worker's shard for reading. Workers are the only writers of
+ * their own shards, so a worker reads its own shard without taking the lock. Only
+ * workers read other shards; readers read their snapshots.
  */
-static void flood_s2s_keep_alive(void) {
-
-    Server *server;
-    HMEntry **s_list;
-    long i, len = 0L;
-    struct request_s2s_keep_alive kalive_packet;
+static void shard_read_lock(Worker *w) {
 
-    /* No neighbors, do nothing */
-    if (hm_isEmpty(neighbors))
-        return;
-    /* malloc() error, print message and return */
-    if ((s_list = hm_entryArray(neighbors, &len)) == NULL) {
-        fprintf(stdout, "%s Failed to flood S2S KEEP ALIVE, memory allocation failed\n",
-                server_addr);
-        return;
-    }
-    /* Initialize and set packet members */
-    memset(&kalive_packet, 0, sizeof(kalive_packet));
-    kalive_packet.req_type = REQ_S2S_KEEP_ALIVE;
+    if (w != self)
+        pthread_rwlock_rdlock(&w->lock);
+}
 
-    for (i = 0L; i < len; i++) {
-        /* Send the packet to each of the neighbors */
-        server = hmentry_value(s_list[i]);
-        sendto(socket_fd, &kalive_packet, sizeof(kalive_packet), 0,
-                (struct sockaddr *)server->addr, sizeof(*server->addr));
-    }
+/*
+ * Releases the lock taken by shard_read_lock().
+ */
+static void shard_read_unlock(Worker *w) {
 
-    free(s_list);
+    if (w != self)
+        pthread_rwlock_unlock(&w->lock);
 }
 
 /*
- * Refreshes all S2S joins by sending S2S join requests for every channel the server
- * is subscribe to to every one of its neighboring servers. Invoked every so often to
- * guard against network failures.
+ * Locks the calling worker's shard for writing; held while the worker modifies its
+ * shard so that other workers never read it mid-update.
  */
-static void refresh_s2s_joins(void) {
-    
-    char **chs;
-    long i, len = 0L;
-
-    /* Get an array of the server's subscribed channels */
-    /* If server is not subscribed to any channels, don't bother with scan */
-    if ((chs = hm_keyArray(r_table, &len)) == NULL) {
-        if (!hm_isEmpty(r_table))  /* malloc() failure, print error and return */
-            fprintf(stdout, "%s Failed to refresh S2S join(s), memory allocation failed\n",
-                    server_addr);
-            return;
-    }
+static void shard_write_lock(void) {
 
-    /* Send an S2S join to all neighbors for each channel */
-    for (i = 0L; i < len; i++)
-        neighbor_flood_channel(chs[i], server_addr);
-    free(chs);
+    if (nworkers > 1)
+        pthread_rwlock_wrlock(&self->lock);
 }
 
 /*
- * Adds the specified channel into the neighboring server's subscription list
- * by allocating memory for space in the hashmap of channels, and creates a
- * linked list to hold the subscribed servers. Also adds all neighboring servers
- * to the list initially. Returns 1 if fully successful, 0 if not (malloc() error(s)).
+ * Releases the lock taken by shard_write_lock().
  */
-static int server_join_channel(char *channel) {
+static void shard_write_unlock(void) {
 
-    LinkedList *servers = NULL;
-    Server *server;
-    HMEntry **addrs = NULL;
-    long i, len = 0L;
+    if (nworkers > 1)
+        pthread_rwlock_unlock(&self->lock);
+}
 
-    /* Create the list of listening servers */
-    if ((servers = ll_create()) == NULL)
-        goto error;
-    if ((addrs = hm_entryArray(neighbors, &len)) == NULL)
-        goto error;
+/*
+ * Returns 1 if the worker publishes snapshots of its shard, 0 if not; they are only
+ * kept while other threads read them, with several workers, or readers.
+ */
+static int snapshots_kept(void) {
 
-    /* Adds each connected server into the list */
-    for (i = 0L; i < len; i++) {
-        server = (Server *)hmentry_value(addrs[i]);
-        /* Checks for malloc() errors */
-        if (!ll_add(servers, server))
-            goto error;
-    }
+    return (nworkers > 1 || nreaders > 0);
+}
 
-    /* Add the list of neighbors into the subscription hashmap */
-    if (!hm_put(r_table, channel, servers, NULL))
-        goto error;
-    free(addrs);
+/*
+ * Notes that the channel with the specified name changed on the worker's shard, so that
+ * the next snapshot brings it up to date; see publish_snapshot().
+ */
+static void channel_changed(const char *name) {
 
-    return 1;   /* All addition(s) were successful */
+    /* A change that cannot be noted has the next snapshot taken of the whole shard */
+    if (snapshots_kept() && !hm_put(self->changed_channels, (char *)name, NULL, NULL))
+        self->rebuild = 1;
+}
 
-error:
-    /* Free any allocated memory, return 0 */
-    if (servers != NULL)
-        ll_destroy(servers, NULL);
-    if (addrs != NULL)
-        free(addrs);
-    return 0;
+/*
+ * Notes that a user with the specified username logged in or out of the worker's shard,
+ * as channel_changed() does for channels.
+ */
+static void user_changed(const char *username) {
+
+    if (snapshots_kept() && !hm_put(self->changed_users, (char *)username, NULL, NULL))
+        self->rebuild = 1;
 }
 
 /*
- * Sends a packet containing the error message 'msg' to the client with the specified
- * address information. Also logs the packet sent to the address with the error
- * message.
+ * Adds the specified user to the worker's username index; a user logged in under
+ * a username already indexed is chained behind the indexed one. Returns 1 if
+ * successful, 0 if not (malloc() error).
  */
-static void server_send_error(struct sockaddr_in *addr, const char *msg) {
-    
-    struct text_error error_packet;
+static int index_username(User *user) {
 
-    /* Initialize the error packet; set the type */
-    memset(&error_packet, 0, sizeof(error_packet));
-    error_packet.txt_type = TXT_ERROR;
-    /* Copy the error message into packet, ensure length does not exceed limit allowed */
-    strncpy(error_packet.txt_error, msg, (SAY_MAX - 1));
-    /* Send packet off to user */
-    sendto(socket_fd, &error_packet, sizeof(error_packet), 0,
-            (struct sockaddr *)addr, sizeof(*addr));
-    /* Log the error message */
-    fprintf(stdout, "%s %s:%d send ERROR \"%s\"\n", server_addr,
-            inet_ntoa(addr->sin_addr), ntohs(addr->sin_port), msg);
+    User *first;
+
+    user_changed(user->username);
+    if (hm_get(names, user->username, (void **)&first)) {
+        user->same_name = first->same_name;
+        first->same_name = user;
+        return 1;
+    }
+    user->same_name = NULL;
+    return hm_put(names, user->username, user, NULL);
 }
 
 /*
- * Server receives an authentication packet; the server responds to the client telling them
- * if the username is currently occupied or not.
+ * Removes the specified user from the worker's username index.
  */
-static void server_verify_request(const char *packet, const char *client_ip, struct sockaddr_in *client) {
+static void unindex_username(User *user) {
 
-    User *user;
-    HMEntry **u_list = NULL;
-    char **ip_list = NULL;
-    size_t nbytes;
-    int res = 1;
-    long i, len = 0L;
-    struct sockaddr_in *forward = NULL;
-    struct text_verify respond_packet;
-    struct request_s2s_verify *s2s_verify = NULL;
-    struct request_verify *verify_packet = (struct request_verify *) packet;
+    User *first, *prev;
 
-    /* Log the received packet */
-    fprintf(stdout, "%s %s recv Request VERIFY %s\n",
-            server_addr, client_ip, verify_packet->req_username);
-    
-    /* Retrieve list of users to check for verification */
-    if ((u_list = hm_entryArray(users, &len)) == NULL)
-        if (!hm_isEmpty(users))
-            return;
-    
-    /* Check each username for uniqueness */
-    for (i = 0L; i < len; i++) {
-        user = (User *)hmentry_value(u_list[i]);
-        if (strcmp(verify_packet->req_username, user->username) == 0) {
-            res = 0;    /* Username taken, break from loop */
+    if (!hm_get(names, user->username, (void **)&first))
+        return;
+    user_changed(user->username);
+    /* The indexed user leaves; the next one with the same name takes its place */
+    if (first == user) {
+        if (user->same_name != NULL)
+            (void)hm_put(names, user->username, user->same_name, NULL);
+        else
+            (void)hm_remove(names, user->username, (void **)&first);
+        return;
+    }
+    for (prev = first; prev->same_name != NULL; prev = prev->same_name) {
+        if (prev->same_name == user) {
+            prev->same_name = user->same_name;
             break;
         }
     }
-    free(u_list);  /* Free allocated memory */
+}
 
-    /* If the username is valid, and there are neighboring servers to check, */
-    /* Forward the packet to the next server in the list */
-    if (!hm_isEmpty(neighbors) && res) {
+/*
+ * Returns the snapshot the specified worker last published of its shard, or NULL if it
+ * has not published one yet. The caller is in a read section of the epoch domain.
+ */
+static Snapshot *shard_snapshot(Worker *w) {
 
-        /* Calculate size of the packet, allocate the memory */
-        nbytes = (sizeof(struct request_s2s_verify) +
-                (sizeof(struct ip_address) * (hm_size(neighbors) - 1)));
-        if ((s2s_verify = (struct request_s2s_verify *)malloc(nbytes)) == NULL)
-            goto error;
-        /* Get list of neighboring servers' IP addresses */
-        if ((ip_list = hm_keyArray(neighbors, &len)) == NULL)
-            goto error;
+    return __atomic_load_n(&w->snapshot, __ATOMIC_ACQUIRE);
+}
 
-        /* Initialize and set the packet members */
-        memset(s2s_verify, 0, nbytes);
-        s2s_verify->req_type = REQ_S2S_VERIFY;
-        s2s_verify->id = generate_id();
-        strcpy(s2s_verify->req_username, verify_packet->req_username);
-        strncpy(s2s_verify->client.ip_addr, client_ip, (IP_MAX - 1));
-        s2s_verify->nto_visit = ((int)len - 1);
-        /* Create the list of IP addresses to visit */
-        for (i = 0; i < s2s_verify->nto_visit; i++)
-            strncpy(s2s_verify->to_visit[i].ip_addr, ip_list[i + 1], (IP_MAX - 1));
-        /* Exclude the first IP address from list, send the packet to this address */
-        if ((forward = get_addr(ip_list[0])) == NULL)
-            goto error;
+/*
+ * Checks every worker's shard for a user logged in under the specified username; the
+ * calling worker's own shard directly, the others through their snapshots, which are
+ * at most one batch behind. Returns 1 if the username is taken, 0 if not.
+ */
+static int username_taken(char *name) {
 
-        /* Forward the S2S verify request, log the sent packet */
-        sendto(socket_fd, s2s_verify, nbytes, 0, (struct sockaddr *)forward, sizeof(*forward));
-        fprintf(stdout, "%s %s send S2S VERIFY %s\n", server_addr, ip_list[0],
-                s2s_verify->req_username);
+    Snapshot *sn;
+    int w, res = 0;
 
-        /* Free all allocated memory and return */
-        free(forward);
-        free(ip_list);
-        free(s2s_verify);
-        return;
-    }
+    /* Most logins are checked on the worker the user will log in to */
+    if (names != NULL && hm_containsKey(names, name))
+        return 1;
 
-    /* Otherwise, send the response packet back to the client */
-    /* Initialize and set packet members */
-    memset(&respond_packet, 0, sizeof(respond_packet));
-    respond_packet.txt_type = TXT_VERIFY;
-    respond_packet.valid = res;
-    /* Send packet back to client, log the request */
-    sendto(socket_fd, &respond_packet, sizeof(respond_packet), 0,
-            (struct sockaddr *)client, sizeof(*client));
-    return;
+    ep_enter(epochs, epoch_slot);
+    for (w = 0; w < nworkers && !res; w++)
+        if (&workers[w] != self && (sn = shard_snapshot(&workers[w])) != NULL)
+            res = sn_hasUser(sn, name);
+    ep_exit(epochs, epoch_slot);
 
-error:
-    /* Send error back to client */
-    server_send_error(client, "Verification failed.");
-    /* Free all allocated memory */
-    if (u_list != NULL)
-        free(u_list);
-    if (ip_list != NULL)
-        free(ip_list);
-    if (forward != NULL)
-        free(forward);
-    if (s2s_verify != NULL)
-        free(s2s_verify);
+    return res;
 }
 
 /*
- * Server receives a login packet; the server allocates memory and creates an instance of the
- * new user and connects them to the server.
+ * Drops the reference of a cached channel ID, and returns its storage to the heap. Used
+ * by the HashMap destructor of the worker's resolved names.
  */
-static void server_login_request(const char *packet, char *client_ip, struct sockaddr_in *addr) {
+static void free_resolved(void *cached) {
 
-    User *user = NULL;
-    char name[USERNAME_MAX];
-    struct request_login *login_packet = (struct request_login *) packet;
+    rg_release(*(int *)cached);
+    free(cached);
+}
 
-    /* Copy username into buffer, ensures name length does not exceed max allowed */
-    memset(name, 0, sizeof(name));
-    strncpy(name, login_packet->req_username, (USERNAME_MAX - 1));
+/*
+ * Returns the ID of the channel with the specified name, or -1 if the name is not
+ * interned (or on a malloc() error). Only the first lookup of a name goes to the
+ * registry; the worker keeps the ID, with a reference, so later lookups take neither
+ * the registry's lock nor a reference. The ID stays valid while the worker handles
+ * the current packet or mail.
+ */
+static int resolve_channel(char *name) {
+
+    int *cached, id;
+
+    if (hm_get(resolved, name, (void **)&cached))
+        return *cached;
+    if ((id = rg_acquire(name)) < 0)
+        return -1;
+    /* Rather than track which names are in use, forget them all once the cache is full */
+    if (hm_size(resolved) >= RESOLVED_CACHE_SIZE)
+        hm_clear(resolved, free_resolved);
+    if ((cached = (int *)malloc(sizeof(int))) == NULL) {
+        rg_release(id);
+        return -1;
+    }
+    *cached = id;
+    if (!hm_put(resolved, name, cached, NULL)) {
+        free_resolved(cached);
+        return -1;
+    }
+    return id;
+}
 
-    /* Create a new instance of the user */
-    /* Send error back to client if malloc() failed, log the error */
-    if ((user = malloc_user(client_ip, name, addr)) == NULL)
-        goto error;
+/*
+ * Returns the worker owning the channel with the specified ID, with channel_affinity.
+ * The registry hands out the IDs densely, so the channels are spread evenly.
+ */
+static Worker *channel_owner(int id) {
 
-    /* Add the new user into the users hashmap */
-    /* Send error back to client if failed, log the error */
-    if (!hm_put(users, client_ip, user, NULL))
-        goto error;
+    return &workers[id % nworkers];
+}
 
-    /* Log the user login information */
-    fprintf(stdout, "%s %s recv Request LOGIN %s\n",
-            server_addr, user->ip_addr, user->username);
-    return;
+/*
+ * Checks whether the channel with the specified ID exists on any worker's shard; the
+ * caller holds a reference to the ID. Returns 1 if it does, 0 if not.
+ */
+static int channel_exists(int id) {
 
-error:
-    /* Send error back to client */
-    server_send_error(addr, "Failed to log into the server.");
-    /* Free all allocated memory */
-    if (user != NULL)
-        free_user(user);
+    int w, res = 0;
+
+    /* Most lookups are for channels the calling worker holds */
+    if (im_get(channels, id) != NULL)
+        return 1;
+    /* With channel affinity, no other worker than the owner holds it */
+    if (channel_affinity) {
+        if (channel_owner(id) == self)
+            return 0;
+        shard_read_lock(channel_owner(id));
+        res = (im_get(channel_owner(id)->channels, id) != NULL);
+        shard_read_unlock(channel_owner(id));
+        return res;
+    }
+
+    for (w = 0; w < nworkers && !res; w++) {
+        if (&workers[w] == self)
+            continue;
+        shard_read_lock(&workers[w]);
+        res = (im_get(workers[w].channels, id) != NULL);
+        shard_read_unlock(&workers[w]);
+    }
+
+    return res;
 }
 
 /*
- * Server receives a join packet; the server adds the client to the requested channel, so
- * that they can now receive messages from other subscribed clients.
+ * Checks whether any client of this server, on any worker, is subscribed to the
+ * channel with the specified ID. Returns 1 if so, 0 if not.
  */
-static void server_join_request(const char *packet, char *client_ip) {
-    
-    User *user, *tmp;
-    LinkedList *user_list = NULL;
-    int ch_len;
-    long i;
-    char *joined = NULL;
-    char buffer[256];
-    struct request_join *join_packet = (struct request_join *) packet;
+static int channel_has_users(int id) {
 
-    /* Assert that the user is currently logged in, do nothing if not */
-    if (!hm_get(users, client_ip, (void **)&user))
-        return;
-    /* Update user time, log received join request */
-    update_user_time(user);
-    fprintf(stdout, "%s %s recv Request JOIN %s %s\n", server_addr,
-            user->ip_addr, user->username, join_packet->req_channel);
+    Channel *ch;
+    int w, res = 0;
 
-    /* Set the channel name length; shorten it down if exceeds max length allowed */
-    ch_len = ((strlen(join_packet->req_channel) > (CHANNEL_MAX - 1)) ?
-                (CHANNEL_MAX - 1) : strlen(join_packet->req_channel));
-    /* Allocate memory from heap for name, report and log error if failed */
-    if ((joined = (char *)malloc(ch_len + 1)) == NULL)
-        goto error;
+    for (w = 0; w < nworkers && !res; w++) {
+        shard_read_lock(&workers[w]);
+        if ((ch = (Channel *)im_get(workers[w].channels, id)) != NULL)
+            res = !ms_isEmpty(ch);
+        shard_read_unlock(&workers[w]);
+    }
 
-    /* Extract the channel name from packet */
-    memcpy(joined, join_packet->req_channel, ch_len);
-    joined[ch_len] = '\0';
+    return res;
+}
 
-    /* Add this channel to the neighboring server's subscription list */
-    if (!hm_isEmpty(neighbors)) {
-        if (!hm_containsKey(r_table, joined)) {
-            if (!server_join_channel(joined))
-                goto error;
-            neighbor_flood_channel(joined, server_addr);
-        }
-    }
+/*
+ * Adds the specified channel name into the set 'ch_set', unless it is there already.
+ * Returns 1 if successful, 0 if not (malloc() error).
+ */
+static int add_channel(const char *channel, void *ch_set) {
 
-    /* Add the channel to user's subscribed list, send error if failed, log error */
-    if (!ll_add(user->channels, joined))
-        goto error;
+    if (hm_containsKey((HashMap *)ch_set, (char *)channel))
+        return 1;
+    return hm_put((HashMap *)ch_set, (char *)channel, NULL, NULL);
+}
 
-    /* User has joined a channel that does not exist */
-    if (!hm_get(channels, joined, (void **)&user_list)) {
+/*
+ * Adds the names of all the channels on the calling worker's shard into the set
+ * 'ch_set'. Returns 1 if successful, 0 if not (malloc() error).
+ */
+static int shard_channels(HashMap *ch_set) {
 
-        /* Create the new channel list, send error back if failed, log the error */
-        if ((user_list = ll_create()) == NULL)
-            goto error;
+    Channel *ch;
+    int id, res = 1;
 
-        /* Add the user to the list, send error back if failed, log the error */
-        if (!ll_add(user_list, user))
-            goto error;
+    for (id = im_next(channels, 0, (void **)&ch); res && id >= 0;
+            id = im_next(channels, id + 1, (void **)&ch))
+        res = add_channel(ms_name(ch), ch_set);
 
-        /* Add the channel to the server's channel collection */
-        /* Send error back to client if failed, log the error */
-        if (!hm_put(channels, joined, user_list, NULL))
-            goto error;
+    return res;
+}
 
-    /* User has joined a channel that already exists */
-    } else {
+/*
+ * Adds the names of all the channels on every worker's shard into the set 'ch_set'; the
+ * calling worker's own shard directly, the others through their snapshots. Returns 1 if
+ * successful, 0 if not (malloc() error).
+ */
+static int collect_channels(HashMap *ch_set) {
 
-        /* Check to see if user is already subscribed; makes sure not to add duplicate instance(s) */
-        for (i = 0L; i < ll_size(user_list); i++) {
-            (void)ll_get(user_list, i, (void **)&tmp);
-            if (strcmp(user->ip_addr, tmp->ip_addr) == 0)
-                return;
-        }
+    Snapshot *sn;
+    int w, res = 1;
 
-        /* User was not found, so add them to subscription list */
-        /* If failed, send error back to client, log the error */
-        if (!ll_add(user_list, user))
-            goto error;
+    ep_enter(epochs, epoch_slot);
+    for (w = 0; w < nworkers && res; w++) {
+        if (&workers[w] == self)
+            res = shard_channels(ch_set);
+        else if ((sn = shard_snapshot(&workers[w])) != NULL)
+            res = sn_forEachChannel(sn, add_channel, ch_set);
     }
-    return;
+    ep_exit(epochs, epoch_slot);
 
-error:
-    /* Send error back to client */
-    sprintf(buffer, "Failed to join %s.", join_packet->req_channel);
-    server_send_error(user->addr, buffer);
-    /* Free all allocated memory */
-    if (joined != NULL)
-        free(joined);
-    if (user_list != NULL)
-        ll_destroy(user_list, NULL);
+    return res;
 }
 
 /*
- * Server recieves a leave packet from a client; the server removes the specified
- * channel from the user's subscription list and deletes the channel if becomes
- * empty.
+ * Appends a copy of the specified username to the list 'unames'. Returns 1 if
+ * successful, -1 if not (malloc() error).
  */
-static void server_leave_request(const char *packet, char *client_ip) {
-
-    User *user, *tmp;
-    Server *server;
-    LinkedList *user_list;
-    int removed = 0;
-    long i;
-    char *ch;
-    char channel[CHANNEL_MAX], buffer[256];
-    struct request_s2s_leaf leaf_packet;
-    struct request_leave *leave_packet = (struct request_leave *) packet;
+static int add_username(LinkedList *unames, const char *username) {
 
-    /* Assert that the user requesting is currently logged in, do nothing if not */
-    if (!hm_get(users, client_ip, (void **)&user))
-        return;
-    update_user_time(user);
+    char *name;
 
-    /* Copy into buffer, ensure the channel name length does not exceed maximum allowed */
-    memset(channel, 0, sizeof(channel));
-    strncpy(channel, leave_packet->req_channel, (CHANNEL_MAX - 1));
-    /* Assert that the channel currently exists */
-    /* If not, report error back to user, log the error */
-    if (!hm_get(channels, channel, (void **)&user_list)) {
-        sprintf(buffer, "No channel by the name %s.", leave_packet->req_channel);
-                server_send_error(user->addr, buffer);
-        return;
+    if ((name = strdup(username)) == NULL || !ll_add(unames, name)) {
+        free(name);
+        return -1;
     }
+    return 1;
+}
 
-    /* Next, remove the requested channel from the user's list of subscribed channels */
-    for (i = 0L; i < ll_size(user->channels); i++) {
-        (void)ll_get(user->channels, i, (void **)&ch);
-        if (strcmp(channel, ch) == 0) {
-            /* Channel found, remove it from list and free reserved memory */
-            ll_remove(user->channels, i, (void **)&ch);
-            fprintf(stdout, "%s %s recv Request LEAVE %s %s\n", server_addr,
-                    user->ip_addr, user->username, ch);
-            free(ch);
-            removed = 1;
-            break;
-        }
-    }
+/*
+ * Appends a copy of the username of a member of a snapshot's channel to the list
+ * 'unames'; see sn_forEachMember(). Returns 1 if successful, 0 if not (malloc() error).
+ */
+static int add_member(const char *username, void *unames) {
 
-    /* Next, remove pointer of user from the channel's list of subscribed users */
-    /* Ensures no more messages will be sent to the unsubscribed user */
-    for (i = 0L; i < ll_size(user_list); i++) {
-        (void)ll_get(user_list, i, (void **)&tmp);
-        if (strcmp(user->ip_addr, tmp->ip_addr) == 0) {
-            /* User found, remove them from subscription list */
-            (void)ll_remove(user_list, i, (void **)&tmp);
-            break;
-        }
-    }
+    return (add_username((LinkedList *)unames, username) > 0);
+}
 
-    if (!removed) {
-        /* User was not removed, wasn't subscribed to channel to begin with */
-        /* Send a message back to user notifying them, log the error */
-        sprintf(buffer, "You are not subscribed to %s.", channel);
-        server_send_error(user->addr, buffer);
-        return;
-    }
+/*
+ * Appends a copy of the username of every client on the calling worker's shard that is
+ * subscribed to the channel with the specified ID to the list 'unames'. Returns 1 if the
+ * channel exists on the shard, 0 if not, or -1 if the collection failed (malloc() error).
+ */
+static int shard_members(int id, LinkedList *unames) {
 
-    /* If the channel the user left becomes empty, remove it from channel list */
-    if (ll_isEmpty(user_list) && strcmp(channel, DEFAULT_CHANNEL)) {
-        /* Free all memory reserved by deleted channel */
-        fprintf(stdout, "%s Removed the empty channel %s\n", server_addr, channel);
-        (void)hm_remove(channels, channel, (void **)&user_list);
-        ll_destroy(user_list, NULL);
-    }
+    Channel *ch;
+    User *user;
+    MSIter it;
+    int res;
 
-    /* Server removes itself from channel sub-tree if leaf */
-    if (remove_server_leaf(channel))
-        return;
-    /* Checks to see if clients are currently subscribed */
-    if (hm_get(channels, channel, (void **)&user_list))
-        if (!ll_isEmpty(user_list))
-            return;
-    /* If no clients are subscribed, send a leaf check packet to all neighbors */
-    if (!hm_isEmpty(neighbors)) {
+    if ((ch = (Channel *)im_get(channels, id)) == NULL)
+        return 0;
+    res = 1;
+    ms_iterInit(ch, &it);
+    while (res > 0 && ms_iterNext(&it, (void **)&user))
+        res = add_username(unames, user->username);
 
-        /* Initialize and set packet members */
-        (void)hm_get(r_table, channel, (void **)&user_list);
-        memset(&leaf_packet, 0, sizeof(leaf_packet));
-        leaf_packet.req_type = REQ_S2S_LEAF;
-        leaf_packet.id = generate_id();
-        strncpy(leaf_packet.channel, channel, (CHANNEL_MAX - 1));
-        /* Sends the packet to all neighbors */
-        for (i = 0L; i < ll_size(user_list); i++) {
-            /* Get the server's address, send the packet */
-            (void)ll_get(user_list, i, (void **)&server);
-            sendto(socket_fd, &leaf_packet, sizeof(leaf_packet), 0,
-                    (struct sockaddr *)server->addr, sizeof(*server->addr));
+    return res;
+}
+
+/*
+ * Appends a copy of the username of every client subscribed to the specified channel,
+ * on every worker's shard, to the list 'unames'; the calling worker's own shard is read
+ * directly, the others through their snapshots. Returns 1 if the channel exists on any
+ * shard, 0 if not, or -1 if the collection failed (malloc() error).
+ */
+static int collect_members(char *channel, LinkedList *unames) {
+
+    Snapshot *sn;
+    int w, id, found, res = 0;
+
+    ep_enter(epochs, epoch_slot);
+    for (w = 0; w < nworkers && res >= 0; w++) {
+        if (&workers[w] == self) {
+            /* The worker's channels pin their IDs, so the name is looked up without a reference */
+            id = rg_lookup(channel);
+            found = (id >= 0) ? shard_members(id, unames) : 0;
+        } else if ((sn = shard_snapshot(&workers[w])) != NULL) {
+            found = sn_forEachMember(sn, channel, add_member, unames);
+        } else {
+            found = 0;
         }
+        if (found != 0)
+            res = found;
     }
+    ep_exit(epochs, epoch_slot);
+
+    return res;
 }
 
 /*
- * Sends a say packet to each subscribed client inside the list 'users', broadcasting
- * the message.
+ * Brings the channel with the specified name up to date in a snapshot of the worker's
+ * shard being built; see snapshot.h. Returns 1 if successful, 0 if not (malloc() error).
  */
-static int broadcast_message(LinkedList *users, char *username, char *channel, char *text) {
-    
-    User **listeners;
-    long i, len = 0L;
-    struct text_say msg_packet;
+static int snapshot_channel(Snapshot *sn, const char *name) {
 
-    /* NULL checking */
-    if (users == NULL)
+    Channel *ch = NULL;
+    User *user;
+    MSIter it;
+    int id;
+
+    if ((id = rg_lookup(name)) >= 0)
+        ch = (Channel *)im_get(channels, id);
+    if (ch == NULL)
+        return sn_removeChannel(sn, name);
+    if (!sn_putChannel(sn, name, ms_size(ch)))
         return 0;
+    ms_iterInit(ch, &it);
+    while (ms_iterNext(&it, (void **)&user))
+        (void)sn_addMember(sn, user->username);
 
-    /* Get list of users, return 0 if malloc() fails */
-    if ((listeners = (User **)ll_toArray(users, &len)) == NULL)
-        if (!ll_isEmpty(users))
-            return 0;
+    return 1;
+}
 
-    /* Initialize the SAY packet to send; set the type, channel, and username */
-    memset(&msg_packet, 0, sizeof(msg_packet));
-    msg_packet.txt_type = TXT_SAY;
-    strncpy(msg_packet.txt_channel, channel, (CHANNEL_MAX - 1));
-    strncpy(msg_packet.txt_username, username, (USERNAME_MAX - 1));
-    strncpy(msg_packet.txt_text, text, (SAY_MAX - 1));
+/*
+ * Brings the specified username up to date in a snapshot of the worker's shard being
+ * built, as snapshot_channel() does for channels. Returns 1 if successful, 0 if not
+ * (malloc() error).
+ */
+static int snapshot_user(Snapshot *sn, const char *username) {
+
+    if (hm_containsKey(names, (char *)username))
+        return sn_putUser(sn, username);
+    return sn_removeUser(sn, username);
+}
 
-    /* Send the packet to each user listening on the channel */
-    for (i = 0L; i < len; i++)
-        sendto(socket_fd, &msg_packet, sizeof(msg_packet), 0,
-                (struct sockaddr *)listeners[i]->addr, sizeof(*listeners[i]->addr));
-    free(listeners);
+/*
+ * Frees a snapshot retired to the epoch domain once no thread can still be reading it.
+ */
+static void free_snapshot(void *sn) {
 
-    return 1;   /* Successful broadcast(s), return 1 */
+    sn_destroy((Snapshot *)sn);
 }
 
 /*
- * Server receiveds a say packet from a client; the server broadcasts the message
- * back to all connected clients subscribed to the requested channel by sending
- * a packet to each of the subscribed clients.
+ * Publishes a new snapshot of the worker's shard if the shard changed since the last
+ * one was taken; invoked after every batch of packets or mail the worker handles. The
+ * new snapshot is derived from the last one, and only the channels and usernames noted
+ * as changed are copied into it, so its cost follows the batch rather than the shard;
+ * the first one, or one after a change could not be noted, is taken of the whole shard.
+ * The snapshot it replaces is freed once no thread can be reading it any longer.
  */
-static void server_say_request(const char *packet, char *client_ip) {
-    
-    User *user;
-    Server *server;
-    LinkedList *ch_users;
-    long i;
-    char buffer[256];
-    struct request_say *say_packet = (struct request_say *) packet;
-    struct request_s2s_say s2s_say;
+static void publish_snapshot(void) {
 
-    /* Assert user is logged in; do nothing if not */
-    if (!hm_get(users, client_ip, (void **)&user))
+    Snapshot *sn;
+    Channel *ch;
+    HMIter it;
+    char *name;
+    int id, full, res = 1;
+
+    if (!snapshots_kept())
         return;
-    /* Assert that the channel exists; do nothing if not */
-    if (!hm_get(channels, say_packet->req_channel, (void **)&ch_users))
+    full = (self->snapshot == NULL || self->rebuild);
+    if (!full && hm_isEmpty(self->changed_channels) && hm_isEmpty(self->changed_users))
         return;
-    /* Update user time, log received say request */
-    update_user_time(user);
-    fprintf(stdout, "%s %s recv Request SAY %s %s \"%s\"\n", server_addr, user->ip_addr,
-            user->username, say_packet->req_channel, say_packet->req_text);
-
-    /* Respond to user with error message if malloc() failure, log the error */
-    if (!broadcast_message(ch_users, user->username, say_packet->req_channel, say_packet->req_text)) {
-        sprintf(buffer, "Failed to send the message.");
-        server_send_error(user->addr, buffer);
+    if ((sn = sn_create(full ? NULL : self->snapshot)) == NULL)
         return;
-    }
-
-    /* Initialize the S2S SAY packet to send; set the ID, channel, and username */
-    memset(&s2s_say, 0, sizeof(s2s_say));
-    s2s_say.req_type = REQ_S2S_SAY;
-    s2s_say.id = generate_id();
-    strncpy(s2s_say.req_channel, say_packet->req_channel, (CHANNEL_MAX - 1));
-    strncpy(s2s_say.req_username, user->username, (USERNAME_MAX - 1));
-    strncpy(s2s_say.req_text, say_packet->req_text, (SAY_MAX - 1));
 
-    /* Get the list of listening neighboring servers */
-    if (!hm_get(r_table, say_packet->req_channel, (void **)&ch_users))
+    if (full) {
+        for (id = im_next(channels, 0, (void **)&ch); res && id >= 0;
+                id = im_next(channels, id + 1, (void **)&ch))
+            res = snapshot_channel(sn, ms_name(ch));
+        hm_iterInit(names, &it);
+        while (res && hm_iterNext(&it, &name, NULL))
+            res = sn_putUser(sn, name);
+    } else {
+        hm_iterInit(self->changed_channels, &it);
+        while (res && hm_iterNext(&it, &name, NULL))
+            res = snapshot_channel(sn, name);
+        hm_iterInit(self->changed_users, &it);
+        while (res && hm_iterNext(&it, &name, NULL))
+            res = snapshot_user(sn, name);
+    }
+    /* The changes stay noted if this fails; they are published after the next batch */
+    if (!res) {
+        sn_destroy(sn);
         return;
-    /* Send the S2S say packet to all connecting servers */
-    for (i = 0L; i < ll_size(ch_users); i++) {
-        (void)ll_get(ch_users, i, (void **)&server);
-        sendto(socket_fd, &s2s_say, sizeof(s2s_say), 0,
-                (struct sockaddr *)server->addr, sizeof(*server->addr));
-        /* Log the S2S packet sent */
-        fprintf(stdout, "%s %s send S2S SAY %s %s \"%s\"\n", server_addr,
-                server->ip_addr, s2s_say.req_username, s2s_say.req_channel,
-        s2s_say.req_text);
     }
+    hm_clear(self->changed_channels, NULL);
+    hm_clear(self->changed_users, NULL);
+    self->rebuild = 0;
+
+    sn = __atomic_exchange_n(&self->snapshot, sn, __ATOMIC_SEQ_CST);
+    if (sn != NULL)
+        ep_retire(epochs, epoch_slot, sn, free_snapshot);
 }
 
 /*
- * Server receives a list packet from a client; the server compiles a list of
- * all the channels currently available on the server, then sends the packet
- * back to the client.
+ * Posts a message to the specified worker's inbox, to broadcast to its subscribers.
+ * Returns 1 if successful, or 0 if the inbox was full and the message was dropped;
+ * only messages may be, all other mail is sent with send_mail().
  */
-static void server_list_request(char *client_ip) {
+static int post_mail(Worker *w, Mail *mail) {
 
-    User *user;
-    size_t nbytes;
-    long i, j, len = 0L;
-    char **array = NULL;
-    struct sockaddr_in *forward;
-    struct request_s2s_list *s2s_list = NULL;
-    struct text_list *list_packet = NULL;
+    return mb_post(w->inbox, self->id, mail);
+}
 
-    /* Assert that the user is logged in, do nothing if not */
-    if (!hm_get(users, client_ip, (void **)&user))
-        return;
-    /* Update user time, log list request */
-    update_user_time(user);
-    fprintf(stdout, "%s %s recv Request LIST %s\n", server_addr, user->ip_addr,
-            user->username);
+/*
+ * Sends the mail to the specified worker's inbox. The mail changes the state of the
+ * worker or the server, or carries a request, so it is never dropped; if the inbox is
+ * full, it waits behind it instead. Returns 1 if successful, or 0 if not (malloc()
+ * error).
+ */
+static int send_mail(Worker *w, Mail *mail) {
 
-    /* Retrieve the complete list of channel names */
-    /* Send error message back to client if failed (malloc() error), log the error */
-    if ((array = hm_keyArray(channels, &len)) == NULL)
-        if (!hm_isEmpty(channels))
-            goto error;
-    
-    /* If there are neighboring servers, we must send an S2S request */
-    if (!hm_isEmpty(neighbors)) {
+    if (mb_send(w->inbox, self->id, mail))
+        return 1;
+    /* Lost; release the packet copy or the channel reference the mail carried */
+    if (mail->type == MAIL_PACKET && mail->data != NULL)
+        free(mail->data);
+    if (mail->channel_id >= 0)
+        rg_release(mail->channel_id);
+    return 0;
+}
 
-        /* Calculate the size of the packet, allocate the memory */
-        nbytes = (sizeof(struct request_s2s_list) + (sizeof(struct s2s_list_container) *
-        (hm_size(channels) + (hm_size(neighbors) - 1))));
-        if ((s2s_list = (struct request_s2s_list *)malloc(nbytes)) == NULL)
-            goto error;
+/*
+ * Returns 1 if the clients' LIST, WHO and VERIFY requests are answered by the readers,
+ * 0 if by worker 0; see nreaders.
+ */
+static int queries_offloaded(void) {
 
-        /* Initialize and set the packet members */
-        memset(s2s_list, 0, nbytes);
-        s2s_list->req_type = REQ_S2S_LIST;
-        s2s_list->id = generate_id();
-        strncpy(s2s_list->client.ip_addr, client_ip, (IP_MAX - 1));
-        s2s_list->nchannels = (int)len;
+    return (nreaders > 0 && __atomic_load_n(&standalone, __ATOMIC_ACQUIRE));
+}
 
-        /* Copy all channels into the packet */
-        for (i = 0L; i < len; i++)
-            strncpy(s2s_list->payload[i].item, array[i], (CHANNEL_MAX - 1));
-        free(array);
+/*
+ * Passes a client's LIST, WHO or VERIFY request on to be answered, given the channel or
+ * username it names. While the server has no neighbors, it goes to the readers in turn,
+ * or is answered right away if the reader's inbox is full; otherwise worker 0 answers
+ * it, as the request may have to be passed on to the neighboring servers.
+ */
+static void mail_query(int type, char *name, struct sockaddr_in *from) {
+
+    Mail mail;
+    Reader *r;
+
+    /* Initialize and set the mail members */
+    mail.type = type;
+    mail.forward = 0;
+    mail.channel_id = -1;
+    mail.len = 0L;
+    mail.data = NULL;
+    mail.from = *from;
+    memset(&mail.u.say, 0, sizeof(mail.u.say));
+    if (type == MAIL_VERIFY)
+        strncpy(mail.u.say.username, name, (USERNAME_MAX - 1));
+    else if (name != NULL)
+        strncpy(mail.u.say.channel, name, (CHANNEL_MAX - 1));
+
+    if (queries_offloaded()) {
+        r = &readers[next_reader];
+        next_reader = (next_reader + 1) % nreaders;
+        if (!mb_post(r->inbox, self->id, &mail))
+            handle_query(&mail);
+    } else if (self == workers) {
+        handle_mail(&mail);
+    } else {
+        (void)send_mail(workers, &mail);
+    }
+}
 
-        /* Get array of neighboring IP addresses */
-        if ((array = hm_keyArray(neighbors, &len)) == NULL)
-            goto error;
-        /* Copy the neighboring IPs into packet to visit */
-        j = i;
-        s2s_list->nto_visit = (int)len - 1;
-        for (i = 0; i < s2s_list->nto_visit; i++)
-            strncpy(s2s_list->payload[j + i].item, array[i + 1], (CHANNEL_MAX - 1));
-
-        /* Get the address of the server to send request to */
-        if ((forward = get_addr(array[0])) == NULL)
-            goto error;
+/*
+ * Tells worker 0 that the channel with the specified ID was joined or left, given
+ * the mail type; worker 0 itself handles the change right away. The caller holds a
+ * reference to the ID; the mail takes one of its own, dropped once it is handled.
+ */
+static void mail_channel(int type, int id) {
 
-        /* Send the packet, log the sent packet */
-        sendto(socket_fd, s2s_list, nbytes, 0, (struct sockaddr *)forward, sizeof(*forward));
-        fprintf(stdout, "%s %s send S2S LIST\n", server_addr, array[0]);
+    Mail mail;
 
-        /* Free all allocated memory */
-        free(array);
-        free(s2s_list);
-        free(forward);
-        return;
-    }
+    /* Initialize and set the mail members */
+    mail.type = type;
+    mail.forward = 0;
+    mail.channel_id = id;
+    mail.len = 0L;
+    mail.data = NULL;
+    rg_hold(id);
 
-    /* Calculate the exact size of packet to send back */
-    nbytes = sizeof(struct text_list) + (sizeof(struct channel_info) * len);
-    /* Allocate memory for the packet using calculated size */
-    /* Send error back to user if failed (malloc() error), log the error */
-    if ((list_packet = (struct text_list *)malloc(nbytes)) == NULL)
-        goto error;
+    if (self == workers)
+        handle_mail(&mail);
+    else
+        (void)send_mail(workers, &mail);
+}
 
-    /* Initialize the packet; set the type and number of channels */
-    memset(list_packet, 0, nbytes);
-    list_packet->txt_type = TXT_LIST;
-    list_packet->txt_nchannels = (int)len;
-    /* Copy each channel name from the list into the packet */
-    for (i = 0L; i < len; i++)
-        strncpy(list_packet->txt_channels[i].ch_channel, array[i], (CHANNEL_MAX - 1));
+/*
+ * Passes a request of the specified client of this worker on to the worker 'w', which
+ * holds the client as a guest; see channel_affinity. Given a channel ID, the mail takes
+ * a reference of its own to it, dropped once it is handled. The guests must stay in
+ * step with the clients, so the mail is sent with send_mail(), never dropped. Returns
+ * 1 if successful, or 0 if not (malloc() error).
+ */
+static int mail_guest(Worker *w, int type, int id, User *user) {
+
+    Mail mail;
+
+    /* Initialize and set the mail members */
+    mail.type = type;
+    mail.forward = 0;
+    mail.channel_id = id;
+    mail.len = 0L;
+    mail.data = NULL;
+    mail.from = user->addr;
+    memcpy(mail.u.say.username, user->username, sizeof(mail.u.say.username));
+    if (id >= 0)
+        rg_hold(id);
+
+    return send_mail(w, &mail);
+}
 
-    /* Send the packet to client, log the listing event */
-    sendto(socket_fd, list_packet, nbytes, 0, (struct sockaddr *)user->addr, sizeof(*user->addr));
+/*
+ * Checks to see if this server is a leaf in the channel sub-tree, given the channel's
+ * ID and the set of neighbors subscribed to it. The server is a leaf if at most one
+ * neighbor is subscribed, and no clients are currently listening; that neighbor, if
+ * any, is then sent an S2S LEAVE request. Returns 1 if is a leaf, or 0 if not; the
+ * caller removes the channel from the routing table.
+ */
+static int leave_if_leaf(int id, BitSet *servers) {
 
-    /* Return all allocated memory back to heap */
-    free(array);
-    free(list_packet);
-    return;
+    Server *server;
+    int i;
+    struct request_s2s_leave leave_packet;
 
-error:
-    /* Send error back to client */
-    server_send_error(user->addr, "Failed to list the channels.");
-    /* Free all allocated memory */
-    if (array != NULL)
-        free(array);
-    if (s2s_list != NULL)
-        free(s2s_list);
-    if (list_packet != NULL)
-        free(list_packet);
+    /* No neighbors, do nothing */
+    if (am_isEmpty(neighbors))
+        return 0;
+    /* Server is a leaf if no other servers or clients are listening */
+    if (bs_size(servers) >= 2 || channel_has_users(id))
+        return 0;
+    /* Extract the only neighboring subscribed server, if any */
+    if ((i = bs_next(servers, 0)) < 0)
+        return 1;
+    server = neighbor_index[i];
+
+    /* Initialize & set S2S leave request packet members */
+    memset(&leave_packet, 0, sizeof(leave_packet));
+    leave_packet.req_type = REQ_S2S_LEAVE;
+    strncpy(leave_packet.req_channel, rg_name(id), (CHANNEL_MAX - 1));
+
+    /* Send S2S leave request to neighboring server */
+    sendto(socket_fd, &leave_packet, sizeof(leave_packet), 0,
+            (struct sockaddr *)&server->addr, sizeof(server->addr));
+    /* Log the sent packet */
+    log_write(LOG_INFO, "%s %s send S2S LEAVE %s",
+            server_addr, server->ip_addr, leave_packet.req_channel);
+    
+    return 1;
 }
 
 /*
- * Server receives a who packet from a client; the server compiles a list of all
- * the users currently subscribed to the requested channel, then sends the packet
- * back to the client.
+ * Removes this server from the channel sub-tree if it is a leaf, given the specified
+ * channel's ID; see leave_if_leaf(). Returns 1 if it was a leaf, or 0 if not; the
+ * routing table's reference to the ID is then dropped.
  */
-static void server_who_request(const char *packet, char *client_ip) {
-
-    User *user, **user_list = NULL;
-    LinkedList *subscribers;
-    char **array = NULL;
-    size_t nbytes;
-    int res = 0;
-    long i, j, len = 0L;
-    char buffer[256];
-    struct sockaddr_in *forward;
-    struct request_s2s_who *s2s_who = NULL;
-    struct text_who *send_packet = NULL;
-    struct request_who *who_packet = (struct request_who *) packet;
-
-    /* Assert that the user is logged in, do nothing if not */
-    if (!hm_get(users, client_ip, (void **)&user))
-        return;
-    /* Update user time, log who request */
-    update_user_time(user);
-    fprintf(stdout, "%s %s recv Request WHO %s %s\n", server_addr, user->ip_addr,
-            user->username, who_packet->req_channel);
-
-    /* Assert that the channel requested exists, send error back if it doesn't, log the error */
-    if ((res = hm_get(channels, who_packet->req_channel, (void **)&subscribers)) != 0)
-        if ((user_list = (User **)ll_toArray(subscribers, &len)) == NULL)
-            if (!ll_isEmpty(subscribers))
-                goto error;
+static int remove_server_leaf(int id) {
     
-    /* If there are neighboring servers, we must send an S2S request to them */
-    if (!hm_isEmpty(neighbors)) {
-
-        /* Calculate the size of the packet, allocate the memory */
-        nbytes = (sizeof(struct request_s2s_who) + (sizeof(struct s2s_who_container) *
-                (len + (hm_size(neighbors) - 1))));
-        if ((s2s_who = (struct request_s2s_who *)malloc(nbytes)) == NULL)
-            goto error;
-
-        /* Initialize and set the packet members */
-        memset(s2s_who, 0, nbytes);
-        s2s_who->req_type = REQ_S2S_WHO;
-        s2s_who->id = generate_id();
-        strncpy(s2s_who->channel, who_packet->req_channel, (CHANNEL_MAX - 1));
-        strncpy(s2s_who->client.ip_addr, client_ip, (IP_MAX - 1));
+    BitSet *servers;
 
-        /* Copy the usernames into the packet */
-        s2s_who->nusers = (int)len;
-        for (i = 0L; i < len; i++)
-            strncpy(s2s_who->payload[i].item, user_list[i]->username, (USERNAME_MAX - 1));
-        free(user_list);
+    /* Retrieve the set of subscribed servers; not in the sub-tree if none */
+    if ((servers = (BitSet *)im_get(r_table, id)) == NULL)
+        return 0;
+    if (!leave_if_leaf(id, servers))
+        return 0;
 
-        /* Get array of neighboring IP addresses to visit */
-        if ((array = hm_keyArray(neighbors, &len)) == NULL)
-            goto error;
-        /* Copy all IPs into the visitation list */
-        j = i;
-        s2s_who->nto_visit = (int)len - 1;
-        for (i = 0; i < s2s_who->nto_visit; i++)
-            strncpy(s2s_who->payload[j + i].item, array[i + 1], (USERNAME_MAX - 1));
-
-        /* Get the address of the server to send packet to */
-        if ((forward = get_addr(array[0])) == NULL)
-            goto error;
-        /* Send the packet, log the sent packet */
-        sendto(socket_fd, s2s_who, nbytes, 0, (struct sockaddr *)forward, sizeof(*forward));
-        fprintf(stdout, "%s %s send S2S WHO %s\n", server_addr, array[0],
-                who_packet->req_channel);
+    /* Remove channel from server subscription list */
+    (void)im_remove(r_table, id);
+    sl_free(&route_type, servers);
+    rg_release(id);
+    return 1;
+}    
 
-        /* Free all allocated memory */
-        free(forward);
-        free(array);
-        free(s2s_who);
-        return;
-    }
+/*
+ * Floods all the neighboring servers with an S2S JOIN request given the specified
+ * channel name and the neighboring server it was received from, if any. The sender
+ * is skipped over; no packet needs to be sent back to the sender.
+ */
+static void neighbor_flood_channel(const char *channel, Server *sender) {
+    
+    Server *server;
+    AMIter it;
+    struct request_s2s_join join_packet;
 
-    /* If channel does not exist, respond back to client with error message */
-    if (!res) {
-        sprintf(buffer, "No channel by the name %s.", who_packet->req_channel);
-        server_send_error(user->addr, buffer);
+    if (am_isEmpty(neighbors))
         return;
-    }
-
-    /* Calculate the exact size of packet to send back */
-    nbytes = sizeof(struct text_who) + (sizeof(struct user_info) * len);
-    /* Allocate memory for the packet using calculated size */
-    /* Send error back to user if failed (malloc() error), log the error */
-    if ((send_packet = (struct text_who *)malloc(nbytes)) == NULL)
-        goto error;
-
-    /* Initialize the packet; set the type, number of users, and channel */
-    memset(send_packet, 0, nbytes);
-    send_packet->txt_type = TXT_WHO;
-    send_packet->txt_nusernames = (int)len;
-    strncpy(send_packet->txt_channel, who_packet->req_channel, (CHANNEL_MAX - 1));
-    /* Copy each username from subscription list into packet */
-    for (i = 0L; i < len; i++)
-        strncpy(send_packet->txt_users[i].us_username, user_list[i]->username, (USERNAME_MAX - 1));
 
-    /* Send the packet to client, log the listing event */
-    sendto(socket_fd, send_packet, nbytes, 0,
-            (struct sockaddr *)user->addr, sizeof(*user->addr));
-    /* Return all allocated memory back to heap */
-    free(user_list);
-    free(send_packet);
-    return;
+    /* Initializes & sets the packet's contents */
+    memset(&join_packet, 0, sizeof(join_packet));
+    join_packet.req_type = REQ_S2S_JOIN;
+    strncpy(join_packet.req_channel, channel, (CHANNEL_MAX - 1));
 
-error:
-    /* Send error back to client */
-    sprintf(buffer, "Failed to list users on %s.", who_packet->req_channel);
-    server_send_error(user->addr, buffer);
-    /* Free all allocated memory */
-    if (user_list != NULL)
-        free(user_list);
-    if (array != NULL)
-        free(array);
-    if (s2s_who != NULL)
-        free(s2s_who);
-    if (send_packet != NULL)
-        free(send_packet);
+    /* Send the packet to each of the connecting servers */
+    /* Do not send it to the server that it received from */
+    fo_begin(fanout, &join_packet, sizeof(join_packet));
+    am_iterInit(neighbors, &it);
+    while (am_iterNext(&it, (void **)&server)) {
+        if (server != sender) {
+            fo_add(fanout, &server->addr);
+            /* Log the sent packet */
+            log_write(LOG_INFO, "%s %s send S2S JOIN %s",
+                    server_addr, server->ip_addr, channel);
+        }
+    }
+    (void)fo_flush(fanout);
 }
 
 /*
- * Server receives a keep-alive packet from a client; the server simply updates the
- * user's last sent packet time so that they are not logged out due to inactivity.
+ * Sends a S2S KEEP ALIVE packet to each of the neighboring servers; this
+ * will prevent the neighboring servers from being removed fom inactivity.
  */
-static void server_keep_alive_request(char *client_ip) {
+static void flood_s2s_keep_alive(void) {
 
-    User *user;
+    Server *server;
+    AMIter it;
+    struct request_s2s_keep_alive kalive_packet;
 
-    /* Assert that the user is logged in, do nothing if not */
-    if (!hm_get(users, client_ip, (void **)&user))
+    /* No neighbors, do nothing */
+    if (am_isEmpty(neighbors))
         return;
-    /* Update user time, log keep alive request */
-    update_user_time(user);
-    fprintf(stdout, "%s %s recv Request KEEP ALIVE %s\n", server_addr, user->ip_addr,
-            user->username);
+    /* Initialize and set packet members */
+    memset(&kalive_packet, 0, sizeof(kalive_packet));
+    kalive_packet.req_type = REQ_S2S_KEEP_ALIVE;
+
+    fo_begin(fanout, &kalive_packet, sizeof(kalive_packet));
+    am_iterInit(neighbors, &it);
+    while (am_iterNext(&it, (void **)&server)) {
+        /* Send the packet to each of the neighbors */
+        fo_add(fanout, &server->addr);
+    }
+    (void)fo_flush(fanout);
 }
 
 /*
- * Manually removes the specified user from the server database. Logs the user
- * out and removes all instances of the user from all their subscribed channels.
- * All reserved memory associated with the user is also freed and returned to
- * the heap.
+ * Refreshes all S2S joins by sending S2S join requests for every channel the server
+ * is subscribe to to every one of its neighboring servers. Invoked every so often to
+ * guard against network failures.
  */
-static void logout_user(User *user) {
-
-    User *tmp;
-    Server *server;
-    LinkedList *user_list;
-    long i;
-    char *ch;
-    struct request_s2s_leaf leaf_packet;
+static void refresh_s2s_joins(void) {
+    
+    void *servers;
+    int id;
 
-    /* For each of the user's subscribed channels */
-    /* Remove user from each of the existing channel's subscription list */
-    while (ll_removeFirst(user->channels, (void **)&ch)) {
+    /* Send an S2S join to all neighbors for each of the server's subscribed channels */
+    /* Flooding leaves the routing table untouched, so it is walked in place */
+    for (id = im_next(r_table, 0, &servers); id >= 0; id = im_next(r_table, id + 1, &servers))
+        neighbor_flood_channel(rg_name(id), NULL);
+}
 
-        /* Error catch: channel does not actually exist, continue */
-        if (!hm_get(channels, ch, (void **)&user_list)) {
-            free(ch);
-            continue;
-        }
+/*
+ * Adds the channel with the specified ID into the neighboring server's subscription
+ * list, with all neighboring servers subscribed to it initially; the caller holds a
+ * reference to the ID, and the list takes one of its own. Returns 1 if successful,
+ * 0 if not (malloc() error).
+ */
+static int server_join_channel(int id) {
 
-        /* Perform a linear search in channel's subscription list for user */
-        for (i = 0L; i < ll_size(user_list); i++) {
-            (void)ll_get(user_list, i, (void **)&tmp);
-            /* User found, remove them from the list */
-            if (strcmp(user->ip_addr, tmp->ip_addr) == 0) {
-                (void)ll_remove(user_list, i, (void **)&tmp);
-                break;
-            }
-        }
+    BitSet *servers;
 
-        /* If the channel is now empty, server should now delete it */
-        if (ll_isEmpty(user_list) && strcmp(ch, DEFAULT_CHANNEL)) {
-            (void)hm_remove(channels, ch, (void **)&user_list);
-            ll_destroy(user_list, NULL);
-            fprintf(stdout, "%s Removed the empty channel %s\n", server_addr, ch);
-        }
+    /* Create the set of listening servers, holding every neighbor */
+    if ((servers = (BitSet *)sl_alloc(&route_type)) == NULL)
+        return 0;
+    *servers = live_neighbors;
 
-        /* Removes server from channel sub-tree if leaf */
-        if (!remove_server_leaf(ch)) {
-            
-            /* If clients are still subscribed, do nothing */
-            if (hm_get(channels, ch, (void **)&user_list)) {
-                if (!ll_isEmpty(user_list)) {
-                    free(ch);
-                    continue;
-                }
-            }
-    
-            /* Otherwise, send a leaf check to all neighboring servers */
-            if (!hm_isEmpty(neighbors)) {
-                /* Initialize and set packet members */
-                (void)hm_get(r_table, ch, (void **)&user_list);
-                memset(&leaf_packet, 0, sizeof(leaf_packet));
-                leaf_packet.req_type = REQ_S2S_LEAF;
-                leaf_packet.id = generate_id();
-                strncpy(leaf_packet.channel, ch, (CHANNEL_MAX - 1));
-                /* Send the packet to each neighboring server */
-                for (i = 0L; i < ll_size(user_list); i++) {
-                    /* Get the IP address, send the packet */
-                    (void)ll_get(user_list, i, (void **)&server);
-                    sendto(socket_fd, &leaf_packet, sizeof(leaf_packet), 0,
-                            (struct sockaddr *)server->addr, sizeof(*server->addr));
-                }
-            }
-        }
-        free(ch);
+    /* Add the set of neighbors into the subscription map */
+    if (!im_put(r_table, id, servers)) {
+        sl_free(&route_type, servers);
+        return 0;
     }
-    free_user(user);
+    rg_hold(id);
+
+    return 1;   /* Addition was successful */
 }
 
 /*
- * Removes all instances of the server from the routing table.
+ * Invoked when a client joins the channel with the specified ID; if the server is not
+ * yet in the channel sub-tree, it subscribes itself and floods all neighboring servers
+ * with S2S JOIN requests.
  */
-static void remove_server(char *ip, char **chs, long len) {
+static void subscribe_channel(int id) {
 
-    LinkedList *s_list;
-    Server *server;
-    long i, j;
+    /* No neighbors, or server is already subscribed; do nothing */
+    if (am_isEmpty(neighbors) || im_get(r_table, id) != NULL)
+        return;
 
-    for (i = 0L; i < len; i++) {
-        /* Get list of servers */
-        if (!hm_get(r_table, chs[i], (void **)&s_list)) 
-            continue;
-        for (j = 0L; j < ll_size(s_list); j++) {
-            /* Find inactive server in the list */
-            (void)ll_get(s_list, j, (void **)&server);
-            if (strcmp(ip, server->ip_addr) != 0)
-                continue;
-            /* Remove instance from channel list */
-            (void)ll_remove(s_list, j, (void **)&server);
-            (void)remove_server_leaf(chs[i]);
-            break;
-        }
+    /* Adds the channel, and all neighboring servers to subscription map */
+    if (!server_join_channel(id)) {
+        log_write(LOG_ERROR, "%s Failed to add channel %s to server's subscription list",
+                server_addr, rg_name(id));
+        return;
     }
+    neighbor_flood_channel(rg_name(id), NULL);
 }
 
 /*
- * Server receives a logout packet from a client; server removes the user from the
- * user database and any instances of them from all the channels.
+ * Sends a packet containing the error message 'msg' to the client with the specified
+ * address information. Also logs the packet sent to the address with the error
+ * message.
  */
-static void server_logout_request(char *client_ip) {
-
-    User *user;
+static void server_send_error(struct sockaddr_in *addr, const char *msg) {
+    
+    struct text_error error_packet;
+    char client_ip[IP_MAX];
 
-    /* Assert the user is logged in, do nothing if not */
-    if (!hm_remove(users, client_ip, (void **)&user))
-        return;
-    /* Log logout request, logout the user */
-    fprintf(stdout, "%s %s recv Request LOGOUT %s\n", server_addr, user->ip_addr,
-            user->username);
-    logout_user(user);
+    /* Initialize the error packet; set the type */
+    memset(&error_packet, 0, sizeof(error_packet));
+    error_packet.txt_type = TXT_ERROR;
+    /* Copy the error message into packet, ensure length does not exceed limit allowed */
+    strncpy(error_packet.txt_error, msg, (SAY_MAX - 1));
+    /* Send packet off to user */
+    sendto(socket_fd, &error_packet, sizeof(error_packet), 0,
+            (struct sockaddr *)addr, sizeof(*addr));
+    /* Log the error message */
+    if (log_enabled(LOG_INFO))
+        log_write(LOG_INFO, "%s %s send ERROR \"%s\"", server_addr,
+                format_addr(addr, client_ip), msg);
 }
 
 /*
- * Checks the specified clock minute and determines whether the client/server
- * is inactive. If the clock minute is past the refresh rate, then the client or
- * server is deemed inactive. Return 1 if inactive, 0 if not.
+ * Replies to the verify request of the client at the specified address; tells the client
+ * whether the specified username is currently occupied or not, or passes the request on
+ * to the neighboring servers to check theirs.
  */
-static int is_inactive(short last_min) {
+static void verify_reply(char *username, struct sockaddr_in *client) {
 
-    struct tm *timestamp;
-    time_t timer;
-    int diff;
+    char client_ip[IP_MAX];
+    Server *first;
+    size_t nbytes;
+    int res = 1, nto_visit;
+    struct text_verify respond_packet;
+    struct request_s2s_verify *s2s_verify = NULL;
 
-    /* Retrieve the current time */
-    time(&timer);
-    timestamp = localtime(&timer);
-    /* Calculate the number of minutes the client last sent a packet */
-    if (timestamp->tm_min >= last_min)
-        diff = (timestamp->tm_min - last_min);
-    else
-        diff = ((60 - last_min) + timestamp->tm_min);
-    /* Check and return user inactivity */
-    return (diff > REFRESH_RATE);
-}
+    /* Check the username for uniqueness among the users of every worker */
+    format_addr(client, client_ip);
+    res = !username_taken(username);
 
-/*
- * Performs a scan on all the currently connected clients and determines for
- * each one whether the client is inactive or not. If inactive, the client
- * is forcefully logged out, or ignored if otherwise.
- */
-static void logout_inactive_users(void) {
-    
-    User *user;
-    HMEntry **u_list;
-    long i, len = 0L;
+    /* If the username is valid, and there are neighboring servers to check, */
+    /* Forward the packet to the next server in the list */
+    if (!am_isEmpty(neighbors) && res) {
 
-    /* If no users are connected, don't bother with the scan */
-    if (hm_isEmpty(users))
-        return;
+        /* Calculate size of the packet, allocate the memory */
+        nbytes = (sizeof(struct request_s2s_verify) +
+                (sizeof(struct ip_address) * (am_size(neighbors) - 1)));
+        if ((s2s_verify = (struct request_s2s_verify *)malloc(nbytes)) == NULL)
+            goto error;
+
+        /* Initialize and set the packet members */
+        memset(s2s_verify, 0, nbytes);
+        s2s_verify->req_type = REQ_S2S_VERIFY;
+        s2s_verify->id = generate_id();
+        strcpy(s2s_verify->req_username, username);
+        strncpy(s2s_verify->client.ip_addr, client_ip, (IP_MAX - 1));
+        /* Send the packet to one neighbor, with the others as the list to visit */
+        first = visit_neighbors((char *)s2s_verify->to_visit, sizeof(struct ip_address),
+                &nto_visit);
+        s2s_verify->nto_visit = nto_visit;
+
+        /* Forward the S2S verify request, log the sent packet */
+        sendto(socket_fd, s2s_verify, nbytes, 0, (struct sockaddr *)&first->addr,
+                sizeof(first->addr));
+        log_write(LOG_INFO, "%s %s send S2S VERIFY %s", server_addr, first->ip_addr,
+                s2s_verify->req_username);
 
-    /* Retrieve the list of all connected clients */
-    /* Abort the scan if failed (malloc() error), log the error */
-    if ((u_list = hm_entryArray(users, &len)) == NULL) {
-        fprintf(stdout, "%s Failed to scan for inactive users, memory allocation failed\n",
-                server_addr);
+        /* Free all allocated memory and return */
+        free(s2s_verify);
         return;
     }
 
-    for (i = 0L; i < len; i++) {
-        user = (User *)hmentry_value(u_list[i]);
-        /* Determines if the user is inactive */
-        if (is_inactive(user->last_min)) {
-            /* User is deemed inactive, logout & remove the user */
-            (void)hm_remove(users, user->ip_addr, (void **)&user);
-            fprintf(stdout, "%s Forcefully logged out inactive user %s\n",
-                    server_addr, user->username);
-            logout_user(user);
-        }
-    }
+    /* Otherwise, send the response packet back to the client */
+    /* Initialize and set packet members */
+    memset(&respond_packet, 0, sizeof(respond_packet));
+    respond_packet.txt_type = TXT_VERIFY;
+    respond_packet.valid = res;
+    /* Send packet back to client, log the request */
+    sendto(socket_fd, &respond_packet, sizeof(respond_packet), 0,
+            (struct sockaddr *)client, sizeof(*client));
+    return;
 
-    /* Free allocated memory */
-    free(u_list);
+error:
+    /* Send error back to client */
+    server_send_error(client, "Verification failed.");
+    /* Free all allocated memory */
+    if (s2s_verify != NULL)
+        free(s2s_verify);
 }
 
 /*
- * Performs a scan on all the neighboring servers and determines for
- * each one whether the server has crashed or not. If so, all instances
- * of the server are removed from the internal tables.
+ * Server receives an authentication packet; the client is told whether the username is
+ * currently occupied or not, by a reader or worker 0, see mail_query().
  */
- static void remove_inactive_servers(void) {
-    
-    Server *server;
-    HMEntry **s_list = NULL;
-    char **chs = NULL;
-    long i, c_len = 0L, s_len = 0L;
+static void server_verify_request(const char *packet, struct sockaddr_in *client) {
 
-    /* Skip scan if either table is empty */
-    if (hm_isEmpty(neighbors))
-        return;
+    char client_ip[IP_MAX];
+    struct request_verify *verify_packet = (struct request_verify *) packet;
 
-    /* malloc() failed, print error and return */
-    if ((chs = hm_keyArray(r_table, &c_len)) == NULL) {
-        if (!hm_isEmpty(r_table)) {
-            fprintf(stdout, "%s Failed to scan for crashed servers, failed to allocate memory\n",
-                    server_addr);
-            goto free;
-        }
-    }
-    /* malloc() failed, print error and return */
-    if ((s_list = hm_entryArray(neighbors, &s_len)) == NULL) {
-        if (!hm_isEmpty(neighbors)) {
-            fprintf(stdout, "%s Failed to scan for crashed servers, failed to allocate memory\n",
-                    server_addr);
-            goto free;
-        }
-    }
+    /* Log the received packet */
+    log_write(LOG_INFO, "%s %s recv Request VERIFY %s",
+            server_addr, format_addr(client, client_ip), verify_packet->req_username);
 
-    for (i = 0L; i < s_len; i++) {
-        server = hmentry_value(s_list[i]);
-        if (is_inactive(server->last_min)) {
-            /* If server deemed crashed, remove all records of it */
-            (void)hm_remove(neighbors, server->ip_addr, (void **)&server);
-            fprintf(stdout, "%s Removed crashed server %s\n", server_addr, server->ip_addr);
-            remove_server(server->ip_addr, chs, c_len);
-            free_server(server);
-        }
-    }
-    goto free;
-    
-free:
-    /* Free all allocated memory */
-    if (chs != NULL)
-        free(chs);
-    if (s_list != NULL)
-        free(s_list);
-    return;
+    mail_query(MAIL_VERIFY, verify_packet->req_username, client);
 }
 
 /*
- * Server receives a S2S VERIFY request. Checks the list of users for username uniqueness and
- * replies back to client immediately if invalid. Otherwise, if there are servers that still
- * need to be checked, forward the packet to the next server on the visitation list.
+ * Server receives a login packet; the server allocates memory and creates an instance of the
+ * new user and connects them to the server.
  */
-static void s2s_verify_request(const char *packet, char *client_ip) {
+static void server_login_request(const char *packet, struct sockaddr_in *addr) {
 
-    HashMap *ip_set = NULL;
-    User *user;
-    HMEntry **u_list = NULL;
-    char **ip_list = NULL;
-    size_t nbytes;
-    long i, len = 0L;
-    int unique, res = 1;
-    struct sockaddr_in *client = NULL;
-    struct text_verify verify_response;
-    struct request_s2s_verify *forward = NULL;
-    struct request_s2s_verify *s2s_verify = (struct request_s2s_verify *) packet;    
-
-    /* Log the received packet */
-    fprintf(stdout, "%s %s recv S2S VERIFY %s\n", server_addr, client_ip,
-            s2s_verify->req_username);
-    
-    /* Only check for username uniqueness if ID is not in cache */
-    /* Otherwise, skip; this is to guard against loops */
-    if ((unique = id_unique(s2s_verify->id)) != 0) {
-        queue_id(s2s_verify->id);
-        /* Get list of users to check */
-        if ((u_list = hm_entryArray(users, &len)) == NULL)
-            if (!hm_isEmpty(users))
-                goto free;
-        /* Iterate through list, check for uniqueness */
-        for (i = 0L; i < len; i++) {
-            user = (User *)hmentry_value(u_list[i]);
-            if (strcmp(s2s_verify->req_username, user->username) == 0) {
-                res = 0;    /* Username is taken, break from loop */
-                break;
-            }
-        }
-        free(u_list);
-        u_list = NULL;
-    }
-
-    /* Get list of neighboring servers */
-    if ((ip_list = hm_keyArray(neighbors, &len)) == NULL)
-        goto free;
-    /* Create a hashmap to store the list */
-    if ((ip_set = hm_create(0L, 0.0f)) == NULL)
-        goto free;
-    
-    /* If ID not in cache, add all the neighboring servers' IP addresses */
-    if (unique) {
-        for (i = 0L; i < len; i++)
-            if (strcmp(ip_list[i], client_ip))
-                if (!hm_containsKey(ip_set, ip_list[i]))
-                    (void)hm_put(ip_set, ip_list[i], NULL, NULL);
-    }
-    
-    /* Copy all IP addresses from received packet into hashmap */
-    for (i = 0; i < s2s_verify->nto_visit; i++)
-        if (!hm_containsKey(ip_set, s2s_verify->to_visit[i].ip_addr))
-            (void)hm_put(ip_set, s2s_verify->to_visit[i].ip_addr, NULL, NULL);
+    User *user = NULL, *previous = NULL;
+    char name[USERNAME_MAX];
+    struct request_login *login_packet = (struct request_login *) packet;
 
-    /* If there are no more servers to visit, send reply back to client */
-    if (hm_isEmpty(ip_set) || !res) {
+    /* Copy username into buffer, ensures name length does not exceed max allowed */
+    memset(name, 0, sizeof(name));
+    strncpy(name, login_packet->req_username, (USERNAME_MAX - 1));
 
-        /* Initialize and set packet members */
-        memset(&verify_response, 0, sizeof(verify_response));
-        verify_response.txt_type = TXT_VERIFY;
-        verify_response.valid = res;
+    /* Create a new instance of the user */
+    /* Send error back to client if malloc() failed, log the error */
+    if ((user = malloc_user(name, addr)) == NULL)
+        goto error;
 
-        /* Get client's address */
-        if ((client = get_addr(s2s_verify->client.ip_addr)) == NULL)
-            goto free;
-        /* Send packet to client, log sent packet */
-        sendto(socket_fd, &verify_response, sizeof(verify_response), 0,
-                (struct sockaddr *)client, sizeof(*client));
-        fprintf(stdout, "%s %s send VERIFICATION %s\n", server_addr,
-                s2s_verify->client.ip_addr, s2s_verify->req_username);
-        goto free;
+    /* Add the new user into the users hashmap and the username index */
+    /* Send error back to client if failed, log the error */
+    shard_write_lock();
+    if (!index_username(user)) {
+        shard_write_unlock();
+        goto error;
     }
+    if (!am_put(users, am_key(addr), user, (void **)&previous)) {
+        unindex_username(user);
+        shard_write_unlock();
+        goto error;
+    }
+    /* A client logging in again from the same address replaces its old session */
+    if (previous != NULL)
+        unindex_username(previous);
+    shard_write_unlock();
+    if (previous != NULL)
+        logout_user(previous);
+    /* Start the user's inactivity timer */
+    update_user_time(user);
 
-    /* Calculate size of new forwarding packet, allocate memory */
-    nbytes = (sizeof(struct request_s2s_verify) + 
-            (sizeof(struct ip_address) * hm_size(ip_set) - 1));
-    if ((forward = (struct request_s2s_verify *)malloc(nbytes)) == NULL)
-        goto free;
-    
-    /* Get array of IP addresses to copy into the new packet */
-    free(ip_list);
-    if ((ip_list = hm_keyArray(ip_set, &len)) == NULL)
-        goto free;
-    
-    /* Initialize and set packet members */
-    memset(forward, 0, nbytes);
-    forward->req_type = REQ_S2S_VERIFY;
-    forward->id = s2s_verify->id;
-    strcpy(forward->req_username, s2s_verify->req_username);
-    strcpy(forward->client.ip_addr, s2s_verify->client.ip_addr);
-    forward->nto_visit = (int)len - 1;
-    /* Copy all IP addresses into packet's visiting list */
-    for (i = 1L; i < len; i++)
-        strcpy(forward->to_visit[i - 1].ip_addr, ip_list[i]);
-
-    /* Get the address of the next server to forward packet to */
-    if ((client = get_addr(ip_list[0])) == NULL)
-        goto free;
-    /* Send the packet to the server, log the sent packet */
-    sendto(socket_fd, forward, nbytes, 0, (struct sockaddr *)client, sizeof(*client));
-    fprintf(stdout, "%s %s send S2S VERIFY %s\n", server_addr, ip_list[0],
-            s2s_verify->req_username);
-    goto free;
+    /* Log the user login information */
+    log_write(LOG_INFO, "%s %s recv Request LOGIN %s",
+            server_addr, user->ip_addr, user->username);
+    return;
 
-free:
+error:
+    /* Send error back to client */
+    server_send_error(addr, "Failed to log into the server.");
     /* Free all allocated memory */
-    if (u_list != NULL)
-        free(u_list);
-    if (ip_list != NULL)
-        free(ip_list);
-    if (ip_set != NULL)
-        hm_destroy(ip_set, NULL);
-    if (client != NULL)
-        free(client);
-    if (forward != NULL)
-        free(forward);
-    return;
+    if (user != NULL)
+        free_user(user);
 }
 
 /*
- * Server receives a S2S JOIN packet. If the server is not subscribed to the contained
- * channel, it subscribes itself to the channel and forwards the packet to all of its
- * neighboring servers. Otherwise, does nothing.
+ * Subscribes the specified user to the channel with the specified ID on this worker's
+ * shard, creating the channel if it does not exist yet; the caller holds a reference
+ * to the ID, and a created channel takes one of its own. Returns 1 if successful, 0
+ * if not (malloc() error).
  */
-static void s2s_join_request(const char *packet, char *client_ip) {
+static int join_channel(User *user, int id) {
 
-    Server *server, *sender;
-    LinkedList *servers;
-    long i;
-    struct request_s2s_join *join_packet = (struct request_s2s_join *) packet;
+    Channel *ch;
+    int created = 0;
 
-    /* Get neighboring sender */
-    if (!hm_get(neighbors, client_ip, (void **)&sender))
-        return;
-    update_server_time(sender);
+    /* Add this channel to the neighboring server's subscription list */
+    mail_channel(MAIL_JOIN, id);
 
-    /* Log the received packet */
-    fprintf(stdout, "%s %s recv S2S JOIN %s\n", server_addr, client_ip,
-            join_packet->req_channel);
+    /* User has joined a channel that does not exist */
+    shard_write_lock();
+    if ((ch = (Channel *)im_get(channels, id)) == NULL) {
 
-    /* If server is already subscribed, request dies here */
-    if (hm_get(r_table, join_packet->req_channel, (void **)&servers)) {
-        for (i = 0L; i < ll_size(servers); i++) {
-            (void)ll_get(servers, i, (void **)&server);
-            /* Server already subscribed, return */
-            if (strcmp(server->ip_addr, client_ip) == 0)
-                return;
-        }
+        /* Create the new channel, add it to the server's channel collection */
+        if ((ch = ms_create(rg_name(id), id)) == NULL)
+            goto error;
+        created = 1;
+        rg_hold(id);
+        if (!im_put(channels, id, ch))
+            goto error;
+    }
 
-        /* Server not subscribed, add it to list */
-        (void)ll_add(servers, sender);
-        return;
+    /* Subscribe the user; a user already subscribed is not added twice */
+    if (ms_join(ch, &user->subs, am_key(&user->addr), user, &user->addr) < 0)
+        goto error;
+    channel_changed(ms_name(ch));
+    shard_write_unlock();
+    return 1;
+
+error:
+    /* Do not leave behind a channel created for the user */
+    if (created) {
+        (void)im_remove(channels, id);
+        ms_destroy(ch);
+        rg_release(id);
     }
+    shard_write_unlock();
+    return 0;
+}
 
-    /* Adds the channel, and all neighboring servers to subscription map */
-    if (!server_join_channel(join_packet->req_channel)) {
-        fprintf(stdout, "%s Failed to add channel %s to server's subscription list\n",
-                server_addr, join_packet->req_channel);
+/*
+ * Server receives a join packet; the server adds the client to the requested channel, so
+ * that they can now receive messages from other subscribed clients.
+ */
+static void server_join_request(const char *packet, struct sockaddr_in *client) {
+    
+    User *user;
+    Worker *owner;
+    int id, ch_len, res;
+    char joined[CHANNEL_MAX];
+    char buffer[256];
+    struct request_join *join_packet = (struct request_join *) packet;
+
+    /* Assert that the user is currently logged in, do nothing if not */
+    if (!am_get(users, am_key(client), (void **)&user))
         return;
+    /* Update user time, log received join request */
+    update_user_time(user);
+    log_write(LOG_INFO, "%s %s recv Request JOIN %s %s", server_addr,
+            user->ip_addr, user->username, join_packet->req_channel);
+
+    /* Set the channel name length; shorten it down if exceeds max length allowed */
+    ch_len = ((strlen(join_packet->req_channel) > (CHANNEL_MAX - 1)) ?
+                (CHANNEL_MAX - 1) : strlen(join_packet->req_channel));
+    /* Extract the channel name from packet */
+    memcpy(joined, join_packet->req_channel, ch_len);
+    joined[ch_len] = '\0';
+
+    /* Intern the channel name; the channel and the mail take references of their own */
+    if ((id = rg_intern(joined)) < 0)
+        goto error;
+    /* With channel affinity, a channel owned by another worker is joined there */
+    owner = channel_owner(id);
+    if (channel_affinity && owner != self) {
+        if ((res = mail_guest(owner, MAIL_ENROL, id, user)))
+            user->shards |= (1ULL << owner->id);
+    } else {
+        res = join_channel(user, id);
     }
+    rg_release(id);
+    if (res)
+        return;
 
-    /* Flood all neighboring servers with S2S join request */
-    neighbor_flood_channel(join_packet->req_channel, client_ip);
+error:
+    /* Send error back to client */
+    sprintf(buffer, "Failed to join %s.", join_packet->req_channel);
+    server_send_error(&user->addr, buffer);
 }
 
 /*
- * Server receives an S2S LEAVE packet. The server that sent the packet is
- * removed/unsubscribed from the channel list it wishes to leave. This way,
- * the server wont send messages to this server to avoid loops, or empty
- * server channels.
+ * Removes the specified guest record from the worker if it holds no subscriptions.
  */
-static void s2s_leave_request(const char *packet, char *client_ip) {
+static void drop_idle_guest(User *guest) {
 
-    LinkedList *servers;
-    Server *server;
-    long i;
-    struct request_s2s_leave *leave_packet = (struct request_s2s_leave *) packet;
+    User *removed;
 
-    /* Log the received packet */
-    fprintf(stdout, "%s %s recv S2S LEAVE %s\n",
-            server_addr, client_ip, leave_packet->req_channel);
-    /* Assert the channel is subscribed to, return if not */
-    if (!hm_get(r_table, leave_packet->req_channel, (void **)&servers))
+    if (guest->subs != NULL)
         return;
+    (void)am_remove(guests, am_key(&guest->addr), (void **)&removed);
+    free_user(guest);
+}
 
-    /* Check each subscribed server in the list */
-    for (i = 0L; i < ll_size(servers); i++) {
-        (void)ll_get(servers, i, (void **)&server);
-        /* Server found, remove from subscription list */
-        if (strcmp(server->ip_addr, client_ip) == 0) {
-            (void)ll_remove(servers, i, (void **)&server);
-            break;
+/*
+ * Invoked on the worker owning the channel with the specified ID when a client of
+ * another worker joins it; the client is subscribed as a guest of this worker. The
+ * guest record, with the specified username, is created on its first channel here.
+ */
+static void guest_join(int id, const char *username, struct sockaddr_in *addr) {
+
+    User *guest;
+    char buffer[256];
+
+    /* Look up the client's guest record; create it if there is none */
+    if (!am_get(guests, am_key(addr), (void **)&guest)) {
+        if ((guest = malloc_user(username, addr)) == NULL)
+            goto error;
+        if (!am_put(guests, am_key(addr), guest, NULL)) {
+            free_user(guest);
+            goto error;
         }
     }
-    
-    /* Server removes itself from channel sub-tree if leaf */
-    (void)remove_server_leaf(leave_packet->req_channel);
+    if (join_channel(guest, id))
+        return;
+    drop_idle_guest(guest);
+
+error:
+    /* The worker shares the server's port; the client gets the error as usual */
+    sprintf(buffer, "Failed to join %s.", rg_name(id));
+    server_send_error(addr, buffer);
 }
 
 /*
- * Server recieves an S2S SAY request. The message gets broadcasted to all/any
- * users listening on the channel. The request is also forwarded to all
- * connected/listening neighboring servers. If the server is a leaf in the
- * channel sub-tree, and no users are listening on the channel, the server replies
- * by sending an S2S leave request.
+ * Invoked when the last client subscribed to the channel with the specified ID on one
+ * of the workers leaves it. The server removes itself from the channel sub-tree if it
+ * is now a leaf; otherwise, if no clients on any worker are subscribed, it sends a
+ * leaf check packet to all subscribed neighbors.
  */
-static void s2s_say_request(const char *packet, char *client_ip) {
+static void channel_vacated(int id) {
 
-    Server *server, *sender;
-    LinkedList *users, *servers;
-    long i;
-    struct request_s2s_leave leave_packet;
-    struct request_s2s_say *say_packet = (struct request_s2s_say *) packet;
+    BitSet *servers;
+    int i;
+    struct request_s2s_leaf leaf_packet;
 
-    /* Get the sending server */
-    if (!hm_get(neighbors, client_ip, (void **)&sender))
+    /* Server removes itself from channel sub-tree if leaf */
+    if (remove_server_leaf(id))
         return;
-    update_server_time(sender);
-    /* Get list of listening servers */
-    if (!hm_get(r_table, say_packet->req_channel, (void **)&servers))
+    /* Checks to see if clients are currently subscribed */
+    if (channel_has_users(id))
+        return;
+    /* If no clients are subscribed, send a leaf check packet to all neighbors */
+    if ((servers = (BitSet *)im_get(r_table, id)) == NULL)
         return;
 
-    /* Initialize and set leave packet members */
-    memset(&leave_packet, 0, sizeof(leave_packet));
-    leave_packet.req_type = REQ_S2S_LEAVE;
-    strncpy(leave_packet.req_channel, say_packet->req_channel, (CHANNEL_MAX - 1));
+    /* Initialize and set packet members */
+    memset(&leaf_packet, 0, sizeof(leaf_packet));
+    leaf_packet.req_type = REQ_S2S_LEAF;
+    leaf_packet.id = generate_id();
+    strncpy(leaf_packet.channel, rg_name(id), (CHANNEL_MAX - 1));
+    /* Sends the packet to all neighbors */
+    fo_begin(fanout, &leaf_packet, sizeof(leaf_packet));
+    for (i = bs_next(servers, 0); i >= 0; i = bs_next(servers, i + 1))
+        fo_add(fanout, &neighbor_index[i]->addr);
+    (void)fo_flush(fanout);
+}
 
-    /* Check the packet ID for uniqueness */
-    if (!id_unique(say_packet->id)) {
-        /* Reply to sender with S2S if duplicate, loop detected */
-        sendto(socket_fd, &leave_packet, sizeof(leave_packet), 0,
-                (struct sockaddr *)sender->addr, sizeof(*sender->addr));
-        /* Log the sent leave packet */
-        fprintf(stdout, "%s %s send S2S LEAVE %s\n", server_addr, sender->ip_addr,
-                say_packet->req_channel);
-        return;
+/*
+ * Finishes a client's leaving the specified channel on this worker's shard, which the
+ * caller has locked for writing; the shard is unlocked. If no clients are left on the
+ * channel here, worker 0 is told, and the channel is deleted unless it is the default.
+ */
+static void channel_left(Channel *ch) {
+
+    int id = ms_id(ch), vacated, removed = 0;
+
+    channel_changed(ms_name(ch));
+    /* If the channel the user left becomes empty, remove it from channel list */
+    if ((vacated = ms_isEmpty(ch)) && strcmp(ms_name(ch), DEFAULT_CHANNEL)) {
+        /* Free all memory reserved by deleted channel */
+        log_write(LOG_INFO, "%s Removed the empty channel %s", server_addr, ms_name(ch));
+        (void)im_remove(channels, id);
+        ms_destroy(ch);
+        removed = 1;
     }
-    queue_id(say_packet->id);   /* Add the packet to the ID queue */
+    shard_write_unlock();
+
+    /* No clients left on the channel here; check whether the server is still needed */
+    /* The mail takes its own reference before the removed channel's is dropped */
+    if (vacated)
+        mail_channel(MAIL_LEAVE, id);
+    if (removed)
+        rg_release(id);
+}
 
-    /* Log the received packet */
-    fprintf(stdout, "%s %s recv S2S SAY %s %s \"%s\"\n", server_addr, client_ip,
-            say_packet->req_username, say_packet->req_channel, say_packet->req_text);
+/*
+ * Server recieves a leave packet from a client; the server removes the specified
+ * channel from the user's subscription list and deletes the channel if becomes
+ * empty.
+ */
+static void server_leave_request(const char *packet, struct sockaddr_in *client) {
 
-    /* Broadcast the message to all local users on channel */
-    if (hm_get(channels, say_packet->req_channel, (void **)&users))
-        (void)broadcast_message(users, say_packet->req_username,
-    say_packet->req_channel, say_packet->req_text);
+    User *user;
+    Worker *owner;
+    Channel *ch = NULL;
+    int id;
+    char channel[CHANNEL_MAX], buffer[256];
+    struct request_leave *leave_packet = (struct request_leave *) packet;
 
-    /* Server is a leaf, remove it from sub-tree */
-    if (remove_server_leaf(say_packet->req_channel))
+    /* Assert that the user requesting is currently logged in, do nothing if not */
+    if (!am_get(users, am_key(client), (void **)&user))
         return;
+    update_user_time(user);
 
-    /* If server not a leaf, forward S2S request to all subscribed neighbors */
-    for (i = 0L; i < ll_size(servers); i++) {
-        (void)ll_get(servers, i, (void **)&server);
-        if (strcmp(server->ip_addr, sender->ip_addr) == 0)
-            continue;   /* Skip the server that sent the request */
-        /* Forward the packet to the subscribed neighbor */
-        sendto(socket_fd, say_packet, sizeof(*say_packet), 0,
-                (struct sockaddr *)server->addr, sizeof(*server->addr));
-        /* Log the sent packet */
-        fprintf(stdout, "%s %s send S2S SAY %s %s \"%s\"\n", server_addr,
-                server->ip_addr, say_packet->req_username, say_packet->req_channel,
-                say_packet->req_text);
+    /* Copy into buffer, ensure the channel name length does not exceed maximum allowed */
+    memset(channel, 0, sizeof(channel));
+    strncpy(channel, leave_packet->req_channel, (CHANNEL_MAX - 1));
+    /* With channel affinity, a channel owned by another worker is left there */
+    if (channel_affinity && (id = rg_acquire(channel)) >= 0) {
+        owner = channel_owner(id);
+        if (owner != self && !mail_guest(owner, MAIL_RESIGN, id, user)) {
+            sprintf(buffer, "Failed to leave %s.", channel);
+            server_send_error(&user->addr, buffer);
+        }
+        rg_release(id);
+        if (owner != self)
+            return;
+    }
+    /* Assert that the channel currently exists */
+    /* If not, report error back to user, log the error */
+    /* Subscribed users always find the channel on their own worker */
+    /* The worker's channels pin their IDs, so the name is looked up without a reference */
+    if ((id = rg_lookup(channel)) >= 0)
+        ch = (Channel *)im_get(channels, id);
+    if (ch == NULL) {
+        if ((id = rg_acquire(channel)) >= 0 && channel_exists(id))
+            sprintf(buffer, "You are not subscribed to %s.", channel);
+        else
+            sprintf(buffer, "No channel by the name %s.", leave_packet->req_channel);
+        if (id >= 0)
+            rg_release(id);
+        server_send_error(&user->addr, buffer);
+        return;
+    }
+
+    /* Next, remove the user's subscription from the channel and from the user's list */
+    /* Ensures no more messages will be sent to the unsubscribed user */
+    shard_write_lock();
+    if (!ms_leave(ch, am_key(&user->addr))) {
+        shard_write_unlock();
+        /* User was not removed, wasn't subscribed to channel to begin with */
+        /* Send a message back to user notifying them, log the error */
+        sprintf(buffer, "You are not subscribed to %s.", channel);
+        server_send_error(&user->addr, buffer);
+        return;
     }
+    log_write(LOG_INFO, "%s %s recv Request LEAVE %s %s", server_addr,
+            user->ip_addr, user->username, channel);
+    channel_left(ch);
 }
 
 /*
- * Server recieves a S2S LIST request. Server will collect all channel names it
- * has stored inside its table(s), and appends it to the packets collection. If
- * there are still servers to visit, the server forwards the S2S LIST to the next,
- * otherwise sends a reply back to the client.
+ * Invoked on the worker owning the channel with the specified ID when a client of
+ * another worker leaves it; the guest's subscription is removed as in
+ * server_leave_request(), and the guest record once it has none left.
  */
-static void s2s_list_request(const char *packet, char *client_ip) {
+static void guest_leave(int id, struct sockaddr_in *addr) {
 
-    HashMap *ch_set = NULL, *ip_set = NULL;
-    char **array = NULL;
-    size_t nbytes;
-    int unique;
-    long i, j, len = 0L;
-    struct sockaddr_in *client = NULL;
-    struct text_list *list_packet = NULL;
-    struct request_s2s_list *forward = NULL;
-    struct request_s2s_list *s2s_list = (struct request_s2s_list *) packet;    
+    User *guest;
+    Channel *ch;
+    char buffer[256];
 
-    /* Log the received packet */
-    fprintf(stdout, "%s %s recv S2S LIST\n", server_addr, client_ip);
+    /* The channel exists only here; the client must be subscribed as a guest */
+    if ((ch = (Channel *)im_get(channels, id)) == NULL) {
+        sprintf(buffer, "No channel by the name %s.", rg_name(id));
+        server_send_error(addr, buffer);
+        return;
+    }
+    shard_write_lock();
+    if (!am_get(guests, am_key(addr), (void **)&guest) || !ms_leave(ch, am_key(addr))) {
+        shard_write_unlock();
+        sprintf(buffer, "You are not subscribed to %s.", rg_name(id));
+        server_send_error(addr, buffer);
+        return;
+    }
+    log_write(LOG_INFO, "%s %s recv Request LEAVE %s %s", server_addr,
+            guest->ip_addr, guest->username, ms_name(ch));
+    channel_left(ch);
+    drop_idle_guest(guest);
+}
 
-    /* Create hashmap to hold list, transfer from packet into map */
+/*
+ * Sends a say packet to each client subscribed to the channel 'ch', broadcasting
+ * the message. The packet is built once and handed to the fan-out engine, which sends
+ * it to the listeners in batches.
+ */
+static int broadcast_message(Channel *ch, char *username, char *text) {
+    
+    struct text_say msg_packet;
+
+    /* NULL checking */
+    if (ch == NULL)
+        return 0;
+
+    /* Initialize the SAY packet to send; set the type, channel, and username */
+    memset(&msg_packet, 0, sizeof(msg_packet));
+    msg_packet.txt_type = TXT_SAY;
+    strncpy(msg_packet.txt_channel, ms_name(ch), (CHANNEL_MAX - 1));
+    strncpy(msg_packet.txt_username, username, (USERNAME_MAX - 1));
+    strncpy(msg_packet.txt_text, text, (SAY_MAX - 1));
+
+    /* Send the packet to each user listening on the channel, straight from its destinations */
+    fo_begin(fanout, &msg_packet, sizeof(msg_packet));
+    fo_addArray(fanout, ms_destinations(ch), ms_size(ch));
+    (void)fo_flush(fanout);
+
+    return 1;   /* Successful broadcast(s), return 1 */
+}
+
+/*
+ * Forwards a message a client of this server sent on the channel with the specified
+ * ID to all of the neighboring servers subscribed to the channel as an S2S SAY request.
+ */
+static void s2s_forward_say(char *username, int id, char *text) {
+
+    Server *server;
+    BitSet *servers;
+    int i;
+    struct request_s2s_say s2s_say;
+
+    /* Get the list of listening neighboring servers */
+    if ((servers = (BitSet *)im_get(r_table, id)) == NULL)
+        return;
+
+    /* Initialize the S2S SAY packet to send; set the ID, channel, and username */
+    memset(&s2s_say, 0, sizeof(s2s_say));
+    s2s_say.req_type = REQ_S2S_SAY;
+    s2s_say.id = generate_id();
+    strncpy(s2s_say.req_channel, rg_name(id), (CHANNEL_MAX - 1));
+    strncpy(s2s_say.req_username, username, (USERNAME_MAX - 1));
+    strncpy(s2s_say.req_text, text, (SAY_MAX - 1));
+
+    /* Send the S2S say packet to all connecting servers */
+    fo_begin(fanout, &s2s_say, sizeof(s2s_say));
+    for (i = bs_next(servers, 0); i >= 0; i = bs_next(servers, i + 1)) {
+        server = neighbor_index[i];
+        fo_add(fanout, &server->addr);
+        /* Log the S2S packet sent */
+        log_write(LOG_INFO, "%s %s send S2S SAY %s %s \"%s\"", server_addr,
+                server->ip_addr, s2s_say.req_username, s2s_say.req_channel,
+        s2s_say.req_text);
+    }
+    (void)fo_flush(fanout);
+}
+
+/*
+ * Delivers a message on the channel with the specified ID to every client of this
+ * server subscribed to it; the caller holds a reference to the ID. The calling worker
+ * broadcasts it to its own subscribers, and passes it to every other worker as mail
+ * to broadcast to theirs; with channel affinity, only the channel's owner has any.
+ * The mail carries the channel's name along with the ID instead of a reference, see
+ * said_channel(). If 'forward' is set, the message is
+ * also forwarded to the subscribed neighboring servers. Returns 1 if the local
+ * broadcast was successful, 0 if not (malloc() error).
+ */
+static int deliver_message(char *username, int id, char *text, int forward) {
+
+    Channel *ch;
+    Mail mail;
+    int w, res = 1;
+
+    /* Broadcast the message to the subscribers on this worker */
+    if ((ch = (Channel *)im_get(channels, id)) != NULL)
+        res = broadcast_message(ch, username, text);
+
+    /* Pass the message to all other workers; worker 0 forwards it to the neighbors */
+    if (nworkers > 1) {
+        memset(&mail, 0, sizeof(mail));
+        mail.type = MAIL_SAY;
+        mail.channel_id = id;
+        strncpy(mail.u.say.channel, rg_name(id), (CHANNEL_MAX - 1));
+        strncpy(mail.u.say.username, username, (USERNAME_MAX - 1));
+        strncpy(mail.u.say.text, text, (SAY_MAX - 1));
+        for (w = 0; w < nworkers; w++) {
+            if (&workers[w] == self)
+                continue;
+            mail.forward = (forward && w == 0);
+            if (channel_affinity && &workers[w] != channel_owner(id) && !mail.forward)
+                continue;
+            (void)post_mail(&workers[w], &mail);
+        }
+    }
+
+    if (forward && self == workers)
+        s2s_forward_say(username, id, text);
+
+    return res;
+}
+
+/*
+ * Server receiveds a say packet from a client; the server broadcasts the message
+ * back to all connected clients subscribed to the requested channel by sending
+ * a packet to each of the subscribed clients.
+ */
+static void server_say_request(const char *packet, struct sockaddr_in *client) {
+    
+    User *user;
+    int id;
+    char buffer[256];
+    struct request_say *say_packet = (struct request_say *) packet;
+
+    /* Assert user is logged in; do nothing if not */
+    if (!am_get(users, am_key(client), (void **)&user))
+        return;
+    /* Look the channel up once; the message travels to the other workers by its ID */
+    /* Assert that the channel exists; do nothing if not */
+    if ((id = resolve_channel(say_packet->req_channel)) < 0 || !channel_exists(id))
+        return;
+    /* Update user time, log received say request */
+    update_user_time(user);
+    log_write(LOG_INFO, "%s %s recv Request SAY %s %s \"%s\"", server_addr, user->ip_addr,
+            user->username, say_packet->req_channel, say_packet->req_text);
+
+    /* Respond to user with error message if malloc() failure, log the error */
+    if (!deliver_message(user->username, id, say_packet->req_text, 1)) {
+        sprintf(buffer, "Failed to send the message.");
+        server_send_error(&user->addr, buffer);
+    }
+}
+
+/*
+ * Replies to the list request of the client at the specified address; compiles a
+ * list of all the channels currently available on the server and sends it back to
+ * the client, or passes it on to the neighboring servers to append theirs.
+ */
+static void list_reply(struct sockaddr_in *addr) {
+
+    HashMap *ch_set = NULL;
+    Server *first;
+    HMIter it;
+    char client_ip[IP_MAX], *ch;
+    size_t nbytes;
+    int nto_visit;
+    long i, len = 0L;
+    struct request_s2s_list *s2s_list = NULL;
+    struct text_list *list_packet = NULL;
+
+    /* Retrieve the complete list of channel names */
+    /* Send error message back to client if failed (malloc() error), log the error */
+    if ((ch_set = hm_create(100L, 0.0f)) == NULL)
+        goto error;
+    if (!collect_channels(ch_set))
+        goto error;
+    len = hm_size(ch_set);
+    
+    /* If there are neighboring servers, we must send an S2S request */
+    if (!am_isEmpty(neighbors)) {
+
+        /* Calculate the size of the packet, allocate the memory */
+        nbytes = (sizeof(struct request_s2s_list) + (sizeof(struct s2s_list_container) *
+        (len + (am_size(neighbors) - 1))));
+        if ((s2s_list = (struct request_s2s_list *)malloc(nbytes)) == NULL)
+            goto error;
+
+        /* Initialize and set the packet members */
+        memset(s2s_list, 0, nbytes);
+        s2s_list->req_type = REQ_S2S_LIST;
+        s2s_list->id = generate_id();
+        strncpy(s2s_list->client.ip_addr, format_addr(addr, client_ip), (IP_MAX - 1));
+        s2s_list->nchannels = (int)len;
+
+        /* Copy all channels into the packet */
+        hm_iterInit(ch_set, &it);
+        for (i = 0L; hm_iterNext(&it, &ch, NULL); i++)
+            strncpy(s2s_list->payload[i].item, ch, (CHANNEL_MAX - 1));
+
+        /* Send the packet to one neighbor, with the others after the channels to visit */
+        first = visit_neighbors((char *)&s2s_list->payload[len],
+                sizeof(struct s2s_list_container), &nto_visit);
+        s2s_list->nto_visit = nto_visit;
+        sendto(socket_fd, s2s_list, nbytes, 0, (struct sockaddr *)&first->addr,
+                sizeof(first->addr));
+        log_write(LOG_INFO, "%s %s send S2S LIST", server_addr, first->ip_addr);
+
+        /* Free all allocated memory */
+        free(s2s_list);
+        hm_destroy(ch_set, NULL);
+        return;
+    }
+
+    /* Calculate the exact size of packet to send back */
+    nbytes = sizeof(struct text_list) + (sizeof(struct channel_info) * len);
+    /* Allocate memory for the packet using calculated size */
+    /* Send error back to user if failed (malloc() error), log the error */
+    if ((list_packet = (struct text_list *)malloc(nbytes)) == NULL)
+        goto error;
+
+    /* Initialize the packet; set the type and number of channels */
+    memset(list_packet, 0, nbytes);
+    list_packet->txt_type = TXT_LIST;
+    list_packet->txt_nchannels = (int)len;
+    /* Copy each channel name from the list into the packet */
+    hm_iterInit(ch_set, &it);
+    for (i = 0L; hm_iterNext(&it, &ch, NULL); i++)
+        strncpy(list_packet->txt_channels[i].ch_channel, ch, (CHANNEL_MAX - 1));
+
+    /* Send the packet to client, log the listing event */
+    sendto(socket_fd, list_packet, nbytes, 0, (struct sockaddr *)addr, sizeof(*addr));
+
+    /* Return all allocated memory back to heap */
+    free(list_packet);
+    hm_destroy(ch_set, NULL);
+    return;
+
+error:
+    /* Send error back to client */
+    server_send_error(addr, "Failed to list the channels.");
+    /* Free all allocated memory */
+    if (s2s_list != NULL)
+        free(s2s_list);
+    if (list_packet != NULL)
+        free(list_packet);
+    if (ch_set != NULL)
+        hm_destroy(ch_set, NULL);
+}
+
+/*
+ * Server receives a list packet from a client; the client's list of all the
+ * channels is compiled and sent back by a reader or worker 0, see mail_query().
+ */
+static void server_list_request(struct sockaddr_in *client) {
+
+    User *user;
+
+    /* Assert that the user is logged in, do nothing if not */
+    if (!am_get(users, am_key(client), (void **)&user))
+        return;
+    /* Update user time, log list request */
+    update_user_time(user);
+    log_write(LOG_INFO, "%s %s recv Request LIST %s", server_addr, user->ip_addr,
+            user->username);
+
+    mail_query(MAIL_LIST, NULL, &user->addr);
+}
+
+/*
+ * Replies to the who request of the client at the specified address; compiles a
+ * list of all the users currently subscribed to the requested channel and sends
+ * it back to the client, or passes it on to the neighboring servers to append
+ * theirs.
+ */
+static void who_reply(char *channel, struct sockaddr_in *addr) {
+
+    LinkedList *unames = NULL;
+    Server *first;
+    LLIter it;
+    char client_ip[IP_MAX], *name;
+    size_t nbytes;
+    int res = 0, nto_visit;
+    long i, len = 0L;
+    char buffer[256];
+    struct request_s2s_who *s2s_who = NULL;
+    struct text_who *send_packet = NULL;
+
+    /* Collect the usernames of every subscriber to the channel */
+    if ((unames = ll_create()) == NULL)
+        goto error;
+    if ((res = collect_members(channel, unames)) < 0)
+        goto error;
+    len = ll_size(unames);
+    
+    /* If there are neighboring servers, we must send an S2S request to them */
+    if (!am_isEmpty(neighbors)) {
+
+        /* Calculate the size of the packet, allocate the memory */
+        nbytes = (sizeof(struct request_s2s_who) + (sizeof(struct s2s_who_container) *
+                (len + (am_size(neighbors) - 1))));
+        if ((s2s_who = (struct request_s2s_who *)malloc(nbytes)) == NULL)
+            goto error;
+
+        /* Initialize and set the packet members */
+        memset(s2s_who, 0, nbytes);
+        s2s_who->req_type = REQ_S2S_WHO;
+        s2s_who->id = generate_id();
+        strncpy(s2s_who->channel, channel, (CHANNEL_MAX - 1));
+        strncpy(s2s_who->client.ip_addr, format_addr(addr, client_ip), (IP_MAX - 1));
+
+        /* Copy the usernames into the packet */
+        s2s_who->nusers = (int)len;
+        ll_iterInit(unames, &it);
+        for (i = 0L; ll_iterNext(&it, (void **)&name); i++)
+            strncpy(s2s_who->payload[i].item, name, (USERNAME_MAX - 1));
+
+        /* Send the packet to one neighbor, with the others after the usernames to visit */
+        first = visit_neighbors((char *)&s2s_who->payload[len],
+                sizeof(struct s2s_who_container), &nto_visit);
+        s2s_who->nto_visit = nto_visit;
+        sendto(socket_fd, s2s_who, nbytes, 0, (struct sockaddr *)&first->addr,
+                sizeof(first->addr));
+        log_write(LOG_INFO, "%s %s send S2S WHO %s", server_addr, first->ip_addr, channel);
+
+        /* Free all allocated memory */
+        free(s2s_who);
+        ll_destroy(unames, free);
+        return;
+    }
+
+    /* If channel does not exist, respond back to client with error message */
+    if (!res) {
+        sprintf(buffer, "No channel by the name %s.", channel);
+        server_send_error(addr, buffer);
+        ll_destroy(unames, free);
+        return;
+    }
+
+    /* Calculate the exact size of packet to send back */
+    nbytes = sizeof(struct text_who) + (sizeof(struct user_info) * len);
+    /* Allocate memory for the packet using calculated size */
+    /* Send error back to user if failed (malloc() error), log the error */
+    if ((send_packet = (struct text_who *)malloc(nbytes)) == NULL)
+        goto error;
+
+    /* Initialize the packet; set the type, number of users, and channel */
+    memset(send_packet, 0, nbytes);
+    send_packet->txt_type = TXT_WHO;
+    send_packet->txt_nusernames = (int)len;
+    strncpy(send_packet->txt_channel, channel, (CHANNEL_MAX - 1));
+    /* Copy each username from subscription list into packet */
+    ll_iterInit(unames, &it);
+    for (i = 0L; ll_iterNext(&it, (void **)&name); i++)
+        strncpy(send_packet->txt_users[i].us_username, name, (USERNAME_MAX - 1));
+
+    /* Send the packet to client, log the listing event */
+    sendto(socket_fd, send_packet, nbytes, 0, (struct sockaddr *)addr, sizeof(*addr));
+    /* Return all allocated memory back to heap */
+    free(send_packet);
+    ll_destroy(unames, free);
+    return;
+
+error:
+    /* Send error back to client */
+    sprintf(buffer, "Failed to list users on %s.", channel);
+    server_send_error(addr, buffer);
+    /* Free all allocated memory */
+    if (unames != NULL)
+        ll_destroy(unames, free);
+    if (s2s_who != NULL)
+        free(s2s_who);
+    if (send_packet != NULL)
+        free(send_packet);
+}
+
+/*
+ * Server receives a who packet from a client; the list of all the users on the
+ * requested channel is compiled and sent back by a reader or worker 0, see
+ * mail_query().
+ */
+static void server_who_request(const char *packet, struct sockaddr_in *client) {
+
+    User *user;
+    struct request_who *who_packet = (struct request_who *) packet;
+
+    /* Assert that the user is logged in, do nothing if not */
+    if (!am_get(users, am_key(client), (void **)&user))
+        return;
+    /* Update user time, log who request */
+    update_user_time(user);
+    log_write(LOG_INFO, "%s %s recv Request WHO %s %s", server_addr, user->ip_addr,
+            user->username, who_packet->req_channel);
+
+    mail_query(MAIL_WHO, who_packet->req_channel, &user->addr);
+}
+
+/*
+ * Server receives a keep-alive packet from a client; the server simply updates the
+ * user's last sent packet time so that they are not logged out due to inactivity.
+ */
+static void server_keep_alive_request(struct sockaddr_in *client) {
+
+    User *user;
+
+    /* Assert that the user is logged in, do nothing if not */
+    if (!am_get(users, am_key(client), (void **)&user))
+        return;
+    /* Update user time, log keep alive request */
+    update_user_time(user);
+    log_write(LOG_INFO, "%s %s recv Request KEEP ALIVE %s", server_addr, user->ip_addr,
+            user->username);
+}
+
+/*
+ * Removes each of the specified user's subscriptions from its channel on this
+ * worker's shard, one at a time; see channel_left().
+ */
+static void leave_all(User *user) {
+
+    Channel *ch;
+
+    for (;;) {
+        shard_write_lock();
+        if ((ch = ms_leaveFirst(&user->subs)) == NULL) {
+            shard_write_unlock();
+            break;
+        }
+        channel_left(ch);
+    }
+}
+
+/*
+ * Manually removes the specified user from the server database. Logs the user
+ * out and removes all instances of the user from all their subscribed channels.
+ * All reserved memory associated with the user is also freed and returned to
+ * the heap.
+ */
+static void logout_user(User *user) {
+
+    int w;
+
+    leave_all(user);
+    /* With channel affinity, the workers holding the user as a guest drop it too */
+    for (w = 0; w < nworkers; w++)
+        if ((user->shards & (1ULL << w)) && !mail_guest(&workers[w], MAIL_DEPART, -1, user))
+            log_write(LOG_ERROR, "%s Failed to drop guest %s from worker %d", server_addr,
+                    user->username, w);
+    free_user(user);
+}
+
+/*
+ * Invoked on a worker when a client of another worker that was its guest logs out;
+ * the guest's subscriptions are all removed, along with the guest record.
+ */
+static void guest_depart(struct sockaddr_in *addr) {
+
+    User *guest;
+
+    /* The guest may have left all the channels here already */
+    if (!am_remove(guests, am_key(addr), (void **)&guest))
+        return;
+    leave_all(guest);
+    free_user(guest);
+}
+
+/*
+ * Removes all instances of the specified set of servers from the routing table; each
+ * channel's set of listening servers is masked with it, and channels this server then
+ * is a leaf of are left.
+ */
+static void remove_servers(const BitSet *gone) {
+
+    BitSet *servers;
+    int id;
+
+    for (id = im_next(r_table, 0, (void **)&servers); id >= 0;
+            id = im_next(r_table, id + 1, (void **)&servers)) {
+        if (!bs_intersects(servers, gone))
+            continue;
+        bs_andNot(servers, gone);
+        if (leave_if_leaf(id, servers)) {
+            (void)im_remove(r_table, id);
+            sl_free(&route_type, servers);
+            rg_release(id);
+        }
+    }
+}
+
+/*
+ * Server receives a logout packet from a client; server removes the user from the
+ * user database and any instances of them from all the channels.
+ */
+static void server_logout_request(struct sockaddr_in *client) {
+
+    User *user;
+
+    /* Assert the user is logged in, do nothing if not */
+    shard_write_lock();
+    if (!am_remove(users, am_key(client), (void **)&user)) {
+        shard_write_unlock();
+        return;
+    }
+    unindex_username(user);
+    shard_write_unlock();
+    /* Log logout request, logout the user */
+    log_write(LOG_INFO, "%s %s recv Request LOGOUT %s", server_addr, user->ip_addr,
+            user->username);
+    logout_user(user);
+}
+
+/*
+ * Invoked by the worker's timer wheel when a client has sent no packet for REFRESH_RATE
+ * minutes; the client is forcefully logged out.
+ */
+static void user_expired(void *arg) {
+
+    User *user = (User *)arg, *removed;
+
+    shard_write_lock();
+    (void)am_remove(users, am_key(&user->addr), (void **)&removed);
+    unindex_username(user);
+    shard_write_unlock();
+    log_write(LOG_WARN, "%s Forcefully logged out inactive user %s",
+            server_addr, user->username);
+    logout_user(user);
+}
+
+/*
+ * Invoked by worker 0's timer wheel when a neighboring server has sent no S2S request
+ * for REFRESH_RATE minutes; the server is deemed crashed, and all instances of it are
+ * removed from the internal tables.
+ */
+static void server_expired(void *arg) {
+
+    Server *server = (Server *)arg, *removed;
+    BitSet gone;
+
+    (void)am_remove(neighbors, am_key(&server->addr), (void **)&removed);
+    log_write(LOG_WARN, "%s Removed crashed server %s", server_addr, server->ip_addr);
+    /* Once the last neighbor is gone, the readers may answer the clients' queries */
+    if (am_isEmpty(neighbors))
+        __atomic_store_n(&standalone, 1, __ATOMIC_RELEASE);
+    /* Retire the server's index, then remove it from every channel */
+    bs_remove(&live_neighbors, server->index);
+    neighbor_index[server->index] = NULL;
+    bs_clear(&gone);
+    bs_add(&gone, server->index);
+    remove_servers(&gone);
+    free_server(server);
+}
+
+/*
+ * Server receives a S2S VERIFY request. Checks the list of users for username uniqueness and
+ * replies back to client immediately if invalid. Otherwise, if there are servers that still
+ * need to be checked, forward the packet to the next server on the visitation list.
+ */
+static void s2s_verify_request(const char *packet, struct sockaddr_in *from) {
+
+    Server *sender;
+    HashMap *ip_set = NULL;
+    char buffer[IP_MAX], *client_ip, *first;
+    size_t nbytes;
+    long i;
+    int unique, nto_visit, res = 1;
+    struct sockaddr_in client;
+    struct text_verify verify_response;
+    struct request_s2s_verify *forward = NULL;
+    struct request_s2s_verify *s2s_verify = (struct request_s2s_verify *) packet;    
+
+    /* Log the received packet */
+    client_ip = sender_ip(from, &sender, buffer);
+    log_write(LOG_INFO, "%s %s recv S2S VERIFY %s", server_addr, client_ip,
+            s2s_verify->req_username);
+    
+    /* Only check for username uniqueness if ID is not in cache */
+    /* Otherwise, skip; this is to guard against loops */
+    if ((unique = id_unique(s2s_verify->id)) != 0) {
+        /* Check the username for uniqueness among the users of every worker */
+        res = !username_taken(s2s_verify->req_username);
+    }
+
+    /* Create a hashmap to store the servers left to visit */
+    if ((ip_set = hm_create(0L, 0.0f)) == NULL)
+        goto free;
+    
+    /* If ID not in cache, add all the neighboring servers' IP addresses */
+    if (unique)
+        add_neighbor_ips(ip_set, client_ip);
+    
+    /* Copy all IP addresses from received packet into hashmap */
+    for (i = 0; i < s2s_verify->nto_visit; i++)
+        if (!hm_containsKey(ip_set, s2s_verify->to_visit[i].ip_addr))
+            (void)hm_put(ip_set, s2s_verify->to_visit[i].ip_addr, NULL, NULL);
+
+    /* If there are no more servers to visit, send reply back to client */
+    if (hm_isEmpty(ip_set) || !res) {
+
+        /* Initialize and set packet members */
+        memset(&verify_response, 0, sizeof(verify_response));
+        verify_response.txt_type = TXT_VERIFY;
+        verify_response.valid = res;
+
+        /* Get client's address */
+        if (!get_addr(s2s_verify->client.ip_addr, &client))
+            goto free;
+        /* Send packet to client, log sent packet */
+        sendto(socket_fd, &verify_response, sizeof(verify_response), 0,
+                (struct sockaddr *)&client, sizeof(client));
+        log_write(LOG_INFO, "%s %s send VERIFICATION %s", server_addr,
+                s2s_verify->client.ip_addr, s2s_verify->req_username);
+        goto free;
+    }
+
+    /* Calculate size of new forwarding packet, allocate memory */
+    nbytes = (sizeof(struct request_s2s_verify) + 
+            (sizeof(struct ip_address) * hm_size(ip_set) - 1));
+    if ((forward = (struct request_s2s_verify *)malloc(nbytes)) == NULL)
+        goto free;
+    
+    /* Initialize and set packet members */
+    memset(forward, 0, nbytes);
+    forward->req_type = REQ_S2S_VERIFY;
+    forward->id = s2s_verify->id;
+    strcpy(forward->req_username, s2s_verify->req_username);
+    strcpy(forward->client.ip_addr, s2s_verify->client.ip_addr);
+    /* The first server is forwarded to, the rest go into the packet's visiting list */
+    first = visit_set(ip_set, (char *)forward->to_visit, sizeof(struct ip_address),
+            &nto_visit);
+    forward->nto_visit = nto_visit;
+
+    /* Get the address of the next server to forward packet to */
+    if (!get_addr(first, &client))
+        goto free;
+    /* Send the packet to the server, log the sent packet */
+    sendto(socket_fd, forward, nbytes, 0, (struct sockaddr *)&client, sizeof(client));
+    log_write(LOG_INFO, "%s %s send S2S VERIFY %s", server_addr, first,
+            s2s_verify->req_username);
+    goto free;
+
+free:
+    /* Free all allocated memory */
+    if (ip_set != NULL)
+        hm_destroy(ip_set, NULL);
+    if (forward != NULL)
+        free(forward);
+    return;
+}
+
+/*
+ * Server receives a S2S JOIN packet. If the server is not subscribed to the contained
+ * channel, it subscribes itself to the channel and forwards the packet to all of its
+ * neighboring servers. Otherwise, does nothing.
+ */
+static void s2s_join_request(const char *packet, struct sockaddr_in *from) {
+
+    Server *sender;
+    BitSet *servers;
+    int id;
+    struct request_s2s_join *join_packet = (struct request_s2s_join *) packet;
+
+    /* Get neighboring sender */
+    if (!am_get(neighbors, am_key(from), (void **)&sender))
+        return;
+    update_server_time(sender);
+
+    /* Log the received packet */
+    log_write(LOG_INFO, "%s %s recv S2S JOIN %s", server_addr, sender->ip_addr,
+            join_packet->req_channel);
+
+    /* Intern the channel name; the routing table takes its own reference */
+    if ((id = rg_intern(join_packet->req_channel)) < 0) {
+        log_write(LOG_ERROR, "%s Failed to add channel %s to server's subscription list",
+                server_addr, join_packet->req_channel);
+        return;
+    }
+
+    /* If server is already subscribed, request dies here; subscribe the sender */
+    if ((servers = (BitSet *)im_get(r_table, id)) != NULL) {
+        bs_add(servers, sender->index);
+    /* Adds the channel, and all neighboring servers to subscription map */
+    } else if (!server_join_channel(id)) {
+        log_write(LOG_ERROR, "%s Failed to add channel %s to server's subscription list",
+                server_addr, join_packet->req_channel);
+    } else {
+        /* Flood all neighboring servers with S2S join request */
+        neighbor_flood_channel(rg_name(id), sender);
+    }
+    rg_release(id);
+}
+
+/*
+ * Server receives an S2S LEAVE packet. The server that sent the packet is
+ * removed/unsubscribed from the channel list it wishes to leave. This way,
+ * the server wont send messages to this server to avoid loops, or empty
+ * server channels.
+ */
+static void s2s_leave_request(const char *packet, struct sockaddr_in *from) {
+
+    BitSet *servers;
+    Server *sender;
+    int id;
+    char buffer[IP_MAX];
+    struct request_s2s_leave *leave_packet = (struct request_s2s_leave *) packet;
+
+    /* Log the received packet */
+    log_write(LOG_INFO, "%s %s recv S2S LEAVE %s",
+            server_addr, sender_ip(from, &sender, buffer), leave_packet->req_channel);
+    /* Assert the channel is subscribed to, return if not */
+    /* The routing table pins the IDs of its channels; no reference is taken */
+    if ((id = rg_lookup(leave_packet->req_channel)) < 0 ||
+            (servers = (BitSet *)im_get(r_table, id)) == NULL)
+        return;
+
+    /* Remove the sender from the subscription list */
+    if (sender != NULL)
+        bs_remove(servers, sender->index);
+    
+    /* Server removes itself from channel sub-tree if leaf */
+    (void)remove_server_leaf(id);
+}
+
+/*
+ * Server recieves an S2S SAY request. The message gets broadcasted to all/any
+ * users listening on the channel. The request is also forwarded to all
+ * connected/listening neighboring servers. If the server is a leaf in the
+ * channel sub-tree, and no users are listening on the channel, the server replies
+ * by sending an S2S leave request.
+ */
+static void s2s_say_request(const char *packet, struct sockaddr_in *from) {
+
+    Server *server, *sender;
+    BitSet *servers;
+    int i, id;
+    struct request_s2s_leave leave_packet;
+    struct request_s2s_say *say_packet = (struct request_s2s_say *) packet;
+
+    /* Get the sending server */
+    if (!am_get(neighbors, am_key(from), (void **)&sender))
+        return;
+    update_server_time(sender);
+    /* Get list of listening servers */
+    if ((id = resolve_channel(say_packet->req_channel)) < 0 ||
+            (servers = (BitSet *)im_get(r_table, id)) == NULL)
+        return;
+
+    /* Initialize and set leave packet members */
+    memset(&leave_packet, 0, sizeof(leave_packet));
+    leave_packet.req_type = REQ_S2S_LEAVE;
+    strncpy(leave_packet.req_channel, say_packet->req_channel, (CHANNEL_MAX - 1));
+
+    /* Check the packet ID for uniqueness */
+    if (!id_unique(say_packet->id)) {
+        /* Reply to sender with S2S if duplicate, loop detected */
+        sendto(socket_fd, &leave_packet, sizeof(leave_packet), 0,
+                (struct sockaddr *)&sender->addr, sizeof(sender->addr));
+        /* Log the sent leave packet */
+        log_write(LOG_INFO, "%s %s send S2S LEAVE %s", server_addr, sender->ip_addr,
+                say_packet->req_channel);
+        return;
+    }
+
+    /* Log the received packet */
+    log_write(LOG_INFO, "%s %s recv S2S SAY %s %s \"%s\"", server_addr, sender->ip_addr,
+            say_packet->req_username, say_packet->req_channel, say_packet->req_text);
+
+    /* Broadcast the message to all local users on channel */
+    (void)deliver_message(say_packet->req_username, id, say_packet->req_text, 0);
+
+    /* Server is a leaf, remove it from sub-tree */
+    if (remove_server_leaf(id))
+        return;
+
+    /* If server not a leaf, forward S2S request to all subscribed neighbors */
+    fo_begin(fanout, say_packet, sizeof(*say_packet));
+    for (i = bs_next(servers, 0); i >= 0; i = bs_next(servers, i + 1)) {
+        if (i == sender->index)
+            continue;   /* Skip the server that sent the request */
+        server = neighbor_index[i];
+        /* Forward the packet to the subscribed neighbor */
+        fo_add(fanout, &server->addr);
+        /* Log the sent packet */
+        log_write(LOG_INFO, "%s %s send S2S SAY %s %s \"%s\"", server_addr,
+                server->ip_addr, say_packet->req_username, say_packet->req_channel,
+                say_packet->req_text);
+    }
+    (void)fo_flush(fanout);
+}
+
+/*
+ * Server recieves a S2S LIST request. Server will collect all channel names it
+ * has stored inside its table(s), and appends it to the packets collection. If
+ * there are still servers to visit, the server forwards the S2S LIST to the next,
+ * otherwise sends a reply back to the client.
+ */
+static void s2s_list_request(const char *packet, struct sockaddr_in *from) {
+
+    Server *sender;
+    HashMap *ch_set = NULL, *ip_set = NULL;
+    HMIter it;
+    char buffer[IP_MAX], *client_ip, *ch, *first;
+    size_t nbytes;
+    int unique, nto_visit;
+    long i, j, len = 0L;
+    struct sockaddr_in client;
+    struct text_list *list_packet = NULL;
+    struct request_s2s_list *forward = NULL;
+    struct request_s2s_list *s2s_list = (struct request_s2s_list *) packet;    
+
+    /* Log the received packet */
+    client_ip = sender_ip(from, &sender, buffer);
+    log_write(LOG_INFO, "%s %s recv S2S LIST", server_addr, client_ip);
+
+    /* Create hashmap to hold list, transfer from packet into map */
     if ((ch_set = hm_create(0L, 0.0f)) == NULL)
         goto free;
 
@@ -1801,34 +2661,18 @@ static void s2s_list_request(const char *packet, char *client_ip) {
 
     /* Only add the channels if ID not in cache; this is to prevent loops */
     if ((unique = id_unique(s2s_list->id)) != 0) {
-        queue_id(s2s_list->id);
-        /* Retrieve array of channel names */
-        if ((array = hm_keyArray(channels, &len)) == NULL)
-            if (!hm_isEmpty(channels))
-                goto free;
-        /* Add all channels from array into map */
-        for (i = 0L; i < len; i++)
-            if (!hm_containsKey(ch_set, array[i]))
-                (void)hm_put(ch_set, array[i], NULL, NULL);
-        free(array);
-        array = NULL;
-    }
-
-    /* Get array of neighboring IPs, create new map for IPs to visit */
-    if ((array = hm_keyArray(neighbors, &len)) == NULL)
-        goto free;
+        /* Add the channels of every worker into map */
+        if (!collect_channels(ch_set))
+            goto free;
+    }
+
+    /* Create new map for IPs to visit */
     if ((ip_set = hm_create(0L, 0.0f)) == NULL)
         goto free;
     
     /* Add the neighboring IPs only if packet hasn't visited here */
-    if (unique) {
-        for (i = 0L; i < len; i++)
-            if (strcmp(array[i], client_ip))
-                if (!hm_containsKey(ip_set, array[i]))
-                    (void)hm_put(ip_set, array[i], NULL, NULL);
-    }
-    free(array);        /* Deallocate array */
-    array = NULL;
+    if (unique)
+        add_neighbor_ips(ip_set, client_ip);
     
     /* Transfer the rest of IPs from packet into map */
     j = s2s_list->nchannels;
@@ -1840,386 +2684,1017 @@ static void s2s_list_request(const char *packet, char *client_ip) {
     if (hm_isEmpty(ip_set)) {
 
         /* Get the client's IP address */
-        if ((client = get_addr(s2s_list->client.ip_addr)) == NULL)
+        if (!get_addr(s2s_list->client.ip_addr, &client))
+            goto free;
+        /* Calculate size of response packet, allocate memory */
+        len = hm_size(ch_set);
+        nbytes = (sizeof(struct text_list) + (sizeof(struct channel_info) * len));
+        if ((list_packet = (struct text_list *)malloc(nbytes)) == NULL)
+            goto free;
+
+        /* Initialize and set packet members */
+        memset(list_packet, 0, nbytes);
+        list_packet->txt_type = TXT_LIST;
+        list_packet->txt_nchannels = (int)len;
+        /* Copy all collected channels into the packet */
+        hm_iterInit(ch_set, &it);
+        for (i = 0L; hm_iterNext(&it, &ch, NULL); i++)
+            strncpy(list_packet->txt_channels[i].ch_channel, ch, (CHANNEL_MAX - 1));
+
+        /* Send the packet to client, log the sent packet */
+        sendto(socket_fd, list_packet, nbytes, 0, (struct sockaddr *)&client, sizeof(client));
+        log_write(LOG_INFO, "%s %s send LIST REPLY", server_addr, s2s_list->client.ip_addr);
+        goto free;
+    }
+
+    /* Here, there are still servers to visit */
+    /* Calculate size of packet, allocate the memory */
+    nbytes = (sizeof(struct request_s2s_list) + ((sizeof(struct s2s_list_container) * 
+            (hm_size(ch_set) + hm_size(ip_set) - 1))));
+    if ((forward = (struct request_s2s_list *)malloc(nbytes)) == NULL)
+        goto free;
+    /* Initialize and set packet members */
+    memset(forward, 0, nbytes);
+    forward->req_type = REQ_S2S_LIST;
+    forward->id = s2s_list->id;
+    strncpy(forward->client.ip_addr, s2s_list->client.ip_addr, (IP_MAX - 1));
+
+    /* Copy the collected channels into packet */
+    forward->nchannels = (int)hm_size(ch_set);
+    hm_iterInit(ch_set, &it);
+    for (i = 0L; hm_iterNext(&it, &ch, NULL); i++)
+        strncpy(forward->payload[i].item, ch, (CHANNEL_MAX - 1));
+    
+    /* Copy IP visitation list into packet, after the channels */
+    first = visit_set(ip_set, (char *)&forward->payload[i],
+            sizeof(struct s2s_list_container), &nto_visit);
+    forward->nto_visit = nto_visit;
+
+    /* Get the address of next server to send to */
+    if (!get_addr(first, &client))
+        goto free;
+    /* Send the packet, log the sent packet */
+    sendto(socket_fd, forward, nbytes, 0, (struct sockaddr *)&client, sizeof(client));
+    log_write(LOG_INFO, "%s %s send S2S LIST", server_addr, first);
+    goto free;
+    
+free:
+    /* Free all allocated memory */
+    if (ch_set != NULL)
+        hm_destroy(ch_set, NULL);
+    if (ip_set != NULL)
+        hm_destroy(ip_set, NULL);
+    if (forward != NULL)
+        free(forward);
+    if (list_packet != NULL)
+        free(list_packet);
+    return;
+}
+
+/*
+ * Server receives a S2S WHO request. Server will append the list of users that
+ * are subscribed on the requested channel onto packet (if the channel exists in
+ * the server's table(s)). If there are still servers to visit, the server forwards
+ * the S2S request to the next server, otherwise it sends a reply back to the client.
+ */
+static void s2s_who_request(const char *packet, struct sockaddr_in *from) {
+
+    Server *sender;
+    LinkedList *unames = NULL;
+    HashMap *ip_set = NULL;
+    LLIter it;
+    char buffer[128], from_ip[IP_MAX], *client_ip, *name, *first;
+    size_t nbytes;
+    int unique, nto_visit;
+    long i, j, len = 0L;
+    struct sockaddr_in client;
+    struct text_who *who_packet = NULL;
+    struct request_s2s_who *forward = NULL;
+    struct request_s2s_who *s2s_who = (struct request_s2s_who *) packet;
+
+    /* Log the received packet */
+    client_ip = sender_ip(from, &sender, from_ip);
+    log_write(LOG_INFO, "%s %s recv S2S WHO %s", server_addr, client_ip, s2s_who->channel);
+    /* Create linked list to hold all usernames */
+    if ((unames = ll_create()) == NULL)
+        goto free;
+    /* Copy all usernames in packet into list */
+    for (i = 0; i < s2s_who->nusers; i++)
+        (void)ll_add(unames, strdup(s2s_who->payload[i].item));
+
+    /* Only add usernames if ID not in cache; this is to prevent loops */
+    if ((unique = id_unique(s2s_who->id)) != 0) {
+        /* Add all users from channel on every worker into list */
+        if (collect_members(s2s_who->channel, unames) < 0)
+            goto free;
+    }
+
+    /* Create new map for IPs to visit */
+    if ((ip_set = hm_create(0L, 0.0f)) == NULL)
+        goto free;
+    
+    /* Add the neighboring IPs only if packet hasn't visited here */
+    if (unique)
+        add_neighbor_ips(ip_set, client_ip);
+
+    /* Transfer the rest of IPs from packet into map */
+    j = s2s_who->nusers;
+    for (i = 0; i < s2s_who->nto_visit; i++)
+        if (!hm_containsKey(ip_set, s2s_who->payload[j + i].item))
+            (void)hm_put(ip_set, s2s_who->payload[j + i].item, NULL, NULL);
+    
+    /* If there are no more servers to visit, we can send response back to client */
+    if (hm_isEmpty(ip_set)) {
+
+        /* Get the client's IP address */
+        if (!get_addr(s2s_who->client.ip_addr, &client))
             goto free;
-        /* Retrieve array of collected channels */
-        if ((array = hm_keyArray(ch_set, &len)) == NULL)
+
+        /* If no usernames recorded, channel doesn't exist; respond with error message */
+        if (ll_isEmpty(unames) && strcmp(s2s_who->channel, DEFAULT_CHANNEL)) {
+            sprintf(buffer, "No channel by the name %s.", s2s_who->channel);
+            server_send_error(&client, buffer);
             goto free;
+        }
+
         /* Calculate size of response packet, allocate memory */
-        nbytes = (sizeof(struct text_list) + (sizeof(struct channel_info) * len));
-        if ((list_packet = (struct text_list *)malloc(nbytes)) == NULL)
+        len = ll_size(unames);
+        nbytes = (sizeof(struct text_who) + (sizeof(struct user_info) * len));
+        if ((who_packet = (struct text_who *)malloc(nbytes)) == NULL)
             goto free;
 
         /* Initialize and set packet members */
-        memset(list_packet, 0, nbytes);
-        list_packet->txt_type = TXT_LIST;
-        list_packet->txt_nchannels = (int)len;
-        /* Copy all channels into the packet */
-        for (i = 0L; i < len; i++)
-            strncpy(list_packet->txt_channels[i].ch_channel, array[i], (CHANNEL_MAX - 1));
+        memset(who_packet, 0, nbytes);
+        who_packet->txt_type = TXT_WHO;
+        who_packet->txt_nusernames = (int)len;
+        strncpy(who_packet->txt_channel, s2s_who->channel, (USERNAME_MAX - 1));
+        /* Copy all usernames into the packet */
+        ll_iterInit(unames, &it);
+        for (i = 0L; ll_iterNext(&it, (void **)&name); i++)
+            strncpy(who_packet->txt_users[i].us_username, name, (USERNAME_MAX - 1));
 
         /* Send the packet to client, log the sent packet */
-        sendto(socket_fd, list_packet, nbytes, 0, (struct sockaddr *)client, sizeof(*client));
-        fprintf(stdout, "%s %s send LIST REPLY\n", server_addr, s2s_list->client.ip_addr);
+        sendto(socket_fd, who_packet, nbytes, 0, (struct sockaddr *)&client, sizeof(client));
+        log_write(LOG_INFO, "%s %s send WHO REPLY %s", server_addr, s2s_who->client.ip_addr,
+                who_packet->txt_channel);
         goto free;
     }
 
     /* Here, there are still servers to visit */
     /* Calculate size of packet, allocate the memory */
-    nbytes = (sizeof(struct request_s2s_list) + ((sizeof(struct s2s_list_container) * 
-            (hm_size(ch_set) + hm_size(ip_set) - 1))));
-    if ((forward = (struct request_s2s_list *)malloc(nbytes)) == NULL)
+    nbytes = (sizeof(struct request_s2s_who) + ((sizeof(struct s2s_who_container) * 
+            (ll_size(unames) + hm_size(ip_set) - 1))));
+    if ((forward = (struct request_s2s_who *)malloc(nbytes)) == NULL)
         goto free;
     /* Initialize and set packet members */
     memset(forward, 0, nbytes);
-    forward->req_type = REQ_S2S_LIST;
-    forward->id = s2s_list->id;
-    strncpy(forward->client.ip_addr, s2s_list->client.ip_addr, (IP_MAX - 1));
+    forward->req_type = REQ_S2S_WHO;
+    forward->id = s2s_who->id;
+    strncpy(forward->client.ip_addr, s2s_who->client.ip_addr, (IP_MAX - 1));
+    strncpy(forward->channel, s2s_who->channel, (CHANNEL_MAX - 1));
 
-    /* Get array of channels, copy contents into packet */
-    if ((array = hm_keyArray(ch_set, &len)) == NULL)
-        goto free;
-    forward->nchannels = (int)len;
-    for (i = 0L; i < len; i++)
-        strncpy(forward->payload[i].item, array[i], (CHANNEL_MAX - 1));
-    free(array);        /* Deallocate array */
-    array = NULL;
-    
-    /* Get array of IPs left to visit, copy contents into packet */
-    if ((array = hm_keyArray(ip_set, &len)) == NULL)
-        goto free;
-    forward->nto_visit = (int)len - 1;
-    /* Copy IP visitation list into packet */
-    j = i;
-    for (i = 0L; i < len - 1; i++)
-        strncpy(forward->payload[j + i].item, array[i + 1], (CHANNEL_MAX - 1));
+    /* Copy the collected usernames into packet */
+    forward->nusers = (int)ll_size(unames);
+    ll_iterInit(unames, &it);
+    for (i = 0L; ll_iterNext(&it, (void **)&name); i++)
+        strncpy(forward->payload[i].item, name, (USERNAME_MAX - 1));
+
+    /* Copy IP addresses into packet, after the usernames */
+    first = visit_set(ip_set, (char *)&forward->payload[i],
+            sizeof(struct s2s_who_container), &nto_visit);
+    forward->nto_visit = nto_visit;
 
     /* Get the address of next server to send to */
-    if ((client = get_addr(array[0])) == NULL)
+    if (!get_addr(first, &client))
         goto free;
     /* Send the packet, log the sent packet */
-    sendto(socket_fd, forward, nbytes, 0, (struct sockaddr *)client, sizeof(*client));
-    fprintf(stdout, "%s %s send S2S LIST\n", server_addr, array[0]);
+    sendto(socket_fd, forward, nbytes, 0, (struct sockaddr *)&client, sizeof(client));
+    log_write(LOG_INFO, "%s %s send S2S WHO %s", server_addr, first, forward->channel);
     goto free;
-    
+
 free:
     /* Free all allocated memory */
-    if (array != NULL)
-        free(array);
-    if (ch_set != NULL)
-        hm_destroy(ch_set, NULL);
+    if (unames != NULL)
+        ll_destroy(unames, free);
     if (ip_set != NULL)
         hm_destroy(ip_set, NULL);
-    if (client != NULL)
-        free(client);
+    if (who_packet != NULL)
+        free(who_packet);
     if (forward != NULL)
         free(forward);
-    if (list_packet != NULL)
-        free(list_packet);
     return;
 }
 
 /*
- * Server receives a S2S WHO request. Server will append the list of users that
- * are subscribed on the requested channel onto packet (if the channel exists in
- * the server's table(s)). If there are still servers to visit, the server forwards
- * the S2S request to the next server, otherwise it sends a reply back to the client.
+ * Server receives an S2S LEAF request. The server checks to see if it currently is
+ * a leaf in the channel subtree, and responds with an S2S leave if so. Otherwise, if
+ * there are no clients subscribed to the channel or it doesn't exist, then the server
+ * forwards this request to all of its neighbors.
+ */
+static void s2s_leaf_request(const char *packet, struct sockaddr_in *from) {
+    
+    Server *sender;
+    BitSet *servers;
+    int i, id;
+    char buffer[IP_MAX], *client_ip;
+    struct request_s2s_leave s2s_leave;
+    struct request_s2s_leaf *s2s_leaf = (struct request_s2s_leaf *) packet;
+
+    /* The routing table pins the IDs of its channels; no reference is taken */
+    id = rg_lookup(s2s_leaf->channel);
+    /* Removes this server from subtreeif is a leaf */
+    if (id >= 0 && remove_server_leaf(id))
+        return;
+    client_ip = sender_ip(from, &sender, buffer);
+    /* Send S2S leave back if ID in cache; this is to guard against loops */
+    if (!id_unique(s2s_leaf->id)) {
+
+        /* Get set of listening neighbors; remove the sender from the channel */
+        if (id < 0 || (servers = (BitSet *)im_get(r_table, id)) == NULL)
+            return;
+        if (sender != NULL)
+            bs_remove(servers, sender->index);
+
+        /* Remove and destroy the set from routing table if it becomes empty */
+        if (bs_isEmpty(servers)) {
+            (void)im_remove(r_table, id);
+            sl_free(&route_type, servers);
+            rg_release(id);
+        }
+
+        /* Intialize and set packet members */
+        memset(&s2s_leave, 0, sizeof(s2s_leave));
+        s2s_leave.req_type = REQ_S2S_LEAVE;
+        strncpy(s2s_leave.req_channel, s2s_leaf->channel, (CHANNEL_MAX - 1));
+        /* Send the packet, log the sent packet */
+        sendto(socket_fd, &s2s_leave, sizeof(s2s_leave), 0,
+                (struct sockaddr *)from, sizeof(*from));
+        log_write(LOG_INFO, "%s %s send S2S LEAVE %s", server_addr, client_ip, s2s_leave.req_channel);
+        return;
+    }
+
+    /* Nothing to forward unless the server is in the channel sub-tree */
+    if (id < 0 || (servers = (BitSet *)im_get(r_table, id)) == NULL)
+        return;
+     /* If clients are still subscribed, do nothing */
+    if (channel_has_users(id))
+        return;
+    /* Otherwise, forward the leaf checking packet to all neighbors */
+    fo_begin(fanout, s2s_leaf, sizeof(*s2s_leaf));
+    for (i = bs_next(servers, 0); i >= 0; i = bs_next(servers, i + 1)) {
+        /* Forward the leaf-check packet to all neighbors */
+        if (neighbor_index[i] != sender)
+            fo_add(fanout, &neighbor_index[i]->addr);
+    }
+    (void)fo_flush(fanout);
+}
+
+/*
+ * Updates the server's log time given its IP address; updates the time this
+ * server last sent packet.
+ */
+static void s2s_keep_alive_request(struct sockaddr_in *from) {
+
+    Server *server;
+
+    if (!am_get(neighbors, am_key(from), (void **)&server))
+        return;
+    update_server_time(server); /* Update the log time */
+}
+
+/*
+ * Returns the specified set of listening servers to the slabs. Used by the IdMap
+ * destructor of the routing table.
+ */
+static void free_route(BitSet *servers) {
+    
+    sl_free(&route_type, servers);
+}
+
+/*
+ * Cleans up after the server before shutting down by freeing and returning all
+ * reserved memory back to the heap; this includes destroying the hashmaps of the
+ * users and channels, any other datastructures used within them, and closing any
+ * open sockets.
+ */
+static void cleanup(void) {
+    
+    /* Write out whatever is left in the log */
+    log_shutdown();
+    /* Other workers or readers may still be running; leave their memory to the OS */
+    if (nworkers > 1 || nreaders > 0)
+        return;
+    /* Destroy the event loop and its timers */
+    if (loop != NULL)
+        el_destroy(loop);
+    /* Stop the pipeline stages, which use the receive ring and the socket */
+    if (self != NULL && self->ingress != NULL)
+        ig_destroy(self->ingress);
+    if (self != NULL && self->egress != NULL)
+        eg_destroy(self->egress);
+    /* Stop the fan-out helpers, which use the socket */
+    if (self != NULL && self->pool != NULL)
+        fp_destroy(self->pool);
+    /* Destroy the receive ring and the fan-out engine */
+    if (ring != NULL)
+        pr_destroy(ring);
+    if (fanout != NULL)
+        fo_destroy(fanout);
+    /* Close the socket if open */
+    if (socket_fd != -1)
+        close(socket_fd);
+    /* Destroy the map holding the channels; this unsubscribes every user */
+    if (channels != NULL)
+        im_destroy(channels, (void *)ms_destroy);
+    /* Destroy the username index, then the hashmap containing all logged in users */
+    if (names != NULL)
+        hm_destroy(names, NULL);
+    if (users != NULL)
+        am_destroy(users, (void *)free_user);
+    if (guests != NULL)
+        am_destroy(guests, (void *)free_user);
+    /* Destroy the map of channels neighboring servers are listening to */
+    if (r_table != NULL)
+        im_destroy(r_table, (void *)free_route);
+    /* Drop the worker's references to the channel names it looked up */
+    if (resolved != NULL)
+        hm_destroy(resolved, free_resolved);
+    /* Destroy the notes of the changes not yet in a snapshot */
+    if (self != NULL) {
+        hm_destroy(self->changed_channels, NULL);
+        hm_destroy(self->changed_users, NULL);
+    }
+    /* Destroy the hashmap containing neighboring servers */
+    if (neighbors != NULL)
+        am_destroy(neighbors, (void *)free_server);
+    /* Destroy the timer wheel, now that nothing holds a timer */
+    if (wheel != NULL)
+        tw_destroy(wheel);
+    /* Destroy the cache of resolved addresses */
+    if (addr_cache != NULL)
+        hm_destroy(addr_cache, free);
+    /* Destroy the message ID cache */
+    if (id_cache != NULL)
+        dd_destroy(id_cache);
+    /* Forget the channel names, now that no table holds their IDs */
+    rg_shutdown();
+    /* Free the snapshots, published and retired */
+    if (workers != NULL && workers[0].snapshot != NULL)
+        sn_destroy(workers[0].snapshot);
+    if (epochs != NULL)
+        ep_destroy(epochs);
+    /* Destroy the worker itself */
+    if (workers != NULL) {
+        pthread_rwlock_destroy(&workers[0].lock);
+        free(workers);
+    }
+}
+
+/*
+ * Prints the specified message to standard error stream as a program error
+ * message, then terminates the server application.
+ */
+static void print_error(const char *msg) {
+    
+    fprintf(stderr, "[Server]: %s\n", msg);
+    exit(0);
+}
+
+/*
+ * Function that handles an interrupt signal from the user. Simply exits
+ * the program, which will invoke the cleanup method registered with the
+ * atexit() function.
+ */
+static void server_exit(UNUSED int signo) {
+    
+    log_write(LOG_INFO, "%s Duckchat server terminated", server_addr);
+    exit(0);
+}
+
+/*
+ * Examines the type of the packet received from the specified client and passes
+ * the packet to the corresponding request handler.
+ */
+static void handle_packet(char *buffer, struct sockaddr_in *client) {
+
+    struct text *packet_type = (struct text *) buffer;
+
+    /* Examine the packet type received */
+    switch (packet_type->txt_type) {
+        case REQ_VERIFY:
+            /* Check to see if the username is taken */
+            server_verify_request(buffer, client);
+            break;
+        case REQ_LOGIN:
+            /* A client requests to login to the server */
+            server_login_request(buffer, client);
+            break;
+        case REQ_LOGOUT:
+            /* A client requests to logout from the server */
+            server_logout_request(client);
+            break;
+        case REQ_JOIN:
+            /* A client requests to join a channel */
+            server_join_request(buffer, client);
+            break;
+        case REQ_LEAVE:
+            /* A client requests to leave a channel */
+            server_leave_request(buffer, client);
+            break;
+        case REQ_SAY:
+            /* A client sent a message to broadcast in their active channel */
+            server_say_request(buffer, client);
+            break;
+        case REQ_LIST:
+            /* A client requests a list of all the channels on the server */
+            server_list_request(client);
+            break;
+        case REQ_WHO:
+            /* A client requests a list of users on the specified channel */
+            server_who_request(buffer, client);
+            break;
+        case REQ_KEEP_ALIVE:
+            /* Received from an inactive user, keeps them logged in */
+            server_keep_alive_request(client);
+            break;
+        case REQ_S2S_VERIFY:
+            /* Server-to-server verify request, check for username verification */
+            s2s_verify_request(buffer, client);
+            break;
+        case REQ_S2S_JOIN:
+            /* Server-to-server join request, forward it to neighbors */
+            s2s_join_request(buffer, client);
+            break;
+        case REQ_S2S_LEAVE:
+            /* Server-to-server leave request, unsubscribe server from a channel */
+            s2s_leave_request(buffer, client);
+            break;
+        case REQ_S2S_SAY:
+            /* Server-to-server say request, forward to all subscribed servers */
+            s2s_say_request(buffer, client);
+            break;
+        case REQ_S2S_LIST:
+            /* Server-to-server list request, collect channel names and forward to neighbors */
+            s2s_list_request(buffer, client);
+            break;
+        case REQ_S2S_WHO:
+            /* Server-to-server who request, collect listening users and forward to neighbors */
+            s2s_who_request(buffer, client);
+            break;
+        case REQ_S2S_LEAF:
+            /* Server-to-server leaf request, checks if the server is a leaf in channel subtree */
+            s2s_leaf_request(buffer, client);
+            break;
+        case REQ_S2S_KEEP_ALIVE:
+            /* Server-to-server keep alive request, update time for corresponding server */
+            s2s_keep_alive_request(client);
+            break;
+        default:
+            /* Do nothing, likey a bogus packet */
+            break;
+    }
+}
+
+/*
+ * Passes a received packet on to worker 0 to handle; used for the requests that
+ * need the S2S state worker 0 owns.
+ */
+static void forward_packet(Packet *pkt) {
+
+    Mail mail;
+
+    /* Initialize and set the mail members */
+    memset(&mail, 0, sizeof(mail));
+    mail.type = MAIL_PACKET;
+    mail.channel_id = -1;
+    mail.len = pkt->len;
+    mail.from = pkt->from;
+    /* Copy the packet inline if it fits; otherwise onto the heap, with a zeroed tail */
+    if (pkt->len <= (long)sizeof(mail.u.packet)) {
+        memcpy(mail.u.packet, pkt->data, pkt->len);
+    } else {
+        if ((mail.data = (char *)calloc(1, pkt->len + sizeof(mail.u.packet))) == NULL)
+            return;
+        memcpy(mail.data, pkt->data, pkt->len);
+    }
+    (void)send_mail(workers, &mail);
+}
+
+/*
+ * Returns 1 if the specified packet is well formed enough to be handled, 0 if not; that
+ * is, it holds a known request type, and the entries an S2S VERIFY, LIST or WHO request
+ * claims to carry fit within it. Fixed-size requests may be short; the zeroed bytes
+ * following a packet stand in for the rest.
+ */
+static int valid_packet(const Packet *pkt) {
+
+    struct request_s2s_verify *verify = (struct request_s2s_verify *)pkt->data;
+    struct request_s2s_list *list = (struct request_s2s_list *)pkt->data;
+    struct request_s2s_who *who = (struct request_s2s_who *)pkt->data;
+    request_t type;
+    long size;
+
+    if (pkt->len < (long)sizeof(request_t))
+        return 0;
+    type = ((struct text *)pkt->data)->txt_type;
+    switch (type) {
+        case REQ_S2S_VERIFY:
+            /* The addresses left to visit follow the request */
+            if (verify->nto_visit < 0)
+                return 0;
+            size = (long)sizeof(struct request_s2s_verify) +
+                    (long)verify->nto_visit * (long)sizeof(struct ip_address);
+            return (pkt->len >= size);
+        case REQ_S2S_LIST:
+            /* The channels collected, then the addresses left to visit, in channel slots */
+            if (list->nchannels < 0 || list->nto_visit < 0)
+                return 0;
+            size = (long)sizeof(struct request_s2s_list) + ((long)list->nchannels +
+                    list->nto_visit) * (long)sizeof(struct s2s_list_container);
+            return (pkt->len >= size);
+        case REQ_S2S_WHO:
+            /* The users collected, then the addresses left to visit, in username slots */
+            if (who->nusers < 0 || who->nto_visit < 0)
+                return 0;
+            size = (long)sizeof(struct request_s2s_who) + ((long)who->nusers +
+                    who->nto_visit) * (long)sizeof(struct s2s_who_container);
+            return (pkt->len >= size);
+        default:
+            return (type >= REQ_VERIFY && type <= REQ_S2S_KEEP_ALIVE);
+    }
+}
+
+/*
+ * Handles a received packet, or passes it on to worker 0; verification and S2S requests
+ * received by the other workers need the S2S state worker 0 owns, unless verification
+ * is left to the readers.
+ */
+static void route_packet(Packet *pkt) {
+
+    request_t type = ((struct text *)pkt->data)->txt_type;
+
+    if (self != workers && ((type == REQ_VERIFY && !queries_offloaded()) ||
+            type >= REQ_S2S_VERIFY)) {
+        forward_packet(pkt);
+    } else {
+        /* Handle the packet; the sender is looked up by its address */
+        handle_packet(pkt->data, &pkt->from);
+    }
+}
+
+/*
+ * Invoked by the event loop whenever the server socket becomes readable; receives
+ * a batch of packets from the connected clients and servers and handles each one,
+ * dropping those that are malformed.
+ */
+static void server_receive(UNUSED int fd, UNUSED void *arg) {
+
+    Packet *pkt;
+
+    /* Receive all pending packets that fit into the ring at once */
+    if (pr_receive(ring) <= 0)
+        return;
+    while (pr_next(ring, &pkt)) {
+        if (valid_packet(pkt))
+            route_packet(pkt);
+        pr_release(ring);
+    }
+}
+
+/*
+ * Invoked by the event loop whenever the worker's ingress has packets waiting, see
+ * pipelined; handles every one of them. The ingress has already validated them.
+ */
+static void server_ingress(UNUSED int fd, UNUSED void *arg) {
+
+    Packet *pkt;
+
+    ig_ack(self->ingress);
+    while (ig_next(self->ingress, &pkt))
+        route_packet(pkt);
+}
+
+/*
+ * Answers the client's query passed on by mail_query(); on a reader, or on worker 0.
+ */
+static void handle_query(Mail *mail) {
+
+    switch (mail->type) {
+        case MAIL_LIST:
+            /* A client requested the list of channels */
+            list_reply(&mail->from);
+            break;
+        case MAIL_WHO:
+            /* A client requested the list of users on a channel */
+            who_reply(mail->u.say.channel, &mail->from);
+            break;
+        case MAIL_VERIFY:
+            /* A client requested whether a username is taken */
+            verify_reply(mail->u.say.username, &mail->from);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Returns the ID of the channel a message passed on by another worker was sent on, or
+ * -1 if no channel has its name any more. The mail holds no reference to the ID, which
+ * may have been given to another name since it was posted; the ID stands if this
+ * worker's own entry under it, which holds a reference, is for the mail's channel, and
+ * the name is resolved again otherwise.
+ */
+static int said_channel(Mail *mail) {
+
+    Channel *ch;
+
+    if ((ch = (Channel *)im_get(channels, mail->channel_id)) != NULL &&
+            strcmp(ms_name(ch), mail->u.say.channel) == 0)
+        return mail->channel_id;
+    return resolve_channel(mail->u.say.channel);
+}
+
+/*
+ * Examines the type of the mail received from another worker and handles it
+ * accordingly.
+ */
+static void handle_mail(Mail *mail) {
+
+    Channel *ch;
+    int id;
+
+    switch (mail->type) {
+        case MAIL_PACKET:
+            /* A packet received by another worker, handle it here */
+            handle_packet((mail->data != NULL) ? mail->data : mail->u.packet, &mail->from);
+            if (mail->data != NULL)
+                free(mail->data);
+            break;
+        case MAIL_SAY:
+            /* A message sent on another worker, broadcast it to local subscribers */
+            if ((id = said_channel(mail)) < 0)
+                break;
+            if ((ch = (Channel *)im_get(channels, id)) != NULL)
+                (void)broadcast_message(ch, mail->u.say.username, mail->u.say.text);
+            if (mail->forward)
+                s2s_forward_say(mail->u.say.username, id, mail->u.say.text);
+            break;
+        case MAIL_JOIN:
+            /* A client joined a channel, subscribe the server to it */
+            subscribe_channel(mail->channel_id);
+            break;
+        case MAIL_LEAVE:
+            /* A worker's last client left a channel */
+            channel_vacated(mail->channel_id);
+            break;
+        case MAIL_LIST:
+        case MAIL_WHO:
+        case MAIL_VERIFY:
+            /* A client's query */
+            handle_query(mail);
+            break;
+        case MAIL_ENROL:
+            /* A client of another worker joined a channel this worker owns */
+            guest_join(mail->channel_id, mail->u.say.username, &mail->from);
+            break;
+        case MAIL_RESIGN:
+            /* A client of another worker left a channel this worker owns */
+            guest_leave(mail->channel_id, &mail->from);
+            break;
+        case MAIL_DEPART:
+            /* A client of another worker logged out */
+            guest_depart(&mail->from);
+            break;
+        default:
+            break;
+    }
+    /* The mail is handled; drop its reference to the channel */
+    if (mail->channel_id >= 0 && mail->type != MAIL_SAY)
+        rg_release(mail->channel_id);
+}
+
+/*
+ * Invoked by the event loop whenever the worker's inbox has mail; handles all of
+ * the mail waiting.
+ */
+static void server_mail(UNUSED int fd, UNUSED void *arg) {
+
+    Mail mail;
+
+    mb_ack(self->inbox);
+    while (mb_fetch(self->inbox, &mail))
+        handle_mail(&mail);
+}
+
+/*
+ * Invoked by the event loop whenever the reader's inbox has queries; answers all of
+ * the queries waiting.
+ */
+static void reader_mail(UNUSED int fd, UNUSED void *arg) {
+
+    Mail mail;
+
+    mb_ack(reader->inbox);
+    while (mb_fetch(reader->inbox, &mail))
+        handle_query(&mail);
+}
+
+/*
+ * Invoked by the event loop every S2S_REFRESH_RATE seconds; floods all neighboring
+ * servers with S2S KEEP ALIVE and JOIN requests.
+ */
+static void server_refresh(UNUSED void *arg) {
+
+    flood_s2s_keep_alive();
+    refresh_s2s_joins();
+}
+
+/*
+ * Logs the memory held by each type of object allocated from the slabs, summed over
+ * all the workers.
+ */
+static void log_slab_stats(void) {
+
+    SlabStats st[SLAB_MAX_TYPES];
+    long i, n;
+
+    n = sl_stats(st, SLAB_MAX_TYPES);
+    for (i = 0L; i < n; i++)
+        log_write(LOG_INFO, "%s Slab %s: %ld of %ld objects in use, %ld bytes in %ld chunks",
+                server_addr, st[i].name, st[i].used, st[i].capacity,
+                st[i].capacity * (long)st[i].size, st[i].chunks);
+    log_write(LOG_INFO, "%s Registry: %ld channel names interned", server_addr, rg_size());
+}
+
+/*
+ * Logs the depth of every worker's pipeline queues, and how often each stage waited
+ * for the next one to make room; see pipelined.
  */
-static void s2s_who_request(const char *packet, char *client_ip) {
-
-    LinkedList *temp, *unames = NULL;
-    HashMap *ip_set = NULL;
-    User **u_list = NULL;
-    char buffer[128], **array = NULL;
-    size_t nbytes;
-    int unique;
-    long i, j, len = 0L;
-    struct sockaddr_in *client = NULL;
-    struct text_who *who_packet = NULL;
-    struct request_s2s_who *forward = NULL;
-    struct request_s2s_who *s2s_who = (struct request_s2s_who *) packet;
+static void log_pipeline_stats(void) {
 
-    /* Log the received packet */
-    fprintf(stdout, "%s %s recv S2S WHO %s\n", server_addr, client_ip, s2s_who->channel);
-    /* Create linked list to hold all usernames */
-    if ((unames = ll_create()) == NULL)
-        goto free;
-    /* Copy all usernames in packet into list */
-    for (i = 0; i < s2s_who->nusers; i++)
-        (void)ll_add(unames, strdup(s2s_who->payload[i].item));
+    Worker *w;
+    int i;
 
-    /* Only add usernames if ID not in cache; this is to prevent loops */
-    if ((unique = id_unique(s2s_who->id)) != 0) {
-        queue_id(s2s_who->id);
-        /* Add all users from channel into list */
-        if (hm_get(channels, s2s_who->channel, (void **)&temp)) {
-            if (!ll_isEmpty(temp)) {/* Skip if no usernames stored */
-                if ((u_list = (User **)ll_toArray(temp, &len)) == NULL)
-                    goto free;
-                for (i = 0L; i < len; i++)
-                    (void)ll_add(unames, strdup(u_list[i]->username));
-                free(u_list);   /* Deallocate array */
-                u_list = NULL;
-            }
-        }
+    for (i = 0; i < nworkers; i++) {
+        w = &workers[i];
+        log_write(LOG_INFO, "%s Worker %d: ingress %ld queued, %ld stalls, %ld rejected; "
+                "egress %ld queued, %ld stalls", server_addr, i, ig_depth(w->ingress),
+                ig_stalls(w->ingress), ig_rejects(w->ingress), eg_depth(w->egress),
+                eg_stalls(w->egress));
     }
+}
 
-    /* Get array of neighboring IPs, create new map for IPs to visit */
-    if ((array = hm_keyArray(neighbors, &len)) == NULL)
-        goto free;
-    if ((ip_set = hm_create(0L, 0.0f)) == NULL)
-        goto free;
-    
-    /* Add the neighboring IPs only if packet hasn't visited here */
-    if (unique) {
-        for (i = 0L; i < len; i++)
-            if (strcmp(array[i], client_ip))
-                if (!hm_containsKey(ip_set, array[i]))
-                    (void)hm_put(ip_set, array[i], NULL, NULL);
-    }
-    free(array);        /* Deallocate array */
-    array = NULL;
+/*
+ * Logs how many messages every worker sent with its fan-out helpers, and how many
+ * chunks of them were taken from another's share; see fanout_helpers.
+ */
+static void log_pool_stats(void) {
 
-    /* Transfer the rest of IPs from packet into map */
-    j = s2s_who->nusers;
-    for (i = 0; i < s2s_who->nto_visit; i++)
-        if (!hm_containsKey(ip_set, s2s_who->payload[j + i].item))
-            (void)hm_put(ip_set, s2s_who->payload[j + i].item, NULL, NULL);
-    
-    /* If there are no more servers to visit, we can send response back to client */
-    if (hm_isEmpty(ip_set)) {
+    int i;
 
-        /* Get the client's IP address */
-        if ((client = get_addr(s2s_who->client.ip_addr)) == NULL)
-            goto free;
+    for (i = 0; i < nworkers; i++)
+        log_write(LOG_INFO, "%s Worker %d: fan-out pool %ld messages, %ld chunks stolen",
+                server_addr, i, fp_messages(workers[i].pool), fp_steals(workers[i].pool));
+}
 
-        /* If no usernames recorded, channel doesn't exist; respond with error message */
-        if (ll_isEmpty(unames) && strcmp(s2s_who->channel, DEFAULT_CHANNEL)) {
-            sprintf(buffer, "No channel by the name %s.", s2s_who->channel);
-            server_send_error(client, buffer);
-            goto free;
-        }
+/*
+ * Logs how many messages each worker's inbox dropped, and how much mail waited
+ * behind it while it was full.
+ */
+static void log_inbox_stats(void) {
 
-        /* Retrieve array of collected usernames */
-        len = 0L;
-        if (!ll_isEmpty(unames))
-            if ((array = (char **)ll_toArray(unames, &len)) == NULL)
-                goto free;
-        /* Calculate size of response packet, allocate memory */
-        nbytes = (sizeof(struct text_who) + (sizeof(struct user_info) * len));
-        if ((who_packet = (struct text_who *)malloc(nbytes)) == NULL)
-            goto free;
+    int i;
 
-        /* Initialize and set packet members */
-        memset(who_packet, 0, nbytes);
-        who_packet->txt_type = TXT_WHO;
-        who_packet->txt_nusernames = (int)len;
-        strncpy(who_packet->txt_channel, s2s_who->channel, (USERNAME_MAX - 1));
-        /* Copy all channels into the packet */
-        for (i = 0L; i < len; i++)
-            strncpy(who_packet->txt_users[i].us_username, array[i], (USERNAME_MAX - 1));
+    for (i = 0; i < nworkers; i++)
+        log_write(LOG_INFO, "%s Worker %d: inbox dropped %ld messages, queued %ld mails",
+                server_addr, i, mb_drops(workers[i].inbox), mb_queued(workers[i].inbox));
+}
 
-        /* Send the packet to client, log the sent packet */
-        sendto(socket_fd, who_packet, nbytes, 0, (struct sockaddr *)client, sizeof(*client));
-        fprintf(stdout, "%s %s send WHO REPLY %s\n", server_addr, s2s_who->client.ip_addr,
-                who_packet->txt_channel);
-        goto free;
-    }
+/*
+ * Invoked by the event loop on worker 0 every REFRESH_RATE minutes; logs the slab
+ * and registry statistics, and those of the inboxes, pipelines and fan-out pools.
+ */
+static void server_stats(UNUSED void *arg) {
+
+    log_slab_stats();
+    if (nworkers > 1)
+        log_inbox_stats();
+    if (pipelined)
+        log_pipeline_stats();
+    if (fanout_helpers > 0)
+        log_pool_stats();
+}
 
-    /* Here, there are still servers to visit */
-    /* Calculate size of packet, allocate the memory */
-    nbytes = (sizeof(struct request_s2s_who) + ((sizeof(struct s2s_who_container) * 
-            (ll_size(unames) + hm_size(ip_set) - 1))));
-    if ((forward = (struct request_s2s_who *)malloc(nbytes)) == NULL)
-        goto free;
-    /* Initialize and set packet members */
-    memset(forward, 0, nbytes);
-    forward->req_type = REQ_S2S_WHO;
-    forward->id = s2s_who->id;
-    strncpy(forward->client.ip_addr, s2s_who->client.ip_addr, (IP_MAX - 1));
-    strncpy(forward->channel, s2s_who->channel, (CHANNEL_MAX - 1));
+/*
+ * Returns the seconds elapsed on the monotonic clock, which unlike the wall clock
+ * never jumps; the worker's timer wheel counts time in these.
+ */
+static unsigned long monotonic_seconds(void) {
 
-    /* Get array of usernames, copy contents into packet */
-    len = 0L;
-    if (!ll_isEmpty(unames))
-        if ((array = (char **)ll_toArray(unames, &len)) == NULL)
-            goto free;
-    forward->nusers = (int)len;
-    for (i = 0L; i < len; i++)
-        strncpy(forward->payload[i].item, array[i], (USERNAME_MAX - 1));
-    if (array != NULL) {        /* Deallocate array */
-        free(array);
-        array = NULL;
-    }
+    struct timespec ts;
 
-    /* Get array of IPs left to visit, copy contents into packet */
-    if ((array = hm_keyArray(ip_set, &len)) == NULL)
-        goto free;
-    forward->nto_visit = (int)len - 1;
-    /* Copy IP addresses into packet */
-    j = i;
-    for (i = 0L; i < len - 1; i++)
-        strncpy(forward->payload[j + i].item, array[i + 1], (USERNAME_MAX - 1));
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec;
+}
 
-    /* Get the address of next server to send to */
-    if ((client = get_addr(array[0])) == NULL)
-        goto free;
-    /* Send the packet, log the sent packet */
-    sendto(socket_fd, forward, nbytes, 0, (struct sockaddr *)client, sizeof(*client));
-    fprintf(stdout, "%s %s send S2S WHO %s\n", server_addr, array[0], forward->channel);
-    goto free;
+/*
+ * Invoked by the event loop every second; advances the worker's timer wheel, expiring
+ * the inactive users, and on worker 0 the crashed servers. Frees the replaced snapshots
+ * no longer read.
+ */
+static void server_tick(UNUSED void *arg) {
 
-free:
-    /* Free all allocated memory */
-    if (u_list != NULL)
-        free(u_list);
-    if (array != NULL)
-        free(array);
-    if (unames != NULL)
-        ll_destroy(unames, free);
-    if (ip_set != NULL)
-        hm_destroy(ip_set, NULL);
-    if (client != NULL)
-        free(client);
-    if (who_packet != NULL)
-        free(who_packet);
-    if (forward != NULL)
-        free(forward);
-    return;
+    tw_advance(wheel, monotonic_seconds());
+    (void)ep_reclaim(epochs, epoch_slot);
 }
 
 /*
- * Server receives an S2S LEAF request. The server checks to see if it currently is
- * a leaf in the channel subtree, and responds with an S2S leave if so. Otherwise, if
- * there are no clients subscribed to the channel or it doesn't exist, then the server
- * forwards this request to all of its neighbors.
+ * Invoked by the event loop at the end of every turn; publishes what the turn's batch
+ * changed on the shard, then sends the messages the fan-out engine left for later
+ * turns, up to its budget.
+ *
+ * Returns 1 if messages are still waiting, so that the loop comes back to them, 0 if not.
  */
-static void s2s_leaf_request(const char *packet, char *client_ip) {
-    
-    Server *server;
-    LinkedList *user_list;
-    long i;
-    struct request_s2s_leave s2s_leave;
-    struct request_s2s_leaf *s2s_leaf = (struct request_s2s_leaf *) packet;
+static int server_backlog(UNUSED void *arg) {
 
-    /* Removes this server from subtreeif is a leaf */
-    if (remove_server_leaf(s2s_leaf->channel))
-        return;
-    /* Send S2S leave back if ID in cache; this is to guard against loops */
-    if (!id_unique(s2s_leaf->id)) {
+    publish_snapshot();
+    return fo_resume(fanout);
+}
 
-        /* Get list of listening neighbors */
-        if (!hm_get(r_table, s2s_leaf->channel, (void **)&user_list))
-            return;
-        for (i = 0L; i < ll_size(user_list); i++) {
-            /* Remove the neighbor from the channel in routing table */
-            (void)ll_get(user_list, i, (void **)&server);
-            if (strcmp(server->ip_addr, client_ip) == 0) {
-                (void)ll_remove(user_list, i, (void **)&server);
-                break;
-            }
-        }
+/*
+ * Sets up the specified worker; creates its socket bound to the server's address,
+ * its shard of users and channels, its packet ring, fan-out engine and inbox, and
+ * the event loop driving it. Terminates the server if any of these fail.
+ */
+static void create_worker(Worker *w, int id, struct sockaddr_in *server) {
+
+    Channel *default_ch;
+    int default_id, on = 1;
+
+    w->id = id;
+    w->inbox = NULL;
+    w->ingress = NULL;
+    w->egress = NULL;
+    w->pool = NULL;
+    /* The first snapshot is taken once the worker runs, of the whole shard */
+    w->snapshot = NULL;
+    w->rebuild = 0;
+    if (pthread_rwlock_init(&w->lock, NULL) != 0)
+        print_error("Failed to create a shard lock.");
 
-        /* Remove and destroy list from routing table if it becomes empty */
-        if (ll_isEmpty(user_list)) {
-            (void)hm_remove(r_table, s2s_leaf->channel, (void **)&user_list);
-            ll_destroy(user_list, NULL);
-        }
+    /* Create the UDP socket, bind name to socket */
+    /* Every worker binds its own socket to the same port; the kernel spreads clients over them */
+    if ((w->socket_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        print_error("Failed to create a socket for the server.");
+    if (nworkers > 1)
+        if (setsockopt(w->socket_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+            print_error("Failed to share the server's port between workers.");
+    if (bind(w->socket_fd, (struct sockaddr *)server, sizeof(*server)) < 0)
+        print_error("Failed to assign the requested address.");
 
-        /* Intialize and set packet members */
-        memset(&s2s_leave, 0, sizeof(s2s_leave));
-        s2s_leave.req_type = REQ_S2S_LEAVE;
-        strncpy(s2s_leave.req_channel, s2s_leaf->channel, (CHANNEL_MAX - 1));
-        /* Send the packet, log the sent packet */
-        sendto(socket_fd, &s2s_leave, sizeof(s2s_leave), 0,
-                (struct sockaddr *)server->addr, sizeof(*server->addr));
-        fprintf(stdout, "%s %s send S2S LEAVE %s\n", server_addr, client_ip, s2s_leave.req_channel);
-        return;
+    /* Create & initialize the worker's shard of users and channels */
+    if ((w->users = am_create(100L)) == NULL)
+        print_error("Failed to allocate a sufficient amount of memory.");
+    if ((w->names = hm_create(100L, 0.0f)) == NULL)
+        print_error("Failed to allocate a sufficient amount of memory.");
+    if ((w->channels = im_create(0L)) == NULL)
+        print_error("Failed to allocate a sufficient amount of memory.");
+    if ((w->resolved = hm_create(100L, 0.0f)) == NULL)
+        print_error("Failed to allocate a sufficient amount of memory.");
+    if ((w->changed_channels = hm_create(0L, 0.0f)) == NULL)
+        print_error("Failed to allocate a sufficient amount of memory.");
+    if ((w->changed_users = hm_create(0L, 0.0f)) == NULL)
+        print_error("Failed to allocate a sufficient amount of memory.");
+    if ((w->guests = am_create(20L)) == NULL)
+        print_error("Failed to allocate a sufficient amount of memory.");
+    if ((w->wheel = tw_create(monotonic_seconds())) == NULL)
+        print_error("Failed to allocate a sufficient amount of memory.");
+    /* The default channel holds the reference to its ID for the life of the worker */
+    /* With channel affinity, only its owner holds it; it is interned first, by worker 0 */
+    if ((default_id = rg_intern(DEFAULT_CHANNEL)) < 0)
+        print_error("Failed to allocate a sufficient amount of memory.");
+    if (channel_affinity && channel_owner(default_id) != w) {
+        rg_release(default_id);
+    } else {
+        if ((default_ch = ms_create(rg_name(default_id), default_id)) == NULL)
+            print_error("Failed to allocate a sufficient amount of memory.");
+        if (!im_put(w->channels, default_id, default_ch))
+            print_error("Failed to allocate a sufficient amount of memory.");
     }
-    queue_id(s2s_leaf->id); /* Add ID to cache */
 
-     /* If clients are still subscribed, do nothing */
-    if (hm_get(channels, s2s_leaf->channel, (void **)&user_list))
-        if (!ll_isEmpty(user_list))
-            return;
-    /* Otherwise, forward the leaf checking packet to all neighbors */
-    (void)hm_get(r_table, s2s_leaf->channel, (void **)&user_list);
-    for (i = 0L; i < ll_size(user_list); i++) {
-        (void)ll_get(user_list, i, (void **)&server);
-        /* Forward the leaf-check packet to all neighbors */
-        if (strcmp(server->ip_addr, client_ip))
-        sendto(socket_fd, s2s_leaf, sizeof(*s2s_leaf), 0,
-                (struct sockaddr *)server->addr, sizeof(*server->addr));
-    }
-}
+    /* Create the ring of packet buffers to receive into, and the fan-out engine */
+    if ((w->ring = pr_create(w->socket_fd, RECV_BATCH)) == NULL)
+        print_error("Failed to allocate a sufficient amount of memory.");
+    if ((w->fanout = fo_create(w->socket_fd, SEND_BATCH)) == NULL)
+        print_error("Failed to allocate a sufficient amount of memory.");
 
-/*
- * Updates the server's log time given its IP address; updates the time this
- * server last sent packet.
- */
-static void s2s_keep_alive_request(char *client_ip) {
+    /* When pipelined, hand the ring to the ingress stage and the batches to the egress */
+    if (pipelined) {
+        if ((w->ingress = ig_create(w->ring, INGRESS_RING_SIZE, valid_packet)) == NULL)
+            print_error("Failed to start the worker's ingress stage.");
+        if ((w->egress = eg_create(w->socket_fd, SEND_BATCH, EGRESS_RING_SIZE)) == NULL)
+            print_error("Failed to start the worker's egress stage.");
+        fo_setEgress(w->fanout, w->egress);
+    }
 
-    Server *server;
+    /* Start the fan-out helpers; each sends on its own descriptor for the worker's socket */
+    if (fanout_helpers > 0) {
+        if ((w->pool = fp_create(w->socket_fd, fanout_helpers, SEND_BATCH)) == NULL)
+            print_error("Failed to start the worker's fan-out helpers.");
+        fo_setPool(w->fanout, w->pool, FANOUT_THRESHOLD);
+    }
 
-    if (!hm_get(neighbors, client_ip, (void **)&server))
-        return;
-    update_server_time(server); /* Update the log time */
+    /* Create the event loop; register the socket and the periodic maintenance jobs */
+    if ((w->loop = el_create()) == NULL)
+        print_error("Failed to create the event loop.");
+    if (pipelined) {
+        if (!el_addFd(w->loop, ig_fd(w->ingress), server_ingress, NULL))
+            print_error("Failed to register the ingress stage with the event loop.");
+    } else if (!el_addFd(w->loop, pr_fd(w->ring), server_receive, NULL)) {
+        print_error("Failed to register the socket with the event loop.");
+    }
+    if (id == 0) {
+        if (el_addTimer(w->loop, (S2S_REFRESH_RATE * 1000L), server_refresh, NULL) < 0)
+            print_error("Failed to create the S2S refresh timer.");
+        if (el_addTimer(w->loop, (REFRESH_RATE * 60000L), server_stats, NULL) < 0)
+            print_error("Failed to create the statistics timer.");
+    }
+    if (el_addTimer(w->loop, 1000L, server_tick, NULL) < 0)
+        print_error("Failed to create the timer wheel's tick.");
+    /* Let the fan-out engine spread large messages over several turns of the loop */
+    fo_setBudget(w->fanout, fanout_budget * (fanout_helpers + 1), FANOUT_BACKLOG);
+    el_setBacklog(w->loop, server_backlog, NULL);
+
+    /* Create the inbox the other workers pass mail through */
+    if (nworkers > 1) {
+        if ((w->inbox = mb_create(nworkers, MAILBOX_SIZE, sizeof(Mail))) == NULL)
+            print_error("Failed to allocate a sufficient amount of memory.");
+        if (!el_addFd(w->loop, mb_fd(w->inbox), server_mail, NULL))
+            print_error("Failed to register the inbox with the event loop.");
+    }
 }
 
 /*
- * Frees the reserved memory occupied by the specified LinkedList. Used by
- * the LinkedList destructor.
+ * Makes the calling thread run the specified worker.
  */
-static void free_ll(LinkedList *ll) {
-    
-    if (ll != NULL)
-        ll_destroy(ll, NULL);
+static void enter_worker(Worker *w) {
+
+    self = w;
+    socket_fd = w->socket_fd;
+    loop = w->loop;
+    ring = w->ring;
+    fanout = w->fanout;
+    users = w->users;
+    names = w->names;
+    channels = w->channels;
+    resolved = w->resolved;
+    guests = w->guests;
+    wheel = w->wheel;
+    epoch_slot = w->id;
+    publish_snapshot();
 }
 
 /*
- * Cleans up after the server before shutting down by freeing and returning all
- * reserved memory back to the heap; this includes destroying the hashmaps of the
- * users and channels, any other datastructures used within them, and closing any
- * open sockets.
+ * Start routine of the worker threads; runs the worker's event loop.
  */
-static void cleanup(void) {
-    
-    /* Close the socket if open */
-    if (socket_fd != -1)
-        close(socket_fd);
-    /* Destroy the hashmap holding the channels */
-    if (channels != NULL)
-        hm_destroy(channels, (void *)free_ll);
-    /* Destroy the hashmap containing all logged in users */
-    if (users != NULL)
-        hm_destroy(users, (void *)free_user);
-    /* Destroy the hashmap of channels neighboring servers are listening to */
-    if (r_table != NULL)
-        hm_destroy(r_table, (void *)free_ll);
-    /* Destroy the hashmap containing neighboring servers */
-    if (neighbors != NULL)
-        hm_destroy(neighbors, (void *)free_server);
+static void *worker_main(void *arg) {
+
+    enter_worker((Worker *)arg);
+    if (!el_run(loop))
+        print_error("Event loop failed.");
+
+    return NULL;
 }
 
 /*
- * Prints the specified message to standard error stream as a program error
- * message, then terminates the server application.
+ * Sets up the specified reader; creates its inbox, which every worker posts to, and the
+ * event loop driving it. Terminates the server if any of these fail.
  */
-static void print_error(const char *msg) {
-    
-    fprintf(stderr, "[Server]: %s\n", msg);
-    exit(0);
+static void create_reader(Reader *r, int id) {
+
+    r->id = id;
+    if ((r->inbox = mb_create(nworkers, MAILBOX_SIZE, sizeof(Mail))) == NULL)
+        print_error("Failed to allocate a sufficient amount of memory.");
+    if ((r->loop = el_create()) == NULL)
+        print_error("Failed to create the event loop.");
+    if (!el_addFd(r->loop, mb_fd(r->inbox), reader_mail, NULL))
+        print_error("Failed to register the inbox with the event loop.");
 }
 
 /*
- * Function that handles an interrupt signal from the user. Simply exits
- * the program, which will invoke the cleanup method registered with the
- * atexit() function.
+ * Start routine of the reader threads; runs the reader's event loop. A reader replies
+ * on the socket of one of the workers, which all share the server's port.
  */
-static void server_exit(UNUSED int signo) {
-    
-    fprintf(stdout, "%s Duckchat server terminated\n", server_addr);
-    exit(0);
+static void *reader_main(void *arg) {
+
+    reader = (Reader *)arg;
+    socket_fd = workers[reader->id % nworkers].socket_fd;
+    loop = reader->loop;
+    epoch_slot = nworkers + reader->id;
+    if (!el_run(loop))
+        print_error("Event loop failed.");
+
+    return NULL;
 }
 
 /*
@@ -2227,24 +3702,77 @@ static void server_exit(UNUSED int signo) {
  */
 int main(int argc, char *argv[]) {
 
-    LinkedList *default_ll;
-    struct sockaddr_in server, client;
+    struct sockaddr_in server;
     struct hostent *host_end;
-    struct timeval timeout;
-    socklen_t addr_len = sizeof(client);
-    fd_set receiver;
-    int i, port_num, res, mode;
-    char buffer[BUFF_SIZE], client_ip[IP_MAX];
-    struct text *packet_type;
+    sigset_t sigs, old_sigs;
+    int i, opt, port_num, level = LOG_INFO;
+    char buffer[256];
+    char *prog = argv[0];
+
+    /* Parse the options; the number of worker threads to run, how they split the */
+    /* channels, whether they are pipelined, the number of reader threads, the number */
+    /* of fan-out helpers per worker, the fan-out budget, and the log level */
+    while ((opt = getopt(argc, argv, "w:cpr:f:b:l:")) != -1) {
+        switch (opt) {
+            case 'w':
+                nworkers = atoi(optarg);
+                break;
+            case 'c':
+                channel_affinity = 1;
+                break;
+            case 'p':
+                pipelined = 1;
+                break;
+            case 'r':
+                nreaders = atoi(optarg);
+                break;
+            case 'f':
+                fanout_helpers = atoi(optarg);
+                break;
+            case 'b':
+                fanout_budget = atol(optarg);
+                break;
+            case 'l':
+                if ((level = log_parseLevel(optarg)) == -1)
+                    argc = 0;   /* Print program usage */
+                break;
+            default:
+                argc = 0;   /* Print program usage */
+                break;
+        }
+    }
+    argc -= optind; argv += optind;
 
     /* Assert that the correct number of arguments were given */
     /* Print program usage otherwise */
-    if (argc < 3 || argc % 2 != 1) {
-        fprintf(stdout, "Usage: %s domain_name port_number [domain_name port_number] ...\n", argv[0]);
+    if (argc < 2 || argc % 2 != 0) {
+        fprintf(stdout, "Usage: %s [-w workers] [-c] [-p] [-r readers] [-f helpers] [-b budget] [-l level] domain_name port_number [domain_name port_number] ...\n", prog);
+        fprintf(stdout, "  -w sets the number of worker threads to run, each with its own socket on the port (default 1).\n");
+        fprintf(stdout, "  -c gives every channel to one worker, which serves all of its subscribers.\n");
+        fprintf(stdout, "  -p pipelines every worker with its own receiving and sending threads.\n");
+        fprintf(stdout, "  -r sets the number of reader threads answering list, who and verify requests (default 0).\n");
+        fprintf(stdout, "  -f sets the number of threads per worker helping to send to large channels (default 0).\n");
+        fprintf(stdout, "  -b sets the number of recipients each sending thread sends to per turn, 0 for no limit (default %d).\n", FANOUT_BUDGET);
+        fprintf(stdout, "  -l sets the log level: error, warn, info or debug (default info).\n");
         fprintf(stdout, "  The first two arguments are the IP address and port number this server binds to.\n");
         fprintf(stdout, "  The following optional arguments are the IP address and port number of adjacent server(s) to connect to.\n");
         return 0;
     }
+    if (nworkers < 1 || nworkers > MAX_WORKERS) {
+        sprintf(buffer, "Number of workers must be in the range [1, %d].", MAX_WORKERS);
+        print_error(buffer);
+    }
+    if (nreaders < 0 || nreaders > MAX_READERS) {
+        sprintf(buffer, "Number of readers must be in the range [0, %d].", MAX_READERS);
+        print_error(buffer);
+    }
+    if (fanout_helpers < 0 || fanout_helpers > MAX_FANOUT_HELPERS) {
+        sprintf(buffer, "Number of fan-out helpers must be in the range [0, %d].",
+                MAX_FANOUT_HELPERS);
+        print_error(buffer);
+    }
+    if (fanout_budget < 0L)
+        print_error("Fan-out budget must not be negative.");
 
     /* Register function to cleanup when user stops the server */
     /* Also register the cleanup() function to be invoked upon program termination */
@@ -2256,7 +3784,7 @@ int main(int argc, char *argv[]) {
     /* Assert that path name to unix domain socket does not exceed maximum allowed */
     /* Print error message and exit otherwise */
     /* Maximum length is specified in duckchat.h */
-    if (strlen(argv[1]) > UNIX_PATH_MAX) {
+    if (strlen(argv[0]) > UNIX_PATH_MAX) {
         sprintf(buffer, "Path name to domain socket length exceeds the length allowed (%d).",
                 UNIX_PATH_MAX);
         print_error(buffer);
@@ -2265,12 +3793,12 @@ int main(int argc, char *argv[]) {
     /* Parse port number given by user, assert that it is in valid range */
     /* Print error message and exit otherwise */
     /* Port numbers typically go up to 65535 (0-1024 for privileged services) */
-    port_num = atoi(argv[2]);
+    port_num = atoi(argv[1]);
     if (port_num < 0 || port_num > 65535)
         print_error("Server socket must be in the range [0, 65535].");
 
     /* Obtain the address of the specified host */
-    if ((host_end = gethostbyname(argv[1])) == NULL)
+    if ((host_end = gethostbyname(argv[0])) == NULL)
         print_error("Failed to locate the host.");
 
     /* Create server address struct, set internet family, address, & port number */
@@ -2279,154 +3807,74 @@ int main(int argc, char *argv[]) {
     memcpy((char *)&server.sin_addr, (char *)host_end->h_addr_list[0], host_end->h_length);
     server.sin_port = htons(port_num);
 
-    /* Create the UDP socket, bind name to socket */
-    if ((socket_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
-        print_error("Failed to create a socket for the server.");
-    if (bind(socket_fd, (struct sockaddr *)&server, sizeof(server)) < 0)
-        print_error("Failed to assign the requested address.");
-
     /* Create & initialize data structures for server to use */
-    if ((users = hm_create(100L, 0.0f)) == NULL)
+    if ((neighbors = am_create(20L)) == NULL)
         print_error("Failed to allocate a sufficient amount of memory.");
-    if ((channels = hm_create(100L, 0.0f)) == NULL)
+    if ((r_table = im_create(0L)) == NULL)
         print_error("Failed to allocate a sufficient amount of memory.");
-    if ((default_ll = ll_create()) == NULL)
+    if (!rg_init())
         print_error("Failed to allocate a sufficient amount of memory.");
-    if (!hm_put(channels, DEFAULT_CHANNEL, default_ll, NULL))
-        print_error("Failed to allocate a sufficient amount of memory.");
-    if ((neighbors = hm_create(20L, 0.0f)) == NULL)
-        print_error("Failed to allocate a sufficient amount of memory.");
-    if ((r_table = hm_create(100L, 0.0f)) == NULL)
+    if ((addr_cache = hm_create(20L, 0.0f)) == NULL)
         print_error("Failed to allocate a sufficient amount of memory.");
     /* Allocate memory for neighboring servers */
-    argc -= 3; argv += 3;       /* Skip to neighboring server arg(s) */
+    argc -= 2; argv += 2;       /* Skip to neighboring server arg(s) */
+    if (argc / 2 > MAX_NEIGHBORS) {
+        sprintf(buffer, "Number of neighboring servers must not exceed %d.", MAX_NEIGHBORS);
+        print_error(buffer);
+    }
     if (!add_neighbors(argv, argc))
         print_error("Failed to allocate a sufficient amount of memory.");
+    standalone = am_isEmpty(neighbors);
 
-    /* Initialize message ID cache */
-    for (i = 0; i < MSGQ_SIZE; i++)
-        id_cache[i] = 0L;
+    /* Initialize message ID cache; the origin ID mixes in the start time and process ID, */
+    /* so that a restarted server's sequence numbers are not taken for its old ones */
+    if ((id_cache = dd_create(DEDUPE_ORIGINS, DEDUPE_WINDOW)) == NULL)
+        print_error("Failed to allocate a sufficient amount of memory.");
+    origin_id = (uint32_t)(((am_key(&server) ^ ((uint64_t)time(NULL) << 24) ^ (uint64_t)getpid())
+            * 0x9E3779B97F4A7C15ULL) >> 32);
+
+    /* Start the logger; log lines are written out by a thread of its own */
+    if (!log_init(level, 0))
+        print_error("Failed to start the logger.");
+
+    /* Create the workers and readers, and the epoch domain they share the snapshots in */
+    /* The main thread runs worker 0 */
+    if ((epochs = ep_create(nworkers + nreaders)) == NULL)
+        print_error("Failed to allocate a sufficient amount of memory.");
+    if ((workers = (Worker *)calloc(nworkers, sizeof(Worker))) == NULL)
+        print_error("Failed to allocate a sufficient amount of memory.");
+    for (i = 0; i < nworkers; i++)
+        create_worker(&workers[i], i, &server);
+    if (nreaders > 0 && (readers = (Reader *)calloc(nreaders, sizeof(Reader))) == NULL)
+        print_error("Failed to allocate a sufficient amount of memory.");
+    for (i = 0; i < nreaders; i++)
+        create_reader(&readers[i], i);
+    enter_worker(&workers[0]);
+    start_neighbor_timers();
 
     /* Display successful launch title & address */
     sprintf(server_addr, "%s:%d", inet_ntoa(server.sin_addr), ntohs(server.sin_port));
-    fprintf(stdout, "%s Duckchat server launched\n", server_addr);
-    /* Set the timeout timer for select() */
-    memset(&timeout, 0, sizeof(timeout));
-    timeout.tv_sec = 60;
-    mode = 0;
+    log_write(LOG_INFO, "%s Duckchat server launched", server_addr);
+
+    /* Start the other workers and the readers; only the main thread handles SIGINT */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &sigs, &old_sigs);
+    for (i = 1; i < nworkers; i++)
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0)
+            print_error("Failed to start a worker thread.");
+    for (i = 0; i < nreaders; i++)
+        if (pthread_create(&readers[i].thread, NULL, reader_main, &readers[i]) != 0)
+            print_error("Failed to start a reader thread.");
+    pthread_sigmask(SIG_SETMASK, &old_sigs, NULL);
 
     /*
-     * Main application loop; a packet is received from one of the connected
-     * clients, and the packet is dealt with accordingly.
+     * Main application loop; packets received from the connected clients and
+     * servers are dealt with accordingly, while the maintenance jobs run on
+     * their own timers.
      */
-    while (1) {
-
-        /* Watch the socket for packets from connected clients */
-        FD_ZERO(&receiver);
-        FD_SET(socket_fd, &receiver);
-        res = select((socket_fd + 1), &receiver, NULL, NULL, &timeout);
-
-        /* A minute passes, flood all servers with JOIN requests */
-        if (res == 0) {
-            flood_s2s_keep_alive();
-            refresh_s2s_joins();
-            mode++;
-            /* Checks for inactive users and servers */
-            if (mode >= REFRESH_RATE) {
-                logout_inactive_users();
-                remove_inactive_servers();
-                mode = 0;
-            }
-            /* Reset timer and continue */
-            timeout.tv_sec = 60;
-            continue;
-        }
-    
-        /* Receive a packet from a connected client */
-        memset(buffer, 0, sizeof(buffer));
-        if (recvfrom(socket_fd, buffer, sizeof(buffer), 0,
-            (struct sockaddr *)&client, &addr_len) < 0)
-            continue;
-        /* Extract full address of sender, parse packet */
-        sprintf(client_ip, "%s:%d", inet_ntoa(client.sin_addr), ntohs(client.sin_port));
-        packet_type = (struct text *) buffer;
-
-        /* Examine the packet type received */
-        switch (packet_type->txt_type) {
-            case REQ_VERIFY:
-                /* Check to see if the username is taken */
-                server_verify_request(buffer, client_ip, &client);
-                break;
-            case REQ_LOGIN:
-                /* A client requests to login to the server */
-                server_login_request(buffer, client_ip, &client);
-                break;
-            case REQ_LOGOUT:
-                /* A client requests to logout from the server */
-                server_logout_request(client_ip);
-                break;
-            case REQ_JOIN:
-                /* A client requests to join a channel */
-                server_join_request(buffer, client_ip);
-                break;
-            case REQ_LEAVE:
-                /* A client requests to leave a channel */
-                server_leave_request(buffer, client_ip);
-                break;
-            case REQ_SAY:
-                /* A client sent a message to broadcast in their active channel */
-                server_say_request(buffer, client_ip);
-                break;
-            case REQ_LIST:
-                /* A client requests a list of all the channels on the server */
-                server_list_request(client_ip);
-                break;
-            case REQ_WHO:
-                /* A client requests a list of users on the specified channel */
-                server_who_request(buffer, client_ip);
-                break;
-            case REQ_KEEP_ALIVE:
-                /* Received from an inactive user, keeps them logged in */
-                server_keep_alive_request(client_ip);
-                break;
-            case REQ_S2S_VERIFY:
-                /* Server-to-server verify request, check for username verification */
-                s2s_verify_request(buffer, client_ip);
-                break;
-            case REQ_S2S_JOIN:
-                /* Server-to-server join request, forward it to neighbors */
-                s2s_join_request(buffer, client_ip);
-                break;
-            case REQ_S2S_LEAVE:
-                /* Server-to-server leave request, unsubscribe server from a channel */
-                s2s_leave_request(buffer, client_ip);
-                break;
-            case REQ_S2S_SAY:
-                /* Server-to-server say request, forward to all subscribed servers */
-                s2s_say_request(buffer, client_ip);
-                break;
-            case REQ_S2S_LIST:
-                /* Server-to-server list request, collect channel names and forward to neighbors */
-                s2s_list_request(buffer, client_ip);
-                break;
-            case REQ_S2S_WHO:
-                /* Server-to-server who request, collect listening users and forward to neighbors */
-                s2s_who_request(buffer, client_ip);
-                break;
-            case REQ_S2S_LEAF:
-                /* Server-to-server leaf request, checks if the server is a leaf in channel subtree */
-                s2s_leaf_request(buffer, client_ip);
-                break;
-            case REQ_S2S_KEEP_ALIVE:
-                /* Server-to-server keep alive request, update time for corresponding server */
-                s2s_keep_alive_request(client_ip);
-                break;
-            default:
-                /* Do nothing, likey a bogus packet */
-                break;
-        }
-    }
+    if (!el_run(loop))
+        print_error("Event loop failed.");
 
     return 0;
 }
-
@@ -0,0 +1,142 @@
+/*
+ * slab.c
+ *
+ * Implementation of the slab allocator; see slab.h. Each thread has a cache per
+ * type of object, holding its free list and counters; only the thread writes to
+ * them. Every cache is also linked into a registry, under a mutex taken only
+ * when a thread first uses a type, which is read to sum up the statistics.
+ */
+
+#include "slab.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+#define CHUNK_SIZE 4096L
+#define ALIGN 8L                    /* alignment of pointers and 64-bit integers */
+
+typedef struct cache {
+    SlabType *type;
+    size_t size;                    /* object size, rounded up to ALIGN */
+    void *free;                     /* free list, linked through the first word */
+    long chunks;
+    long capacity;
+    long used;
+    long allocs;
+    struct cache *next;             /* next in the registry */
+} Cache;
+
+static __thread Cache *caches[SLAB_MAX_TYPES];
+static Cache *registry = NULL;
+static int ntypes = 0;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * local function to return the calling thread's cache for type `t', creating
+ * it, and numbering the type, on first use
+ */
+static Cache *cache(SlabType *t) {
+    Cache *c;
+    int id = __atomic_load_n(&t->id, __ATOMIC_ACQUIRE);
+
+    if (id > 0 && (c = caches[id - 1]) != NULL)
+        return c;
+    if ((c = (Cache *)malloc(sizeof(Cache))) == NULL)
+        return NULL;
+    c->type = t;
+    c->size = ((t->size + ALIGN - 1) / ALIGN) * ALIGN;
+    if (c->size < sizeof(void *))
+        c->size = sizeof(void *);
+    c->free = NULL;
+    c->chunks = c->capacity = c->used = c->allocs = 0L;
+
+    pthread_mutex_lock(&registry_lock);
+    if ((id = t->id) == 0) {
+        if (ntypes == SLAB_MAX_TYPES) {
+            pthread_mutex_unlock(&registry_lock);
+            free(c);
+            return NULL;
+        }
+        id = ++ntypes;
+        __atomic_store_n(&t->id, id, __ATOMIC_RELEASE);
+    }
+    c->next = registry;
+    registry = c;
+    pthread_mutex_unlock(&registry_lock);
+
+    caches[id - 1] = c;
+    return c;
+}
+
+/*
+ * local function to carve a new chunk into objects onto the free list of `c'
+ */
+static int refill(Cache *c) {
+    char *chunk;
+    long i, n = CHUNK_SIZE / (long)c->size;
+
+    if (n < 1L)
+        n = 1L;
+    if ((chunk = (char *)malloc(n * c->size)) == NULL)
+        return 0;
+    /* link the objects in address order, so they are handed out that way */
+    for (i = n - 1; i >= 0L; i--) {
+        *(void **)(chunk + i * c->size) = c->free;
+        c->free = chunk + i * c->size;
+    }
+    c->chunks++;
+    c->capacity += n;
+    return 1;
+}
+
+void *sl_alloc(SlabType *t) {
+    Cache *c;
+    void *obj;
+
+    if ((c = cache(t)) == NULL)
+        return NULL;
+    if (c->free == NULL && !refill(c))
+        return NULL;
+    obj = c->free;
+    c->free = *(void **)obj;
+    c->used++;
+    c->allocs++;
+    return obj;
+}
+
+void sl_free(SlabType *t, void *obj) {
+    Cache *c;
+
+    /* without a cache (malloc failure), the object is lost, but stays valid */
+    if (obj == NULL || (c = cache(t)) == NULL)
+        return;
+    *(void **)obj = c->free;
+    c->free = obj;
+    c->used--;
+}
+
+long sl_stats(SlabStats *st, long max) {
+    Cache *c;
+    long i, n;
+
+    pthread_mutex_lock(&registry_lock);
+    for (i = 0L; i < ntypes && i < max; i++) {
+        st[i].name = NULL;
+        st[i].size = 0;
+        st[i].chunks = st[i].capacity = st[i].used = st[i].allocs = 0L;
+    }
+    for (c = registry; c != NULL; c = c->next) {
+        i = c->type->id - 1;
+        if (i >= max)
+            continue;
+        st[i].name = c->type->name;
+        st[i].size = c->size;
+        st[i].chunks += c->chunks;
+        st[i].capacity += c->capacity;
+        st[i].used += c->used;
+        st[i].allocs += c->allocs;
+    }
+    n = (ntypes < max) ? ntypes : max;
+    pthread_mutex_unlock(&registry_lock);
+
+    return n;
+}
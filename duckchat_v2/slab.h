@@ -0,0 +1,67 @@
+/*
+ * slab.h
+ *
+ * Interface for a process-wide slab allocator of small fixed-size objects, such
+ * as the nodes of linked lists and the subscriptions of users to channels. Every
+ * thread carves the objects of each type out of chunks of a few kilobytes and
+ * keeps the freed ones on a free list of its own, so allocating or freeing an
+ * object is a pointer pop or push, with no locking. An object may be freed by
+ * another thread than the one that allocated it; it is then reused by that
+ * thread. Chunks are never returned to the heap, so the memory held by a type
+ * follows the largest number of its objects in use at once.
+ */
+
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include <stddef.h>
+
+/*
+ * describes one type of object allocated from the slabs; declared statically by
+ * the module allocating the objects, with SLAB_TYPE(); its members are private
+ * to the implementation
+ */
+typedef struct slabtype {
+    const char *name;
+    size_t size;
+    int id;                     /* index of the type, 0 until first used */
+} SlabType;
+
+#define SLAB_TYPE(name, type) { (name), sizeof(type), 0 }
+#define SLAB_MAX_TYPES 16       /* types the slabs can hold; sl_alloc() fails past these */
+
+/*
+ * the statistics of one type of object, summed over all threads
+ */
+typedef struct {
+    const char *name;
+    size_t size;                /* size of an object, as allocated */
+    long chunks;                /* chunks carved into objects */
+    long capacity;              /* objects carved out of the chunks */
+    long used;                  /* objects currently allocated */
+    long allocs;                /* objects allocated since the start */
+} SlabStats;
+
+/*
+ * allocates an object of type `t'; the object is aligned for pointers and
+ * 64-bit integers, and its contents are undefined
+ *
+ * returns a pointer to the object, or NULL if there are malloc() errors
+ */
+void *sl_alloc(SlabType *t);
+
+/*
+ * returns the object `obj' of type `t' to the slabs; `obj' may be NULL
+ */
+void sl_free(SlabType *t, void *obj);
+
+/*
+ * fills `st' with the statistics of up to `max' types of objects, those used so
+ * far; the counts are read without stopping the other threads, so they may be
+ * slightly out of date
+ *
+ * returns the number of types filled in
+ */
+long sl_stats(SlabStats *st, long max);
+
+#endif /* _SLAB_H_ */
@@ -0,0 +1,424 @@
+/*
+ * snapshot.c
+ *
+ * Implementation of the shard snapshot; see snapshot.h. The channels and the
+ * usernames are kept in two hash tries. A branch node has BRANCH children,
+ * picked by the next BITS bits of the hash of a name; a leaf holds up to LEAF_MAX
+ * records, and is split into a branch when it overflows, or grows once the hash
+ * is used up. A record holds a name, and for a channel the usernames subscribed
+ * to it.
+ * Snapshots derived from one another share their nodes and records, which count
+ * the snapshots and nodes pointing to them. A change copies the shared nodes on
+ * the path to the record it replaces, and changes the copies, which only the
+ * snapshot being built points to; a shared node is never changed, so snapshots
+ * already published stay as they were. Only the thread building the snapshots
+ * touches the counts; the readers never look at them.
+ */
+
+#include "snapshot.h"
+#include "duckchat.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/random.h>
+
+#define BITS 4                      /* bits of the hash consumed per level */
+#define BRANCH 16                   /* children of a branch, 1 << BITS */
+#define DEPTH_MAX 16                /* levels of branches the 64-bit hash can pick */
+#define LEAF_MAX 8                  /* records a leaf holds before it is split */
+#define KEY_MAX ((CHANNEL_MAX > USERNAME_MAX) ? CHANNEL_MAX : USERNAME_MAX)
+
+typedef struct {
+    int refs;                       /* leaves holding the record */
+    uint64_t hash;                  /* hash of the name */
+    long count, size;               /* usernames subscribed, and room for them */
+    char name[KEY_MAX];             /* name of the channel, or the username */
+    char members[][USERNAME_MAX];
+} Record;
+
+typedef struct {
+    int refs;                       /* snapshots and nodes pointing to the node */
+    int branch;                     /* 1 if a branch, 0 if a leaf */
+    int count, size;                /* leaf: records held, and room for them */
+    void *slots[];                  /* branch: children, or NULL; leaf: records */
+} Node;
+
+struct snapshot {
+    uint64_t seed;                  /* seed of the hash, shared by derived snapshots */
+    void *channels;                 /* root node of the channels, NULL if none */
+    void *users;                    /* root node of the usernames, ditto */
+    Record *last;                   /* builder only: the channel put last */
+};
+
+/*
+ * local function to hash a name; FNV-1a, with the bits of the result mixed so
+ * that every level of the trie sees well spread ones
+ */
+static uint64_t hash(uint64_t seed, const char *name) {
+    uint64_t h = seed ^ 0xcbf29ce484222325ULL;
+
+    for (; *name != '\0'; name++)
+        h = (h ^ (unsigned char)*name) * 0x100000001b3ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 33);
+}
+
+/*
+ * local function to draw the seed of a new line of snapshots, so that names
+ * crafted to collide cannot pile up in one leaf
+ */
+static uint64_t make_seed(void) {
+    uint64_t s;
+
+    if (getrandom(&s, sizeof(s), GRND_NONBLOCK) != (ssize_t)sizeof(s))
+        s = (uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)&s;
+    return s;
+}
+
+/*
+ * local function to pick the child of a branch at `depth' for a hash
+ */
+static int child(uint64_t h, int depth) {
+    return (int)((h >> (depth * BITS)) & (BRANCH - 1));
+}
+
+/*
+ * local function to create a record for `name' with room for `size' members
+ */
+static Record *record_create(uint64_t seed, const char *name, long size) {
+    Record *rec;
+
+    if ((rec = (Record *)malloc(sizeof(Record) + size * USERNAME_MAX)) == NULL)
+        return NULL;
+    rec->refs = 1;
+    snprintf(rec->name, KEY_MAX, "%s", name);
+    rec->hash = hash(seed, rec->name);
+    rec->count = 0L;
+    rec->size = size;
+    return rec;
+}
+
+/*
+ * local function to drop a reference to a record, freeing it with the last
+ */
+static void record_release(Record *rec) {
+    if (--rec->refs == 0)
+        free(rec);
+}
+
+/*
+ * local function to create an empty node; a branch has BRANCH slots
+ */
+static Node *node_create(int branch, int size) {
+    Node *n;
+
+    if ((n = (Node *)malloc(sizeof(Node) + size * sizeof(void *))) == NULL)
+        return NULL;
+    n->refs = 1;
+    n->branch = branch;
+    n->count = 0;
+    n->size = size;
+    memset(n->slots, 0, size * sizeof(void *));
+    return n;
+}
+
+/*
+ * local function to drop a reference to a node, freeing it with the last, and
+ * then dropping its references to its children or records
+ */
+static void node_release(Node *n) {
+    int i;
+
+    if (n == NULL || --n->refs > 0)
+        return;
+    if (n->branch) {
+        for (i = 0; i < BRANCH; i++)
+            node_release((Node *)n->slots[i]);
+    } else {
+        for (i = 0; i < n->count; i++)
+            record_release((Record *)n->slots[i]);
+    }
+    free(n);
+}
+
+/*
+ * local function to make the node in `*slot' one that only the snapshot being
+ * built points to; a shared node is replaced there by a copy, which takes
+ * references of its own to the children or records
+ *
+ * returns the node, or NULL if there are malloc() errors
+ */
+static Node *own(void **slot) {
+    Node *n = (Node *)*slot, *copy;
+    int i;
+
+    if (n->refs == 1)
+        return n;
+    if ((copy = node_create(n->branch, n->size)) == NULL)
+        return NULL;
+    copy->count = n->count;
+    if (n->branch) {
+        memcpy(copy->slots, n->slots, BRANCH * sizeof(void *));
+        for (i = 0; i < BRANCH; i++)
+            if (n->slots[i] != NULL)
+                ((Node *)n->slots[i])->refs++;
+    } else {
+        memcpy(copy->slots, n->slots, n->count * sizeof(void *));
+        for (i = 0; i < n->count; i++)
+            ((Record *)n->slots[i])->refs++;
+    }
+    n->refs--;
+    *slot = copy;
+    return copy;
+}
+
+/*
+ * local function to find the record named `name', with hash `h', under `n'
+ */
+static Record *lookup(const Node *n, uint64_t h, const char *name) {
+    Record *rec;
+    int depth, i;
+
+    for (depth = 0; n != NULL && n->branch; depth++)
+        n = (const Node *)n->slots[child(h, depth)];
+    if (n == NULL)
+        return NULL;
+    for (i = 0; i < n->count; i++) {
+        rec = (Record *)n->slots[i];
+        if (rec->hash == h && strcmp(rec->name, name) == 0)
+            return rec;
+    }
+    return NULL;
+}
+
+/*
+ * local function to split a full leaf at `depth' into a branch, moving its
+ * records into new leaves one level down; the leaf is freed
+ *
+ * returns the branch, or NULL if there are malloc() errors; the leaf is then
+ * left as it was
+ */
+static Node *split(Node *leaf, int depth) {
+    Node *branch, *n;
+    Record *rec;
+    int i, k;
+
+    if ((branch = node_create(1, BRANCH)) == NULL)
+        return NULL;
+    for (i = 0; i < leaf->count; i++) {
+        rec = (Record *)leaf->slots[i];
+        k = child(rec->hash, depth + 1);
+        if ((n = (Node *)branch->slots[k]) == NULL) {
+            if ((n = node_create(0, LEAF_MAX)) == NULL)
+                goto error;
+            branch->slots[k] = n;
+        }
+        n->slots[n->count++] = rec;
+    }
+    free(leaf);
+    return branch;
+
+error:
+    for (k = 0; k < BRANCH; k++)
+        free(branch->slots[k]);
+    free(branch);
+    return NULL;
+}
+
+/*
+ * local function to put `rec' into the trie rooted in `*slot', taking over its
+ * reference, and replacing the record of the same name if there is one
+ *
+ * returns 1 if successful, 0 if there are malloc() errors
+ */
+static int put(void **slot, Record *rec) {
+    Node *n;
+    Record *old;
+    int depth = -1, i;
+
+    for (;;) {
+        if (*slot == NULL && (*slot = node_create(0, LEAF_MAX)) == NULL)
+            return 0;
+        if ((n = own(slot)) == NULL)
+            return 0;
+        if (n->branch) {
+            slot = &n->slots[child(rec->hash, ++depth)];
+            continue;
+        }
+        for (i = 0; i < n->count; i++) {
+            old = (Record *)n->slots[i];
+            if (old->hash == rec->hash && strcmp(old->name, rec->name) == 0) {
+                n->slots[i] = rec;
+                record_release(old);
+                return 1;
+            }
+        }
+        if (n->count < n->size) {
+            n->slots[n->count++] = rec;
+            return 1;
+        }
+        /* Full; split it while the hash has bits left, grow it once they run out */
+        if (depth + 1 < DEPTH_MAX) {
+            if ((n = split(n, depth)) == NULL)
+                return 0;
+        } else {
+            if ((n = (Node *)realloc(n, sizeof(Node) + 2 * n->size * sizeof(void *))) == NULL)
+                return 0;
+            n->size *= 2;
+        }
+        *slot = n;
+    }
+}
+
+/*
+ * local function to remove the record named `name' from the trie rooted in
+ * `*slot'; a leaf left empty is freed, a branch left empty is kept
+ *
+ * returns 1 if successful, 0 if there are malloc() errors
+ */
+static int removeRecord(void **slot, uint64_t h, const char *name) {
+    Node *n;
+    Record *rec = NULL;
+    int depth, i;
+
+    /* Copy nothing if there is nothing to remove */
+    if (lookup((Node *)*slot, h, name) == NULL)
+        return 1;
+    for (depth = 0; ; depth++) {
+        if ((n = own(slot)) == NULL)
+            return 0;
+        if (!n->branch)
+            break;
+        slot = &n->slots[child(h, depth)];
+    }
+    for (i = 0; i < n->count; i++) {
+        rec = (Record *)n->slots[i];
+        if (rec->hash == h && strcmp(rec->name, name) == 0)
+            break;
+    }
+    n->slots[i] = n->slots[--n->count];
+    record_release(rec);
+    if (n->count == 0) {
+        node_release(n);
+        *slot = NULL;
+    }
+    return 1;
+}
+
+/*
+ * local function to invoke `fxn' on the name of every record under `n'
+ */
+static int visit(const Node *n, int (*fxn)(const char *name, void *arg), void *arg) {
+    int i;
+
+    if (n == NULL)
+        return 1;
+    if (n->branch) {
+        for (i = 0; i < BRANCH; i++)
+            if (!visit((const Node *)n->slots[i], fxn, arg))
+                return 0;
+    } else {
+        for (i = 0; i < n->count; i++)
+            if (!(*fxn)(((const Record *)n->slots[i])->name, arg))
+                return 0;
+    }
+    return 1;
+}
+
+Snapshot *sn_create(Snapshot *base) {
+    Snapshot *sn;
+
+    if ((sn = (Snapshot *)malloc(sizeof(Snapshot))) == NULL)
+        return NULL;
+    if (base != NULL) {
+        sn->seed = base->seed;
+        if ((sn->channels = base->channels) != NULL)
+            ((Node *)sn->channels)->refs++;
+        if ((sn->users = base->users) != NULL)
+            ((Node *)sn->users)->refs++;
+    } else {
+        sn->seed = make_seed();
+        sn->channels = sn->users = NULL;
+    }
+    sn->last = NULL;
+    return sn;
+}
+
+void sn_destroy(Snapshot *sn) {
+    node_release((Node *)sn->channels);
+    node_release((Node *)sn->users);
+    free(sn);
+}
+
+int sn_putChannel(Snapshot *sn, const char *name, long nmembers) {
+    Record *rec;
+
+    sn->last = NULL;
+    if ((rec = record_create(sn->seed, name, nmembers)) == NULL)
+        return 0;
+    if (!put(&sn->channels, rec)) {
+        free(rec);
+        return 0;
+    }
+    sn->last = rec;
+    return 1;
+}
+
+int sn_addMember(Snapshot *sn, const char *name) {
+    Record *rec = sn->last;
+
+    if (rec == NULL || rec->count == rec->size)
+        return 0;
+    snprintf(rec->members[rec->count++], USERNAME_MAX, "%s", name);
+    return 1;
+}
+
+int sn_removeChannel(Snapshot *sn, const char *name) {
+    sn->last = NULL;
+    return removeRecord(&sn->channels, hash(sn->seed, name), name);
+}
+
+int sn_putUser(Snapshot *sn, const char *name) {
+    Record *rec;
+
+    if (lookup((Node *)sn->users, hash(sn->seed, name), name) != NULL)
+        return 1;
+    if ((rec = record_create(sn->seed, name, 0L)) == NULL)
+        return 0;
+    if (!put(&sn->users, rec)) {
+        free(rec);
+        return 0;
+    }
+    return 1;
+}
+
+int sn_removeUser(Snapshot *sn, const char *name) {
+    return removeRecord(&sn->users, hash(sn->seed, name), name);
+}
+
+int sn_forEachChannel(const Snapshot *sn, int (*fxn)(const char *name, void *arg),
+        void *arg) {
+    return visit((const Node *)sn->channels, fxn, arg);
+}
+
+int sn_forEachMember(const Snapshot *sn, const char *name,
+        int (*fxn)(const char *username, void *arg), void *arg) {
+    Record *rec;
+    long j;
+
+    if ((rec = lookup((const Node *)sn->channels, hash(sn->seed, name), name)) == NULL)
+        return 0;
+    for (j = 0L; j < rec->count; j++)
+        if (!(*fxn)(rec->members[j], arg))
+            return -1;
+    return 1;
+}
+
+int sn_hasUser(const Snapshot *sn, const char *name) {
+    return (lookup((const Node *)sn->users, hash(sn->seed, name), name) != NULL);
+}
@@ -0,0 +1,96 @@
+/*
+ * snapshot.h
+ *
+ * Interface for a read-only snapshot of a worker's shard: the names of its
+ * channels with the usernames subscribed to each, and the usernames logged in.
+ * A snapshot is built by the worker and from then on never changes, so any
+ * number of threads may read it without locks (see epoch.h for when it may be
+ * freed).
+ * A new snapshot is derived from the previous one and shares with it every
+ * channel and username the worker did not change in between, so that taking it
+ * costs in proportion to the changes rather than to the shard. All snapshots
+ * derived from one another must be created, changed and destroyed by the same
+ * thread.
+ */
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+typedef struct snapshot Snapshot;   /* opaque type definition */
+
+/*
+ * create a snapshot holding the same channels and usernames as `base', or an
+ * empty one if `base' is NULL; `base' is not changed
+ *
+ * returns a pointer to the snapshot, or NULL if there are malloc() errors
+ */
+Snapshot *sn_create(Snapshot *base);
+
+/*
+ * returns the storage of the snapshot to the heap, except what it shares with
+ * other snapshots
+ */
+void sn_destroy(Snapshot *sn);
+
+/*
+ * builder only: adds the channel `name' with room for `nmembers' subscribers,
+ * replacing the channel of that name if there is one; members added from now
+ * on are subscribed to it
+ *
+ * returns 1 if successful, 0 if there are malloc() errors
+ */
+int sn_putChannel(Snapshot *sn, const char *name, long nmembers);
+
+/*
+ * builder only: adds a copy of the username `name' to the channel put last
+ *
+ * returns 1 if successful, 0 if there is no room left or no channel yet
+ */
+int sn_addMember(Snapshot *sn, const char *name);
+
+/*
+ * builder only: removes the channel `name', if there is one
+ *
+ * returns 1 if successful, 0 if there are malloc() errors
+ */
+int sn_removeChannel(Snapshot *sn, const char *name);
+
+/*
+ * builder only: adds the username `name', unless it is already there
+ *
+ * returns 1 if successful, 0 if there are malloc() errors
+ */
+int sn_putUser(Snapshot *sn, const char *name);
+
+/*
+ * builder only: removes the username `name', if it is there
+ *
+ * returns 1 if successful, 0 if there are malloc() errors
+ */
+int sn_removeUser(Snapshot *sn, const char *name);
+
+/*
+ * invokes `fxn' on the name of every channel in the snapshot, in an arbitrary
+ * order, until it returns 0
+ *
+ * returns 1 if every channel was visited, 0 if `fxn' stopped the visit
+ */
+int sn_forEachChannel(const Snapshot *sn, int (*fxn)(const char *name, void *arg),
+        void *arg);
+
+/*
+ * invokes `fxn' on the username of every user subscribed to the channel `name',
+ * until it returns 0
+ *
+ * returns 1 if every user was visited, 0 if there is no such channel, or -1 if
+ * `fxn' stopped the visit
+ */
+int sn_forEachMember(const Snapshot *sn, const char *name,
+        int (*fxn)(const char *username, void *arg), void *arg);
+
+/*
+ * returns 1 if the username `name' is in the snapshot, 0 if not
+ */
+int sn_hasUser(const Snapshot *sn, const char *name);
+
+#endif /* _SNAPSHOT_H_ */
@@ -0,0 +1,91 @@
+/*
+ * spscring.c
+ *
+ * Implementation of the lock-free single-producer/single-consumer ring; see
+ * spscring.h. The producer owns `tail', the consumer owns `head'; both live on
+ * their own cache lines so the two threads do not bounce a line between them.
+ */
+
+#include "spscring.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE 64
+
+struct spscring {
+    long mask;
+    size_t elemsize;
+    char *elements;
+    long head __attribute__((aligned(CACHE_LINE)));     /* next element to pop */
+    long tail __attribute__((aligned(CACHE_LINE)));     /* next free position */
+    long drops;
+};
+
+SpscRing *sr_create(long capacity, size_t elemsize) {
+    SpscRing *sr;
+    long N = 1L;
+
+    while (N < capacity)
+        N <<= 1;
+    if ((sr = (SpscRing *)aligned_alloc(CACHE_LINE, sizeof(SpscRing))) == NULL)
+        return NULL;
+    if ((sr->elements = (char *)malloc(N * elemsize)) == NULL) {
+        free(sr);
+        return NULL;
+    }
+    sr->mask = N - 1;
+    sr->elemsize = elemsize;
+    sr->head = 0L;
+    sr->tail = 0L;
+    sr->drops = 0L;
+    return sr;
+}
+
+void sr_destroy(SpscRing *sr) {
+    free(sr->elements);
+    free(sr);
+}
+
+int sr_push(SpscRing *sr, const void *elem) {
+    long t = __atomic_load_n(&sr->tail, __ATOMIC_RELAXED);
+
+    if (t - __atomic_load_n(&sr->head, __ATOMIC_ACQUIRE) > sr->mask) {
+        __atomic_fetch_add(&sr->drops, 1L, __ATOMIC_RELAXED);
+        return 0;
+    }
+    memcpy(sr->elements + (t & sr->mask) * sr->elemsize, elem, sr->elemsize);
+    __atomic_store_n(&sr->tail, t + 1, __ATOMIC_RELEASE);
+    /*
+     * pairs with the fence in sr_pop(): either the consumer sees the new tail,
+     * or we see that it has already consumed everything before this element
+     */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return ((__atomic_load_n(&sr->head, __ATOMIC_RELAXED) == t) ? 2 : 1);
+}
+
+int sr_isFull(SpscRing *sr) {
+    return (__atomic_load_n(&sr->tail, __ATOMIC_RELAXED) -
+            __atomic_load_n(&sr->head, __ATOMIC_ACQUIRE) > sr->mask);
+}
+
+int sr_pop(SpscRing *sr, void *elem) {
+    long h = __atomic_load_n(&sr->head, __ATOMIC_RELAXED);
+
+    if (h == __atomic_load_n(&sr->tail, __ATOMIC_ACQUIRE)) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (h == __atomic_load_n(&sr->tail, __ATOMIC_ACQUIRE))
+            return 0;
+    }
+    memcpy(elem, sr->elements + (h & sr->mask) * sr->elemsize, sr->elemsize);
+    __atomic_store_n(&sr->head, h + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+long sr_size(SpscRing *sr) {
+    return __atomic_load_n(&sr->tail, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&sr->head, __ATOMIC_ACQUIRE);
+}
+
+long sr_drops(SpscRing *sr) {
+    return __atomic_load_n(&sr->drops, __ATOMIC_RELAXED);
+}
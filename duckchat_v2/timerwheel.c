@@ -0,0 +1,147 @@
+/*
+ * timerwheel.c
+ *
+ * Implementation of the timer wheel; see timerwheel.h. A timer due at tick `e'
+ * is kept in level L, slot (e >> 6L) & 63, for the smallest L at which it is
+ * less than 64^(L+1) ticks away. Whenever the first level wraps around, the
+ * slot of the next level that has come due is emptied into the finer levels,
+ * which may in turn empty a slot of the level after it.
+ */
+
+#include "timerwheel.h"
+#include <stdlib.h>
+
+#define LEVELS 4
+#define SLOT_BITS 6
+#define SLOTS (1L << SLOT_BITS)
+#define MASK (SLOTS - 1)
+#define MAX_DELAY ((1UL << (LEVELS * SLOT_BITS)) - 1)
+
+struct timerwheel {
+    unsigned long now;              /* current time */
+    unsigned long next;             /* next tick to process */
+    Timer *slots[LEVELS][SLOTS];
+};
+
+TimerWheel *tw_create(unsigned long now) {
+    TimerWheel *tw;
+    long i, j;
+
+    if ((tw = (TimerWheel *)malloc(sizeof(TimerWheel))) == NULL)
+        return NULL;
+    tw->now = now;
+    tw->next = now + 1;
+    for (i = 0L; i < LEVELS; i++)
+        for (j = 0L; j < SLOTS; j++)
+            tw->slots[i][j] = NULL;
+    return tw;
+}
+
+void tw_destroy(TimerWheel *tw) {
+    free(tw);
+}
+
+void tw_init(Timer *t, void (*callback)(void *arg), void *arg) {
+    t->next = NULL;
+    t->pprev = NULL;
+    t->expires = 0UL;
+    t->callback = callback;
+    t->arg = arg;
+}
+
+unsigned long tw_now(TimerWheel *tw) {
+    return tw->now;
+}
+
+/*
+ * local function to link the idle timer `t' into the slot for its expiry time
+ */
+static void add(TimerWheel *tw, Timer *t) {
+    unsigned long delay;
+    Timer **head;
+    int level = 0;
+
+    /* a timer due already expires at the next tick */
+    if (t->expires < tw->next)
+        t->expires = tw->next;
+    delay = t->expires - tw->next;
+    if (delay > MAX_DELAY) {
+        delay = MAX_DELAY;
+        t->expires = tw->next + MAX_DELAY;
+    }
+    while (level < LEVELS - 1 && delay >= (1UL << ((level + 1) * SLOT_BITS)))
+        level++;
+    head = &tw->slots[level][(t->expires >> (level * SLOT_BITS)) & MASK];
+
+    t->next = *head;
+    t->pprev = head;
+    if (*head != NULL)
+        (*head)->pprev = &t->next;
+    *head = t;
+}
+
+void tw_cancel(Timer *t) {
+    if (t->pprev == NULL)
+        return;
+    *t->pprev = t->next;
+    if (t->next != NULL)
+        t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+void tw_schedule(TimerWheel *tw, Timer *t, unsigned long delay) {
+    tw_cancel(t);
+    t->expires = tw->now + ((delay > MAX_DELAY) ? MAX_DELAY : delay);
+    add(tw, t);
+}
+
+int tw_pending(Timer *t) {
+    return (t->pprev != NULL);
+}
+
+/*
+ * local function to empty slot `index' of level `level' into the finer levels;
+ * returns `index', so that the caller knows whether this level wrapped around
+ */
+static long cascade(TimerWheel *tw, int level, long index) {
+    Timer *t = tw->slots[level][index], *next;
+
+    tw->slots[level][index] = NULL;
+    for (; t != NULL; t = next) {
+        next = t->next;
+        add(tw, t);
+    }
+    return index;
+}
+
+void tw_advance(TimerWheel *tw, unsigned long now) {
+    Timer *expired, *t;
+    unsigned long tick;
+    long index;
+    int level;
+
+    while (tw->next <= now) {
+        tick = tw->next;
+        index = (long)(tick & MASK);
+        /* the first level wrapped around; bring the coarser timers due next closer */
+        for (level = 1; index == 0 && level < LEVELS; level++)
+            index = cascade(tw, level, (long)((tick >> (level * SLOT_BITS)) & MASK));
+
+        /* take the whole slot first, so timers scheduled by callbacks land in later ticks */
+        index = (long)(tick & MASK);
+        expired = tw->slots[0][index];
+        tw->slots[0][index] = NULL;
+        if (expired != NULL)
+            expired->pprev = &expired;
+        tw->now = tick;
+        tw->next = tick + 1;
+
+        while ((t = expired) != NULL) {
+            tw_cancel(t);
+            (*t->callback)(t->arg);
+        }
+    }
+    if (now > tw->now)
+        tw->now = now;
+}
@@ -0,0 +1,81 @@
+/*
+ * timerwheel.h
+ *
+ * Interface for a hierarchical timer wheel, used to expire soft state such as
+ * inactive users and neighboring servers. Time is counted in ticks, and the
+ * wheel has four levels of 64 slots each: a timer due within 64 ticks sits in
+ * a slot of the first level, and later ones in coarser slots that are spread
+ * into the finer levels as their time comes near. Scheduling, rescheduling and
+ * cancelling a timer take constant time, and advancing the wheel by a tick only
+ * touches the timers that expire, plus the occasional coarse slot.
+ *
+ * A timer is embedded in the structure it expires, so the wheel allocates no
+ * storage per timer.
+ */
+
+#ifndef _TIMERWHEEL_H_
+#define _TIMERWHEEL_H_
+
+typedef struct timerwheel TimerWheel;   /* opaque type definition */
+
+/*
+ * a timer; declared as a member of the structure it expires and set up with
+ * tw_init(); its members are private to the implementation
+ */
+typedef struct timer {
+    struct timer *next;
+    struct timer **pprev;       /* the link pointing at this timer, NULL if idle */
+    unsigned long expires;      /* tick the timer is due at */
+    void (*callback)(void *arg);
+    void *arg;
+} Timer;
+
+/*
+ * create a timer wheel whose current time is `now' ticks
+ *
+ * returns a pointer to the wheel, or NULL if there are malloc() errors
+ */
+TimerWheel *tw_create(unsigned long now);
+
+/*
+ * destroys the wheel, returning its storage to the heap; timers still
+ * scheduled are not invoked, and must not be used with the wheel again
+ */
+void tw_destroy(TimerWheel *tw);
+
+/*
+ * sets up the idle timer `t' to invoke `callback' with `arg' when it expires
+ */
+void tw_init(Timer *t, void (*callback)(void *arg), void *arg);
+
+/*
+ * returns the current time of the wheel, in ticks
+ */
+unsigned long tw_now(TimerWheel *tw);
+
+/*
+ * schedules the timer `t' to expire `delay' ticks from the current time of
+ * the wheel; a timer already scheduled is moved to the new time; timers due
+ * beyond the reach of the wheel (2^24 ticks) expire at its reach
+ */
+void tw_schedule(TimerWheel *tw, Timer *t, unsigned long delay);
+
+/*
+ * cancels the timer `t'; does nothing if it is not scheduled
+ */
+void tw_cancel(Timer *t);
+
+/*
+ * returns 1 if the timer `t' is scheduled, 0 if it is idle
+ */
+int tw_pending(Timer *t);
+
+/*
+ * advances the current time of the wheel to `now' ticks, invoking the callback
+ * of every timer that expires on the way, in order of expiry; a timer is idle
+ * by the time its callback is invoked, so the callback may reschedule it, or
+ * free the structure holding it
+ */
+void tw_advance(TimerWheel *tw, unsigned long now);
+
+#endif /* _TIMERWHEEL_H_ */
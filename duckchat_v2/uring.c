@@ -0,0 +1,157 @@
+/*
+ * uring.c
+ *
+ * Implementation of the minimal io_uring instance; see uring.h. The kernel owns
+ * the submission ring's head and the completion ring's tail, we own the other two;
+ * each index is published with a release store and read with an acquire load.
+ */
+
+#include "uring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+struct uring {
+    int fd;
+    unsigned *sq_head;          /* kernel: next entry to consume */
+    unsigned *sq_tail;          /* us: next entry to fill */
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local;          /* entries handed out, published on submit */
+    unsigned sq_submitted;      /* entries already passed to io_uring_enter() */
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;          /* us: next completion to consume */
+    unsigned *cq_tail;          /* kernel: next completion to post */
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+Uring *ur_create(unsigned entries, unsigned cq_entries) {
+    struct io_uring_params p;
+    unsigned *array;
+    Uring *ur;
+    unsigned i;
+
+    if ((ur = (Uring *)malloc(sizeof(Uring))) == NULL)
+        return NULL;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cq_entries;
+    if ((ur->fd = (int)syscall(__NR_io_uring_setup, entries, &p)) < 0) {
+        free(ur);
+        return NULL;
+    }
+
+    /* map the rings; recent kernels share one mapping for both */
+    ur->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ur->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ur->cq_ring_size > ur->sq_ring_size)
+            ur->sq_ring_size = ur->cq_ring_size;
+        ur->cq_ring_size = ur->sq_ring_size;
+    }
+    ur->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ur->sq_ring = mmap(NULL, ur->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING);
+    ur->cq_ring = MAP_FAILED;
+    ur->sqes = MAP_FAILED;
+    if (ur->sq_ring == MAP_FAILED)
+        goto error;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        ur->cq_ring = ur->sq_ring;
+    else if ((ur->cq_ring = mmap(NULL, ur->cq_ring_size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, ur->fd,
+                                 IORING_OFF_CQ_RING)) == MAP_FAILED)
+        goto error;
+    if ((ur->sqes = (struct io_uring_sqe *)mmap(NULL, ur->sqes_size,
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ur->fd, IORING_OFF_SQES)) == MAP_FAILED)
+        goto error;
+
+    ur->sq_head = (unsigned *)((char *)ur->sq_ring + p.sq_off.head);
+    ur->sq_tail = (unsigned *)((char *)ur->sq_ring + p.sq_off.tail);
+    ur->sq_mask = *(unsigned *)((char *)ur->sq_ring + p.sq_off.ring_mask);
+    ur->sq_entries = p.sq_entries;
+    ur->sq_local = ur->sq_submitted = *ur->sq_tail;
+    ur->cq_head = (unsigned *)((char *)ur->cq_ring + p.cq_off.head);
+    ur->cq_tail = (unsigned *)((char *)ur->cq_ring + p.cq_off.tail);
+    ur->cq_mask = *(unsigned *)((char *)ur->cq_ring + p.cq_off.ring_mask);
+    ur->cqes = (struct io_uring_cqe *)((char *)ur->cq_ring + p.cq_off.cqes);
+
+    /* entries are always consumed in order, so the indirection array is fixed */
+    array = (unsigned *)((char *)ur->sq_ring + p.sq_off.array);
+    for (i = 0; i < p.sq_entries; i++)
+        array[i] = i;
+    return ur;
+
+error:
+    ur_destroy(ur);
+    return NULL;
+}
+
+void ur_destroy(Uring *ur) {
+    if (ur->sqes != MAP_FAILED)
+        munmap(ur->sqes, ur->sqes_size);
+    if (ur->cq_ring != MAP_FAILED && ur->cq_ring != ur->sq_ring)
+        munmap(ur->cq_ring, ur->cq_ring_size);
+    if (ur->sq_ring != MAP_FAILED)
+        munmap(ur->sq_ring, ur->sq_ring_size);
+    close(ur->fd);
+    free(ur);
+}
+
+int ur_fd(Uring *ur) {
+    return ur->fd;
+}
+
+struct io_uring_sqe *ur_getSqe(Uring *ur) {
+    struct io_uring_sqe *sqe;
+
+    if (ur->sq_local - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE) >= ur->sq_entries)
+        return NULL;
+    sqe = &ur->sqes[ur->sq_local++ & ur->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int ur_submit(Uring *ur, unsigned wait) {
+    unsigned n = ur->sq_local - ur->sq_submitted;
+    int res;
+
+    __atomic_store_n(ur->sq_tail, ur->sq_local, __ATOMIC_RELEASE);
+    do {
+        res = (int)syscall(__NR_io_uring_enter, ur->fd, n, wait,
+                           (wait > 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (res < 0 && errno == EINTR);
+    /* take back whatever the kernel did not consume; it only reads the tail here */
+    ur->sq_submitted += (res > 0) ? (unsigned)res : 0U;
+    if (ur->sq_local != ur->sq_submitted) {
+        ur->sq_local = ur->sq_submitted;
+        __atomic_store_n(ur->sq_tail, ur->sq_local, __ATOMIC_RELEASE);
+    }
+    return ((res < 0) ? -1 : res);
+}
+
+struct io_uring_cqe *ur_peekCqe(Uring *ur) {
+    unsigned head = *ur->cq_head;
+
+    if (head == __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ur->cqes[head & ur->cq_mask];
+}
+
+void ur_seenCqe(Uring *ur) {
+    __atomic_store_n(ur->cq_head, *ur->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int ur_register(Uring *ur, unsigned opcode, void *arg, unsigned nargs) {
+    return (syscall(__NR_io_uring_register, ur->fd, opcode, arg, nargs) >= 0);
+}
@@ -0,0 +1,73 @@
+/*
+ * uring.h
+ *
+ * Interface for a minimal io_uring(7) instance, driven through the raw system
+ * calls. It maps the submission and completion rings, hands out submission queue
+ * entries to fill in, submits them in batches, and walks the completions. Used by
+ * the packet ring and the fan-out engine when the server is built with the
+ * io_uring I/O backend (make IO_BACKEND=uring).
+ */
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <linux/io_uring.h>
+
+typedef struct uring Uring;         /* opaque type definition */
+
+/*
+ * create an io_uring instance with `entries' submission queue entries and
+ * `cq_entries' completion queue entries; both are rounded up to a power of two
+ * by the kernel
+ *
+ * returns a pointer to the instance, or NULL if there are malloc(), mmap() or
+ * io_uring_setup() errors (e.g. the kernel does not support io_uring)
+ */
+Uring *ur_create(unsigned entries, unsigned cq_entries);
+
+/*
+ * destroys the instance, unmapping its rings and closing its descriptor; any
+ * operations still in flight are cancelled by the kernel
+ */
+void ur_destroy(Uring *ur);
+
+/*
+ * returns the instance's descriptor; it polls readable while completions are
+ * waiting, so it can be registered with an event loop
+ */
+int ur_fd(Uring *ur);
+
+/*
+ * returns the next free submission queue entry, cleared, or NULL if the
+ * submission queue is full; the entry is queued by the next ur_submit()
+ */
+struct io_uring_sqe *ur_getSqe(Uring *ur);
+
+/*
+ * submits all entries obtained since the last call with a single system call;
+ * if `wait' > 0, also waits until at least that many completions are available;
+ * entries the kernel did not accept are discarded
+ *
+ * returns the number of entries submitted, or -1 if the system call failed
+ */
+int ur_submit(Uring *ur, unsigned wait);
+
+/*
+ * returns the oldest completion, or NULL if none are waiting; the completion
+ * stays valid until ur_seenCqe() is called
+ */
+struct io_uring_cqe *ur_peekCqe(Uring *ur);
+
+/*
+ * marks the oldest completion as consumed
+ */
+void ur_seenCqe(Uring *ur);
+
+/*
+ * performs the io_uring_register() operation `opcode' on the instance
+ *
+ * returns 1 if successful, 0 if not
+ */
+int ur_register(Uring *ur, unsigned opcode, void *arg, unsigned nargs);
+
+#endif /* _URING_H_ */